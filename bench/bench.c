@@ -0,0 +1,600 @@
+// Non-interactive benchmark driver for the B+Tree file index.
+// Runs YCSB-style workload mixes against a preloaded tree and prints
+// wall-clock latency percentiles and throughput as JSON on stdout.
+// With --volume-sweep it instead measures allocation and lookup costs on
+// image-backed volumes of growing size.
+
+#include "bptree.h"
+#include "fat32.h"
+#include "stats.h"
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define KEY_LENGTH 32
+#define SCAN_LENGTH_DEFAULT 16
+#define VOLUME_SIZES_DEFAULT "1G,16G,256G,1T,4T"
+#define VOLUME_CACHE_CLUSTERS 4096
+#define LARGE_FILE_SIZE (5ull << 30)     // Probe file of the volume sweep, past the old 4GB limit
+
+typedef enum { OP_READ, OP_UPDATE, OP_INSERT, OP_SCAN, OP_DELETE, OP_RENAME, OP_COUNT } OpType;
+static const char* opNames[OP_COUNT] = { "read", "update", "insert", "scan", "delete", "rename" };
+
+// Operation mix of a workload, percentages must add up to 100
+typedef struct {
+    const char* name;
+    int mix[OP_COUNT];
+} Workload;
+
+static const Workload workloads[] = {
+    { "read-heavy",  { 95, 5, 0, 0, 0 } },   // YCSB B
+    { "write-heavy", { 50, 50, 0, 0, 0 } },  // YCSB A
+    { "scan",        { 0, 0, 5, 95, 0 } },   // YCSB E
+    { "churn",       { 0, 0, 50, 0, 50 } },  // create/delete churn at constant size
+    { "replace",     { 50, 0, 0, 0, 0, 50 } },  // atomic replace: write a temporary, rename it over a record
+};
+#define NUM_WORKLOADS (int)(sizeof(workloads) / sizeof(workloads[0]))
+
+typedef struct {
+    const char* workload;
+    const char* distribution;
+    int threads;
+    uint64_t records;
+    uint64_t operations;     // Total across all threads
+    double zipfTheta;
+    int scanLength;
+    uint64_t seed;
+    bool stats;              // Embed the instrumentation snapshot of the run phase
+    const char* traceFile;   // Chrome trace of the run phases, NULL for none
+    uint32_t traceSample;    // Trace one in this many operations per thread
+    const char* volumeDir;   // Run the volume sweep with its images here, NULL for the workloads
+    const char* volumeSizes; // Comma-separated volume sizes of the sweep, with K, M, G or T suffixes
+} BenchConfig;
+
+// Zipfian generator after Gray et al., "Quickly Generating Billion-Record Synthetic Databases"
+typedef struct {
+    uint64_t items;
+    double theta;
+    double alpha;
+    double zetan;
+    double eta;
+} Zipfian;
+
+// Per-thread latency samples, one array per operation type
+typedef struct {
+    uint64_t* samples[OP_COUNT];
+    uint64_t counts[OP_COUNT];
+    uint64_t capacity;
+} LatencyLog;
+
+typedef struct {
+    const BenchConfig* config;
+    const Workload* workload;
+    BPTree* tree;
+    FAT32_FileSystem* fs;
+    Zipfian* zipf;
+    uint64_t ops;
+    uint64_t seed;
+    LatencyLog log;
+} WorkerState;
+
+// Churn inserts new keys past the preloaded range and deletes the oldest ones
+static atomic_uint_fast64_t insertCursor;
+static atomic_uint_fast64_t deleteCursor;
+static atomic_uint_fast64_t tempCursor;
+
+static uint64_t nowNanos(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t nextRandom(uint64_t* state) {
+    // xorshift64*
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ull;
+}
+
+static double nextUnit(uint64_t* state) {
+    return (nextRandom(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static uint64_t fnv1a64(uint64_t value) {
+    uint64_t hash = 14695981039346656037ull;
+    for (int i = 0; i < 8; i++) {
+        hash ^= (value >> (i * 8)) & 0xFF;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+static void zipfianInit(Zipfian* z, uint64_t items, double theta) {
+    z->items = items;
+    z->theta = theta;
+    z->zetan = 0;
+    for (uint64_t i = 1; i <= items; i++) {
+        z->zetan += 1.0 / pow((double)i, theta);
+    }
+    double zeta2 = 1.0 + 1.0 / pow(2.0, theta);
+    z->alpha = 1.0 / (1.0 - theta);
+    z->eta = (1.0 - pow(2.0 / (double)items, 1.0 - theta)) / (1.0 - zeta2 / z->zetan);
+}
+
+static uint64_t zipfianNext(const Zipfian* z, uint64_t* state) {
+    double u = nextUnit(state);
+    double uz = u * z->zetan;
+    if (uz < 1.0) return 0;
+    if (uz < 1.0 + pow(0.5, z->theta)) return 1;
+    uint64_t rank = (uint64_t)((double)z->items * pow(z->eta * u - z->eta + 1.0, z->alpha));
+    return rank < z->items ? rank : z->items - 1;
+}
+
+// Pick a record, zipfian ranks are scrambled so hot keys spread over the key space
+static uint64_t chooseRecord(WorkerState* w) {
+    if (w->zipf) {
+        return fnv1a64(zipfianNext(w->zipf, &w->seed)) % w->config->records;
+    }
+    return nextRandom(&w->seed) % w->config->records;
+}
+
+static void makeKey(char* key, uint64_t record) {
+    snprintf(key, KEY_LENGTH, "user%016llx", (unsigned long long)fnv1a64(record));
+}
+
+static bool countVisitor(const char* key, FAT32_Entry* value, void* ctx) {
+    (void)key;
+    (void)value;
+    (*(int*)ctx)++;
+    return true;
+}
+
+static OpType chooseOp(WorkerState* w) {
+    int roll = (int)(nextRandom(&w->seed) % 100);
+    for (int op = 0; op < OP_COUNT; op++) {
+        roll -= w->workload->mix[op];
+        if (roll < 0) return (OpType)op;
+    }
+    return OP_READ;
+}
+
+static void runOp(WorkerState* w, OpType op) {
+    char key[KEY_LENGTH];
+
+    switch (op) {
+    case OP_READ:
+        makeKey(key, chooseRecord(w));
+        search(w->tree, key);
+        break;
+    case OP_UPDATE: {
+        makeKey(key, chooseRecord(w));
+        FAT32_Entry* entry = search(w->tree, key);
+        if (entry) {
+            entry->modificationTime = time(NULL);
+            update(w->tree, key, key, entry);
+        }
+        break;
+    }
+    case OP_INSERT: {
+        uint64_t record = atomic_fetch_add(&insertCursor, 1);
+        makeKey(key, record);
+        insert(w->tree, key, create_file_entry(w->fs, key, 0));
+        break;
+    }
+    case OP_SCAN: {
+        int seen = 0;
+        makeKey(key, chooseRecord(w));
+        scan(w->tree, key, w->config->scanLength, countVisitor, &seen);
+        break;
+    }
+    case OP_DELETE: {
+        uint64_t record = atomic_fetch_add(&deleteCursor, 1);
+        makeKey(key, record);
+        FAT32_Entry* entry = search(w->tree, key);
+        if (entry) {
+            delete(w->tree, key);
+            fat32_delete(w->fs, entry);
+        }
+        break;
+    }
+    case OP_RENAME: {
+        char temp[KEY_LENGTH];
+        FAT32_Entry* replaced;
+        snprintf(temp, KEY_LENGTH, "temp%016llx", (unsigned long long)atomic_fetch_add(&tempCursor, 1));
+        makeKey(key, chooseRecord(w));
+        insert(w->tree, temp, create_file_entry(w->fs, key, 0));
+        if (renameEntry(w->tree, temp, key, &replaced) && replaced) fat32_delete(w->fs, replaced);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+static void* workerMain(void* arg) {
+    WorkerState* w = (WorkerState*)arg;
+    for (uint64_t i = 0; i < w->ops; i++) {
+        OpType op = chooseOp(w);
+        uint64_t start = nowNanos();
+        runOp(w, op);
+        uint64_t elapsed = nowNanos() - start;
+        w->log.samples[op][w->log.counts[op]++] = elapsed;
+    }
+    return NULL;
+}
+
+static int compareU64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static uint64_t percentile(const uint64_t* sorted, uint64_t count, double p) {
+    if (count == 0) return 0;
+    uint64_t index = (uint64_t)ceil(p * (double)count);
+    if (index > 0) index--;
+    return sorted[index < count ? index : count - 1];
+}
+
+static void printLatency(FILE* out, const uint64_t* sorted, uint64_t count) {
+    double sum = 0;
+    for (uint64_t i = 0; i < count; i++) sum += (double)sorted[i];
+    fprintf(out, "{\"count\": %llu, \"mean\": %.1f, \"p50\": %llu, \"p99\": %llu, \"p999\": %llu, \"max\": %llu}",
+            (unsigned long long)count, count ? sum / (double)count : 0.0,
+            (unsigned long long)percentile(sorted, count, 0.50),
+            (unsigned long long)percentile(sorted, count, 0.99),
+            (unsigned long long)percentile(sorted, count, 0.999),
+            (unsigned long long)(count ? sorted[count - 1] : 0));
+}
+
+static const Workload* findWorkload(const char* name) {
+    for (int i = 0; i < NUM_WORKLOADS; i++) {
+        if (strcmp(workloads[i].name, name) == 0) return &workloads[i];
+    }
+    return NULL;
+}
+
+static void runWorkload(const BenchConfig* config, const Workload* workload, bool first) {
+    // Every record owns no clusters, a small volume is enough for the metadata
+    FAT32_FileSystem* fs = fat32_init(1024 * 1024);
+    BPTree* tree = initializeBPTree(fs);
+
+    // Load phase
+    uint64_t loadStart = nowNanos();
+    for (uint64_t r = 0; r < config->records; r++) {
+        char key[KEY_LENGTH];
+        makeKey(key, r);
+        insert(tree, key, create_file_entry(fs, key, 0));
+    }
+    double loadSeconds = (double)(nowNanos() - loadStart) / 1e9;
+    atomic_store(&insertCursor, config->records);
+    atomic_store(&deleteCursor, 0);
+
+    Zipfian zipf;
+    bool useZipf = strcmp(config->distribution, "zipfian") == 0;
+    if (useZipf) zipfianInit(&zipf, config->records, config->zipfTheta);
+
+    // Run phase
+    WorkerState* states = (WorkerState*)calloc(config->threads, sizeof(WorkerState));
+    pthread_t* threads = (pthread_t*)malloc(config->threads * sizeof(pthread_t));
+    for (int t = 0; t < config->threads; t++) {
+        WorkerState* w = &states[t];
+        w->config = config;
+        w->workload = workload;
+        w->tree = tree;
+        w->fs = fs;
+        w->zipf = useZipf ? &zipf : NULL;
+        w->ops = config->operations / config->threads + (t < (int)(config->operations % config->threads) ? 1 : 0);
+        w->seed = config->seed * 0x9E3779B97F4A7C15ull + (uint64_t)t + 1;
+        w->log.capacity = w->ops;
+        for (int op = 0; op < OP_COUNT; op++) {
+            w->log.samples[op] = workload->mix[op] ? (uint64_t*)malloc((w->ops + 1) * sizeof(uint64_t)) : NULL;
+        }
+    }
+
+    stats_reset();
+    if (config->traceFile) trace_start(config->traceSample);
+    uint64_t runStart = nowNanos();
+    for (int t = 0; t < config->threads; t++) {
+        pthread_create(&threads[t], NULL, workerMain, &states[t]);
+    }
+    for (int t = 0; t < config->threads; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    double runSeconds = (double)(nowNanos() - runStart) / 1e9;
+    trace_stop();
+
+    // Merge per-thread samples
+    uint64_t total = 0;
+    uint64_t* all = (uint64_t*)malloc((config->operations + 1) * sizeof(uint64_t));
+    uint64_t* perOp[OP_COUNT];
+    uint64_t perOpCount[OP_COUNT] = { 0 };
+    for (int op = 0; op < OP_COUNT; op++) {
+        perOp[op] = (uint64_t*)malloc((config->operations + 1) * sizeof(uint64_t));
+        for (int t = 0; t < config->threads; t++) {
+            LatencyLog* log = &states[t].log;
+            if (log->counts[op] == 0) continue;
+            memcpy(perOp[op] + perOpCount[op], log->samples[op], log->counts[op] * sizeof(uint64_t));
+            memcpy(all + total, log->samples[op], log->counts[op] * sizeof(uint64_t));
+            perOpCount[op] += log->counts[op];
+            total += log->counts[op];
+        }
+        qsort(perOp[op], perOpCount[op], sizeof(uint64_t), compareU64);
+    }
+    qsort(all, total, sizeof(uint64_t), compareU64);
+
+    FILE* out = stdout;
+    fprintf(out, "%s  {\"workload\": \"%s\", \"distribution\": \"%s\", \"threads\": %d, "
+                 "\"records\": %llu, \"operations\": %llu,\n",
+            first ? "" : ",\n", workload->name, config->distribution, config->threads,
+            (unsigned long long)config->records, (unsigned long long)total);
+    fprintf(out, "   \"load_seconds\": %.6f, \"load_ops_per_sec\": %.1f,\n",
+            loadSeconds, loadSeconds > 0 ? (double)config->records / loadSeconds : 0.0);
+    fprintf(out, "   \"run_seconds\": %.6f, \"throughput_ops_per_sec\": %.1f,\n",
+            runSeconds, runSeconds > 0 ? (double)total / runSeconds : 0.0);
+    fprintf(out, "   \"latency_ns\": ");
+    printLatency(out, all, total);
+    fprintf(out, ",\n   \"operations_ns\": {");
+    bool firstOp = true;
+    for (int op = 0; op < OP_COUNT; op++) {
+        if (perOpCount[op] == 0) continue;
+        fprintf(out, "%s\n     \"%s\": ", firstOp ? "" : ",", opNames[op]);
+        printLatency(out, perOp[op], perOpCount[op]);
+        firstOp = false;
+    }
+    fprintf(out, "}");
+    if (config->stats) {
+        fprintf(out, ",\n   \"stats\": ");
+        stats_dump_json(out);
+    }
+    fprintf(out, "}");
+
+    // Cleanup
+    for (int op = 0; op < OP_COUNT; op++) free(perOp[op]);
+    free(all);
+    for (int t = 0; t < config->threads; t++) {
+        for (int op = 0; op < OP_COUNT; op++) free(states[t].log.samples[op]);
+    }
+    free(states);
+    free(threads);
+    destroyBPTree(tree);
+    fat32_cleanup(fs);
+}
+
+// Bytes in a size such as 512M or 2T, 0 if it does not parse
+static uint64_t parseSize(const char* text, char** end) {
+    uint64_t size = strtoull(text, end, 10);
+    switch (**end) {
+    case 'T': case 't': size <<= 10; // fall through
+    case 'G': case 'g': size <<= 10; // fall through
+    case 'M': case 'm': size <<= 10; // fall through
+    case 'K': case 'k': size <<= 10; (*end)++; break;
+    default: break;
+    }
+    return size;
+}
+
+static void sortSamples(uint64_t* samples, uint64_t count) {
+    qsort(samples, count, sizeof(uint64_t), compareU64);
+}
+
+// Files over 4GB: a sparse file past the mark gets a write there that must read back
+static bool probeLargeFile(FAT32_FileSystem* fs) {
+    uint8_t written[CLUSTER_SIZE];
+    uint8_t read[CLUSTER_SIZE];
+    uint64_t offset = LARGE_FILE_SIZE - 3 * CLUSTER_SIZE - 100;
+    FAT32_Entry* large = create_file_entry(fs, "large", LARGE_FILE_SIZE);
+    if (!large) return false;
+    for (int i = 0; i < CLUSTER_SIZE; i++) written[i] = (uint8_t)(i * 7 + 1);
+    bool ok = fat32_write_range(fs, large, offset, written, sizeof(written)) &&
+              fat32_read_range(fs, large, offset, read, sizeof(read), NULL) == (int64_t)sizeof(read) &&
+              memcmp(written, read, sizeof(read)) == 0 && large->fileSize == LARGE_FILE_SIZE;
+    fat32_delete(fs, large);
+    return ok;
+}
+
+// One volume of the sweep: records files of one to four clusters, then
+// operations rounds that each free the oldest file, allocate a new one, look up
+// a random live file and read its first cluster. Allocation starts from a
+// per-group free hint and lookups go through the tree, so neither should grow
+// with the volume. Mounting reads and counts the whole FAT, which does.
+static bool runVolume(const BenchConfig* config, uint64_t size, bool first) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/bench-volume-%llu.img", config->volumeDir, (unsigned long long)size);
+    unlink(path);
+
+    uint64_t mountStart = nowNanos();
+    FAT32_FileSystem* fs = fat32_init_image(path, size, VOLUME_CACHE_CLUSTERS);
+    if (!fs) {
+        fprintf(stderr, "Cannot create a %llu byte volume at %s\n", (unsigned long long)size, path);
+        return false;
+    }
+    double mountSeconds = (double)(nowNanos() - mountStart) / 1e9;
+    BPTree* tree = initializeBPTree(fs);
+    // Volumes past about 1TB get larger clusters, files stay one to four clusters long
+    uint32_t clusterSize = fs->clusterSize;
+
+    char key[KEY_LENGTH];
+    for (uint64_t r = 0; r < config->records; r++) {
+        makeKey(key, r);
+        insert(tree, key, create_file_entry(fs, key, (1 + fnv1a64(r) % 4) * clusterSize));
+    }
+
+    uint64_t* samples[4];
+    for (int i = 0; i < 4; i++) samples[i] = (uint64_t*)malloc(config->operations * sizeof(uint64_t));
+    uint64_t* allocs = samples[0];
+    uint64_t* frees = samples[1];
+    uint64_t* lookups = samples[2];
+    uint64_t* reads = samples[3];
+    uint64_t seed = config->seed;
+    uint8_t* buffer = (uint8_t*)malloc(clusterSize);
+
+    for (uint64_t i = 0; i < config->operations; i++) {
+        makeKey(key, i);
+        FAT32_Entry* entry = search(tree, key);
+        uint64_t start = nowNanos();
+        delete(tree, key);
+        fat32_delete(fs, entry);
+        frees[i] = nowNanos() - start;
+
+        uint64_t record = config->records + i;
+        makeKey(key, record);
+        start = nowNanos();
+        entry = create_file_entry(fs, key, (1 + fnv1a64(record) % 4) * clusterSize);
+        allocs[i] = nowNanos() - start;
+        insert(tree, key, entry);
+
+        makeKey(key, i + 1 + nextRandom(&seed) % config->records);
+        start = nowNanos();
+        entry = search(tree, key);
+        lookups[i] = nowNanos() - start;
+        start = nowNanos();
+        fat32_read_range(fs, entry, 0, buffer, clusterSize, NULL);
+        reads[i] = nowNanos() - start;
+    }
+
+    free(buffer);
+    FAT32_StatFs statfs;
+    fat32_statfs(fs, &statfs);
+    bool largeChecked = size >= 2 * LARGE_FILE_SIZE;
+    bool largeOk = largeChecked && probeLargeFile(fs);
+
+    FILE* out = stdout;
+    fprintf(out, "%s  {\"volume_bytes\": %llu, \"cluster_bytes\": %u, \"clusters\": %u, \"records\": %llu, "
+            "\"operations\": %llu,\n", first ? "" : ",\n", (unsigned long long)size, statfs.clusterSize,
+            statfs.totalClusters, (unsigned long long)config->records, (unsigned long long)config->operations);
+    fprintf(out, "   \"mount_seconds\": %.6f, \"large_file_ok\": %s,\n", mountSeconds,
+            largeChecked ? (largeOk ? "true" : "false") : "null");
+    const char* names[4] = { "alloc_ns", "free_ns", "lookup_ns", "read_ns" };
+    for (int i = 0; i < 4; i++) {
+        sortSamples(samples[i], config->operations);
+        fprintf(out, "%s\"%s\": ", i ? ",\n   " : "   ", names[i]);
+        printLatency(out, samples[i], config->operations);
+        free(samples[i]);
+    }
+    fprintf(out, "}");
+
+    destroyBPTree(tree);
+    fat32_cleanup(fs);
+    unlink(path);
+    return !largeChecked || largeOk;
+}
+
+static int runVolumeSweep(const BenchConfig* config) {
+    const char* next = config->volumeSizes;
+    bool first = true;
+    int result = 0;
+    printf("[\n");
+    while (*next) {
+        char* end;
+        uint64_t size = parseSize(next, &end);
+        if (size == 0 || (*end != ',' && *end != '\0')) {
+            fprintf(stderr, "Bad volume size in %s\n", config->volumeSizes);
+            result = 1;
+            break;
+        }
+        fprintf(stderr, "Running a %llu byte volume...\n", (unsigned long long)size);
+        if (!runVolume(config, size, first)) result = 1;
+        first = false;
+        next = *end ? end + 1 : end;
+    }
+    printf("\n]\n");
+    return result;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -w, --workload NAME     read-heavy | write-heavy | scan | churn | replace | all (default all)\n"
+            "  -d, --distribution D    uniform | zipfian (default zipfian)\n"
+            "  -t, --threads N         worker threads (default 1)\n"
+            "  -r, --records N         preloaded records (default 100000)\n"
+            "  -o, --operations N      operations per workload (default 1000000)\n"
+            "      --theta F           zipfian skew (default 0.99)\n"
+            "      --scan-length N     entries per scan (default %d)\n"
+            "      --seed N            random seed (default 1)\n"
+            "      --stats             include instrumentation counters (build with STATS=1)\n"
+            "      --trace FILE        write a Chrome trace of the run phases to FILE\n"
+            "      --trace-sample N    trace one in N operations per thread (default 100)\n"
+            "      --volume-sweep DIR  instead of the workloads, time allocation and lookups on sparse\n"
+            "                          volume images in DIR, -r files and -o churn rounds per volume\n"
+            "      --volume-sizes L    volume sizes of the sweep (default " VOLUME_SIZES_DEFAULT ")\n",
+            prog, SCAN_LENGTH_DEFAULT);
+}
+
+int main(int argc, char** argv) {
+    BenchConfig config = { "all", "zipfian", 1, 100000, 1000000, 0.99, SCAN_LENGTH_DEFAULT, 1, false, NULL, 100,
+                           NULL, VOLUME_SIZES_DEFAULT };
+
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const char* value = (i + 1 < argc) ? argv[i + 1] : NULL;
+        if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+            usage(argv[0]);
+            return 0;
+        }
+        if (strcmp(arg, "--stats") == 0) {
+            config.stats = true;
+            continue;
+        }
+        if (!value) {
+            usage(argv[0]);
+            return 1;
+        }
+        if (strcmp(arg, "-w") == 0 || strcmp(arg, "--workload") == 0) config.workload = value;
+        else if (strcmp(arg, "-d") == 0 || strcmp(arg, "--distribution") == 0) config.distribution = value;
+        else if (strcmp(arg, "-t") == 0 || strcmp(arg, "--threads") == 0) config.threads = atoi(value);
+        else if (strcmp(arg, "-r") == 0 || strcmp(arg, "--records") == 0) config.records = strtoull(value, NULL, 10);
+        else if (strcmp(arg, "-o") == 0 || strcmp(arg, "--operations") == 0) config.operations = strtoull(value, NULL, 10);
+        else if (strcmp(arg, "--theta") == 0) config.zipfTheta = atof(value);
+        else if (strcmp(arg, "--scan-length") == 0) config.scanLength = atoi(value);
+        else if (strcmp(arg, "--seed") == 0) config.seed = strtoull(value, NULL, 10);
+        else if (strcmp(arg, "--trace") == 0) config.traceFile = value;
+        else if (strcmp(arg, "--trace-sample") == 0) config.traceSample = (uint32_t)strtoul(value, NULL, 10);
+        else if (strcmp(arg, "--volume-sweep") == 0) config.volumeDir = value;
+        else if (strcmp(arg, "--volume-sizes") == 0) config.volumeSizes = value;
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+        i++;
+    }
+
+    if (config.threads <= 0 || config.records == 0 || config.operations == 0 ||
+        (strcmp(config.distribution, "uniform") != 0 && strcmp(config.distribution, "zipfian") != 0) ||
+        (strcmp(config.workload, "all") != 0 && !findWorkload(config.workload))) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (config.volumeDir) return runVolumeSweep(&config);
+
+    trace_reset();
+    printf("[\n");
+    bool first = true;
+    for (int i = 0; i < NUM_WORKLOADS; i++) {
+        if (strcmp(config.workload, "all") != 0 && strcmp(config.workload, workloads[i].name) != 0) continue;
+        fprintf(stderr, "Running %s...\n", workloads[i].name);
+        runWorkload(&config, &workloads[i], first);
+        first = false;
+    }
+    printf("\n]\n");
+
+    if (config.traceFile) {
+        FILE* trace = fopen(config.traceFile, "w");
+        if (!trace) {
+            fprintf(stderr, "Cannot write %s\n", config.traceFile);
+            return 1;
+        }
+        fprintf(stderr, "Wrote %d trace events to %s\n", trace_dump_chrome(trace), config.traceFile);
+        fclose(trace);
+    }
+
+    return 0;
+}
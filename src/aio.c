@@ -0,0 +1,232 @@
+#include "include/aio.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+// Raw system calls, the tree does not depend on liburing
+static int uringSetup(unsigned entries, struct io_uring_params* params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uringEnter(int ringFd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete, flags, NULL, 0);
+}
+
+static bool setupRing(AioContext* ctx) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    ctx->ringFd = uringSetup(ctx->depth, &params);
+    if (ctx->ringFd < 0) return false;
+
+    ctx->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ctx->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (singleMmap) {
+        if (ctx->cqRingSize > ctx->sqRingSize) ctx->sqRingSize = ctx->cqRingSize;
+        ctx->cqRingSize = ctx->sqRingSize;
+    }
+
+    ctx->sqRing = mmap(NULL, ctx->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       ctx->ringFd, IORING_OFF_SQ_RING);
+    if (ctx->sqRing == MAP_FAILED) {
+        close(ctx->ringFd);
+        return false;
+    }
+    ctx->cqRing = singleMmap ? ctx->sqRing
+                             : mmap(NULL, ctx->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                    ctx->ringFd, IORING_OFF_CQ_RING);
+    ctx->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    ctx->sqes = mmap(NULL, ctx->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     ctx->ringFd, IORING_OFF_SQES);
+    if (ctx->cqRing == MAP_FAILED || ctx->sqes == MAP_FAILED) {
+        if (ctx->sqes != MAP_FAILED) munmap(ctx->sqes, ctx->sqesSize);
+        if (!singleMmap && ctx->cqRing != MAP_FAILED) munmap(ctx->cqRing, ctx->cqRingSize);
+        munmap(ctx->sqRing, ctx->sqRingSize);
+        close(ctx->ringFd);
+        return false;
+    }
+
+    uint8_t* sq = (uint8_t*)ctx->sqRing;
+    uint8_t* cq = (uint8_t*)ctx->cqRing;
+    ctx->sqTail = (unsigned*)(sq + params.sq_off.tail);
+    ctx->sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+    ctx->sqArray = (unsigned*)(sq + params.sq_off.array);
+    ctx->cqHead = (unsigned*)(cq + params.cq_off.head);
+    ctx->cqTail = (unsigned*)(cq + params.cq_off.tail);
+    ctx->cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+    ctx->cqes = cq + params.cq_off.cqes;
+    ctx->depth = params.sq_entries;
+    return true;
+}
+
+// Fallback path: run the request now and queue its completion
+static void completeNow(AioContext* ctx, void* userData, int result) {
+    unsigned slot = (ctx->doneHead + ctx->doneCount) % ctx->depth;
+    ctx->done[slot].userData = userData;
+    ctx->done[slot].result = result;
+    ctx->doneCount++;
+}
+
+static int syncTransfer(AioContext* ctx, bool write, void* buffer, uint32_t length, uint64_t offset) {
+    uint32_t done = 0;
+    while (done < length) {
+        ssize_t n = write ? pwrite(ctx->fd, (uint8_t*)buffer + done, length - done, (off_t)(offset + done))
+                          : pread(ctx->fd, (uint8_t*)buffer + done, length - done, (off_t)(offset + done));
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -errno;
+        if (n == 0) break;
+        done += (uint32_t)n;
+    }
+    return (int)done;
+}
+
+static int prepare(AioContext* ctx, uint8_t opcode, void* buffer, uint32_t length, uint64_t offset, void* userData) {
+    pthread_mutex_lock(&ctx->mutex);
+
+    if (ctx->queued + ctx->inflight + ctx->doneCount >= ctx->depth) {
+        // Caller must submit and reap before preparing more
+        pthread_mutex_unlock(&ctx->mutex);
+        return -1;
+    }
+
+    if (!ctx->uring) {
+        completeNow(ctx, userData, syncTransfer(ctx, opcode == IORING_OP_WRITE, buffer, length, offset));
+        pthread_mutex_unlock(&ctx->mutex);
+        return 0;
+    }
+
+    unsigned tail = *ctx->sqTail;
+    unsigned index = tail & *ctx->sqMask;
+    struct io_uring_sqe* sqe = &((struct io_uring_sqe*)ctx->sqes)[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = ctx->fd;
+    sqe->addr = (uint64_t)(uintptr_t)buffer;
+    sqe->len = length;
+    sqe->off = offset;
+    sqe->user_data = (uint64_t)(uintptr_t)userData;
+    ctx->sqArray[index] = index;
+    __atomic_store_n(ctx->sqTail, tail + 1, __ATOMIC_RELEASE);
+    ctx->queued++;
+
+    pthread_mutex_unlock(&ctx->mutex);
+    return 0;
+}
+
+// Core function implementations
+AioContext* aio_create(int fd, unsigned depth) {
+    AioContext* ctx = (AioContext*)calloc(1, sizeof(AioContext));
+    ctx->fd = fd;
+    ctx->depth = depth ? depth : AIO_DEFAULT_DEPTH;
+    ctx->ringFd = -1;
+    pthread_mutex_init(&ctx->mutex, NULL);
+
+    ctx->uring = setupRing(ctx);
+    if (!ctx->uring) {
+        ctx->done = (AioCompletion*)malloc(ctx->depth * sizeof(AioCompletion));
+    }
+    return ctx;
+}
+
+// Queue a read, returns -1 when the context is full and must be reaped first
+int aio_prep_read(AioContext* ctx, void* buffer, uint32_t length, uint64_t offset, void* userData) {
+    return prepare(ctx, IORING_OP_READ, buffer, length, offset, userData);
+}
+
+int aio_prep_write(AioContext* ctx, const void* buffer, uint32_t length, uint64_t offset, void* userData) {
+    return prepare(ctx, IORING_OP_WRITE, (void*)buffer, length, offset, userData);
+}
+
+// Hand every prepared request to the kernel with one system call
+int aio_submit(AioContext* ctx) {
+    pthread_mutex_lock(&ctx->mutex);
+
+    int submitted = 0;
+    while (ctx->uring && ctx->queued > 0) {
+        int n = uringEnter(ctx->ringFd, ctx->queued, 0, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            submitted = -errno;
+            break;
+        }
+        ctx->queued -= (unsigned)n;
+        ctx->inflight += (unsigned)n;
+        submitted += n;
+    }
+
+    pthread_mutex_unlock(&ctx->mutex);
+    return submitted;
+}
+
+// Collect up to max completions, blocking until at least minWait are available
+int aio_reap(AioContext* ctx, AioCompletion* out, int max, int minWait) {
+    pthread_mutex_lock(&ctx->mutex);
+
+    int reaped = 0;
+    if (!ctx->uring) {
+        while (reaped < max && ctx->doneCount > 0) {
+            out[reaped++] = ctx->done[ctx->doneHead];
+            ctx->doneHead = (ctx->doneHead + 1) % ctx->depth;
+            ctx->doneCount--;
+        }
+        pthread_mutex_unlock(&ctx->mutex);
+        return reaped;
+    }
+
+    if (minWait > (int)ctx->inflight) minWait = (int)ctx->inflight;
+    while (reaped < max) {
+        unsigned head = *ctx->cqHead;
+        unsigned tail = __atomic_load_n(ctx->cqTail, __ATOMIC_ACQUIRE);
+        if (head == tail) {
+            if (reaped >= minWait || ctx->inflight == 0) break;
+            // Wait without the mutex so other threads can keep preparing requests
+            unsigned want = (unsigned)(minWait - reaped);
+            pthread_mutex_unlock(&ctx->mutex);
+            int n = uringEnter(ctx->ringFd, 0, want, IORING_ENTER_GETEVENTS);
+            int err = errno;
+            pthread_mutex_lock(&ctx->mutex);
+            if (n < 0 && err != EINTR) break;
+            continue;
+        }
+        struct io_uring_cqe* cqe = &((struct io_uring_cqe*)ctx->cqes)[head & *ctx->cqMask];
+        out[reaped].userData = (void*)(uintptr_t)cqe->user_data;
+        out[reaped].result = cqe->res;
+        reaped++;
+        ctx->inflight--;
+        __atomic_store_n(ctx->cqHead, head + 1, __ATOMIC_RELEASE);
+    }
+
+    pthread_mutex_unlock(&ctx->mutex);
+    return reaped;
+}
+
+// Requests prepared or in flight whose completions have not been reaped
+unsigned aio_pending(AioContext* ctx) {
+    pthread_mutex_lock(&ctx->mutex);
+    unsigned pending = ctx->queued + ctx->inflight + ctx->doneCount;
+    pthread_mutex_unlock(&ctx->mutex);
+    return pending;
+}
+
+void aio_destroy(AioContext* ctx) {
+    if (ctx->uring) {
+        // Drain so the kernel never writes into freed buffers
+        aio_submit(ctx);
+        AioCompletion scratch[32];
+        while (aio_pending(ctx) > 0 && aio_reap(ctx, scratch, 32, 1) > 0) {
+        }
+        munmap(ctx->sqes, ctx->sqesSize);
+        if (ctx->cqRing != ctx->sqRing) munmap(ctx->cqRing, ctx->cqRingSize);
+        munmap(ctx->sqRing, ctx->sqRingSize);
+        close(ctx->ringFd);
+    }
+    free(ctx->done);
+    pthread_mutex_destroy(&ctx->mutex);
+    free(ctx);
+}
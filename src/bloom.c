@@ -0,0 +1,202 @@
+#include "include/bloom.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define BLOOM_BLOCK_BITS (BLOOM_BLOCK_WORDS * 64)
+
+// Helper function implementations
+static uint64_t hashKey(const char* key) {
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ull;
+    for (const unsigned char* p = (const unsigned char*)key; *p; p++) {
+        hash ^= *p;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// splitmix64 finalizer, spreads FNV's weak high bits over the whole word
+static uint64_t mix64(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ull;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+// Block of the key and one bit mask per word of it, 9 bits of the second hash per bit set
+static uint64_t* keyBlock(BloomBits* bits, uint64_t hash, uint64_t* masks) {
+    uint64_t positions = mix64(hash ^ 0x9E3779B97F4A7C15ull);
+    memset(masks, 0, BLOOM_BLOCK_WORDS * sizeof(uint64_t));
+    for (int i = 0; i < BLOOM_HASHES; i++, positions >>= 9) {
+        uint32_t bit = (uint32_t)(positions % BLOOM_BLOCK_BITS);
+        masks[bit / 64] |= 1ull << (bit % 64);
+    }
+    return bits->words + (size_t)(mix64(hash) & bits->blockMask) * BLOOM_BLOCK_WORDS;
+}
+
+static void setBits(BloomBits* bits, uint64_t hash) {
+    uint64_t masks[BLOOM_BLOCK_WORDS];
+    uint64_t* block = keyBlock(bits, hash, masks);
+    for (int i = 0; i < BLOOM_BLOCK_WORDS; i++) {
+        if (masks[i]) __atomic_fetch_or(&block[i], masks[i], __ATOMIC_RELAXED);
+    }
+}
+
+static bool testBits(BloomBits* bits, uint64_t hash) {
+    uint64_t masks[BLOOM_BLOCK_WORDS];
+    uint64_t* block = keyBlock(bits, hash, masks);
+    for (int i = 0; i < BLOOM_BLOCK_WORDS; i++) {
+        if ((__atomic_load_n(&block[i], __ATOMIC_RELAXED) & masks[i]) != masks[i]) return false;
+    }
+    return true;
+}
+
+// Array for at least capacity keys at BLOOM_BITS_PER_KEY, a power of two of blocks
+static BloomBits* createBits(uint32_t capacity) {
+    uint64_t wanted = ((uint64_t)capacity * BLOOM_BITS_PER_KEY + BLOOM_BLOCK_BITS - 1) / BLOOM_BLOCK_BITS;
+    uint32_t blocks = 1;
+    while (blocks < wanted) blocks *= 2;
+
+    BloomBits* bits = (BloomBits*)calloc(1, sizeof(BloomBits) + (size_t)blocks * BLOOM_BLOCK_WORDS * sizeof(uint64_t));
+    bits->capacity = (uint32_t)((uint64_t)blocks * BLOOM_BLOCK_BITS / BLOOM_BITS_PER_KEY);
+    bits->blockMask = blocks - 1;
+    return bits;
+}
+
+static BloomBits* activeBits(BloomFilter* filter) {
+    uint64_t generation = __atomic_load_n(&filter->generation, __ATOMIC_ACQUIRE);
+    return __atomic_load_n(&filter->bits[generation & 1], __ATOMIC_ACQUIRE);
+}
+
+static BPTreeNode* firstLeaf(BPTree* tree) {
+    BPTreeNode* node = tree->root;
+    while (!node->isLeaf) node = node->children[0];
+    return node;
+}
+
+// Fill the inactive array from the tree and publish it, with rebuildMutex held.
+// The tree's read lock keeps writers, and so bloom_add, out for the duration.
+static void rebuildLocked(BPTree* tree) {
+    BloomFilter* filter = tree->bloom;
+    pthread_rwlock_rdlock(&tree->lock);
+
+    uint32_t count = 0;
+    for (BPTreeNode* leaf = firstLeaf(tree); leaf; leaf = leaf->next) count += (uint32_t)leaf->numKeys;
+
+    // Only readers of an older generation can be probing the inactive array, and
+    // the fence makes sure they see generation has moved on if they see it cleared
+    uint64_t generation = filter->generation;
+    BloomBits* target = filter->bits[(generation + 1) & 1];
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    if (count > target->capacity) {
+        BloomBits* grown = createBits(count * 2);
+        target->retired = filter->retired;
+        filter->retired = target;
+        target = grown;
+        __atomic_store_n(&filter->bits[(generation + 1) & 1], target, __ATOMIC_RELEASE);
+    } else {
+        size_t words = (size_t)(target->blockMask + 1) * BLOOM_BLOCK_WORDS;
+        for (size_t i = 0; i < words; i++) __atomic_store_n(&target->words[i], 0, __ATOMIC_RELAXED);
+    }
+
+    for (BPTreeNode* leaf = firstLeaf(tree); leaf; leaf = leaf->next) {
+        for (int i = 0; i < leaf->numKeys; i++) setBits(target, hashKey(leaf->keys[i]));
+    }
+    __atomic_store_n(&filter->keys, count, __ATOMIC_RELAXED);
+    __atomic_store_n(&filter->deletes, 0, __ATOMIC_RELAXED);
+    filter->rebuilds++;
+    __atomic_store_n(&filter->generation, generation + 1, __ATOMIC_RELEASE);
+
+    pthread_rwlock_unlock(&tree->lock);
+}
+
+// Core function implementations
+
+// Keep a Bloom filter of the tree's keys so search() answers most misses
+// without the tree lock. Sized for expectedKeys, or the current keys if more,
+// and grown by later rebuilds. Call before the tree is shared between threads.
+void bloom_enable(BPTree* tree, uint32_t expectedKeys) {
+    if (tree->bloom || tree->secondary) return;
+    BloomFilter* filter = (BloomFilter*)calloc(1, sizeof(BloomFilter));
+    filter->bits[0] = createBits(expectedKeys);
+    filter->bits[1] = createBits(expectedKeys);
+    pthread_mutex_init(&filter->rebuildMutex, NULL);
+    tree->bloom = filter;
+    bloom_rebuild(tree);
+}
+
+// False only if key is certainly not in the tree. Takes no lock.
+bool bloom_may_contain(BPTree* tree, const char* key) {
+    BloomFilter* filter = tree->bloom;
+    if (!filter) return true;
+
+    uint64_t generation = __atomic_load_n(&filter->generation, __ATOMIC_ACQUIRE);
+    BloomBits* bits = __atomic_load_n(&filter->bits[generation & 1], __ATOMIC_ACQUIRE);
+    if (testBits(bits, hashKey(key))) return true;
+
+    // A rebuild may have cleared the array under us, a miss only counts if it did not
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&filter->generation, __ATOMIC_RELAXED) != generation;
+}
+
+// Drop the stale bits of deleted keys and resize for the current key count
+void bloom_rebuild(BPTree* tree) {
+    BloomFilter* filter = tree->bloom;
+    if (!filter) return;
+    pthread_mutex_lock(&filter->rebuildMutex);
+    rebuildLocked(tree);
+    pthread_mutex_unlock(&filter->rebuildMutex);
+}
+
+void bloom_get_stats(BPTree* tree, BloomStats* out) {
+    BloomFilter* filter = tree->bloom;
+    memset(out, 0, sizeof(*out));
+    if (!filter) return;
+    pthread_mutex_lock(&filter->rebuildMutex);
+    BloomBits* bits = activeBits(filter);
+    out->capacity = bits->capacity;
+    out->keys = __atomic_load_n(&filter->keys, __ATOMIC_RELAXED);
+    out->deletes = __atomic_load_n(&filter->deletes, __ATOMIC_RELAXED);
+    out->rebuilds = filter->rebuilds;
+    out->bytes = (uint64_t)(bits->blockMask + 1) * BLOOM_BLOCK_WORDS * sizeof(uint64_t);
+    pthread_mutex_unlock(&filter->rebuildMutex);
+}
+
+void bloom_destroy(BPTree* tree) {
+    BloomFilter* filter = tree->bloom;
+    if (!filter) return;
+    while (filter->retired) {
+        BloomBits* next = filter->retired->retired;
+        free(filter->retired);
+        filter->retired = next;
+    }
+    free(filter->bits[0]);
+    free(filter->bits[1]);
+    pthread_mutex_destroy(&filter->rebuildMutex);
+    free(filter);
+    tree->bloom = NULL;
+}
+
+void bloom_add(BPTree* tree, const char* key) {
+    BloomFilter* filter = tree->bloom;
+    setBits(activeBits(filter), hashKey(key));
+    __atomic_add_fetch(&filter->keys, 1, __ATOMIC_RELAXED);
+}
+
+void bloom_removed(BPTree* tree) {
+    __atomic_add_fetch(&tree->bloom->deletes, 1, __ATOMIC_RELAXED);
+}
+
+// Rebuild when deletes have left too many stale bits or the keys outgrew the
+// array. The thread that trips the threshold pays for the rebuild; others
+// arriving meanwhile go on.
+void bloom_maintain(BPTree* tree) {
+    BloomFilter* filter = tree->bloom;
+    uint32_t keys = __atomic_load_n(&filter->keys, __ATOMIC_RELAXED);
+    uint32_t deletes = __atomic_load_n(&filter->deletes, __ATOMIC_RELAXED);
+    if (deletes <= keys / BLOOM_REBUILD_DIVISOR && keys <= activeBits(filter)->capacity) return;
+    if (pthread_mutex_trylock(&filter->rebuildMutex) != 0) return;
+    rebuildLocked(tree);
+    pthread_mutex_unlock(&filter->rebuildMutex);
+}
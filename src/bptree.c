@@ -1,5 +1,10 @@
+#define _GNU_SOURCE
 #include "include/bptree.h"
+#include "include/bloom.h"
 #include "include/distributed.h"
+#include "include/index.h"
+#include "include/stats.h"
+#include "include/trace.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,13 +15,38 @@ BPTreeNode* createNode(bool isLeaf) {
     node->isLeaf = isLeaf;
     node->numKeys = 0;
     node->next = NULL;
-    node->bitmapAddress = 0;
     memset(node->keys, 0, sizeof(node->keys));
     memset(node->values, 0, sizeof(node->values));
     memset(node->children, 0, sizeof(node->children));
     return node;
 }
 
+// Lock helpers that account wait time when instrumentation is built in
+static inline void lockTreeRead(BPTree* tree) {
+    STATS_TIMER_START(waitStart);
+    TRACE_BEGIN(TRACE_TREE_RDLOCK, 0);
+    pthread_rwlock_rdlock(&tree->lock);
+    TRACE_END(TRACE_TREE_RDLOCK);
+    STATS_TIMER_RECORD(STAT_HIST_TREE_RDLOCK_WAIT, waitStart);
+}
+
+static inline void lockTreeWrite(BPTree* tree) {
+    STATS_TIMER_START(waitStart);
+    TRACE_BEGIN(TRACE_TREE_WRLOCK, 0);
+    pthread_rwlock_wrlock(&tree->lock);
+    TRACE_END(TRACE_TREE_WRLOCK);
+    STATS_TIMER_RECORD(STAT_HIST_TREE_WRLOCK_WAIT, waitStart);
+}
+
+// One key move under the write lock, see moveKey
+typedef struct {
+    bool replace;              // Overwrite an entry already stored under the new key
+    bool substitute;           // Store value under the new key instead of the moved entry
+    FAT32_Entry* value;
+    FAT32_Entry* moved;        // Out: entry that was under the old key
+    FAT32_Entry* displaced;    // Out: entry that lost the new key, with replace
+} KeyMove;
+
 // Find position in node
 int findPosition(BPTreeNode* node, const char* key) {
     int i;
@@ -26,36 +56,42 @@ int findPosition(BPTreeNode* node, const char* key) {
     return i;
 }
 
-// Bitmap management
+// Bitmap management, the slot of an entry is kept in its bitmapAddress
 uint32_t allocateBitmapSpace(BPTree* tree) {
-    for (uint32_t i = 0; i < tree->bitmapSize * 8; i++) {
-        if (!(tree->bitmap[i / 8] & (1 << (i % 8)))) {
-            tree->bitmap[i / 8] |= (1 << (i % 8));
-            return i;
-        }
-    }
-    return 0xFFFFFFFF;
+    return slotmap_alloc(&tree->slots);
 }
 
 void freeBitmapSpace(BPTree* tree, uint32_t address) {
-    if (address < tree->bitmapSize * 8) {
-        tree->bitmap[address / 8] &= ~(1 << (address % 8));
+    slotmap_free(&tree->slots, address);
+}
+
+// An entry replaced in place hands its slot to the new entry
+static void moveSlot(BPTree* tree, FAT32_Entry* oldValue, FAT32_Entry* newValue) {
+    if (oldValue == newValue || tree->secondary) return;
+    if (!newValue) {
+        freeBitmapSpace(tree, oldValue->bitmapAddress);
+    } else {
+        newValue->bitmapAddress = oldValue ? oldValue->bitmapAddress : allocateBitmapSpace(tree);
     }
 }
 
 // Find leaf node containing key
 BPTreeNode* findLeaf(BPTreeNode* root, const char* key) {
     BPTreeNode* current = root;
+    uint64_t visited = 1;
     while (!current->isLeaf) {
         int pos = findPosition(current, key);
         current = current->children[pos];
+        visited++;
     }
+    STATS_ADD(STAT_TREE_NODES_VISITED, visited);
     return current;
 }
 
 // Split leaf node
 void splitLeaf(BPTreeNode* parent, int index, BPTreeNode* child) {
     BPTreeNode* newNode = createNode(true);
+    STATS_INC(STAT_TREE_SPLITS);
     int mid = (MAX_KEYS + 1) / 2;
 
     for (int i = mid; i < child->numKeys; i++) {
@@ -77,9 +113,46 @@ void splitLeaf(BPTreeNode* parent, int index, BPTreeNode* child) {
     parent->numKeys++;
 }
 
+// Split internal node, the middle key moves up into the parent
+void splitInternal(BPTreeNode* parent, int index, BPTreeNode* child) {
+    BPTreeNode* newNode = createNode(false);
+    STATS_INC(STAT_TREE_SPLITS);
+    int mid = child->numKeys / 2;
+
+    for (int i = mid + 1; i < child->numKeys; i++) {
+        strcpy(newNode->keys[i - mid - 1], child->keys[i]);
+        newNode->numKeys++;
+    }
+    for (int i = mid + 1; i <= child->numKeys; i++) {
+        newNode->children[i - mid - 1] = child->children[i];
+        child->children[i] = NULL;
+    }
+
+    for (int i = parent->numKeys; i > index; i--) {
+        strcpy(parent->keys[i], parent->keys[i - 1]);
+        parent->children[i + 1] = parent->children[i];
+    }
+    strcpy(parent->keys[index], child->keys[mid]);
+    parent->children[index + 1] = newNode;
+    parent->numKeys++;
+    child->numKeys = mid;
+}
+
+// Split a full child of parent, whichever kind of node it is
+static void splitChild(BPTreeNode* parent, int index, BPTreeNode* child) {
+    TRACE_BEGIN(TRACE_TREE_SPLIT, child->isLeaf);
+    if (child->isLeaf) {
+        splitLeaf(parent, index, child);
+    } else {
+        splitInternal(parent, index, child);
+    }
+    TRACE_END(TRACE_TREE_SPLIT);
+}
+
 // Insert into non-full node
 void insertNonFull(BPTreeNode* node, const char* key, FAT32_Entry* value) {
     int i = node->numKeys - 1;
+    STATS_INC(STAT_TREE_NODES_VISITED);
     
     if (node->isLeaf) {
         while (i >= 0 && strcmp(key, node->keys[i]) < 0) {
@@ -95,13 +168,138 @@ void insertNonFull(BPTreeNode* node, const char* key, FAT32_Entry* value) {
         i++;
         
         if (node->children[i]->numKeys == MAX_KEYS) {
-            splitLeaf(node, i, node->children[i]);
-            if (strcmp(key, node->keys[i]) > 0) i++;
+            splitChild(node, i, node->children[i]);
+            if (strcmp(key, node->keys[i]) >= 0) i++;
         }
         insertNonFull(node->children[i], key, value);
     }
 }
 
+// Index of key in a leaf, -1 if it is not there
+static int keyIndex(BPTreeNode* leaf, const char* key) {
+    for (int i = 0; i < leaf->numKeys; i++) {
+        if (strcmp(leaf->keys[i], key) == 0) return i;
+    }
+    return -1;
+}
+
+static void removeAt(BPTreeNode* leaf, int index) {
+    for (int j = index; j < leaf->numKeys - 1; j++) {
+        strcpy(leaf->keys[j], leaf->keys[j + 1]);
+        leaf->values[j] = leaf->values[j + 1];
+    }
+    leaf->numKeys--;
+}
+
+// Leaf that holds key, with the separators around it: every key in the leaf
+// is >= *low and < *high, NULL where the leaf is the leftmost or rightmost
+static BPTreeNode* findLeafBounded(BPTreeNode* root, const char* key, const char** low, const char** high) {
+    BPTreeNode* current = root;
+    uint64_t visited = 1;
+    *low = *high = NULL;
+    while (!current->isLeaf) {
+        int pos = findPosition(current, key);
+        if (pos > 0) *low = current->keys[pos - 1];
+        if (pos < current->numKeys) *high = current->keys[pos];
+        current = current->children[pos];
+        visited++;
+    }
+    STATS_ADD(STAT_TREE_NODES_VISITED, visited);
+    return current;
+}
+
+// Give the tree a new root above a full one, so the root always has room for a split child
+static void growRoot(BPTree* tree) {
+    BPTreeNode* newRoot = createNode(false);
+    newRoot->children[0] = tree->root;
+    tree->root = newRoot;
+    tree->height++;
+    STATS_GAUGE(STAT_GAUGE_TREE_HEIGHT, tree->height);
+    splitChild(newRoot, 0, newRoot->children[0]);
+}
+
+// Store key in one top-down pass with the write lock held, splitting full nodes
+// on the way like insert. With replace, an existing key gets the new value
+// instead and its old value is returned; a full leaf that already holds the key
+// is not split for it. Returns NULL when the key was added.
+static FAT32_Entry* storeKey(BPTree* tree, const char* key, FAT32_Entry* value, bool replace) {
+    BPTreeNode* node = tree->root;
+    int index;
+
+    if (replace && node->isLeaf && (index = keyIndex(node, key)) >= 0) {
+        FAT32_Entry* old = node->values[index];
+        node->values[index] = value;
+        return old;
+    }
+    if (node->numKeys == MAX_KEYS) {
+        growRoot(tree);
+        node = tree->root;
+    }
+
+    while (!node->isLeaf) {
+        STATS_INC(STAT_TREE_NODES_VISITED);
+        int pos = findPosition(node, key);
+        BPTreeNode* child = node->children[pos];
+        if (replace && child->isLeaf && (index = keyIndex(child, key)) >= 0) {
+            FAT32_Entry* old = child->values[index];
+            child->values[index] = value;
+            return old;
+        }
+        if (child->numKeys == MAX_KEYS) {
+            splitChild(node, pos, child);
+            if (strcmp(key, node->keys[pos]) >= 0) pos++;
+        }
+        node = node->children[pos];
+    }
+    insertNonFull(node, key, value);
+    return NULL;
+}
+
+// Move the entry under oldKey to newKey with the write lock held. When newKey
+// falls inside the bounds of oldKey's leaf the entry moves within that leaf,
+// which has room because its old key goes first; otherwise the old key is
+// unlinked and one more descent stores the new one.
+static bool moveKey(BPTree* tree, const char* oldKey, const char* newKey, KeyMove* move) {
+    const char* low;
+    const char* high;
+    BPTreeNode* leaf = findLeafBounded(tree->root, oldKey, &low, &high);
+    int index = keyIndex(leaf, oldKey);
+
+    move->displaced = NULL;
+    if (index < 0) return false;
+    move->moved = leaf->values[index];
+    FAT32_Entry* value = move->substitute ? move->value : move->moved;
+    if (tree->bloom && strcmp(oldKey, newKey) != 0) {
+        // Set newKey's bits before it becomes visible, oldKey's go stale
+        bloom_add(tree, newKey);
+        bloom_removed(tree);
+    }
+
+    if (strcmp(oldKey, newKey) == 0) {
+        leaf->values[index] = value;
+    } else if ((!low || strcmp(newKey, low) >= 0) && (!high || strcmp(newKey, high) < 0)) {
+        int target = move->replace ? keyIndex(leaf, newKey) : -1;
+        if (target >= 0) {
+            move->displaced = leaf->values[target];
+            removeAt(leaf, target);
+            if (target < index) index--;
+        }
+        removeAt(leaf, index);
+        insertNonFull(leaf, newKey, value);
+    } else {
+        removeAt(leaf, index);
+        move->displaced = storeKey(tree, newKey, value, move->replace);
+    }
+    return true;
+}
+
+// Entry that lost its key to a rename or upsert: drop its slot and index keys
+static void releaseDisplaced(BPTree* tree, FAT32_Entry* displaced) {
+    if (!displaced) return;
+    if (!tree->secondary) freeBitmapSpace(tree, displaced->bitmapAddress);
+    if (tree->indexes) index_remove(tree, displaced);
+}
+
 // Balancing operations
 void borrowFromLeft(BPTreeNode* node, BPTreeNode* leftSibling, BPTreeNode* parent, int index) {
     for (int i = node->numKeys; i > 0; i--) {
@@ -133,6 +331,7 @@ void borrowFromRight(BPTreeNode* node, BPTreeNode* rightSibling, BPTreeNode* par
 
 void mergeNodes(BPTreeNode* leftNode, BPTreeNode* rightNode) {
     int startIndex = leftNode->numKeys;
+    STATS_INC(STAT_TREE_MERGES);
     
     for (int i = 0; i < rightNode->numKeys; i++) {
         strcpy(leftNode->keys[startIndex + i], rightNode->keys[i]);
@@ -149,72 +348,120 @@ void mergeNodes(BPTreeNode* leftNode, BPTreeNode* rightNode) {
 BPTree* initializeBPTree(FAT32_FileSystem* fs) {
     BPTree* tree = (BPTree*)malloc(sizeof(BPTree));
     tree->root = createNode(true);
-    tree->bitmap = (uint8_t*)calloc(BITMAP_SIZE, sizeof(uint8_t));
-    tree->bitmapSize = BITMAP_SIZE;
+    slotmap_init(&tree->slots, BITMAP_SIZE * 8);
     tree->fs = fs;
-    pthread_rwlock_init(&tree->lock, NULL);
+    tree->height = 1;
+    tree->nextDirectoryId = DIR_ROOT_ID + 1;
+    tree->indexes = NULL;
+    tree->secondary = false;
+    tree->bloom = NULL;
+    // Spelled out rather than left to the default: index.c's change guard takes
+    // the read lock again from inside scans, which a waiting writer must not block
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_READER_NP);
+    pthread_rwlock_init(&tree->lock, &attr);
+    pthread_rwlockattr_destroy(&attr);
     return tree;
 }
 
 void insert(BPTree* tree, const char* key, FAT32_Entry* value) {
+    STATS_INC(STAT_TREE_INSERTS);
+    TRACE_BEGIN(TRACE_TREE_INSERT, 0);
+    if (value && !tree->secondary) value->bitmapAddress = allocateBitmapSpace(tree);
+    lockTreeWrite(tree);
     
-    pthread_rwlock_wrlock(&tree->lock);
-    
-    if (tree->root->numKeys == MAX_KEYS) {
-        BPTreeNode* newRoot = createNode(false);
-        newRoot->children[0] = tree->root;
-        tree->root = newRoot;
-        splitLeaf(newRoot, 0, newRoot->children[0]);
-        insertNonFull(newRoot, key, value);
-    } else {
-        insertNonFull(tree->root, key, value);
-    }
+    if (tree->bloom) bloom_add(tree, key);
+    if (tree->root->numKeys == MAX_KEYS) growRoot(tree);
+    insertNonFull(tree->root, key, value);
+    if (tree->indexes) index_add(tree, value);
     
     pthread_rwlock_unlock(&tree->lock);
+    if (tree->bloom) bloom_maintain(tree);
+    TRACE_END(TRACE_TREE_INSERT);
 }
 
 void insert_dme(BPTree* tree, const char* key, FAT32_Entry* value, DistributedNode *node) {
+    STATS_INC(STAT_TREE_INSERTS);
+    TRACE_BEGIN(TRACE_TREE_INSERT, 0);
+    if (value && !tree->secondary) value->bitmapAddress = allocateBitmapSpace(tree);
     requestToken(node);
-    pthread_rwlock_wrlock(&tree->lock);
+    lockTreeWrite(tree);
     
-    if (tree->root->numKeys == MAX_KEYS) {
-        BPTreeNode* newRoot = createNode(false);
-        newRoot->children[0] = tree->root;
-        tree->root = newRoot;
-        splitLeaf(newRoot, 0, newRoot->children[0]);
-        insertNonFull(newRoot, key, value);
-    } else {
-        insertNonFull(tree->root, key, value);
-    }
+    if (tree->bloom) bloom_add(tree, key);
+    if (tree->root->numKeys == MAX_KEYS) growRoot(tree);
+    insertNonFull(tree->root, key, value);
+    if (tree->indexes) index_add(tree, value);
     
     pthread_rwlock_unlock(&tree->lock);
+    if (tree->bloom) bloom_maintain(tree);
     releaseToken(node);
+    TRACE_END(TRACE_TREE_INSERT);
 }
 
 FAT32_Entry* search(BPTree* tree, const char* key) {
-    pthread_rwlock_rdlock(&tree->lock);
+    STATS_INC(STAT_TREE_LOOKUPS);
+    if (tree->bloom && !bloom_may_contain(tree, key)) {
+        STATS_INC(STAT_TREE_BLOOM_REJECTS);
+        return NULL;
+    }
+    TRACE_BEGIN(TRACE_TREE_SEARCH, 0);
+    lockTreeRead(tree);
     
     BPTreeNode* leaf = findLeaf(tree->root, key);
     for (int i = 0; i < leaf->numKeys; i++) {
         if (strcmp(leaf->keys[i], key) == 0) {
             FAT32_Entry* value = leaf->values[i];
             pthread_rwlock_unlock(&tree->lock);
+            TRACE_END(TRACE_TREE_SEARCH);
             return value;
         }
     }
     
     pthread_rwlock_unlock(&tree->lock);
+    if (tree->bloom) STATS_INC(STAT_TREE_BLOOM_FALSE_POSITIVES);
+    TRACE_END(TRACE_TREE_SEARCH);
     return NULL;
 }
 
+// Visit entries in key order starting at the first key >= startKey
+int scan(BPTree* tree, const char* startKey, int maxCount, BPTreeVisitor visit, void* ctx) {
+    int visited = 0;
+    TRACE_BEGIN(TRACE_TREE_SCAN, 0);
+    lockTreeRead(tree);
+
+    BPTreeNode* leaf = findLeaf(tree->root, startKey);
+    int i = 0;
+    while (i < leaf->numKeys && strcmp(leaf->keys[i], startKey) < 0) i++;
+
+    while (leaf && (maxCount <= 0 || visited < maxCount)) {
+        if (i >= leaf->numKeys) {
+            leaf = leaf->next;
+            i = 0;
+            continue;
+        }
+        visited++;
+        if (!visit(leaf->keys[i], leaf->values[i], ctx)) break;
+        i++;
+    }
+
+    pthread_rwlock_unlock(&tree->lock);
+    TRACE_END(TRACE_TREE_SCAN);
+    return visited;
+}
+
 void delete(BPTree* tree, const char* key) {
-    pthread_rwlock_wrlock(&tree->lock);
+    STATS_INC(STAT_TREE_DELETES);
+    TRACE_BEGIN(TRACE_TREE_DELETE, 0);
+    lockTreeWrite(tree);
     
     BPTreeNode* leaf = findLeaf(tree->root, key);
     int i;
     for (i = 0; i < leaf->numKeys; i++) {
         if (strcmp(leaf->keys[i], key) == 0) {
-            freeBitmapSpace(tree, leaf->bitmapAddress);
+            if (leaf->values[i] && !tree->secondary) freeBitmapSpace(tree, leaf->values[i]->bitmapAddress);
+            if (tree->indexes) index_remove(tree, leaf->values[i]);
+            if (tree->bloom) bloom_removed(tree);
             for (int j = i; j < leaf->numKeys - 1; j++) {
                 strcpy(leaf->keys[j], leaf->keys[j + 1]);
                 leaf->values[j] = leaf->values[j + 1];
@@ -225,17 +472,23 @@ void delete(BPTree* tree, const char* key) {
     }
     
     pthread_rwlock_unlock(&tree->lock);
+    if (tree->bloom) bloom_maintain(tree);
+    TRACE_END(TRACE_TREE_DELETE);
 }
 
 void delete_dme(BPTree* tree, const char* key, DistributedNode *node) {
+    STATS_INC(STAT_TREE_DELETES);
+    TRACE_BEGIN(TRACE_TREE_DELETE, 0);
     requestToken(node);
-    pthread_rwlock_wrlock(&tree->lock);
+    lockTreeWrite(tree);
     
     BPTreeNode* leaf = findLeaf(tree->root, key);
     int i;
     for (i = 0; i < leaf->numKeys; i++) {
         if (strcmp(leaf->keys[i], key) == 0) {
-            freeBitmapSpace(tree, leaf->bitmapAddress);
+            if (leaf->values[i] && !tree->secondary) freeBitmapSpace(tree, leaf->values[i]->bitmapAddress);
+            if (tree->indexes) index_remove(tree, leaf->values[i]);
+            if (tree->bloom) bloom_removed(tree);
             for (int j = i; j < leaf->numKeys - 1; j++) {
                 strcpy(leaf->keys[j], leaf->keys[j + 1]);
                 leaf->values[j] = leaf->values[j + 1];
@@ -246,60 +499,184 @@ void delete_dme(BPTree* tree, const char* key, DistributedNode *node) {
     }
     
     pthread_rwlock_unlock(&tree->lock);
+    if (tree->bloom) bloom_maintain(tree);
     releaseToken(node);
+    TRACE_END(TRACE_TREE_DELETE);
 }
 
-bool update(BPTree* tree, const char* oldKey, const char* newKey, FAT32_Entry* newValue) {
-    pthread_rwlock_wrlock(&tree->lock);
-    
-    BPTreeNode* leaf = findLeaf(tree->root, oldKey);
-    bool found = false;
-    
-    for (int i = 0; i < leaf->numKeys; i++) {
-        if (strcmp(leaf->keys[i], oldKey) == 0) {
-            if ((i == 0 || strcmp(leaf->keys[i-1], newKey) < 0) &&
-                (i == leaf->numKeys-1 || strcmp(leaf->keys[i+1], newKey) > 0)) {
-                strcpy(leaf->keys[i], newKey);
-                leaf->values[i] = newValue;
-                found = true;
-            } else {
-                delete(tree, oldKey);
-                insert(tree, newKey, newValue);
-                found = true;
-            }
-            break;
+// Insert key, or replace the entry stored under it, in one descent under one
+// acquisition of the write lock. Returns the replaced entry, which the caller
+// now owns, or NULL if key was new.
+FAT32_Entry* upsert(BPTree* tree, const char* key, FAT32_Entry* value) {
+    STATS_INC(STAT_TREE_INSERTS);
+    TRACE_BEGIN(TRACE_TREE_UPSERT, 0);
+    uint32_t slot = (value && !tree->secondary) ? allocateBitmapSpace(tree) : SLOTMAP_NONE;
+    lockTreeWrite(tree);
+
+    if (tree->bloom) bloom_add(tree, key);
+    FAT32_Entry* old = storeKey(tree, key, value, true);
+    if (old == value) {
+        old = NULL;
+    } else {
+        if (value && !tree->secondary) {
+            // A replaced entry hands its slot on, the fresh one goes back below
+            value->bitmapAddress = old ? old->bitmapAddress : slot;
+            if (!old) slot = SLOTMAP_NONE;
+        }
+        if (tree->indexes) {
+            if (old) index_remove(tree, old);
+            index_add(tree, value);
         }
     }
-    
+
+    pthread_rwlock_unlock(&tree->lock);
+    if (slot != SLOTMAP_NONE) freeBitmapSpace(tree, slot);
+    if (tree->bloom) bloom_maintain(tree);
+    TRACE_END(TRACE_TREE_UPSERT);
+    return old;
+}
+
+// Move the entry stored under oldKey to newKey atomically: readers see it under
+// one key or the other, never both or neither. An entry already under newKey is
+// replaced, as rename(2) does, and returned through replaced for the caller to
+// free; NULL if newKey was free. Returns false if oldKey does not exist.
+bool renameEntry(BPTree* tree, const char* oldKey, const char* newKey, FAT32_Entry** replaced) {
+    return renameEntryIf(tree, oldKey, newKey, NULL, NULL, replaced);
+}
+
+// renameEntry that first runs check under the same write lock, so the caller
+// can validate the target and update the moved entry's fields atomically with
+// the move. Returns false if oldKey does not exist or check refused.
+bool renameEntryIf(BPTree* tree, const char* oldKey, const char* newKey, BPTreeRenameCheck check, void* ctx,
+                   FAT32_Entry** replaced) {
+    KeyMove move = { .replace = true };
+    TRACE_BEGIN(TRACE_TREE_RENAME, 0);
+    lockTreeWrite(tree);
+
+    bool found;
+    FAT32_Entry* moved = check ? searchLocked(tree, oldKey) : NULL;
+    if (check && (!moved || !check(tree, moved, searchLocked(tree, newKey), ctx))) {
+        found = false;
+        move.displaced = NULL;
+    } else {
+        found = moveKey(tree, oldKey, newKey, &move);
+        if (move.displaced == move.moved) move.displaced = NULL;
+        releaseDisplaced(tree, move.displaced);
+    }
+
     pthread_rwlock_unlock(&tree->lock);
+    if (tree->bloom) bloom_maintain(tree);
+    if (replaced) *replaced = move.displaced;
+    TRACE_END(TRACE_TREE_RENAME);
     return found;
 }
 
-bool update_dme(BPTree* tree, const char* oldKey, const char* newKey, FAT32_Entry* newValue, DistributedNode *node) {
-    requestToken(node);
-    pthread_rwlock_wrlock(&tree->lock);
-    
-    BPTreeNode* leaf = findLeaf(tree->root, oldKey);
-    bool found = false;
-    
-    for (int i = 0; i < leaf->numKeys; i++) {
-        if (strcmp(leaf->keys[i], oldKey) == 0) {
-            if ((i == 0 || strcmp(leaf->keys[i-1], newKey) < 0) &&
-                (i == leaf->numKeys-1 || strcmp(leaf->keys[i+1], newKey) > 0)) {
-                strcpy(leaf->keys[i], newKey);
-                leaf->values[i] = newValue;
-                found = true;
-            } else {
-                delete(tree, oldKey);
-                insert(tree, newKey, newValue);
-                found = true;
-            }
-            break;
+// Insert key unless it is already stored or check, run under the same write
+// lock, rejects value; a NULL check accepts it. Returns false, leaving the tree
+// as it was, if key exists or check failed.
+bool insertIfAbsent(BPTree* tree, const char* key, FAT32_Entry* value, BPTreeCheck check, void* ctx) {
+    STATS_INC(STAT_TREE_INSERTS);
+    TRACE_BEGIN(TRACE_TREE_INSERT, 0);
+    uint32_t slot = (value && !tree->secondary) ? allocateBitmapSpace(tree) : SLOTMAP_NONE;
+    lockTreeWrite(tree);
+
+    bool absent = keyIndex(findLeaf(tree->root, key), key) < 0 && (!check || check(tree, value, ctx));
+    if (absent) {
+        if (value && !tree->secondary) {
+            value->bitmapAddress = slot;
+            slot = SLOTMAP_NONE;
         }
+        if (tree->bloom) bloom_add(tree, key);
+        storeKey(tree, key, value, false);
+        if (tree->indexes) index_add(tree, value);
     }
-    
+
+    pthread_rwlock_unlock(&tree->lock);
+    if (slot != SLOTMAP_NONE) freeBitmapSpace(tree, slot);
+    if (tree->bloom) bloom_maintain(tree);
+    TRACE_END(TRACE_TREE_INSERT);
+    return absent;
+}
+
+// Remove key if check, run under the same write lock, accepts its entry; a NULL
+// check always does. The entry is returned through removed for the caller to
+// free. Returns false if key does not exist or check kept it.
+bool deleteIf(BPTree* tree, const char* key, BPTreeCheck check, void* ctx, FAT32_Entry** removed) {
+    STATS_INC(STAT_TREE_DELETES);
+    TRACE_BEGIN(TRACE_TREE_DELETE, 0);
+    lockTreeWrite(tree);
+
+    BPTreeNode* leaf = findLeaf(tree->root, key);
+    int index = keyIndex(leaf, key);
+    FAT32_Entry* value = index >= 0 ? leaf->values[index] : NULL;
+    bool deleted = index >= 0 && (!check || check(tree, value, ctx));
+    if (deleted) {
+        if (value && !tree->secondary) freeBitmapSpace(tree, value->bitmapAddress);
+        if (tree->indexes) index_remove(tree, value);
+        if (tree->bloom) bloom_removed(tree);
+        removeAt(leaf, index);
+    }
+
+    pthread_rwlock_unlock(&tree->lock);
+    if (tree->bloom) bloom_maintain(tree);
+    if (removed) *removed = deleted ? value : NULL;
+    TRACE_END(TRACE_TREE_DELETE);
+    return deleted;
+}
+
+// Lookups for checks, which run with the lock already held
+FAT32_Entry* searchLocked(BPTree* tree, const char* key) {
+    BPTreeNode* leaf = findLeaf(tree->root, key);
+    int index = keyIndex(leaf, key);
+    return index >= 0 ? leaf->values[index] : NULL;
+}
+
+// True if some key starts with prefix
+bool containsPrefix(BPTree* tree, const char* prefix) {
+    size_t length = strlen(prefix);
+    for (BPTreeNode* leaf = findLeaf(tree->root, prefix); leaf; leaf = leaf->next) {
+        for (int i = 0; i < leaf->numKeys; i++) {
+            if (strcmp(leaf->keys[i], prefix) >= 0) return strncmp(leaf->keys[i], prefix, length) == 0;
+        }
+    }
+    return false;
+}
+
+// Rekey oldKey's entry as newKey with newValue. Unlike renameEntry an entry
+// already under newKey stays, next to the moved one.
+static bool updateLocked(BPTree* tree, const char* oldKey, const char* newKey, FAT32_Entry* newValue) {
+    KeyMove move = { .substitute = true, .value = newValue };
+    if (!moveKey(tree, oldKey, newKey, &move)) return false;
+
+    if (move.moved != newValue) {
+        moveSlot(tree, move.moved, newValue);
+        if (tree->indexes) {
+            index_remove(tree, move.moved);
+            index_add(tree, newValue);
+        }
+    }
+    return true;
+}
+
+bool update(BPTree* tree, const char* oldKey, const char* newKey, FAT32_Entry* newValue) {
+    TRACE_BEGIN(TRACE_TREE_UPDATE, 0);
+    lockTreeWrite(tree);
+    bool found = updateLocked(tree, oldKey, newKey, newValue);
+    pthread_rwlock_unlock(&tree->lock);
+    if (tree->bloom) bloom_maintain(tree);
+    TRACE_END(TRACE_TREE_UPDATE);
+    return found;
+}
+
+bool update_dme(BPTree* tree, const char* oldKey, const char* newKey, FAT32_Entry* newValue, DistributedNode *node) {
+    TRACE_BEGIN(TRACE_TREE_UPDATE, 0);
+    requestToken(node);
+    lockTreeWrite(tree);
+    bool found = updateLocked(tree, oldKey, newKey, newValue);
     pthread_rwlock_unlock(&tree->lock);
+    if (tree->bloom) bloom_maintain(tree);
     releaseToken(node);
+    TRACE_END(TRACE_TREE_UPDATE);
     return found;
 }
 
@@ -313,8 +690,10 @@ void cleanupTree(BPTreeNode* node) {
 }
 
 void destroyBPTree(BPTree* tree) {
+    index_destroy(tree);
+    bloom_destroy(tree);
     cleanupTree(tree->root);
-    free(tree->bitmap);
+    slotmap_destroy(&tree->slots);
     pthread_rwlock_destroy(&tree->lock);
     free(tree);
 }
@@ -0,0 +1,513 @@
+#include "include/bufpool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+// Helper function implementations
+static uint32_t hashCluster(BufferPool* pool, uint32_t cluster) {
+    return (cluster * 2654435761u) & pool->bucketMask;
+}
+
+static uint8_t* frameData(BufferPool* pool, uint32_t frame) {
+    return pool->memory + (uint64_t)frame * pool->clusterSize;
+}
+
+static off_t clusterOffset(BufferPool* pool, uint32_t cluster) {
+    return (off_t)(pool->dataOffset + (uint64_t)(cluster - 2) * pool->clusterSize);
+}
+
+static uint32_t findFrame(BufferPool* pool, uint32_t cluster) {
+    uint32_t frame = pool->buckets[hashCluster(pool, cluster)];
+    while (frame != BUFPOOL_NO_FRAME && pool->frames[frame].cluster != cluster) {
+        frame = pool->frames[frame].nextInBucket;
+    }
+    return frame;
+}
+
+static void unlinkFrame(BufferPool* pool, uint32_t frame) {
+    uint32_t* link = &pool->buckets[hashCluster(pool, pool->frames[frame].cluster)];
+    while (*link != frame) {
+        link = &pool->frames[*link].nextInBucket;
+    }
+    *link = pool->frames[frame].nextInBucket;
+    pool->frames[frame].cluster = BUFPOOL_NO_FRAME;
+    pool->frames[frame].nextInBucket = BUFPOOL_NO_FRAME;
+    pool->stats.residentFrames--;
+}
+
+static void linkFrame(BufferPool* pool, uint32_t frame, uint32_t cluster) {
+    uint32_t bucket = hashCluster(pool, cluster);
+    pool->frames[frame].cluster = cluster;
+    pool->frames[frame].nextInBucket = pool->buckets[bucket];
+    pool->buckets[bucket] = frame;
+    pool->frames[frame].loading = false;
+    pool->frames[frame].ioError = false;
+    pool->stats.residentFrames++;
+}
+
+// Run the verifier over a cluster that just came off the image
+static int checkLoaded(BufferPool* pool, uint32_t cluster, const uint8_t* buffer) {
+    if (pool->verify && !pool->verify(pool->verifyCtx, cluster, buffer)) {
+        pool->stats.verifyFailures++;
+        return -1;
+    }
+    return 0;
+}
+
+// Full-cluster I/O that retries short transfers
+static int readImage(BufferPool* pool, uint32_t cluster, uint8_t* buffer) {
+    uint32_t done = 0;
+    while (done < pool->clusterSize) {
+        ssize_t n = pread(pool->fd, buffer + done, pool->clusterSize - done, clusterOffset(pool, cluster) + done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        if (n == 0) {
+            // Past the end of a sparse image reads as zeros
+            memset(buffer + done, 0, pool->clusterSize - done);
+            break;
+        }
+        done += (uint32_t)n;
+    }
+    return 0;
+}
+
+static int readCluster(BufferPool* pool, uint32_t cluster, uint8_t* buffer) {
+    if (readImage(pool, cluster, buffer) != 0) return -1;
+    pool->stats.reads++;
+    return checkLoaded(pool, cluster, buffer);
+}
+
+static int writeCluster(BufferPool* pool, uint32_t cluster, const uint8_t* buffer) {
+    uint32_t done = 0;
+    while (done < pool->clusterSize) {
+        ssize_t n = pwrite(pool->fd, buffer + done, pool->clusterSize - done, clusterOffset(pool, cluster) + done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        done += (uint32_t)n;
+    }
+    pool->stats.writebacks++;
+    return 0;
+}
+
+static int writeBack(BufferPool* pool, uint32_t frame) {
+    BufferFrame* f = &pool->frames[frame];
+    if (!f->dirty) return 0;
+    if (writeCluster(pool, f->cluster, frameData(pool, frame)) != 0) return -1;
+    f->dirty = false;
+    pool->stats.dirtyFrames--;
+    return 0;
+}
+
+// Completion tags: frame index in the high bits, request kind in the low two
+enum { IO_LOAD, IO_PREFETCH, IO_WRITEBACK, IO_WRITE_THROUGH };
+#define IO_TAG(frame, kind) ((void*)(((uintptr_t)(frame) << 2) | (kind)))
+
+// Apply one finished request to its frame, returns -1 if the transfer failed
+static int retireIo(BufferPool* pool, const AioCompletion* done) {
+    uintptr_t tag = (uintptr_t)done->userData;
+    uint32_t frame = (uint32_t)(tag >> 2);
+    BufferFrame* f = &pool->frames[frame];
+    int result = 0;
+
+    switch (tag & 3) {
+    case IO_LOAD:
+    case IO_PREFETCH:
+        if (done->result < 0) {
+            // Retry synchronously before reporting the frame as failed
+            if (readCluster(pool, f->cluster, frameData(pool, frame)) != 0) result = -1;
+        } else {
+            if ((uint32_t)done->result < pool->clusterSize) {
+                // Past the end of a sparse image reads as zeros
+                memset(frameData(pool, frame) + done->result, 0, pool->clusterSize - done->result);
+            }
+            pool->stats.reads++;
+            result = checkLoaded(pool, f->cluster, frameData(pool, frame));
+        }
+        f->loading = false;
+        f->ioError = result != 0;
+        if ((tag & 3) == IO_PREFETCH) {
+            // Drop the readahead pin; a failed readahead is simply forgotten
+            f->pinCount--;
+            if (f->ioError && f->pinCount == 0) unlinkFrame(pool, frame);
+            result = 0;
+        }
+        break;
+    case IO_WRITEBACK:
+        if (done->result == (int)pool->clusterSize) {
+            f->dirty = false;
+            pool->stats.dirtyFrames--;
+            pool->stats.writebacks++;
+        } else if (writeBack(pool, frame) != 0) {
+            result = -1;
+        }
+        break;
+    case IO_WRITE_THROUGH:
+        if (done->result != (int)pool->clusterSize) result = -1;
+        else pool->stats.writebacks++;
+        break;
+    }
+    return result;
+}
+
+// Submit anything prepared and retire completions, waiting for at least minWait.
+// Returns how many were retired; failures are reported through *result.
+static int reapIo(BufferPool* pool, int minWait, int* result) {
+    AioCompletion done[BUFPOOL_BATCH_MAX];
+    aio_submit(pool->aio);
+    int n = aio_reap(pool->aio, done, BUFPOOL_BATCH_MAX, minWait);
+    for (int i = 0; i < n; i++) {
+        if (retireIo(pool, &done[i]) != 0) *result = -1;
+    }
+    return n;
+}
+
+// Look a cluster up, waiting out a readahead of it that is still in flight
+static uint32_t residentFrame(BufferPool* pool, uint32_t cluster) {
+    int ignored = 0;
+    uint32_t frame = findFrame(pool, cluster);
+    while (frame != BUFPOOL_NO_FRAME && pool->frames[frame].loading) {
+        reapIo(pool, 1, &ignored);
+        frame = findFrame(pool, cluster);
+    }
+    return frame;
+}
+
+// Read a batch of freshly claimed frames with one submission
+static int loadFrames(BufferPool* pool, const uint32_t* frames, uint32_t count) {
+    int result = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t frame = frames[i];
+        if (aio_prep_read(pool->aio, frameData(pool, frame), pool->clusterSize,
+                          (uint64_t)clusterOffset(pool, pool->frames[frame].cluster), IO_TAG(frame, IO_LOAD)) == 0) {
+            pool->frames[frame].loading = true;
+        } else if (readCluster(pool, pool->frames[frame].cluster, frameData(pool, frame)) != 0) {
+            result = -1;
+        }
+    }
+
+    // Readaheads already in flight may complete first, keep going until the batch is in
+    for (uint32_t i = 0; i < count; i++) {
+        while (pool->frames[frames[i]].loading) {
+            if (reapIo(pool, 1, &result) <= 0) return -1;
+        }
+        if (pool->frames[frames[i]].ioError) result = -1;
+    }
+    return result;
+}
+
+// CLOCK replacement: sweep at most twice so every reference bit gets cleared once
+static uint32_t claimFrame(BufferPool* pool) {
+    for (uint32_t step = 0; step < pool->frameCount * 2; step++) {
+        uint32_t frame = pool->clockHand;
+        pool->clockHand = (pool->clockHand + 1) % pool->frameCount;
+        BufferFrame* f = &pool->frames[frame];
+
+        if (f->cluster == BUFPOOL_NO_FRAME) return frame;
+        if (f->pinCount > 0) continue;
+        if (f->referenced) {
+            f->referenced = false;
+            continue;
+        }
+        if (writeBack(pool, frame) != 0) continue;
+        unlinkFrame(pool, frame);
+        pool->stats.evictions++;
+        return frame;
+    }
+    return BUFPOOL_NO_FRAME;
+}
+
+// Core function implementations
+BufferPool* bufpool_create(int fd, uint64_t dataOffset, uint32_t clusterSize, uint32_t frameCount) {
+    if (frameCount == 0) return NULL;
+
+    BufferPool* pool = (BufferPool*)calloc(1, sizeof(BufferPool));
+    pool->fd = fd;
+    pool->dataOffset = dataOffset;
+    pool->clusterSize = clusterSize;
+    pool->frameCount = frameCount;
+    pool->memory = (uint8_t*)malloc((uint64_t)frameCount * clusterSize);
+    pool->frames = (BufferFrame*)calloc(frameCount, sizeof(BufferFrame));
+    if (!pool->memory || !pool->frames) {
+        free(pool->memory);
+        free(pool->frames);
+        free(pool);
+        return NULL;
+    }
+
+    // Twice as many buckets as frames keeps chains short
+    uint32_t buckets = 1;
+    while (buckets < frameCount * 2) buckets <<= 1;
+    pool->buckets = (uint32_t*)malloc(buckets * sizeof(uint32_t));
+    pool->bucketMask = buckets - 1;
+    memset(pool->buckets, 0xFF, buckets * sizeof(uint32_t));
+
+    for (uint32_t i = 0; i < frameCount; i++) {
+        pool->frames[i].cluster = BUFPOOL_NO_FRAME;
+        pool->frames[i].nextInBucket = BUFPOOL_NO_FRAME;
+    }
+    pool->stats.frameCount = frameCount;
+    pool->aio = aio_create(fd, AIO_DEFAULT_DEPTH);
+    pthread_mutex_init(&pool->mutex, NULL);
+    return pool;
+}
+
+// Pin a cluster in memory; with overwrite the caller replaces the whole cluster,
+// so a miss skips the read
+uint8_t* bufpool_pin(BufferPool* pool, uint32_t cluster, bool overwrite) {
+    pthread_mutex_lock(&pool->mutex);
+
+    uint32_t frame = residentFrame(pool, cluster);
+    if (frame != BUFPOOL_NO_FRAME) {
+        pool->stats.hits++;
+    } else {
+        pool->stats.misses++;
+        frame = claimFrame(pool);
+        if (frame == BUFPOOL_NO_FRAME) {
+            // Every frame is pinned
+            pthread_mutex_unlock(&pool->mutex);
+            return NULL;
+        }
+        if (!overwrite && readCluster(pool, cluster, frameData(pool, frame)) != 0) {
+            pthread_mutex_unlock(&pool->mutex);
+            return NULL;
+        }
+        linkFrame(pool, frame, cluster);
+    }
+
+    BufferFrame* f = &pool->frames[frame];
+    f->pinCount++;
+    f->referenced = true;
+    uint8_t* data = frameData(pool, frame);
+
+    pthread_mutex_unlock(&pool->mutex);
+    return data;
+}
+
+// Pin a run of clusters, reading every miss in one submission. Returns how many
+// leading clusters were pinned (fewer when the pool runs out of frames) or -1 on I/O error
+int bufpool_pin_many(BufferPool* pool, const uint32_t* clusters, uint32_t count, uint8_t** out) {
+    uint32_t missFrames[BUFPOOL_BATCH_MAX];
+    uint32_t misses = 0;
+    uint32_t pinned;
+
+    if (count > BUFPOOL_BATCH_MAX) count = BUFPOOL_BATCH_MAX;
+    pthread_mutex_lock(&pool->mutex);
+
+    for (pinned = 0; pinned < count; pinned++) {
+        uint32_t frame = residentFrame(pool, clusters[pinned]);
+        if (frame != BUFPOOL_NO_FRAME) {
+            pool->stats.hits++;
+        } else {
+            frame = claimFrame(pool);
+            if (frame == BUFPOOL_NO_FRAME) break;
+            pool->stats.misses++;
+            linkFrame(pool, frame, clusters[pinned]);
+            missFrames[misses++] = frame;
+        }
+        pool->frames[frame].pinCount++;
+        pool->frames[frame].referenced = true;
+        out[pinned] = frameData(pool, frame);
+    }
+
+    if (misses > 0 && loadFrames(pool, missFrames, misses) != 0) {
+        for (uint32_t i = 0; i < pinned; i++) {
+            pool->frames[findFrame(pool, clusters[i])].pinCount--;
+        }
+        for (uint32_t i = 0; i < misses; i++) {
+            unlinkFrame(pool, missFrames[i]);
+        }
+        pthread_mutex_unlock(&pool->mutex);
+        return -1;
+    }
+
+    pthread_mutex_unlock(&pool->mutex);
+    return (int)pinned;
+}
+
+// Start reading clusters that are not resident without waiting for them. Pins of
+// those clusters later wait for the read instead of issuing their own. Stops early
+// when no frame can be reclaimed; returns how many reads were started.
+int bufpool_prefetch(BufferPool* pool, const uint32_t* clusters, uint32_t count) {
+    int started = 0;
+    pthread_mutex_lock(&pool->mutex);
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (findFrame(pool, clusters[i]) != BUFPOOL_NO_FRAME) continue;
+        uint32_t frame = claimFrame(pool);
+        if (frame == BUFPOOL_NO_FRAME) break;
+        if (aio_prep_read(pool->aio, frameData(pool, frame), pool->clusterSize,
+                          (uint64_t)clusterOffset(pool, clusters[i]), IO_TAG(frame, IO_PREFETCH)) != 0) {
+            break;
+        }
+
+        // The readahead holds a pin until its read completes; the reference bit
+        // lets the frame survive one CLOCK sweep before the reader arrives
+        linkFrame(pool, frame, clusters[i]);
+        pool->frames[frame].loading = true;
+        pool->frames[frame].pinCount = 1;
+        pool->frames[frame].referenced = true;
+        pool->stats.prefetches++;
+        started++;
+    }
+    if (started > 0) aio_submit(pool->aio);
+
+    pthread_mutex_unlock(&pool->mutex);
+    return started;
+}
+
+// Write full clusters straight to the image in one submission. Resident copies
+// are updated in place instead so readers never see stale frames.
+int bufpool_write_through(BufferPool* pool, const uint32_t* clusters, const uint8_t* const* buffers, uint32_t count) {
+    int result = 0;
+    pthread_mutex_lock(&pool->mutex);
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t frame = residentFrame(pool, clusters[i]);
+        if (frame != BUFPOOL_NO_FRAME) {
+            memcpy(frameData(pool, frame), buffers[i], pool->clusterSize);
+            if (!pool->frames[frame].dirty) {
+                pool->frames[frame].dirty = true;
+                pool->stats.dirtyFrames++;
+            }
+            continue;
+        }
+        while (aio_prep_write(pool->aio, buffers[i], pool->clusterSize,
+                              (uint64_t)clusterOffset(pool, clusters[i]), IO_TAG(0, IO_WRITE_THROUGH)) != 0) {
+            // Context full, retire what is in flight first
+            reapIo(pool, 1, &result);
+        }
+    }
+
+    // The caller's buffers must stay untouched until every write has landed
+    while (aio_pending(pool->aio) > 0) {
+        if (reapIo(pool, 1, &result) <= 0) {
+            result = -1;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&pool->mutex);
+    return result;
+}
+
+// Copy a cluster out of the pool if it is resident, without claiming a frame
+bool bufpool_copy_resident(BufferPool* pool, uint32_t cluster, void* dest, uint32_t length) {
+    pthread_mutex_lock(&pool->mutex);
+
+    uint32_t frame = residentFrame(pool, cluster);
+    if (frame != BUFPOOL_NO_FRAME) {
+        memcpy(dest, frameData(pool, frame), length);
+        pool->frames[frame].referenced = true;
+        pool->stats.hits++;
+    }
+
+    pthread_mutex_unlock(&pool->mutex);
+    return frame != BUFPOOL_NO_FRAME;
+}
+
+void bufpool_unpin(BufferPool* pool, uint32_t cluster, bool dirty) {
+    pthread_mutex_lock(&pool->mutex);
+
+    uint32_t frame = findFrame(pool, cluster);
+    if (frame != BUFPOOL_NO_FRAME) {
+        BufferFrame* f = &pool->frames[frame];
+        if (f->pinCount > 0) f->pinCount--;
+        if (dirty && !f->dirty) {
+            f->dirty = true;
+            pool->stats.dirtyFrames++;
+        }
+    }
+
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+// Forget a freed cluster without writing it back
+void bufpool_discard(BufferPool* pool, uint32_t cluster) {
+    pthread_mutex_lock(&pool->mutex);
+
+    uint32_t frame = findFrame(pool, cluster);
+    if (frame != BUFPOOL_NO_FRAME && pool->frames[frame].pinCount == 0) {
+        if (pool->frames[frame].dirty) {
+            pool->frames[frame].dirty = false;
+            pool->stats.dirtyFrames--;
+        }
+        pool->frames[frame].referenced = false;
+        unlinkFrame(pool, frame);
+    }
+
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+// Write every dirty frame back with batched submissions, returns -1 if any write failed
+int bufpool_flush(BufferPool* pool) {
+    int result = 0;
+    pthread_mutex_lock(&pool->mutex);
+
+    for (uint32_t i = 0; i < pool->frameCount; i++) {
+        BufferFrame* f = &pool->frames[i];
+        if (f->cluster == BUFPOOL_NO_FRAME || !f->dirty) continue;
+        while (aio_prep_write(pool->aio, frameData(pool, i), pool->clusterSize,
+                              (uint64_t)clusterOffset(pool, f->cluster), IO_TAG(i, IO_WRITEBACK)) != 0) {
+            reapIo(pool, 1, &result);
+        }
+    }
+    while (aio_pending(pool->aio) > 0) {
+        if (reapIo(pool, 1, &result) <= 0) {
+            result = -1;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&pool->mutex);
+    return result;
+}
+
+// Copy a cluster without caching it: from its frame when resident, otherwise
+// straight from the image. The verifier is not run.
+int bufpool_read(BufferPool* pool, uint32_t cluster, void* dest) {
+    pthread_mutex_lock(&pool->mutex);
+    uint32_t frame = residentFrame(pool, cluster);
+    int result = 0;
+    if (frame != BUFPOOL_NO_FRAME && !pool->frames[frame].ioError) {
+        memcpy(dest, frameData(pool, frame), pool->clusterSize);
+    } else {
+        result = readImage(pool, cluster, (uint8_t*)dest);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return result;
+}
+
+// Check every cluster read from the image with verify, NULL to trust the image.
+// A cluster that fails is reported as an I/O error and never becomes resident.
+void bufpool_set_verifier(BufferPool* pool, BufferPoolVerifier verify, void* ctx) {
+    pthread_mutex_lock(&pool->mutex);
+    pool->verify = verify;
+    pool->verifyCtx = ctx;
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+void bufpool_get_stats(BufferPool* pool, BufferPoolStats* out) {
+    pthread_mutex_lock(&pool->mutex);
+    *out = pool->stats;
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+void bufpool_reset_stats(BufferPool* pool) {
+    pthread_mutex_lock(&pool->mutex);
+    pool->stats.hits = pool->stats.misses = 0;
+    pool->stats.reads = pool->stats.writebacks = pool->stats.evictions = 0;
+    pool->stats.prefetches = pool->stats.verifyFailures = 0;
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+void bufpool_destroy(BufferPool* pool) {
+    bufpool_flush(pool);
+    aio_destroy(pool->aio);
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool->buckets);
+    free(pool->frames);
+    free(pool->memory);
+    free(pool);
+}
@@ -0,0 +1,190 @@
+#include "include/client.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Helper function implementations
+static bool reserve(uint8_t** buffer, uint32_t* capacity, uint32_t needed) {
+    if (needed <= *capacity) return true;
+    uint32_t grown = *capacity ? *capacity : 4096;
+    while (grown < needed) grown *= 2;
+    uint8_t* resized = (uint8_t*)realloc(*buffer, grown);
+    if (!resized) return false;
+    *buffer = resized;
+    *capacity = grown;
+    return true;
+}
+
+// Send one request and wait for its response
+static int roundTrip(FsClient* client, uint8_t opcode, uint8_t flags, const char* key, uint64_t offset,
+                     uint32_t count, const void* data, uint32_t length, FsResponse* response) {
+    if (client->pending > 0) return -EBUSY;
+    if (fsclient_queue(client, opcode, flags, key, offset, count, data, length) == 0) return -EINVAL;
+    if (fsclient_flush(client) != 0 || fsclient_next(client, response) != 0) return -EIO;
+    return response->status;
+}
+
+// Core function implementations
+FsClient* fsclient_connect(const char* path) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) return NULL;
+    strcpy(address.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return NULL;
+    if (connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    FsClient* client = (FsClient*)calloc(1, sizeof(FsClient));
+    client->fd = fd;
+    client->nextId = 1;
+    return client;
+}
+
+void fsclient_close(FsClient* client) {
+    if (!client) return;
+    close(client->fd);
+    free(client->out);
+    free(client->in);
+    free(client);
+}
+
+// Append a request to the output buffer, returns its id or 0 if it cannot be sent
+uint32_t fsclient_queue(FsClient* client, uint8_t opcode, uint8_t flags, const char* key, uint64_t offset,
+                        uint32_t count, const void* data, uint32_t length) {
+    size_t keyLength = key ? strlen(key) : 0;
+    if (keyLength > FS_PROTO_MAX_KEY || length > FS_PROTO_MAX_DATA) return 0;
+
+    FsRequestHeader header;
+    header.length = (uint32_t)keyLength + length;
+    header.id = client->nextId++;
+    if (client->nextId == 0) client->nextId = 1;
+    header.opcode = opcode;
+    header.flags = flags;
+    header.keyLength = (uint16_t)keyLength;
+    header.offset = offset;
+    header.count = count;
+
+    if (!reserve(&client->out, &client->outCapacity, client->outLength + sizeof(header) + header.length)) return 0;
+    uint8_t* at = client->out + client->outLength;
+    memcpy(at, &header, sizeof(header));
+    if (keyLength) memcpy(at + sizeof(header), key, keyLength);
+    if (length) memcpy(at + sizeof(header) + keyLength, data, length);
+    client->outLength += sizeof(header) + header.length;
+    client->pending++;
+    return header.id;
+}
+
+// Send every queued request, returns 0 on success
+int fsclient_flush(FsClient* client) {
+    uint32_t sent = 0;
+    while (sent < client->outLength) {
+        ssize_t n = send(client->fd, client->out + sent, client->outLength - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        sent += (uint32_t)n;
+    }
+    client->outLength = 0;
+    return 0;
+}
+
+// Wait for the next response, returns 0 on success and -1 if the connection failed
+// or nothing is outstanding
+int fsclient_next(FsClient* client, FsResponse* out) {
+    if (client->pending == 0) return -1;
+
+    // Drop what was handed out last time
+    memmove(client->in, client->in + client->inUsed, client->inLength - client->inUsed);
+    client->inLength -= client->inUsed;
+    client->inUsed = 0;
+
+    FsResponseHeader header;
+    while (1) {
+        uint32_t needed = sizeof(header);
+        if (client->inLength >= sizeof(header)) {
+            memcpy(&header, client->in, sizeof(header));
+            needed += header.length;
+            if (client->inLength >= needed) break;
+        }
+        if (!reserve(&client->in, &client->inCapacity, needed > client->inLength + 65536 ? needed : client->inLength + 65536)) {
+            return -1;
+        }
+        ssize_t n = recv(client->fd, client->in + client->inLength, client->inCapacity - client->inLength, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        client->inLength += (uint32_t)n;
+    }
+
+    out->id = header.id;
+    out->status = header.status;
+    out->data = client->in + sizeof(header);
+    out->length = header.length;
+    client->inUsed = sizeof(header) + header.length;
+    client->pending--;
+    return 0;
+}
+
+int fsclient_create(FsClient* client, const char* key, const void* data, uint32_t length) {
+    FsResponse response;
+    return roundTrip(client, FS_OP_CREATE, 0, key, 0, 0, data, length, &response);
+}
+
+// Returns the number of bytes read, 0 at the end of the file
+int fsclient_read(FsClient* client, const char* key, uint64_t offset, void* buffer, uint32_t length) {
+    FsResponse response;
+    int status = roundTrip(client, FS_OP_READ, 0, key, offset, length, NULL, 0, &response);
+    if (status > 0) memcpy(buffer, response.data, response.length);
+    return status;
+}
+
+int fsclient_write(FsClient* client, const char* key, uint64_t offset, const void* data, uint32_t length) {
+    FsResponse response;
+    return roundTrip(client, FS_OP_WRITE, 0, key, offset, 0, data, length, &response);
+}
+
+int fsclient_append(FsClient* client, const char* key, const void* data, uint32_t length) {
+    FsResponse response;
+    return roundTrip(client, FS_OP_WRITE, FS_FLAG_APPEND, key, 0, 0, data, length, &response);
+}
+
+int fsclient_delete(FsClient* client, const char* key) {
+    FsResponse response;
+    return roundTrip(client, FS_OP_DELETE, 0, key, 0, 0, NULL, 0, &response);
+}
+
+int fsclient_stat(FsClient* client, const char* key, FsStat* out) {
+    FsResponse response;
+    int status = roundTrip(client, FS_OP_STAT, 0, key, 0, 0, NULL, 0, &response);
+    if (status == 0 && response.length == sizeof(FsStat)) memcpy(out, response.data, sizeof(FsStat));
+    return status;
+}
+
+// Visit up to max keys starting with prefix in order, 0 for no limit.
+// Returns the number of keys listed.
+int fsclient_list(FsClient* client, const char* prefix, uint32_t max,
+                  bool (*visit)(const char* key, uint64_t size, void* ctx), void* ctx) {
+    FsResponse response;
+    int status = roundTrip(client, FS_OP_LIST, 0, prefix, 0, max, NULL, 0, &response);
+    char key[FS_PROTO_MAX_KEY + 1];
+    uint32_t at = 0;
+
+    for (int i = 0; i < status && visit && at + sizeof(FsListEntry) <= response.length; i++) {
+        FsListEntry item;
+        memcpy(&item, response.data + at, sizeof(item));
+        at += sizeof(item);
+        if (item.keyLength > FS_PROTO_MAX_KEY || at + item.keyLength > response.length) return -EIO;
+        memcpy(key, response.data + at, item.keyLength);
+        key[item.keyLength] = '\0';
+        at += item.keyLength;
+        if (!visit(key, item.size, ctx)) break;
+    }
+    return status;
+}
@@ -0,0 +1,290 @@
+#include "include/crc32c.h"
+#include <pthread.h>
+#include <string.h>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#include <wmmintrin.h>
+#endif
+
+// Stream lengths for the hardware path: three independent crc32 chains hide the
+// instruction's latency, then the partial CRCs are combined by shifting them
+// over the bytes that followed. Both must be powers of two.
+#define CRC32C_LONG 1024
+#define CRC32C_SHORT 128
+
+static pthread_once_t tablesOnce = PTHREAD_ONCE_INIT;
+static uint32_t sliceTable[8][256];         // Slicing-by-8 tables for the software path
+static uint32_t longShift[4][256];          // Appends CRC32C_LONG zero bytes to a CRC
+static uint32_t shortShift[4][256];         // Appends CRC32C_SHORT zero bytes to a CRC
+static bool hardware;
+static bool carryless;                      // pclmul present as well, long inputs are folded
+static uint64_t foldBy4[2];                 // Fold constants for 64 bytes ahead, see foldConstant
+static uint64_t foldBy1[2];                 // Fold constants for 16 bytes ahead
+
+// Helper function implementations
+
+// GF(2) matrix times vector, mat has a row per bit of vec
+static uint32_t gf2Times(const uint32_t* mat, uint32_t vec) {
+    uint32_t sum = 0;
+    for (; vec; vec >>= 1, mat++) {
+        if (vec & 1) sum ^= *mat;
+    }
+    return sum;
+}
+
+static void gf2Square(uint32_t* square, const uint32_t* mat) {
+    for (int n = 0; n < 32; n++) square[n] = gf2Times(mat, mat[n]);
+}
+
+// Tables that apply the operator for length zero bytes to a CRC one byte at a time
+static void buildShift(uint32_t table[4][256], size_t length) {
+    uint32_t odd[32];
+    uint32_t even[32];
+
+    // Operator for one zero bit, then repeated squaring up to length bytes
+    odd[0] = CRC32C_POLY;
+    for (int n = 1; n < 32; n++) odd[n] = 1u << (n - 1);
+    gf2Square(even, odd);     // 2 bits
+    gf2Square(odd, even);     // 4 bits
+    uint32_t* result = odd;
+    while (1) {
+        gf2Square(even, odd);
+        result = even;
+        length >>= 1;
+        if (length == 0) break;
+        gf2Square(odd, even);
+        result = odd;
+        length >>= 1;
+        if (length == 0) break;
+    }
+
+    for (uint32_t n = 0; n < 256; n++) {
+        table[0][n] = gf2Times(result, n);
+        table[1][n] = gf2Times(result, n << 8);
+        table[2][n] = gf2Times(result, n << 16);
+        table[3][n] = gf2Times(result, n << 24);
+    }
+}
+
+// x^n mod P, bit-reflected and times x, the form the carry-less folds multiply by
+static uint64_t foldConstant(uint32_t n) {
+    uint64_t r = 1;
+    for (uint32_t i = 0; i < n; i++) {
+        r <<= 1;
+        if (r & 0x100000000ull) r ^= 0x11EDC6F41ull;
+    }
+    uint64_t reflected = 0;
+    for (int bit = 0; bit < 32; bit++) {
+        if (r & (1ull << bit)) reflected |= 1ull << (31 - bit);
+    }
+    return reflected << 1;
+}
+
+static uint32_t shift(uint32_t table[4][256], uint32_t crc) {
+    return table[0][crc & 0xFF] ^ table[1][(crc >> 8) & 0xFF] ^ table[2][(crc >> 16) & 0xFF] ^ table[3][crc >> 24];
+}
+
+static void buildTables(void) {
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t crc = n;
+        for (int k = 0; k < 8; k++) crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        sliceTable[0][n] = crc;
+    }
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t crc = sliceTable[0][n];
+        for (int k = 1; k < 8; k++) {
+            crc = sliceTable[0][crc & 0xFF] ^ (crc >> 8);
+            sliceTable[k][n] = crc;
+        }
+    }
+    buildShift(longShift, CRC32C_LONG);
+    buildShift(shortShift, CRC32C_SHORT);
+
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    hardware = __builtin_cpu_supports("sse4.2");
+    carryless = hardware && __builtin_cpu_supports("pclmul");
+    foldBy4[0] = foldConstant(512 + 32);
+    foldBy4[1] = foldConstant(512 - 32);
+    foldBy1[0] = foldConstant(128 + 32);
+    foldBy1[1] = foldConstant(128 - 32);
+#endif
+}
+
+static uint32_t crcSoftware(uint32_t crc, const uint8_t* next, size_t length) {
+    while (length > 0 && ((uintptr_t)next & 7) != 0) {
+        crc = sliceTable[0][(crc ^ *next++) & 0xFF] ^ (crc >> 8);
+        length--;
+    }
+    while (length >= 8) {
+        uint64_t word;
+        memcpy(&word, next, sizeof(word));
+        word ^= crc;
+        crc = sliceTable[7][word & 0xFF] ^ sliceTable[6][(word >> 8) & 0xFF] ^
+              sliceTable[5][(word >> 16) & 0xFF] ^ sliceTable[4][(word >> 24) & 0xFF] ^
+              sliceTable[3][(word >> 32) & 0xFF] ^ sliceTable[2][(word >> 40) & 0xFF] ^
+              sliceTable[1][(word >> 48) & 0xFF] ^ sliceTable[0][word >> 56];
+        next += 8;
+        length -= 8;
+    }
+    while (length > 0) {
+        crc = sliceTable[0][(crc ^ *next++) & 0xFF] ^ (crc >> 8);
+        length--;
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+// Three interleaved chains of blockLength bytes each, combined with the shift
+// table. With dest, every word is also stored there once it is in a register.
+__attribute__((target("sse4.2,pclmul"), always_inline))
+static inline uint64_t crcInterleaved(uint64_t crc0, uint8_t** dest, const uint8_t** next, size_t* length,
+                                      size_t blockLength, uint32_t table[4][256]) {
+    while (*length >= blockLength * 3) {
+        uint64_t crc1 = 0;
+        uint64_t crc2 = 0;
+        const uint8_t* p = *next;
+        const uint8_t* end = p + blockLength;
+        uint8_t* d = dest ? *dest : NULL;
+        do {
+            uint64_t a, b, c;
+            memcpy(&a, p, 8);
+            memcpy(&b, p + blockLength, 8);
+            memcpy(&c, p + 2 * blockLength, 8);
+            crc0 = _mm_crc32_u64(crc0, a);
+            crc1 = _mm_crc32_u64(crc1, b);
+            crc2 = _mm_crc32_u64(crc2, c);
+            if (dest) {
+                memcpy(d, &a, 8);
+                memcpy(d + blockLength, &b, 8);
+                memcpy(d + 2 * blockLength, &c, 8);
+                d += 8;
+            }
+            p += 8;
+        } while (p < end);
+        crc0 = shift(table, (uint32_t)crc0) ^ crc1;
+        crc0 = shift(table, (uint32_t)crc0) ^ crc2;
+        *next += blockLength * 3;
+        *length -= blockLength * 3;
+        if (dest) *dest += blockLength * 3;
+    }
+    return crc0;
+}
+
+__attribute__((target("sse4.2,pclmul"), always_inline))
+static inline __m128i fold(__m128i x, __m128i k, __m128i next) {
+    return _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x00), _mm_clmulepi64_si128(x, k, 0x11)), next);
+}
+
+__attribute__((target("sse4.2,pclmul"), always_inline))
+static inline __m128i loadCopy(const uint8_t* p, uint8_t* d) {
+    __m128i x = _mm_loadu_si128((const __m128i*)p);
+    if (d) _mm_storeu_si128((__m128i*)d, x);
+    return x;
+}
+
+// Fold 64-byte blocks with carry-less multiplies, four 16-byte lanes at a time,
+// down to one 16-byte residue congruent to them modulo P. The running CRC goes
+// into the first block, so the CRC of the residue from zero is the CRC of it all.
+// The data is in registers anyway, so with dest each lane is stored on the way.
+__attribute__((target("sse4.2,pclmul"), always_inline))
+static inline uint64_t crcFolded(uint64_t crc0, uint8_t** dest, const uint8_t** next, size_t* length) {
+    const uint8_t* p = *next;
+    uint8_t* d = dest ? *dest : NULL;
+    size_t blocks = *length / 64;
+    __m128i x0 = _mm_xor_si128(loadCopy(p, d), _mm_cvtsi32_si128((int)(uint32_t)crc0));
+    __m128i x1 = loadCopy(p + 16, d ? d + 16 : NULL);
+    __m128i x2 = loadCopy(p + 32, d ? d + 32 : NULL);
+    __m128i x3 = loadCopy(p + 48, d ? d + 48 : NULL);
+    __m128i k4 = _mm_set_epi64x((long long)foldBy4[1], (long long)foldBy4[0]);
+    for (size_t i = 1; i < blocks; i++) {
+        p += 64;
+        if (d) d += 64;
+        x0 = fold(x0, k4, loadCopy(p, d));
+        x1 = fold(x1, k4, loadCopy(p + 16, d ? d + 16 : NULL));
+        x2 = fold(x2, k4, loadCopy(p + 32, d ? d + 32 : NULL));
+        x3 = fold(x3, k4, loadCopy(p + 48, d ? d + 48 : NULL));
+    }
+    __m128i k1 = _mm_set_epi64x((long long)foldBy1[1], (long long)foldBy1[0]);
+    x1 = fold(x0, k1, x1);
+    x2 = fold(x1, k1, x2);
+    x3 = fold(x2, k1, x3);
+    crc0 = _mm_crc32_u64(0, (uint64_t)_mm_cvtsi128_si64(x3));
+    crc0 = _mm_crc32_u64(crc0, (uint64_t)_mm_extract_epi64(x3, 1));
+    *next += blocks * 64;
+    *length -= blocks * 64;
+    if (dest) *dest += blocks * 64;
+    return crc0;
+}
+
+// Shared by crcHardware and crcCopyHardware, dest is NULL when nothing is copied
+__attribute__((target("sse4.2,pclmul"), always_inline))
+static inline uint32_t crcHardwareBody(uint32_t crc, uint8_t* dest, const uint8_t* next, size_t length) {
+    uint64_t crc0 = crc;
+    while (length > 0 && ((uintptr_t)next & 7) != 0) {
+        if (dest) *dest++ = *next;
+        crc0 = _mm_crc32_u8((uint32_t)crc0, *next++);
+        length--;
+    }
+    if (carryless && length >= 256) crc0 = crcFolded(crc0, dest ? &dest : NULL, &next, &length);
+    crc0 = crcInterleaved(crc0, dest ? &dest : NULL, &next, &length, CRC32C_LONG, longShift);
+    crc0 = crcInterleaved(crc0, dest ? &dest : NULL, &next, &length, CRC32C_SHORT, shortShift);
+    while (length >= 8) {
+        uint64_t word;
+        memcpy(&word, next, sizeof(word));
+        crc0 = _mm_crc32_u64(crc0, word);
+        if (dest) {
+            memcpy(dest, &word, sizeof(word));
+            dest += 8;
+        }
+        next += 8;
+        length -= 8;
+    }
+    while (length > 0) {
+        if (dest) *dest++ = *next;
+        crc0 = _mm_crc32_u8((uint32_t)crc0, *next++);
+        length--;
+    }
+    return (uint32_t)crc0;
+}
+
+__attribute__((target("sse4.2,pclmul")))
+static uint32_t crcHardware(uint32_t crc, const uint8_t* next, size_t length) {
+    return crcHardwareBody(crc, NULL, next, length);
+}
+
+__attribute__((target("sse4.2,pclmul")))
+static uint32_t crcCopyHardware(uint32_t crc, uint8_t* dest, const uint8_t* next, size_t length) {
+    return crcHardwareBody(crc, dest, next, length);
+}
+#endif
+
+// Core function implementations
+
+// Extend crc (0 to start) over length bytes of data
+uint32_t crc32c(uint32_t crc, const void* data, size_t length) {
+    pthread_once(&tablesOnce, buildTables);
+    crc = ~crc;
+#if defined(__x86_64__)
+    if (hardware) return ~crcHardware(crc, (const uint8_t*)data, length);
+#endif
+    return ~crcSoftware(crc, (const uint8_t*)data, length);
+}
+
+// crc32c over src that also copies it to dest, reading the data once. On the
+// table path the lookups dominate, so it checksums and then copies.
+uint32_t crc32c_copy(uint32_t crc, void* dest, const void* src, size_t length) {
+    pthread_once(&tablesOnce, buildTables);
+    crc = ~crc;
+#if defined(__x86_64__)
+    if (hardware) return ~crcCopyHardware(crc, (uint8_t*)dest, (const uint8_t*)src, length);
+#endif
+    crc = crcSoftware(crc, (const uint8_t*)src, length);
+    memcpy(dest, src, length);
+    return ~crc;
+}
+
+bool crc32c_hardware(void) {
+    pthread_once(&tablesOnce, buildTables);
+    return hardware;
+}
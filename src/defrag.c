@@ -0,0 +1,238 @@
+#include "include/defrag.h"
+#include "include/fat32.h"
+#include "include/stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Keys of fragmented entries found by one walk over the leaves
+typedef struct {
+    FAT32_FileSystem* fs;
+    char (*keys)[MAX_FILENAME];
+    uint32_t count;
+    uint32_t capacity;
+} Candidates;
+
+typedef struct {
+    FAT32_FileSystem* fs;
+    DefragReport* report;
+} Measure;
+
+// One relocation, performed from inside a scan so the entry stays indexed meanwhile
+typedef struct {
+    FAT32_FileSystem* fs;
+    const char* key;
+    uint32_t moved;           // Clusters copied, 0 if the entry was not moved
+} MoveRequest;
+
+// Helper function implementations
+static void applyDefaults(DefragConfig* config, const DefragConfig* requested) {
+    memset(config, 0, sizeof(*config));
+    if (requested) *config = *requested;
+    if (config->idleMillis == 0) config->idleMillis = DEFRAG_DEFAULT_IDLE_MS;
+}
+
+static bool measureVisitor(const char* key, FAT32_Entry* value, void* ctx) {
+    Measure* measure = (Measure*)ctx;
+    (void)key;
+    if (!value || !fat32_valid_cluster(measure->fs, value->startCluster)) return true;
+
+    uint32_t clusters = 0;
+    uint32_t extents = 0;
+    uint32_t previous = 0;
+    for (uint32_t cluster = value->startCluster; fat32_valid_cluster(measure->fs, cluster);
+         cluster = get_next_cluster(measure->fs, cluster)) {
+        if (cluster != previous + 1) extents++;
+        previous = cluster;
+        clusters++;
+    }
+
+    measure->report->files++;
+    measure->report->clusters += clusters;
+    measure->report->extents += extents;
+    if (extents > 1) measure->report->fragmentedFiles++;
+    return true;
+}
+
+static bool collectVisitor(const char* key, FAT32_Entry* value, void* ctx) {
+    Candidates* candidates = (Candidates*)ctx;
+    if (!value || value->staging || fat32_count_extents(candidates->fs, value->startCluster) < 2) return true;
+
+    if (candidates->count == candidates->capacity) {
+        candidates->capacity = candidates->capacity ? candidates->capacity * 2 : 64;
+        candidates->keys = realloc(candidates->keys, candidates->capacity * sizeof(*candidates->keys));
+    }
+    strcpy(candidates->keys[candidates->count++], key);
+    return true;
+}
+
+static bool moveVisitor(const char* key, FAT32_Entry* value, void* ctx) {
+    MoveRequest* request = (MoveRequest*)ctx;
+    if (strcmp(key, request->key) == 0 && value &&
+        fat32_count_extents(request->fs, value->startCluster) > 1) {
+        request->moved = (uint32_t)fat32_relocate(request->fs, value);
+    }
+    return false;
+}
+
+static bool stopRequested(Defragmenter* defrag) {
+    pthread_mutex_lock(&defrag->mutex);
+    bool stopping = defrag->stopping;
+    pthread_mutex_unlock(&defrag->mutex);
+    return stopping;
+}
+
+// Sleep for up to nanos, returns true if a stop request cut it short
+static bool pauseFor(Defragmenter* defrag, uint64_t nanos) {
+    uint64_t deadline = stats_now() + nanos;
+    struct timespec until;
+    until.tv_sec = (time_t)(deadline / 1000000000ull);
+    until.tv_nsec = (long)(deadline % 1000000000ull);
+
+    pthread_mutex_lock(&defrag->mutex);
+    while (!defrag->stopping && stats_now() < deadline) {
+        pthread_cond_timedwait(&defrag->cond, &defrag->mutex, &until);
+    }
+    bool stopping = defrag->stopping;
+    pthread_mutex_unlock(&defrag->mutex);
+    return stopping;
+}
+
+// One walk over the leaves, returns the number of clusters moved
+static uint64_t runPass(Defragmenter* defrag) {
+    FAT32_FileSystem* fs = defrag->tree->fs;
+    Candidates candidates = { fs, NULL, 0, 0 };
+    uint64_t moved = 0;
+
+    scan(defrag->tree, "", 0, collectVisitor, &candidates);
+
+    for (uint32_t i = 0; i < candidates.count && !stopRequested(defrag); i++) {
+        fat32_reclaim(fs, false);
+
+        MoveRequest request = { fs, candidates.keys[i], 0 };
+        scan(defrag->tree, candidates.keys[i], 1, moveVisitor, &request);
+        if (request.moved == 0) continue;
+
+        moved += request.moved;
+        pthread_mutex_lock(&defrag->mutex);
+        defrag->filesMoved++;
+        defrag->clustersMoved += request.moved;
+        pthread_mutex_unlock(&defrag->mutex);
+
+        // Throttle: spread the copy budget evenly over time
+        if (defrag->config.clustersPerSecond > 0 &&
+            pauseFor(defrag, (uint64_t)request.moved * 1000000000ull / defrag->config.clustersPerSecond)) {
+            break;
+        }
+    }
+
+    free(candidates.keys);
+    pthread_mutex_lock(&defrag->mutex);
+    defrag->passes++;
+    pthread_mutex_unlock(&defrag->mutex);
+    return moved;
+}
+
+static void initDefragmenter(Defragmenter* defrag, BPTree* tree, const DefragConfig* config) {
+    memset(defrag, 0, sizeof(*defrag));
+    defrag->tree = tree;
+    applyDefaults(&defrag->config, config);
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&defrag->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&defrag->mutex, NULL);
+}
+
+static void finishDefragmenter(Defragmenter* defrag) {
+    // Chains this defragmenter retired go back before its caller reuses the space
+    fat32_reclaim(defrag->tree->fs, true);
+    pthread_cond_destroy(&defrag->cond);
+    pthread_mutex_destroy(&defrag->mutex);
+}
+
+static void* defragMain(void* arg) {
+    Defragmenter* defrag = (Defragmenter*)arg;
+
+    while (!stopRequested(defrag)) {
+        uint64_t moved = runPass(defrag);
+
+        pthread_mutex_lock(&defrag->mutex);
+        defrag->idle = moved == 0;
+        if (defrag->idle) pthread_cond_broadcast(&defrag->cond);
+        pthread_mutex_unlock(&defrag->mutex);
+
+        if (moved == 0) {
+            pauseFor(defrag, (uint64_t)defrag->config.idleMillis * 1000000ull);
+            fat32_reclaim(defrag->tree->fs, false);
+        }
+    }
+    return NULL;
+}
+
+// Core function implementations
+
+// Walk every leaf and count files, clusters and extents
+void defrag_measure(BPTree* tree, DefragReport* out) {
+    Measure measure = { tree->fs, out };
+    memset(out, 0, sizeof(*out));
+    scan(tree, "", 0, measureVisitor, &measure);
+}
+
+// 1.0 means every file is one contiguous run
+double defrag_extents_per_file(const DefragReport* report) {
+    return report->files ? (double)report->extents / report->files : 1.0;
+}
+
+// Defragment in the calling thread until a pass finds nothing it can move,
+// returns the number of clusters moved
+uint64_t defrag_run(BPTree* tree, const DefragConfig* config) {
+    Defragmenter defrag;
+    initDefragmenter(&defrag, tree, config);
+
+    uint64_t total = 0;
+    uint64_t moved;
+    while ((moved = runPass(&defrag)) > 0) total += moved;
+
+    finishDefragmenter(&defrag);
+    return total;
+}
+
+// Defragment on a background thread while the tree stays in use
+Defragmenter* defrag_start(BPTree* tree, const DefragConfig* config) {
+    Defragmenter* defrag = (Defragmenter*)malloc(sizeof(Defragmenter));
+    initDefragmenter(defrag, tree, config);
+
+    if (pthread_create(&defrag->thread, NULL, defragMain, defrag) != 0) {
+        finishDefragmenter(defrag);
+        free(defrag);
+        return NULL;
+    }
+    defrag->running = true;
+    return defrag;
+}
+
+// Block until a pass completes without finding anything it can move
+void defrag_wait_idle(Defragmenter* defrag) {
+    pthread_mutex_lock(&defrag->mutex);
+    defrag->idle = false;
+    while (!defrag->idle && !defrag->stopping) {
+        pthread_cond_wait(&defrag->cond, &defrag->mutex);
+    }
+    pthread_mutex_unlock(&defrag->mutex);
+}
+
+// Stop the background thread; replaced chains are freed after their grace period
+void defrag_stop(Defragmenter* defrag) {
+    pthread_mutex_lock(&defrag->mutex);
+    defrag->stopping = true;
+    pthread_cond_broadcast(&defrag->cond);
+    pthread_mutex_unlock(&defrag->mutex);
+
+    if (defrag->running) pthread_join(defrag->thread, NULL);
+    finishDefragmenter(defrag);
+    free(defrag);
+}
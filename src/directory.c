@@ -0,0 +1,249 @@
+#include "include/directory.h"
+#include "include/fat32.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Children of one directory, filtered out of an ordered tree scan
+typedef struct {
+    char prefix[DIR_KEY_PREFIX + 1];
+    BPTreeVisitor visit;
+    void* ctx;
+    int count;
+} DirScan;
+
+// Helper function implementations
+void dir_make_key(char* key, uint32_t parentId, const char* name) {
+    snprintf(key, MAX_FILENAME, "%08x%c%s", parentId, DIR_SEPARATOR, name);
+}
+
+// Copy the next component of *path into name and advance past it. Empty and "."
+// components are skipped. Returns 1 for a component, 0 at the end of the path
+// and -1 for ".." or a name that does not fit in a key.
+static int nextComponent(const char** path, char* name) {
+    const char* p = *path;
+    while (1) {
+        while (*p == DIR_SEPARATOR) p++;
+        if (*p == '\0') {
+            *path = p;
+            return 0;
+        }
+        const char* end = strchr(p, DIR_SEPARATOR);
+        size_t length = end ? (size_t)(end - p) : strlen(p);
+        *path = p + length;
+        if (length == 1 && p[0] == '.') {
+            p += length;
+            continue;
+        }
+        if (length > DIR_MAX_NAME || (length == 2 && p[0] == '.' && p[1] == '.')) return -1;
+        memcpy(name, p, length);
+        name[length] = '\0';
+        return 1;
+    }
+}
+
+// Resolve every component but the last, one tree lookup each. The last
+// component is left in name, empty when path names the root, and the key of
+// the parent directory in parentKey if given, empty for the root. Fails if the
+// path passes through the directory with id excludedId (0 for none). With
+// locked, the caller already holds the tree lock.
+static bool resolveParentExcluding(BPTree* tree, const char* path, uint32_t excludedId, bool locked,
+                                   uint32_t* parentId, char* name, char* parentKey) {
+    char component[DIR_MAX_NAME + 1];
+    char key[MAX_FILENAME];
+    uint32_t id = DIR_ROOT_ID;
+    int status;
+
+    name[0] = '\0';
+    key[0] = '\0';
+    while ((status = nextComponent(&path, component)) == 1) {
+        if (name[0] != '\0') {
+            dir_make_key(key, id, name);
+            FAT32_Entry* dir = locked ? searchLocked(tree, key) : search(tree, key);
+            if (!dir || !(dir->attributes & ATTR_DIRECTORY) || dir->directoryId == excludedId) return false;
+            id = dir->directoryId;
+        }
+        strcpy(name, component);
+    }
+
+    *parentId = id;
+    if (parentKey) strcpy(parentKey, key);
+    return status == 0;
+}
+
+static bool resolveParent(BPTree* tree, const char* path, uint32_t* parentId, char* name) {
+    return resolveParentExcluding(tree, path, 0, false, parentId, name, NULL);
+}
+
+static bool resolveDirectory(BPTree* tree, const char* path, uint32_t* id) {
+    char name[DIR_MAX_NAME + 1];
+    char key[MAX_FILENAME];
+    uint32_t parentId;
+
+    if (!resolveParent(tree, path, &parentId, name)) return false;
+    if (name[0] == '\0') {
+        *id = DIR_ROOT_ID;
+        return true;
+    }
+    dir_make_key(key, parentId, name);
+    FAT32_Entry* dir = search(tree, key);
+    if (!dir || !(dir->attributes & ATTR_DIRECTORY)) return false;
+    *id = dir->directoryId;
+    return true;
+}
+
+// Lets createEntry insert only while the parent directory is still in place
+static bool parentPresent(BPTree* tree, FAT32_Entry* entry, void* ctx) {
+    const char* parentKey = (const char*)ctx;
+    if (parentKey[0] == '\0') return true;
+    FAT32_Entry* parent = searchLocked(tree, parentKey);
+    return parent && (parent->attributes & ATTR_DIRECTORY) && parent->directoryId == entry->parentId;
+}
+
+// Lets dir_remove delete files, and directories only while they have no children
+static bool removableEntry(BPTree* tree, FAT32_Entry* entry, void* ctx) {
+    char prefix[DIR_KEY_PREFIX + 1];
+    (void)ctx;
+    if (!entry || !(entry->attributes & ATTR_DIRECTORY)) return true;
+    dir_make_key(prefix, entry->directoryId, "");
+    return !containsPrefix(tree, prefix);
+}
+
+// Where dir_rename moves an entry, resolved before the move takes the lock
+typedef struct {
+    const char* to;
+    uint32_t newParentId;
+    const char* newName;
+} RenameTarget;
+
+// Target checks of dir_rename, redone under the write lock of the move: the
+// path to must still lead to the same directory and must not pass through a
+// moved directory, and only a file may be replaced. On success the entry
+// takes its new parent and name before any reader can find it under the new key.
+// Renaming an entry onto itself succeeds and changes nothing, as rename(2) does.
+static bool renameAllowed(BPTree* tree, FAT32_Entry* moved, FAT32_Entry* target, void* ctx) {
+    RenameTarget* rename = (RenameTarget*)ctx;
+    char name[DIR_MAX_NAME + 1];
+    uint32_t parentId;
+    if (target == moved) return true;
+
+    uint32_t excludedId = (moved->attributes & ATTR_DIRECTORY) ? moved->directoryId : 0;
+    if (!resolveParentExcluding(tree, rename->to, excludedId, true, &parentId, name, NULL) ||
+        parentId != rename->newParentId || (excludedId && parentId == excludedId)) {
+        return false;
+    }
+    if (target && (excludedId || (target->attributes & ATTR_DIRECTORY))) return false;
+
+    moved->parentId = rename->newParentId;
+    strcpy(moved->filename, rename->newName);
+    return true;
+}
+
+static bool dirScanVisitor(const char* key, FAT32_Entry* value, void* ctx) {
+    DirScan* dirScan = (DirScan*)ctx;
+    if (strncmp(key, dirScan->prefix, DIR_KEY_PREFIX) != 0) return false;
+    dirScan->count++;
+    return dirScan->visit ? dirScan->visit(key + DIR_KEY_PREFIX, value, dirScan->ctx) : true;
+}
+
+// Shared by dir_mkdir and dir_create, fails if the parent is missing or the name is taken
+static FAT32_Entry* createEntry(BPTree* tree, const char* path, uint64_t size, bool directory) {
+    char name[DIR_MAX_NAME + 1];
+    char key[MAX_FILENAME];
+    char parentKey[MAX_FILENAME];
+    uint32_t parentId;
+
+    if (!resolveParentExcluding(tree, path, 0, false, &parentId, name, parentKey) || name[0] == '\0') return NULL;
+    dir_make_key(key, parentId, name);
+    if (search(tree, key)) return NULL;
+
+    // The search only saves building an entry for a taken name; the insert decides,
+    // and also fails if the parent was removed since it was resolved
+    FAT32_Entry* entry = create_file_entry(tree->fs, name, directory ? 0 : size);
+    if (!entry) return NULL;
+    entry->parentId = parentId;
+    if (directory) {
+        entry->attributes = ATTR_DIRECTORY;
+        entry->directoryId = __atomic_fetch_add(&tree->nextDirectoryId, 1, __ATOMIC_RELAXED);
+    }
+    if (!insertIfAbsent(tree, key, entry, parentPresent, parentKey)) {
+        fat32_delete(tree->fs, entry);
+        return NULL;
+    }
+    return entry;
+}
+
+// Core function implementations
+
+// Entry at path, NULL if any component is missing. The root has no entry.
+FAT32_Entry* dir_lookup(BPTree* tree, const char* path) {
+    char name[DIR_MAX_NAME + 1];
+    char key[MAX_FILENAME];
+    uint32_t parentId;
+
+    if (!resolveParent(tree, path, &parentId, name) || name[0] == '\0') return NULL;
+    dir_make_key(key, parentId, name);
+    return search(tree, key);
+}
+
+FAT32_Entry* dir_mkdir(BPTree* tree, const char* path) {
+    return createEntry(tree, path, 0, true);
+}
+
+FAT32_Entry* dir_create(BPTree* tree, const char* path, uint64_t size) {
+    return createEntry(tree, path, size, false);
+}
+
+// Visit the children of a directory in name order with one leaf range scan.
+// The visitor runs under the tree's read lock and receives bare names.
+// Returns the number of children visited, or -1 if path is not a directory.
+int dir_list(BPTree* tree, const char* path, BPTreeVisitor visit, void* ctx) {
+    uint32_t id;
+    if (!resolveDirectory(tree, path, &id)) return -1;
+
+    DirScan dirScan;
+    dir_make_key(dirScan.prefix, id, "");
+    dirScan.visit = visit;
+    dirScan.ctx = ctx;
+    dirScan.count = 0;
+    scan(tree, dirScan.prefix, 0, dirScanVisitor, &dirScan);
+    return dirScan.count;
+}
+
+// Remove a file or an empty directory, returns 1 on success
+int dir_remove(BPTree* tree, const char* path) {
+    char name[DIR_MAX_NAME + 1];
+    char key[MAX_FILENAME];
+    uint32_t parentId;
+
+    if (!resolveParent(tree, path, &parentId, name) || name[0] == '\0') return 0;
+    dir_make_key(key, parentId, name);
+
+    // The emptiness check and the delete share one write lock, so no child can be created in between
+    FAT32_Entry* entry;
+    if (!deleteIf(tree, key, removableEntry, NULL, &entry)) return 0;
+    return fat32_delete(tree->fs, entry);
+}
+
+// Move a file or directory to path to, replacing a file already there as
+// rename(2) does. The key moves atomically, so lookups find the entry at one
+// path or the other; a directory keeps its id and with it all its children.
+// Fails if to is a directory or lies inside from. Returns 1 on success.
+int dir_rename(BPTree* tree, const char* from, const char* to) {
+    char name[DIR_MAX_NAME + 1];
+    char newName[DIR_MAX_NAME + 1];
+    char key[MAX_FILENAME];
+    char newKey[MAX_FILENAME];
+    uint32_t parentId;
+    RenameTarget target = { to, 0, newName };
+
+    if (!resolveParent(tree, from, &parentId, name) || name[0] == '\0') return 0;
+    if (!resolveParent(tree, to, &target.newParentId, newName) || newName[0] == '\0') return 0;
+    dir_make_key(key, parentId, name);
+    dir_make_key(newKey, target.newParentId, newName);
+
+    FAT32_Entry* replaced;
+    if (!renameEntryIf(tree, key, newKey, renameAllowed, &target, &replaced)) return 0;
+    if (replaced) fat32_delete(tree->fs, replaced);
+    return 1;
+}
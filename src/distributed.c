@@ -1,6 +1,9 @@
 #include "include/distributed.h"
+#include "include/stats.h"
+#include "include/trace.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <pthread.h>
 #include <sys/socket.h>
@@ -28,33 +31,137 @@ DistributedNode* initializeNode(int nodeId, int totalNodes, bool initialToken, B
     node->sharedTree = tree;
     node->sharedFS = fs;
 
+    // Standalone until joined to a token ring
+    node->ring = NULL;
+    node->tokenDepth = 0;
+    atomic_init(&node->scheduled, false);
+
     return node;
 }
 
+// Join nodes into a token ring, the node created with initialToken starts as holder
+TokenRing* initializeTokenRing(DistributedNode** nodes, int totalNodes) {
+    TokenRing* ring = (TokenRing*)malloc(sizeof(TokenRing));
+    pthread_mutex_init(&ring->mutex, NULL);
+    pthread_cond_init(&ring->cond, NULL);
+    ring->holder = 0;
+    ring->busy = false;
+    ring->totalNodes = totalNodes;
+    memset(ring->requesting, 0, sizeof(ring->requesting));
+    ring->verbose = true;
+
+    for (int i = 0; i < totalNodes; i++) {
+        nodes[i]->ring = ring;
+        if (nodes[i]->hasToken) ring->holder = nodes[i]->nodeId;
+    }
+    return ring;
+}
+
+void destroyTokenRing(TokenRing* ring) {
+    pthread_mutex_destroy(&ring->mutex);
+    pthread_cond_destroy(&ring->cond);
+    free(ring);
+}
+
+// Mark node as waiting and hand it an idle token, with the ring mutex held.
+// Returns the node the idle token was handed over from, -1 if it is busy.
+static int postRequest(TokenRing* ring, int nodeId) {
+    ring->requesting[nodeId] = true;
+    if (ring->busy) return -1;
+    int from = ring->holder;
+    ring->holder = nodeId;
+    ring->busy = true;
+    return from;
+}
 
-// Request token with priority
+// Request token, nested requests from the current holder only bump the depth
 void requestToken(DistributedNode* node) {
-    pthread_mutex_lock(&node->queue->mutex);
+    TokenRing* ring = node->ring;
+    if (!ring) {
+        // A standalone node always owns its token
+        node->tokenDepth++;
+        node->hasToken = true;
+        return;
+    }
+
+    pthread_mutex_lock(&ring->mutex);
+
+    if (node->tokenDepth++ > 0) {
+        pthread_mutex_unlock(&ring->mutex);
+        return;
+    }
 
-    // Wait until token is acquired
-    while (!node->hasToken || node->queue->size == 0) {
-        pthread_cond_wait(&node->queue->cond, &node->queue->mutex);
+    // Wait until the token is handed to us or its holder is idle
+    STATS_TIMER_START(waitStart);
+    TRACE_BEGIN(TRACE_TOKEN_ACQUIRE, (uint32_t)node->nodeId);
+    postRequest(ring, node->nodeId);
+    while (ring->holder != node->nodeId && ring->busy) {
+        pthread_cond_wait(&ring->cond, &ring->mutex);
     }
+    STATS_TIMER_RECORD(STAT_HIST_TOKEN_WAIT, waitStart);
+    STATS_INC(STAT_TOKEN_ACQUIRES);
+    ring->requesting[node->nodeId] = false;
+    ring->holder = node->nodeId;
+    ring->busy = true;
+    node->hasToken = true;
 
-    printf("Node %d: Acquired token!\n", node->nodeId);
-    pthread_mutex_unlock(&node->queue->mutex);
+    if (ring->verbose) printf("Node %d: Acquired token!\n", node->nodeId);
+    pthread_mutex_unlock(&ring->mutex);
+    TRACE_END(TRACE_TOKEN_ACQUIRE);
 }
 
-// Release token and pass to the next process
-void releaseToken(DistributedNode* node) {
-    pthread_mutex_lock(&node->queue->mutex);
+// Register a request without waiting, for callers that cannot block (the
+// replay's simulated clock). An idle token is handed to node at once, a busy one
+// by releaseToken in ring order; either way node then takes it with requestToken,
+// which no longer waits. Returns the node the idle token came from, -1 if busy.
+int postTokenRequest(DistributedNode* node) {
+    TokenRing* ring = node->ring;
+    if (!ring) return node->nodeId;
+    pthread_mutex_lock(&ring->mutex);
+    int from = postRequest(ring, node->nodeId);
+    pthread_mutex_unlock(&ring->mutex);
+    return from;
+}
+
+// Release token and pass it to the next requesting node in the ring. Returns
+// the node it was passed to, -1 if nobody was waiting or node still holds it.
+int releaseToken(DistributedNode* node) {
+    TokenRing* ring = node->ring;
+    if (!ring) {
+        if (node->tokenDepth > 0 && --node->tokenDepth == 0) node->hasToken = false;
+        return -1;
+    }
+
+    pthread_mutex_lock(&ring->mutex);
 
-    printf("Node %d: Releasing token.\n", node->nodeId);
+    if (node->tokenDepth == 0 || --node->tokenDepth > 0) {
+        pthread_mutex_unlock(&ring->mutex);
+        return -1;
+    }
+
+    TRACE_BEGIN(TRACE_TOKEN_RELEASE, (uint32_t)node->nodeId);
+    if (ring->verbose) printf("Node %d: Releasing token.\n", node->nodeId);
     node->hasToken = false;
+    ring->busy = false;
+
+    // Walk the ring starting at our successor so every waiter gets a turn
+    int next = -1;
+    for (int i = 1; i < ring->totalNodes; i++) {
+        int candidate = (node->nodeId + i) % ring->totalNodes;
+        if (ring->requesting[candidate]) {
+            if (ring->verbose) printf("Node %d: Passing token to Node %d...\n", node->nodeId, candidate);
+            ring->holder = candidate;
+            ring->busy = true;
+            next = candidate;
+            STATS_INC(STAT_TOKEN_PASSES);
+            break;
+        }
+    }
 
-    // Notify the next node or highest-priority task
-    pthread_cond_broadcast(&node->queue->cond);
-    pthread_mutex_unlock(&node->queue->mutex);
+    pthread_cond_broadcast(&ring->cond);
+    pthread_mutex_unlock(&ring->mutex);
+    TRACE_END(TRACE_TOKEN_RELEASE);
+    return next;
 }
 
 // Add a task to the priority queue
@@ -82,14 +189,8 @@ void enqueue(PriorityQueue* queue, Task task) {
     pthread_mutex_unlock(&queue->mutex);
 }
 
-// Remove the highest-priority task from the queue
-Task dequeue(PriorityQueue* queue) {
-    pthread_mutex_lock(&queue->mutex);
-
-    while (queue->size == 0) {
-        pthread_cond_wait(&queue->cond, &queue->mutex);
-    }
-
+// Pop the heap root, caller holds the queue mutex and size > 0
+static Task popTop(PriorityQueue* queue) {
     Task top = queue->tasks[0];
     queue->tasks[0] = queue->tasks[--queue->size];
 
@@ -109,10 +210,43 @@ Task dequeue(PriorityQueue* queue) {
         i = smallest;
     }
 
+    return top;
+}
+
+// Remove the highest-priority task from the queue
+Task dequeue(PriorityQueue* queue) {
+    pthread_mutex_lock(&queue->mutex);
+
+    while (queue->size == 0) {
+        pthread_cond_wait(&queue->cond, &queue->mutex);
+    }
+
+    Task top = popTop(queue);
     pthread_mutex_unlock(&queue->mutex);
     return top;
 }
 
+// Remove the highest-priority task without blocking
+bool tryDequeue(PriorityQueue* queue, Task* task) {
+    pthread_mutex_lock(&queue->mutex);
+
+    if (queue->size == 0) {
+        pthread_mutex_unlock(&queue->mutex);
+        return false;
+    }
+
+    *task = popTop(queue);
+    pthread_mutex_unlock(&queue->mutex);
+    return true;
+}
+
+int queueSize(PriorityQueue* queue) {
+    pthread_mutex_lock(&queue->mutex);
+    int size = queue->size;
+    pthread_mutex_unlock(&queue->mutex);
+    return size;
+}
+
 // // Initialize the distributed node
 // DistributedNode* initializeNode(int nodeId, int totalNodes, bool initialToken) {
 //     DistributedNode* node = (DistributedNode*)malloc(sizeof(DistributedNode));
@@ -0,0 +1,299 @@
+#include "include/executor.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Worker identity of the calling thread, -1 outside the pool
+static __thread Executor* currentExecutor = NULL;
+static __thread int currentWorker = -1;
+static __thread uint32_t stealSeed = 0;
+
+typedef struct {
+    Executor* ex;
+    int index;
+} WorkerArg;
+
+// Deque operations
+static void dequeInit(WorkDeque* dq) {
+    dq->capacity = EXECUTOR_DEQUE_INITIAL;
+    dq->jobs = (Job*)malloc(dq->capacity * sizeof(Job));
+    dq->head = 0;
+    dq->count = 0;
+    pthread_mutex_init(&dq->mutex, NULL);
+}
+
+static void pushTail(WorkDeque* dq, Job job) {
+    pthread_mutex_lock(&dq->mutex);
+    if (dq->count == dq->capacity) {
+        Job* grown = (Job*)malloc(dq->capacity * 2 * sizeof(Job));
+        for (int i = 0; i < dq->count; i++) {
+            grown[i] = dq->jobs[(dq->head + i) & (dq->capacity - 1)];
+        }
+        free(dq->jobs);
+        dq->jobs = grown;
+        dq->head = 0;
+        dq->capacity *= 2;
+    }
+    dq->jobs[(dq->head + dq->count) & (dq->capacity - 1)] = job;
+    dq->count++;
+    pthread_mutex_unlock(&dq->mutex);
+}
+
+static bool popTail(WorkDeque* dq, Job* job) {
+    pthread_mutex_lock(&dq->mutex);
+    if (dq->count == 0) {
+        pthread_mutex_unlock(&dq->mutex);
+        return false;
+    }
+    dq->count--;
+    *job = dq->jobs[(dq->head + dq->count) & (dq->capacity - 1)];
+    pthread_mutex_unlock(&dq->mutex);
+    return true;
+}
+
+static bool popHead(WorkDeque* dq, Job* job) {
+    // Thieves never wait on a busy victim
+    if (pthread_mutex_trylock(&dq->mutex) != 0) return false;
+    if (dq->count == 0) {
+        pthread_mutex_unlock(&dq->mutex);
+        return false;
+    }
+    *job = dq->jobs[dq->head];
+    dq->head = (dq->head + 1) & (dq->capacity - 1);
+    dq->count--;
+    pthread_mutex_unlock(&dq->mutex);
+    return true;
+}
+
+static uint32_t nextRandom(void) {
+    // xorshift32
+    stealSeed ^= stealSeed << 13;
+    stealSeed ^= stealSeed >> 17;
+    stealSeed ^= stealSeed << 5;
+    return stealSeed;
+}
+
+// Try every other worker once, starting from a random victim
+static bool stealJob(Executor* ex, int self, Job* job) {
+    int start = nextRandom() % ex->numWorkers;
+    for (int i = 0; i < ex->numWorkers; i++) {
+        int victim = (start + i) % ex->numWorkers;
+        if (victim == self) continue;
+        if (popHead(&ex->deques[victim], job)) return true;
+    }
+    return false;
+}
+
+static void finishJob(Executor* ex) {
+    if (atomic_fetch_sub(&ex->pending, 1) == 1) {
+        pthread_mutex_lock(&ex->idleMutex);
+        pthread_cond_broadcast(&ex->doneCond);
+        pthread_mutex_unlock(&ex->idleMutex);
+    }
+}
+
+static void* workerLoop(void* arg) {
+    WorkerArg* wa = (WorkerArg*)arg;
+    Executor* ex = wa->ex;
+    int self = wa->index;
+    free(wa);
+
+    currentExecutor = ex;
+    currentWorker = self;
+    stealSeed = 2463534242u ^ (uint32_t)(self * 2654435761u);
+
+    while (1) {
+        Job job;
+        if (popTail(&ex->deques[self], &job) || stealJob(ex, self, &job)) {
+            atomic_fetch_sub(&ex->queued, 1);
+            job.fn(job.arg);
+            finishJob(ex);
+            continue;
+        }
+
+        pthread_mutex_lock(&ex->idleMutex);
+        while (atomic_load(&ex->queued) == 0 && !atomic_load(&ex->stopping)) {
+            pthread_cond_wait(&ex->workCond, &ex->idleMutex);
+        }
+        bool stop = atomic_load(&ex->stopping) && atomic_load(&ex->queued) == 0;
+        pthread_mutex_unlock(&ex->idleMutex);
+        if (stop) break;
+    }
+
+    return NULL;
+}
+
+// Core function implementations
+Executor* executor_create(int numWorkers, TaskHandler handler) {
+    if (numWorkers <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        numWorkers = cores > 0 ? (int)cores : 1;
+    }
+
+    Executor* ex = (Executor*)malloc(sizeof(Executor));
+    ex->numWorkers = numWorkers;
+    ex->taskHandler = handler;
+    ex->threads = (pthread_t*)malloc(numWorkers * sizeof(pthread_t));
+    ex->deques = (WorkDeque*)malloc(numWorkers * sizeof(WorkDeque));
+    atomic_init(&ex->queued, 0);
+    atomic_init(&ex->pending, 0);
+    atomic_init(&ex->nextDeque, 0);
+    atomic_init(&ex->stopping, false);
+    pthread_mutex_init(&ex->idleMutex, NULL);
+    pthread_cond_init(&ex->workCond, NULL);
+    pthread_cond_init(&ex->doneCond, NULL);
+
+    for (int i = 0; i < numWorkers; i++) {
+        dequeInit(&ex->deques[i]);
+    }
+    for (int i = 0; i < numWorkers; i++) {
+        WorkerArg* wa = (WorkerArg*)malloc(sizeof(WorkerArg));
+        wa->ex = ex;
+        wa->index = i;
+        pthread_create(&ex->threads[i], NULL, workerLoop, wa);
+    }
+    return ex;
+}
+
+void executor_submit(Executor* ex, JobFunc fn, void* arg) {
+    Job job = { fn, arg };
+
+    // Workers keep their own follow-up work local, outside submits are spread round-robin
+    int target = (currentExecutor == ex) ? currentWorker
+                 : (int)(atomic_fetch_add(&ex->nextDeque, 1) % ex->numWorkers);
+
+    atomic_fetch_add(&ex->pending, 1);
+    pushTail(&ex->deques[target], job);
+
+    pthread_mutex_lock(&ex->idleMutex);
+    atomic_fetch_add(&ex->queued, 1);
+    pthread_cond_signal(&ex->workCond);
+    pthread_mutex_unlock(&ex->idleMutex);
+}
+
+// Run a batch of one node's tasks; a node is scheduled at most once at a time,
+// so its tasks keep their priority order and never run concurrently
+static void runNode(void* arg) {
+    DistributedNode* node = (DistributedNode*)arg;
+    Executor* ex = currentExecutor;
+    Task task;
+
+    for (int i = 0; i < EXECUTOR_NODE_BATCH && tryDequeue(node->queue, &task); i++) {
+        ex->taskHandler(node, task);
+    }
+
+    atomic_store(&node->scheduled, false);
+
+    // Reschedule if work remains or arrived after our last dequeue
+    if (queueSize(node->queue) > 0 && !atomic_exchange(&node->scheduled, true)) {
+        executor_submit(ex, runNode, node);
+    }
+}
+
+void executor_submit_task(Executor* ex, DistributedNode* node, Task task) {
+    enqueue(node->queue, task);
+    if (!atomic_exchange(&node->scheduled, true)) {
+        executor_submit(ex, runNode, node);
+    }
+}
+
+// One executor_run_indexed call. Helper jobs may start after the caller has
+// returned, so the run is freed by whichever of them drops the last reference.
+typedef struct {
+    IndexFunc fn;
+    void* ctx;
+    int count;
+    atomic_int next;          // Next index to hand out
+    int done;                 // Indices finished, under mutex
+    atomic_int refs;          // Caller plus helper jobs not yet finished
+    pthread_mutex_t mutex;
+    pthread_cond_t doneCond;
+} IndexedRun;
+
+static void runIndices(IndexedRun* run) {
+    int finished = 0;
+    int index;
+    while ((index = atomic_fetch_add(&run->next, 1)) < run->count) {
+        run->fn(run->ctx, index);
+        finished++;
+    }
+    if (finished == 0) return;
+    pthread_mutex_lock(&run->mutex);
+    run->done += finished;
+    if (run->done == run->count) pthread_cond_broadcast(&run->doneCond);
+    pthread_mutex_unlock(&run->mutex);
+}
+
+static void releaseRun(IndexedRun* run) {
+    if (atomic_fetch_sub(&run->refs, 1) != 1) return;
+    pthread_mutex_destroy(&run->mutex);
+    pthread_cond_destroy(&run->doneCond);
+    free(run);
+}
+
+static void indexedJob(void* arg) {
+    runIndices((IndexedRun*)arg);
+    releaseRun((IndexedRun*)arg);
+}
+
+// Run fn(ctx, i) for every i in [0, count) on the calling thread and up to one
+// helper job per worker, returning once all of them have finished. The caller
+// takes indices too and only waits for ones already running, so this is safe
+// from inside a job of the same pool. Runs inline without a pool.
+void executor_run_indexed(Executor* ex, int count, IndexFunc fn, void* ctx) {
+    if (!ex || count <= 1) {
+        for (int i = 0; i < count; i++) fn(ctx, i);
+        return;
+    }
+
+    int helpers = count - 1 < ex->numWorkers ? count - 1 : ex->numWorkers;
+    IndexedRun* run = (IndexedRun*)malloc(sizeof(IndexedRun));
+    run->fn = fn;
+    run->ctx = ctx;
+    run->count = count;
+    atomic_init(&run->next, 0);
+    run->done = 0;
+    atomic_init(&run->refs, helpers + 1);
+    pthread_mutex_init(&run->mutex, NULL);
+    pthread_cond_init(&run->doneCond, NULL);
+    for (int i = 0; i < helpers; i++) executor_submit(ex, indexedJob, run);
+
+    runIndices(run);
+    pthread_mutex_lock(&run->mutex);
+    while (run->done < count) pthread_cond_wait(&run->doneCond, &run->mutex);
+    pthread_mutex_unlock(&run->mutex);
+    releaseRun(run);
+}
+
+void executor_wait_idle(Executor* ex) {
+    pthread_mutex_lock(&ex->idleMutex);
+    while (atomic_load(&ex->pending) > 0) {
+        pthread_cond_wait(&ex->doneCond, &ex->idleMutex);
+    }
+    pthread_mutex_unlock(&ex->idleMutex);
+}
+
+void executor_destroy(Executor* ex) {
+    executor_wait_idle(ex);
+
+    pthread_mutex_lock(&ex->idleMutex);
+    atomic_store(&ex->stopping, true);
+    pthread_cond_broadcast(&ex->workCond);
+    pthread_mutex_unlock(&ex->idleMutex);
+
+    for (int i = 0; i < ex->numWorkers; i++) {
+        pthread_join(ex->threads[i], NULL);
+    }
+    for (int i = 0; i < ex->numWorkers; i++) {
+        free(ex->deques[i].jobs);
+        pthread_mutex_destroy(&ex->deques[i].mutex);
+    }
+
+    pthread_mutex_destroy(&ex->idleMutex);
+    pthread_cond_destroy(&ex->workCond);
+    pthread_cond_destroy(&ex->doneCond);
+    free(ex->deques);
+    free(ex->threads);
+    free(ex);
+}
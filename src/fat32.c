@@ -1,87 +1,987 @@
 #include "include/fat32.h"
 #include "include/distributed.h"
+#include "include/executor.h"
+#include "include/stats.h"
+#include "include/trace.h"
+#include "include/lz.h"
+#include "include/crc32c.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/stat.h>
+
+static uint32_t nextThreadGroup;
+static __thread int threadGroup = -1;
+static uint32_t nextEpochSlot;
+static __thread int threadEpochSlot = -1;
+
+// Chain replaced by a relocation or a write, freed once no reader can still be walking it
+typedef struct FAT32_RetiredChain {
+    uint32_t startCluster;
+    struct FAT32_ExtentMap* extentMap;    // Layout that went with the chain, NULL if uncompressed
+    uint64_t epoch;           // Epoch when the replacement was published
+    struct FAT32_RetiredChain* next;
+} FAT32_RetiredChain;
 
 // Helper function implementations
-uint32_t cluster_to_sector(FAT32_FileSystem* fs, uint32_t cluster) {
-    return ((cluster - 2) * fs->sectorsPerCluster) + fs->reservedSectors + 
-           (fs->numberOfFATs * fs->sectorsPerFAT);
+uint64_t cluster_to_sector(FAT32_FileSystem* fs, uint32_t cluster) {
+    return ((uint64_t)(cluster - 2) * fs->sectorsPerCluster) + fs->reservedSectors +
+           ((uint64_t)fs->numberOfFATs * fs->sectorsPerFAT);
 }
 
-uint32_t allocate_clusters(FAT32_FileSystem* fs, uint32_t count) {
+// True for a cluster that can hold data; free, bad and end-of-chain values are all outside the range
+bool fat32_valid_cluster(FAT32_FileSystem* fs, uint32_t cluster) {
+    return cluster >= FAT32_FIRST_CLUSTER && cluster < fs->clusterCount;
+}
+
+// Allocation group of a cluster
+static FAT32_AllocGroup* groupOf(FAT32_FileSystem* fs, uint32_t cluster) {
+    return &fs->groups[cluster / fs->groupClusters];
+}
+
+// Group this thread allocates from first, threads are spread over the groups round robin
+static uint32_t homeGroup(FAT32_FileSystem* fs) {
+    if (threadGroup < 0) threadGroup = (int)(__atomic_fetch_add(&nextThreadGroup, 1, __ATOMIC_RELAXED) % FAT32_MAX_GROUPS);
+    return (uint32_t)threadGroup % fs->groupCount;
+}
+
+// A thread that had to steal moves its home to the group that served it, so a
+// filled group is passed over once rather than on every allocation
+static void stealFrom(uint32_t group) {
+    threadGroup = (int)group;
+    STATS_INC(STAT_FAT_ALLOC_STEALS);
+}
+
+// Epoch-based reclamation for chains replaced under running readers. A reader
+// counts itself in the epoch it enters, and the epoch only moves on once no
+// reader is left in the one before it, so every reader that could have loaded
+// a chain retired in epoch e is gone by the time the epoch reaches e + 2.
+// Returns the counter to hand to exitEpoch, which may run on another thread.
+static uint32_t* enterEpoch(FAT32_FileSystem* fs) {
+    if (threadEpochSlot < 0) {
+        threadEpochSlot = (int)(__atomic_fetch_add(&nextEpochSlot, 1, __ATOMIC_RELAXED) % FAT32_EPOCH_SLOTS);
+    }
+    uint32_t parity = (uint32_t)(__atomic_load_n(&fs->epoch, __ATOMIC_SEQ_CST) & 1);
+    uint32_t* readers = &fs->epochSlots[threadEpochSlot].readers[parity];
+    // Sequentially consistent, so the count is visible before any startCluster is loaded
+    __atomic_add_fetch(readers, 1, __ATOMIC_SEQ_CST);
+    return readers;
+}
+
+static void exitEpoch(uint32_t* readers) {
+    __atomic_sub_fetch(readers, 1, __ATOMIC_RELEASE);
+}
+
+// Move to the next epoch if no reader is left in the previous one
+static void advanceEpoch(FAT32_FileSystem* fs) {
+    uint64_t epoch = __atomic_load_n(&fs->epoch, __ATOMIC_SEQ_CST);
+    uint32_t previous = (uint32_t)((epoch + 1) & 1);
+    for (uint32_t i = 0; i < FAT32_EPOCH_SLOTS; i++) {
+        if (__atomic_load_n(&fs->epochSlots[i].readers[previous], __ATOMIC_SEQ_CST) != 0) return;
+    }
+    __atomic_compare_exchange_n(&fs->epoch, &epoch, epoch + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+// Writers and relocations of an entry exclude each other through its write
+// sequence; a relocation copies without it and only takes it to publish
+static void lockEntry(FAT32_Entry* entry) {
+    uint32_t sequence = __atomic_load_n(&entry->writeSequence, __ATOMIC_RELAXED);
+    while ((sequence & 1) || !__atomic_compare_exchange_n(&entry->writeSequence, &sequence, sequence + 1, true,
+                                                          __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        if (sequence & 1) {
+            sched_yield();
+            sequence = __atomic_load_n(&entry->writeSequence, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static void unlockEntry(FAT32_Entry* entry) {
+    __atomic_add_fetch(&entry->writeSequence, 1, __ATOMIC_RELEASE);
+}
+
+// Take count clusters off the volume-wide free count, leaving what delayed
+// allocation has promised to staged files. Once claimed, the groups are
+// guaranteed to hold that many free clusters between them.
+static bool claimClusters(FAT32_FileSystem* fs, uint32_t count) {
+    uint32_t free = __atomic_load_n(&fs->freeClusters, __ATOMIC_RELAXED);
+    do {
+        uint32_t reserved = __atomic_load_n(&fs->reservedClusters, __ATOMIC_RELAXED);
+        if (free < reserved || count > free - reserved) return false;
+    } while (!__atomic_compare_exchange_n(&fs->freeClusters, &free, free - count, true,
+                                          __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+    // A reservation made meanwhile may have counted the same clusters, one of the two backs out
+    if (free - count < __atomic_load_n(&fs->reservedClusters, __ATOMIC_SEQ_CST)) {
+        __atomic_add_fetch(&fs->freeClusters, count, __ATOMIC_RELEASE);
+        return false;
+    }
+    return true;
+}
+
+// Start of the first run of count free clusters in [first, end) from hint, 0 if there is none
+static uint32_t findFreeRun(FAT32_FileSystem* fs, uint32_t first, uint32_t end, uint32_t hint,
+                            uint32_t count, uint32_t* scanned) {
+    uint32_t run = 0;
     uint32_t start = 0;
-    uint32_t current = 0;
-    uint32_t found = 0;
-    
-    for (uint32_t i = 2; i < fs->totalSectors/fs->sectorsPerCluster; i++) {
-        if (get_next_cluster(fs, i) == 0) {
-            if (found == 0) start = i;
-            found++;
-            if (found == count) {
-                // Link clusters
-                for (uint32_t j = start; j < start + count - 1; j++) {
-                    set_next_cluster(fs, j, j + 1);
-                }
-                set_next_cluster(fs, start + count - 1, 0xFFFFFFFF);
-                return start;
-            }
-        } else {
-            found = 0;
+    uint32_t cluster = hint;
+
+    for (uint32_t i = first; i < end; i++, cluster++) {
+        if (cluster >= end) {
+            // Runs do not wrap around the end of the range
+            cluster = first;
+            run = 0;
+        }
+        (*scanned)++;
+        if (get_next_cluster(fs, cluster) != FAT32_FREE) {
+            run = 0;
+            continue;
+        }
+        if (run++ == 0) start = cluster;
+        if (run == count) return start;
+    }
+    return 0;
+}
+
+// Take a free cluster, with its group locked, and link it after previous
+static void takeCluster(FAT32_FileSystem* fs, uint32_t cluster, uint32_t previous) {
+    FAT32_AllocGroup* group = groupOf(fs, cluster);
+    if (previous) set_next_cluster(fs, previous, cluster);
+    set_next_cluster(fs, cluster, FAT32_EOC);
+    // Stored atomically for the unlocked peeks that skip full groups
+    __atomic_store_n(&group->freeCount, group->freeCount - 1, __ATOMIC_RELAXED);
+    if (group->nextFree == cluster) group->nextFree = (cluster + 1 < group->end) ? cluster + 1 : group->first;
+}
+
+static void takeRun(FAT32_FileSystem* fs, uint32_t start, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) takeCluster(fs, start + i, i ? start + i - 1 : 0);
+}
+
+// One run of count clusters inside a single group, the home group first
+static uint32_t allocateGroupRun(FAT32_FileSystem* fs, uint32_t home, uint32_t count, uint32_t* scanned) {
+    for (uint32_t i = 0; i < fs->groupCount; i++) {
+        uint32_t index = (home + i) % fs->groupCount;
+        FAT32_AllocGroup* group = &fs->groups[index];
+        if (__atomic_load_n(&group->freeCount, __ATOMIC_RELAXED) < count) continue;
+
+        pthread_mutex_lock(&group->mutex);
+        uint32_t start = 0;
+        if (group->freeCount >= count) {
+            start = findFreeRun(fs, group->first, group->end, group->nextFree, count, scanned);
+            if (start) takeRun(fs, start, count);
+        }
+        pthread_mutex_unlock(&group->mutex);
+        if (start) {
+            if (i > 0) stealFrom(index);
+            return start;
         }
     }
     return 0;
 }
 
+// A run longer than a group crosses group boundaries, so every group is locked, in order
+static uint32_t allocateVolumeRun(FAT32_FileSystem* fs, uint32_t count, uint32_t* scanned) {
+    uint32_t hint = FAT32_FIRST_CLUSTER;
+    for (uint32_t i = 0; i < fs->groupCount; i++) pthread_mutex_lock(&fs->groups[i].mutex);
+    for (uint32_t i = 0; i < fs->groupCount; i++) {
+        if (fs->groups[i].freeCount == 0) continue;
+        hint = fs->groups[i].nextFree;
+        break;
+    }
+    uint32_t start = findFreeRun(fs, FAT32_FIRST_CLUSTER, fs->clusterCount, hint, count, scanned);
+    if (start) takeRun(fs, start, count);
+    for (uint32_t i = fs->groupCount; i-- > 0;) pthread_mutex_unlock(&fs->groups[i].mutex);
+    return start;
+}
+
+// First fit across groups, the home group first. The claim guarantees the
+// clusters exist, a group passed over early may be revisited after frees.
+static uint32_t allocateScattered(FAT32_FileSystem* fs, uint32_t home, uint32_t count, uint32_t* scanned) {
+    uint32_t start = 0;
+    uint32_t previous = 0;
+    uint32_t found = 0;
+    uint32_t last = home;
+
+    for (uint32_t i = 0; found < count; i++) {
+        uint32_t index = (home + i) % fs->groupCount;
+        FAT32_AllocGroup* group = &fs->groups[index];
+        if (__atomic_load_n(&group->freeCount, __ATOMIC_RELAXED) == 0) continue;
+
+        pthread_mutex_lock(&group->mutex);
+        uint32_t cluster = group->nextFree;
+        for (uint32_t j = group->first; j < group->end && found < count && group->freeCount > 0; j++, cluster++) {
+            if (cluster >= group->end) cluster = group->first;
+            (*scanned)++;
+            if (get_next_cluster(fs, cluster) != FAT32_FREE) continue;
+            takeCluster(fs, cluster, previous);
+            if (found++ == 0) start = cluster;
+            previous = cluster;
+            last = index;
+        }
+        pthread_mutex_unlock(&group->mutex);
+    }
+    if (last != home) stealFrom(last);
+    return start;
+}
+
+// Link count free clusters into a chain: one contiguous run when the volume has
+// one, otherwise first fit unless contiguousOnly. Each thread starts in its own
+// allocation group and only moves to other groups when its own cannot serve the
+// request, so concurrent allocations mostly take different locks.
+static uint32_t allocateChain(FAT32_FileSystem* fs, uint32_t count, bool contiguousOnly) {
+    uint32_t scanned = 0;
+
+    // Empty files own no clusters
+    if (count == 0) return 0;
+
+    STATS_INC(STAT_FAT_ALLOC_CALLS);
+    TRACE_BEGIN(TRACE_FAT_ALLOC, count);
+    if (!claimClusters(fs, count)) {
+        STATS_INC(STAT_FAT_ALLOC_FAILURES);
+        TRACE_END(TRACE_FAT_ALLOC);
+        return 0;
+    }
+    STATS_TIMER_START(allocStart);
+
+    uint32_t home = homeGroup(fs);
+    uint32_t start = (count <= fs->groupClusters) ? allocateGroupRun(fs, home, count, &scanned)
+                                                  : allocateVolumeRun(fs, count, &scanned);
+    if (start == 0 && !contiguousOnly) start = allocateScattered(fs, home, count, &scanned);
+    if (start == 0) {
+        __atomic_add_fetch(&fs->freeClusters, count, __ATOMIC_RELAXED);
+        STATS_INC(STAT_FAT_ALLOC_FAILURES);
+    }
+    STATS_ADD(STAT_FAT_ALLOC_SCANNED, scanned);
+    STATS_TIMER_RECORD(STAT_HIST_FAT_ALLOC, allocStart);
+    TRACE_END(TRACE_FAT_ALLOC);
+    return start;
+}
+
+uint32_t allocate_clusters(FAT32_FileSystem* fs, uint32_t count) {
+    return allocateChain(fs, count, false);
+}
+
+// Allocate count clusters as one run, 0 if no free run is long enough
+uint32_t allocate_contiguous(FAT32_FileSystem* fs, uint32_t count) {
+    return allocateChain(fs, count, true);
+}
+
+// Content-addressed dedup. A FAT cluster links to exactly one successor, so a
+// cluster can only be shared together with the rest of its chain: the index is
+// keyed by a cluster's data and its successor, and writes share the longest
+// trailing run of clusters that is already on the volume. refCounts counts the
+// entries and predecessor clusters pointing at an indexed cluster.
+typedef struct FAT32_Dedup {
+    uint64_t* fingerprints;   // Per cluster, valid while the cluster is indexed
+    uint32_t* refCounts;      // References to an indexed cluster, 0 for clusters outside the index
+    uint32_t* nextInBucket;   // Next cluster in the same hash bucket
+    uint32_t* buckets;        // Hash table heads, fingerprint -> first cluster, 0 when empty
+    uint32_t bucketMask;      // Number of buckets - 1
+    uint64_t lookups;
+    uint64_t hits;
+    uint32_t indexedClusters;
+    pthread_mutex_t mutex;    // Protects the index, taken before the group locks
+} FAT32_Dedup;
+
+static void dedupIndex(FAT32_Dedup* dedup, uint32_t cluster, uint64_t fingerprint) {
+    uint32_t bucket = (uint32_t)fingerprint & dedup->bucketMask;
+    dedup->fingerprints[cluster] = fingerprint;
+    dedup->refCounts[cluster] = 1;
+    dedup->nextInBucket[cluster] = dedup->buckets[bucket];
+    dedup->buckets[bucket] = cluster;
+    dedup->indexedClusters++;
+}
+
+static void dedupUnindex(FAT32_Dedup* dedup, uint32_t cluster) {
+    uint32_t* link = &dedup->buckets[(uint32_t)dedup->fingerprints[cluster] & dedup->bucketMask];
+    while (*link != cluster) link = &dedup->nextInBucket[*link];
+    *link = dedup->nextInBucket[cluster];
+    dedup->refCounts[cluster] = 0;
+    dedup->indexedClusters--;
+}
+
+// Per-cluster CRC32C of what was last written through the file system. A cluster
+// without a valid checksum (free, or not written since checksums were enabled) is
+// never reported as corrupt.
+typedef struct FAT32_Checksums {
+    uint32_t* crcs;           // Per cluster, meaningful where valid is set
+    uint8_t* valid;           // Cleared when a cluster is freed
+    uint64_t errors;          // Mismatches found by verified reads and scrubs
+} FAT32_Checksums;
+
+// Release a chain. A cluster that is still shared keeps itself and everything after it.
+// Each cluster goes back to its own group; chains mostly stay inside one group, so
+// the group lock is only switched where the chain crosses into another.
 void free_clusters(FAT32_FileSystem* fs, uint32_t startCluster) {
+    FAT32_Dedup* dedup = fs->dedup;
+    FAT32_AllocGroup* locked = NULL;
     uint32_t current = startCluster;
+    uint32_t freed = 0;
     uint32_t next;
     
-    while (current != 0xFFFFFFFF && current != 0) {
+    TRACE_BEGIN(TRACE_FAT_FREE, 0);
+    if (dedup) pthread_mutex_lock(&dedup->mutex);
+    while (fat32_valid_cluster(fs, current)) {
+        if (dedup && dedup->refCounts[current] > 1) {
+            dedup->refCounts[current]--;
+            break;
+        }
+        if (dedup && dedup->refCounts[current] == 1) dedupUnindex(dedup, current);
+
+        FAT32_AllocGroup* group = groupOf(fs, current);
+        if (group != locked) {
+            if (locked) pthread_mutex_unlock(&locked->mutex);
+            pthread_mutex_lock(&group->mutex);
+            locked = group;
+        }
         next = get_next_cluster(fs, current);
-        set_next_cluster(fs, current, 0);
+        set_next_cluster(fs, current, FAT32_FREE);
+        if (fs->pool) bufpool_discard(fs->pool, current);
+        if (fs->checksums) fs->checksums->valid[current] = 0;
+        __atomic_store_n(&group->freeCount, group->freeCount + 1, __ATOMIC_RELAXED);
+        if (current < group->nextFree) group->nextFree = current;
+        freed++;
         current = next;
+        STATS_INC(STAT_FAT_CLUSTERS_FREED);
     }
+    if (locked) pthread_mutex_unlock(&locked->mutex);
+    // Groups first, so the groups never hold fewer free clusters than the volume count says
+    __atomic_add_fetch(&fs->freeClusters, freed, __ATOMIC_RELAXED);
+    if (dedup) pthread_mutex_unlock(&dedup->mutex);
+    TRACE_END(TRACE_FAT_FREE);
 }
 
-// FAT table operations
+// FAT table operations. Entries are read and written whole, so scans of a group
+// can run next to writers linking chains that are already allocated.
 uint32_t get_next_cluster(FAT32_FileSystem* fs, uint32_t cluster) {
-    return fs->fatTable[cluster];
+    return __atomic_load_n(&fs->fatTable[cluster], __ATOMIC_RELAXED) & FAT32_ENTRY_MASK;
 }
 
+// The top 4 bits of an entry are reserved and kept as they are
 void set_next_cluster(FAT32_FileSystem* fs, uint32_t cluster, uint32_t next) {
-    fs->fatTable[cluster] = next;
+    uint32_t value = (__atomic_load_n(&fs->fatTable[cluster], __ATOMIC_RELAXED) & ~FAT32_ENTRY_MASK) |
+                     (next & FAT32_ENTRY_MASK);
+    __atomic_store_n(&fs->fatTable[cluster], value, __ATOMIC_RELAXED);
+    __atomic_store_n(&fs->fatDirty[cluster * sizeof(uint32_t) / SECTOR_SIZE], 1, __ATOMIC_RELAXED);
 }
 
-// Core function implementations
-FAT32_FileSystem* fat32_init(uint32_t size) {
+// Cluster data access, through the buffer pool for image-backed volumes.
+// With overwrite the caller replaces the whole cluster, so a cache miss skips the read.
+static uint8_t* pinCluster(FAT32_FileSystem* fs, uint32_t cluster, bool overwrite) {
+    if (fs->pool) return bufpool_pin(fs->pool, cluster, overwrite);
+    return fs->data + (uint64_t)(cluster - FAT32_FIRST_CLUSTER) * fs->clusterSize;
+}
+
+static void unpinCluster(FAT32_FileSystem* fs, uint32_t cluster, bool dirty) {
+    if (fs->pool) bufpool_unpin(fs->pool, cluster, dirty);
+}
+
+static void recordChecksum(FAT32_FileSystem* fs, uint32_t cluster, const uint8_t* data) {
+    FAT32_Checksums* sums = fs->checksums;
+    if (!sums) return;
+    sums->crcs[cluster] = crc32c(0, data, fs->clusterSize);
+    sums->valid[cluster] = 1;
+}
+
+// Unpin a cluster the caller modified through data, updating its checksum
+static void unpinWritten(FAT32_FileSystem* fs, uint32_t cluster, const uint8_t* data) {
+    recordChecksum(fs, cluster, data);
+    unpinCluster(fs, cluster, true);
+}
+
+// A verbatim copy keeps the source's checksum, so a corrupt source stays detectable
+static void copyChecksum(FAT32_FileSystem* fs, uint32_t from, uint32_t to) {
+    FAT32_Checksums* sums = fs->checksums;
+    if (!sums) return;
+    sums->crcs[to] = sums->crcs[from];
+    sums->valid[to] = sums->valid[from];
+}
+
+static bool checksumMismatch(FAT32_FileSystem* fs) {
+    __atomic_fetch_add(&fs->checksums->errors, 1, __ATOMIC_RELAXED);
+    STATS_INC(STAT_FAT_CHECKSUM_ERRORS);
+    return false;
+}
+
+// False if the cluster has a checksum and data does not match it
+static bool checkCluster(FAT32_FileSystem* fs, uint32_t cluster, const uint8_t* data) {
+    FAT32_Checksums* sums = fs->checksums;
+    if (!sums || !sums->valid[cluster] || crc32c(0, data, fs->clusterSize) == sums->crcs[cluster]) return true;
+    return checksumMismatch(fs);
+}
+
+// Read-path check for in-memory volumes; image volumes are verified by the
+// buffer pool as clusters are loaded, so resident frames are trusted
+static bool verifyRead(FAT32_FileSystem* fs, uint32_t cluster, const uint8_t* data) {
+    return !fs->verifyReads || fs->pool || checkCluster(fs, cluster, data);
+}
+
+// Copy chunk bytes at skip out of an in-memory cluster, checking it as verifyRead
+// would in the same pass: the copied bytes are checksummed as they are copied,
+// the rest of the cluster around them is only checksummed
+static bool copyVerified(FAT32_FileSystem* fs, uint32_t cluster, const uint8_t* data, uint32_t skip, uint8_t* dest,
+                         uint32_t chunk) {
+    FAT32_Checksums* sums = fs->checksums;
+    if (!fs->verifyReads || fs->pool || !sums || !sums->valid[cluster]) {
+        memcpy(dest, data + skip, chunk);
+        return true;
+    }
+    uint32_t crc = crc32c(0, data, skip);
+    crc = crc32c_copy(crc, dest, data + skip, chunk);
+    crc = crc32c(crc, data + skip + chunk, fs->clusterSize - skip - chunk);
+    return crc == sums->crcs[cluster] || checksumMismatch(fs);
+}
+
+static bool verifyLoaded(void* ctx, uint32_t cluster, const uint8_t* data) {
+    return checkCluster((FAT32_FileSystem*)ctx, cluster, data);
+}
+
+// Taken before the entry lock and released after notifyChange, see FAT32_ChangeGuard
+static void beginChange(FAT32_FileSystem* fs) {
+    if (fs->changeGuard) fs->changeGuard(fs->onChangeCtx, true);
+}
+
+static void endChange(FAT32_FileSystem* fs) {
+    if (fs->changeGuard) fs->changeGuard(fs->onChangeCtx, false);
+}
+
+static void notifyChange(FAT32_FileSystem* fs, FAT32_Entry* entry, time_t oldTime, uint32_t oldStart) {
+    if (fs->onChange && (entry->modificationTime != oldTime || entry->startCluster != oldStart)) {
+        fs->onChange(fs->onChangeCtx, entry, oldTime, oldStart);
+    }
+}
+
+// Only sizes that pass fitsVolume have a cluster count that fits in 32 bits
+static uint32_t clustersFor(FAT32_FileSystem* fs, uint64_t size) {
+    return (uint32_t)((size + fs->clusterSize - 1) / fs->clusterSize);
+}
+
+// True if size bytes could be held by the volume's clusters at all
+static bool fitsVolume(FAT32_FileSystem* fs, uint64_t size) {
+    return size <= (uint64_t)fs->clusterCount * fs->clusterSize;
+}
+
+static uint64_t fatBytes(FAT32_FileSystem* fs) {
+    return (uint64_t)fs->clusterCount * sizeof(uint32_t);
+}
+
+static uint32_t fatSectors(FAT32_FileSystem* fs) {
+    return (uint32_t)((fatBytes(fs) + SECTOR_SIZE - 1) / SECTOR_SIZE);
+}
+
+// pread or pwrite all of length, which may exceed what one call transfers
+static bool transferFAT(int fd, bool write, void* buffer, uint64_t length, off_t offset) {
+    uint64_t done = 0;
+    while (done < length) {
+        ssize_t n = write ? pwrite(fd, (uint8_t*)buffer + done, length - done, offset + (off_t)done)
+                          : pread(fd, (uint8_t*)buffer + done, length - done, offset + (off_t)done);
+        if (n <= 0) return false;
+        done += (uint64_t)n;
+    }
+    return true;
+}
+
+// Split the cluster space into groups of at least FAT32_GROUP_MIN_CLUSTERS,
+// at most FAT32_MAX_GROUPS of them
+static void initGroups(FAT32_FileSystem* fs) {
+    uint32_t perGroup = (fs->clusterCount + FAT32_MAX_GROUPS - 1) / FAT32_MAX_GROUPS;
+    fs->groupClusters = perGroup > FAT32_GROUP_MIN_CLUSTERS ? perGroup : FAT32_GROUP_MIN_CLUSTERS;
+    fs->groupCount = (fs->clusterCount + fs->groupClusters - 1) / fs->groupClusters;
+    fs->groups = (FAT32_AllocGroup*)aligned_alloc(FAT32_CACHE_LINE, fs->groupCount * sizeof(FAT32_AllocGroup));
+    memset(fs->groups, 0, fs->groupCount * sizeof(FAT32_AllocGroup));
+    for (uint32_t i = 0; i < fs->groupCount; i++) {
+        FAT32_AllocGroup* group = &fs->groups[i];
+        group->first = i ? i * fs->groupClusters : FAT32_FIRST_CLUSTER;
+        group->end = (i + 1 < fs->groupCount) ? (i + 1) * fs->groupClusters : fs->clusterCount;
+        pthread_mutex_init(&group->mutex, NULL);
+    }
+}
+
+// Rebuild the free count and hint of every group, and the volume total, from the FAT
+static void countGroups(FAT32_FileSystem* fs) {
+    fs->freeClusters = 0;
+    for (uint32_t i = 0; i < fs->groupCount; i++) {
+        FAT32_AllocGroup* group = &fs->groups[i];
+        group->freeCount = 0;
+        group->nextFree = 0;
+        for (uint32_t cluster = group->first; cluster < group->end; cluster++) {
+            if (get_next_cluster(fs, cluster) != FAT32_FREE) continue;
+            if (group->freeCount++ == 0) group->nextFree = cluster;
+        }
+        if (group->freeCount == 0) group->nextFree = group->first;
+        fs->freeClusters += group->freeCount;
+    }
+}
+
+// Fresh FAT: reserved entries, the root directory cluster and everything else free
+static void formatFAT(FAT32_FileSystem* fs) {
+    memset(fs->fatTable, 0, fatBytes(fs));
+    fs->fatTable[0] = FAT32_MEDIA;
+    fs->fatTable[1] = FAT32_EOC;
+    fs->fatTable[fs->rootCluster] = FAT32_EOC;
+    memset(fs->fatDirty, 1, fatSectors(fs));
+    countGroups(fs);
+}
+
+// Geometry and FAT shared by in-memory and image-backed volumes. Clusters start
+// at CLUSTER_SIZE and double, as FAT32 formatters do, until the data region fits
+// in FAT32_MAX_CLUSTERS entries. NULL if the volume is too small for a data
+// cluster or too large even for FAT32_MAX_CLUSTER_SIZE clusters.
+static FAT32_FileSystem* createFileSystem(uint64_t size) {
+    const uint32_t reservedSectors = 32;
+    const uint32_t numberOfFATs = 2;
+    uint64_t totalSectors = size / SECTOR_SIZE;
+    uint32_t clusterSize = CLUSTER_SIZE;
+    uint64_t sectorsPerFAT, metadataBytes;
+    while (1) {
+        sectorsPerFAT = (totalSectors / (clusterSize / SECTOR_SIZE) * 4 + SECTOR_SIZE - 1) / SECTOR_SIZE;
+        metadataBytes = (reservedSectors + numberOfFATs * sectorsPerFAT) * SECTOR_SIZE;
+        if (size < metadataBytes + 2 * (uint64_t)clusterSize) return NULL;
+        if ((size - metadataBytes) / clusterSize + FAT32_FIRST_CLUSTER <= FAT32_MAX_CLUSTERS) break;
+        if (clusterSize == FAT32_MAX_CLUSTER_SIZE) return NULL;
+        clusterSize *= 2;
+    }
+
     FAT32_FileSystem* fs = (FAT32_FileSystem*)malloc(sizeof(FAT32_FileSystem));
-    
-    fs->totalSectors = size / SECTOR_SIZE;
-    fs->sectorsPerCluster = CLUSTER_SIZE / SECTOR_SIZE;
-    fs->reservedSectors = 32;
-    fs->numberOfFATs = 2;
-    fs->sectorsPerFAT = (fs->totalSectors / fs->sectorsPerCluster * 4 + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    fs->totalSectors = totalSectors;
+    fs->clusterSize = clusterSize;
+    fs->sectorsPerCluster = clusterSize / SECTOR_SIZE;
+    fs->reservedSectors = reservedSectors;
+    fs->numberOfFATs = numberOfFATs;
+    fs->sectorsPerFAT = (uint32_t)sectorsPerFAT;
     fs->rootCluster = 2;
     
+    // Size of data region, whole clusters only
+    fs->dataSize = size - metadataBytes;
+    fs->clusterCount = (uint32_t)(fs->dataSize / fs->clusterSize) + FAT32_FIRST_CLUSTER;
+    fs->data = NULL;
+
     // Allocate FAT table
-    uint32_t fatSize = fs->totalSectors / fs->sectorsPerCluster * sizeof(uint32_t);
-    fs->fatTable = (uint8_t*)calloc(fatSize, 1);
+    fs->fatTable = (uint32_t*)calloc(fs->clusterCount, sizeof(uint32_t));
+    fs->fatDirty = (uint8_t*)calloc(fatSectors(fs), 1);
+    if (!fs->fatTable || !fs->fatDirty) {
+        free(fs->fatTable);
+        free(fs->fatDirty);
+        free(fs);
+        return NULL;
+    }
+    initGroups(fs);
+    formatFAT(fs);
+
+    fs->delayedAllocation = false;
+    fs->reservedClusters = 0;
+    fs->stagedHead = NULL;
+    pthread_mutex_init(&fs->stagedMutex, NULL);
+    fs->inlineThreshold = FAT32_INLINE_CAPACITY;
+    fs->dedupEnabled = false;
+    fs->dedup = NULL;
+    fs->compression = false;
+    fs->checksums = NULL;
+    fs->verifyReads = false;
+    fs->onChange = NULL;
+    fs->changeGuard = NULL;
+    fs->onChangeCtx = NULL;
+    fs->imageFd = -1;
+    fs->pool = NULL;
+    fs->stripeExecutor = NULL;
+    fs->stripeThreshold = FAT32_STRIPE_THRESHOLD;
+    fs->aio = NULL;
+    fs->finishedHead = fs->finishedTail = NULL;
+    pthread_mutex_init(&fs->asyncMutex, NULL);
+    fs->epoch = 0;
+    fs->epochSlots = (FAT32_EpochSlot*)aligned_alloc(FAT32_CACHE_LINE, FAT32_EPOCH_SLOTS * sizeof(FAT32_EpochSlot));
+    memset(fs->epochSlots, 0, FAT32_EPOCH_SLOTS * sizeof(FAT32_EpochSlot));
+    fs->retired = NULL;
+    pthread_mutex_init(&fs->retiredMutex, NULL);
     
-    // Allocate data region
-    fs->dataSize = size - (fs->reservedSectors + fs->numberOfFATs * fs->sectorsPerFAT) * SECTOR_SIZE;
+    return fs;
+}
+
+// Load the FAT from the first readable copy. FSInfo only stores the volume-wide
+// free count, the per-group counts are always rebuilt from the FAT.
+static bool loadFAT(FAT32_FileSystem* fs) {
+    bool loaded = false;
+    for (uint32_t i = 0; i < fs->numberOfFATs && !loaded; i++) {
+        off_t fatOffset = (off_t)(fs->reservedSectors + (uint64_t)i * fs->sectorsPerFAT) * SECTOR_SIZE;
+        loaded = transferFAT(fs->imageFd, false, fs->fatTable, fatBytes(fs), fatOffset) &&
+                 (fs->fatTable[0] & FAT32_ENTRY_MASK) == FAT32_MEDIA;
+    }
+    if (!loaded) return false;
+    memset(fs->fatDirty, 0, fatSectors(fs));
+    countGroups(fs);
+    return true;
+}
+
+// Core function implementations
+// In-memory volume of size bytes, NULL if that size cannot be formatted or allocated
+FAT32_FileSystem* fat32_init(uint64_t size) {
+    FAT32_FileSystem* fs = createFileSystem(size);
+    if (!fs) return NULL;
     fs->data = (uint8_t*)calloc(fs->dataSize, 1);
-    
-    // Initialize bitmap
-    fs->bitmapSize = fs->totalSectors / 8 + 1;
-    fs->bitmap = (uint8_t*)calloc(fs->bitmapSize, 1);
-    
+    if (!fs->data) {
+        fat32_cleanup(fs);
+        return NULL;
+    }
+    return fs;
+}
+
+// Open or create a volume stored in an image file, caching at most cacheClusters clusters
+FAT32_FileSystem* fat32_init_image(const char* path, uint64_t size, uint32_t cacheClusters) {
+    FAT32_FileSystem* fs = createFileSystem(size);
+    if (!fs) return NULL;
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        perror("open image");
+        fat32_cleanup(fs);
+        return NULL;
+    }
+    fs->imageFd = fd;
+
+    // Reuse the FAT of an existing image with the same geometry, otherwise format
+    FAT32_ImageHeader header;
+    bool formatted = pread(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+                     memcmp(header.magic, FAT32_IMAGE_MAGIC, sizeof(header.magic)) == 0 &&
+                     header.version == FAT32_IMAGE_VERSION &&
+                     header.totalSectors == fs->totalSectors &&
+                     header.sectorsPerCluster == fs->sectorsPerCluster;
+    if (formatted) formatted = loadFAT(fs);
+    if (!formatted) {
+        // A sparse image of zeros already holds a free FAT, only the sector with
+        // the reserved and root entries has to be written
+        formatFAT(fs);
+        memset(fs->fatDirty, 0, fatSectors(fs));
+        fs->fatDirty[0] = 1;
+        if (ftruncate(fd, 0) != 0 || ftruncate(fd, (off_t)size) != 0) {
+            perror("size image");
+            close(fd);
+            fs->imageFd = -1;
+            fat32_cleanup(fs);
+            return NULL;
+        }
+    }
+
+    uint64_t dataOffset = cluster_to_sector(fs, 2) * SECTOR_SIZE;
+    fs->pool = bufpool_create(fd, dataOffset, fs->clusterSize, cacheClusters);
+    if (!fs->pool) {
+        close(fd);
+        fs->imageFd = -1;
+        fat32_cleanup(fs);
+        return NULL;
+    }
+
+    fs->aio = aio_create(fd, AIO_DEFAULT_DEPTH);
+
+    if (!formatted) fat32_sync(fs);
     return fs;
 }
 
-FAT32_Entry* create_file_entry(FAT32_FileSystem* fs, const char* filename, uint32_t size) {
+// Write dirty clusters, the changed FAT sectors to every FAT copy, FSInfo and
+// the header back to the image
+int fat32_sync(FAT32_FileSystem* fs) {
+    int result = fat32_flush(fs);
+    if (fs->imageFd < 0) return result;
+
+    if (bufpool_flush(fs->pool) != 0) result = -1;
+
+    FAT32_ImageHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, FAT32_IMAGE_MAGIC, sizeof(header.magic));
+    header.totalSectors = fs->totalSectors;
+    header.sectorsPerCluster = fs->sectorsPerCluster;
+    header.reservedSectors = fs->reservedSectors;
+    header.numberOfFATs = fs->numberOfFATs;
+    header.sectorsPerFAT = fs->sectorsPerFAT;
+    header.rootCluster = fs->rootCluster;
+    header.version = FAT32_IMAGE_VERSION;
+    if (pwrite(fs->imageFd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) result = -1;
+
+    // Coalesce runs of dirty sectors into one write per copy
+    uint32_t sectors = fatSectors(fs);
+    for (uint32_t first = 0; first < sectors; first++) {
+        if (!fs->fatDirty[first]) continue;
+        uint32_t last = first;
+        while (last + 1 < sectors && fs->fatDirty[last + 1]) last++;
+
+        uint64_t offset = (uint64_t)first * SECTOR_SIZE;
+        uint64_t length = (uint64_t)(last + 1) * SECTOR_SIZE;
+        if (length > fatBytes(fs)) length = fatBytes(fs);
+        length -= offset;
+        for (uint32_t i = 0; i < fs->numberOfFATs; i++) {
+            off_t fatOffset = (off_t)((fs->reservedSectors + (uint64_t)i * fs->sectorsPerFAT) * SECTOR_SIZE + offset);
+            if (!transferFAT(fs->imageFd, true, (uint8_t*)fs->fatTable + offset, length, fatOffset)) result = -1;
+        }
+        memset(fs->fatDirty + first, 0, last - first + 1);
+        first = last;
+    }
+
+    FAT32_FSInfo info;
+    memset(&info, 0, sizeof(info));
+    info.leadSignature = FSINFO_LEAD_SIGNATURE;
+    info.structSignature = FSINFO_STRUCT_SIGNATURE;
+    info.freeCount = fs->freeClusters;
+    info.nextFree = FSINFO_UNKNOWN;
+    for (uint32_t i = 0; i < fs->groupCount && info.nextFree == FSINFO_UNKNOWN; i++) {
+        if (fs->groups[i].freeCount > 0) info.nextFree = fs->groups[i].nextFree;
+    }
+    info.trailSignature = FSINFO_TRAIL_SIGNATURE;
+    if (pwrite(fs->imageFd, &info, sizeof(info), SECTOR_SIZE) != (ssize_t)sizeof(info)) result = -1;
+
+    if (fsync(fs->imageFd) != 0) result = -1;
+    return result;
+}
+
+// Volume size and free space from the FSInfo counters, without touching the FAT
+void fat32_statfs(FAT32_FileSystem* fs, FAT32_StatFs* out) {
+    out->clusterSize = fs->clusterSize;
+    out->totalClusters = fs->clusterCount - FAT32_FIRST_CLUSTER;
+    out->freeClusters = __atomic_load_n(&fs->freeClusters, __ATOMIC_RELAXED);
+    out->reservedClusters = __atomic_load_n(&fs->reservedClusters, __ATOMIC_RELAXED);
+}
+
+// Layout of a compressed file. Each extent of FAT32_COMPRESS_CLUSTERS clusters of raw bytes
+// starts on a cluster boundary and is stored compressed, or as is when
+// compressing it would not save a cluster.
+typedef struct FAT32_ExtentMap {
+    uint32_t count;           // Extents in the file
+    uint32_t storedClusters;  // Length of the chain
+    struct {
+        uint32_t firstCluster;    // Position of the extent within the chain
+        uint32_t storedLength;    // Bytes stored, below the raw length only when compressed
+    } extents[];
+} FAT32_ExtentMap;
+
+// True if some cluster of the chain is referenced from outside it
+static bool chainShared(FAT32_FileSystem* fs, uint32_t startCluster) {
+    if (!fs->dedup) return false;
+    for (uint32_t cluster = startCluster; fat32_valid_cluster(fs, cluster);
+         cluster = get_next_cluster(fs, cluster)) {
+        if (fs->dedup->refCounts[cluster] > 1) return true;
+    }
+    return false;
+}
+
+// Number of contiguous runs in a chain, 1 for an unfragmented file
+uint32_t fat32_count_extents(FAT32_FileSystem* fs, uint32_t startCluster) {
+    uint32_t extents = 0;
+    uint32_t previous = 0;
+    for (uint32_t cluster = startCluster; fat32_valid_cluster(fs, cluster);
+         cluster = get_next_cluster(fs, cluster)) {
+        if (cluster != previous + 1) extents++;
+        previous = cluster;
+    }
+    return extents;
+}
+
+// Hand a chain that was just unlinked from its entry, and its extent map, to
+// fat32_reclaim, which frees them once no reader can still be walking them
+static void retireChain(FAT32_FileSystem* fs, uint32_t startCluster, FAT32_ExtentMap* extentMap) {
+    if (!fat32_valid_cluster(fs, startCluster) && !extentMap) return;
+    FAT32_RetiredChain* retired = (FAT32_RetiredChain*)malloc(sizeof(FAT32_RetiredChain));
+    retired->startCluster = startCluster;
+    retired->extentMap = extentMap;
+    pthread_mutex_lock(&fs->retiredMutex);
+    // Tagged after the store, a reader that loaded the old start entered no later than this epoch
+    retired->epoch = __atomic_load_n(&fs->epoch, __ATOMIC_SEQ_CST);
+    retired->next = fs->retired;
+    fs->retired = retired;
+    pthread_mutex_unlock(&fs->retiredMutex);
+}
+
+// Copy a file into one contiguous run and publish the new chain with a single
+// store to startCluster, so readers see either the old or the new layout. The
+// copy runs without holding the entry but inside an epoch, so a write that
+// replaces the chain meanwhile retires it rather than freeing it under the copy.
+// Publishing takes the entry and only succeeds if no write has started since the
+// copy began, and writers that start later see the new chain. The old chain is
+// retired and freed by fat32_reclaim once no reader can still be walking it.
+// Returns the number of clusters moved, 0 when no run was free or the file was
+// written during the copy.
+int fat32_relocate(FAT32_FileSystem* fs, FAT32_Entry* entry) {
+    uint32_t sequence = __atomic_load_n(&entry->writeSequence, __ATOMIC_ACQUIRE);
+    if (sequence & 1) return 0;
+    uint32_t start = __atomic_load_n(&entry->startCluster, __ATOMIC_ACQUIRE);
+    uint32_t count = entry->extentMap ? entry->extentMap->storedClusters : clustersFor(fs, entry->fileSize);
+    if (entry->staging || count == 0 || !fat32_valid_cluster(fs, start)) return 0;
+    // Moving a shared chain would give this file a private copy and undo the sharing
+    if (chainShared(fs, start)) return 0;
+
+    uint32_t target = allocate_contiguous(fs, count);
+    if (target == 0) return 0;
+
+    uint32_t* readers = enterEpoch(fs);
+    uint32_t from = start;
+    for (uint32_t i = 0; i < count; i++) {
+        // A chain cut short by a concurrent write ends early, give up on the move
+        uint8_t* source = fat32_valid_cluster(fs, from) ? pinCluster(fs, from, false) : NULL;
+        uint8_t* dest = source ? pinCluster(fs, target + i, true) : NULL;
+        if (!dest) {
+            if (source) unpinCluster(fs, from, false);
+            exitEpoch(readers);
+            free_clusters(fs, target);
+            return 0;
+        }
+        memcpy(dest, source, fs->clusterSize);
+        copyChecksum(fs, from, target + i);
+        unpinCluster(fs, target + i, true);
+        unpinCluster(fs, from, false);
+        from = get_next_cluster(fs, from);
+    }
+    exitEpoch(readers);
+
+    // A writer got in while copying, keep its data and drop the copy
+    beginChange(fs);
+    if (!__atomic_compare_exchange_n(&entry->writeSequence, &sequence, sequence + 1, false, __ATOMIC_ACQ_REL,
+                                     __ATOMIC_RELAXED)) {
+        endChange(fs);
+        free_clusters(fs, target);
+        return 0;
+    }
+    __atomic_store_n(&entry->startCluster, target, __ATOMIC_RELEASE);
+    notifyChange(fs, entry, entry->modificationTime, start);
+    unlockEntry(entry);
+    endChange(fs);
+    retireChain(fs, start, NULL);
+    return (int)count;
+}
+
+// Free the retired chains that no reader can still be walking.
+// With wait, keep advancing the epoch until every retired chain is freed.
+// Returns the number of chains freed.
+uint32_t fat32_reclaim(FAT32_FileSystem* fs, bool wait) {
+    uint32_t freed = 0;
+    pthread_mutex_lock(&fs->retiredMutex);
+    while (fs->retired) {
+        advanceEpoch(fs);
+        uint64_t epoch = __atomic_load_n(&fs->epoch, __ATOMIC_SEQ_CST);
+        FAT32_RetiredChain** link = &fs->retired;
+        while (*link) {
+            FAT32_RetiredChain* chain = *link;
+            if (chain->epoch + 2 > epoch) {
+                link = &chain->next;
+                continue;
+            }
+            *link = chain->next;
+            free_clusters(fs, chain->startCluster);
+            free(chain->extentMap);
+            free(chain);
+            freed++;
+        }
+        if (!wait || !fs->retired) break;
+        pthread_mutex_unlock(&fs->retiredMutex);
+        sched_yield();
+        pthread_mutex_lock(&fs->retiredMutex);
+    }
+    pthread_mutex_unlock(&fs->retiredMutex);
+    return freed;
+}
+
+// Data of a file created under delayed allocation, held until fat32_flush places it
+typedef struct FAT32_Staging {
+    FAT32_Entry* entry;
+    uint8_t* data;
+    uint64_t capacity;
+    uint32_t reserved;        // Clusters counted in fs->reservedClusters
+    struct FAT32_Staging* prev;
+    struct FAT32_Staging* next;
+} FAT32_Staging;
+
+// Promise enough free clusters for size bytes so the flush cannot run out of space
+static bool reserveStaged(FAT32_FileSystem* fs, FAT32_Staging* staging, uint64_t size) {
+    if (!fitsVolume(fs, size)) return false;
+    uint32_t needed = clustersFor(fs, size);
+    if (needed <= staging->reserved) {
+        __atomic_sub_fetch(&fs->reservedClusters, staging->reserved - needed, __ATOMIC_RELEASE);
+        staging->reserved = needed;
+        return true;
+    }
+
+    uint32_t extra = needed - staging->reserved;
+    uint32_t reserved = __atomic_load_n(&fs->reservedClusters, __ATOMIC_RELAXED);
+    do {
+        uint32_t free = __atomic_load_n(&fs->freeClusters, __ATOMIC_RELAXED);
+        if (free < reserved || extra > free - reserved) return false;
+    } while (!__atomic_compare_exchange_n(&fs->reservedClusters, &reserved, reserved + extra, true,
+                                          __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+    // Same check as claimClusters from the other side, an allocation made meanwhile wins
+    if (__atomic_load_n(&fs->freeClusters, __ATOMIC_SEQ_CST) < reserved + extra) {
+        __atomic_sub_fetch(&fs->reservedClusters, extra, __ATOMIC_RELEASE);
+        return false;
+    }
+    staging->reserved = needed;
+    return true;
+}
+
+static bool growStaged(FAT32_FileSystem* fs, FAT32_Staging* staging, uint64_t size) {
+    if (size <= staging->capacity) return true;
+    uint64_t capacity = staging->capacity ? staging->capacity : fs->clusterSize;
+    while (capacity < size) capacity = (capacity > UINT64_MAX / 2) ? size : capacity * 2;
+    uint8_t* data = (uint8_t*)realloc(staging->data, capacity);
+    if (!data) return false;
+    staging->data = data;
+    staging->capacity = capacity;
+    return true;
+}
+
+static bool stageEntry(FAT32_FileSystem* fs, FAT32_Entry* entry, uint64_t size) {
+    FAT32_Staging* staging = (FAT32_Staging*)calloc(1, sizeof(FAT32_Staging));
+    staging->entry = entry;
+    if (!reserveStaged(fs, staging, size) || !growStaged(fs, staging, size)) {
+        __atomic_sub_fetch(&fs->reservedClusters, staging->reserved, __ATOMIC_RELEASE);
+        free(staging->data);
+        free(staging);
+        return false;
+    }
+    if (size > 0) memset(staging->data, 0, size);
+
+    pthread_mutex_lock(&fs->stagedMutex);
+    staging->next = fs->stagedHead;
+    if (fs->stagedHead) fs->stagedHead->prev = staging;
+    fs->stagedHead = staging;
+    pthread_mutex_unlock(&fs->stagedMutex);
+    entry->staging = staging;
+    entry->startCluster = 0;
+    return true;
+}
+
+static void unstageEntry(FAT32_FileSystem* fs, FAT32_Entry* entry) {
+    FAT32_Staging* staging = entry->staging;
+    pthread_mutex_lock(&fs->stagedMutex);
+    if (staging->prev) staging->prev->next = staging->next;
+    else fs->stagedHead = staging->next;
+    if (staging->next) staging->next->prev = staging->prev;
+    pthread_mutex_unlock(&fs->stagedMutex);
+    __atomic_sub_fetch(&fs->reservedClusters, staging->reserved, __ATOMIC_RELEASE);
+    free(staging->data);
+    free(staging);
+    entry->staging = NULL;
+}
+
+// Allocate clusters for an entry, or stage it when delayed allocation is on
+static bool allocateEntry(FAT32_FileSystem* fs, FAT32_Entry* entry, uint64_t size) {
+    entry->staging = NULL;
+    if (fs->delayedAllocation) return stageEntry(fs, entry, size);
+    if (!fitsVolume(fs, size)) return false;
+
+    uint32_t clustersNeeded = clustersFor(fs, size);
+    entry->startCluster = allocate_clusters(fs, clustersNeeded);
+    return clustersNeeded == 0 || entry->startCluster != 0;
+}
+
+// New entries up to the inline threshold keep their data in the entry itself
+static bool placeEntry(FAT32_FileSystem* fs, FAT32_Entry* entry, uint64_t size) {
+    if (size > fs->inlineThreshold) return allocateEntry(fs, entry, size);
+
+    entry->staging = NULL;
+    entry->attributes |= ATTR_INLINE;
+    entry->startCluster = 0;
+    memset(entry->inlineData, 0, size);
+    return true;
+}
+
+FAT32_Entry* create_file_entry(FAT32_FileSystem* fs, const char* filename, uint64_t size) {
 
     FAT32_Entry* entry = (FAT32_Entry*)malloc(sizeof(FAT32_Entry));
     
@@ -89,15 +989,21 @@ FAT32_Entry* create_file_entry(FAT32_FileSystem* fs, const char* filename, uint3
     entry->fileSize = size;
     entry->attributes = ATTR_ARCHIVE;
     entry->creationTime = entry->modificationTime = time(NULL);
+    entry->parentId = entry->directoryId = 0;
+    entry->extentMap = NULL;
+    entry->writeSequence = 0;
     
     // Allocate clusters
-    uint32_t clustersNeeded = (size + CLUSTER_SIZE - 1) / CLUSTER_SIZE;
-    entry->startCluster = allocate_clusters(fs, clustersNeeded);
+    if (!placeEntry(fs, entry, size)) {
+        // Volume full
+        free(entry);
+        entry = NULL;
+    }
     
     return entry;
 }
 
-FAT32_Entry* create_file_entry_dme(FAT32_FileSystem* fs, const char* filename, uint32_t size, DistributedNode *node) {
+FAT32_Entry* create_file_entry_dme(FAT32_FileSystem* fs, const char* filename, uint64_t size, DistributedNode *node) {
     requestToken(node);
 
     FAT32_Entry* entry = (FAT32_Entry*)malloc(sizeof(FAT32_Entry));
@@ -106,102 +1012,1266 @@ FAT32_Entry* create_file_entry_dme(FAT32_FileSystem* fs, const char* filename, u
     entry->fileSize = size;
     entry->attributes = ATTR_ARCHIVE;
     entry->creationTime = entry->modificationTime = time(NULL);
+    entry->parentId = entry->directoryId = 0;
+    entry->extentMap = NULL;
+    entry->writeSequence = 0;
     
     // Allocate clusters
-    uint32_t clustersNeeded = (size + CLUSTER_SIZE - 1) / CLUSTER_SIZE;
-    entry->startCluster = allocate_clusters(fs, clustersNeeded);
+    if (!placeEntry(fs, entry, size)) {
+        // Volume full
+        free(entry);
+        entry = NULL;
+    }
     
     releaseToken(node);
     return entry;
 }
 
-int fat32_write(FAT32_FileSystem* fs, FAT32_Entry* entry, const void* data, uint32_t size) {
+// Image write path: full clusters go to the image in one batched submission,
+// a trailing partial cluster is merged through the buffer pool
+static int writeImageChain(FAT32_FileSystem* fs, uint32_t cluster, const uint8_t* buffer, uint64_t size) {
+    uint32_t clusters[BUFPOOL_BATCH_MAX];
+    const uint8_t* sources[BUFPOOL_BATCH_MAX];
+    uint32_t batched = 0;
+    uint64_t remaining = size;
 
+    while (remaining > 0 && fat32_valid_cluster(fs, cluster)) {
+        uint32_t writeSize = (remaining < fs->clusterSize) ? (uint32_t)remaining : fs->clusterSize;
+
+        if (writeSize == fs->clusterSize) {
+            recordChecksum(fs, cluster, buffer);
+            clusters[batched] = cluster;
+            sources[batched] = buffer;
+            if (++batched == BUFPOOL_BATCH_MAX) {
+                if (bufpool_write_through(fs->pool, clusters, sources, batched) != 0) return 0;
+                batched = 0;
+            }
+        } else {
+            uint8_t* target = pinCluster(fs, cluster, false);
+            if (!target) return 0;
+            memcpy(target, buffer, writeSize);
+            unpinWritten(fs, cluster, target);
+        }
 
-    if (!entry || !data || size == 0) return 0;
-    
-    uint32_t cluster = entry->startCluster;
-    uint32_t remaining = size;
-    const uint8_t* buffer = (const uint8_t*)data;
-    
-    while (remaining > 0 && cluster != 0xFFFFFFFF) {
-        uint32_t sector = cluster_to_sector(fs, cluster);
-        uint32_t writeSize = (remaining < CLUSTER_SIZE) ? remaining : CLUSTER_SIZE;
-        
-        memcpy(fs->data + sector * SECTOR_SIZE, buffer, writeSize);
-        
         buffer += writeSize;
         remaining -= writeSize;
         cluster = get_next_cluster(fs, cluster);
+        STATS_INC(STAT_FAT_WRITE_HOPS);
     }
-    
-    entry->fileSize = size;
-    entry->modificationTime = time(NULL);
-    
+
+    if (batched > 0 && bufpool_write_through(fs->pool, clusters, sources, batched) != 0) return 0;
     return 1;
 }
 
-int fat32_write_dme(FAT32_FileSystem* fs, FAT32_Entry* entry, const void* data, uint32_t size, DistributedNode *node) {
-    requestToken(node);
+// Write size bytes from the start of a chain
+static int writeChain(FAT32_FileSystem* fs, uint32_t cluster, const uint8_t* buffer, uint64_t size) {
+    if (fs->pool) return writeImageChain(fs, cluster, buffer, size);
 
-    if (!entry || !data || size == 0) return 0;
-    
-    uint32_t cluster = entry->startCluster;
-    uint32_t remaining = size;
-    const uint8_t* buffer = (const uint8_t*)data;
-    
-    while (remaining > 0 && cluster != 0xFFFFFFFF) {
-        uint32_t sector = cluster_to_sector(fs, cluster);
-        uint32_t writeSize = (remaining < CLUSTER_SIZE) ? remaining : CLUSTER_SIZE;
-        
-        memcpy(fs->data + sector * SECTOR_SIZE, buffer, writeSize);
+    uint64_t remaining = size;
+    while (remaining > 0 && fat32_valid_cluster(fs, cluster)) {
+        uint32_t writeSize = (remaining < fs->clusterSize) ? (uint32_t)remaining : fs->clusterSize;
         
+        uint8_t* target = pinCluster(fs, cluster, true);
+        memcpy(target, buffer, writeSize);
+        unpinWritten(fs, cluster, target);
+
         buffer += writeSize;
         remaining -= writeSize;
         cluster = get_next_cluster(fs, cluster);
+        STATS_INC(STAT_FAT_WRITE_HOPS);
+    }
+    return 1;
+}
+
+// Parallel striped transfers. A large read or whole-file write is cut into
+// stripes of FAT32_STRIPE_CLUSTERS clusters at cluster boundaries, the chain is
+// walked once to find the first cluster of each, and the stripes run on the
+// volume's executor. In-memory volumes only: image volumes share one buffer
+// pool that concurrent stripes could pin empty.
+typedef struct {
+    uint64_t offset;          // File offset of the stripe's first byte
+    uint32_t length;
+    uint32_t cluster;         // Cluster holding offset
+} FAT32_Stripe;
+
+typedef struct {
+    FAT32_FileSystem* fs;
+    FAT32_Entry* entry;
+    uint8_t* buffer;          // Holds byte base of the file
+    uint64_t base;
+    FAT32_Stripe* stripes;
+    int failed;
+} FAT32_StripedTransfer;
+
+static bool stripesTransfer(FAT32_FileSystem* fs, uint64_t length) {
+    return fs->stripeExecutor && !fs->pool && length >= fs->stripeThreshold;
+}
+
+// Stripes covering length bytes from offset, cluster holding offset. Returns the count.
+static int planStripes(FAT32_FileSystem* fs, uint32_t cluster, uint64_t offset, uint64_t length,
+                       FAT32_Stripe** out) {
+    const uint64_t stripeBytes = (uint64_t)FAT32_STRIPE_CLUSTERS * fs->clusterSize;
+    uint64_t position = offset;
+    uint64_t end = offset + length;
+    int count = 0;
+    FAT32_Stripe* stripes = (FAT32_Stripe*)malloc(((length + offset % stripeBytes) / stripeBytes + 1) *
+                                                  sizeof(FAT32_Stripe));
+
+    while (position < end && fat32_valid_cluster(fs, cluster)) {
+        uint64_t next = (position / stripeBytes + 1) * stripeBytes;
+        if (next > end) next = end;
+        stripes[count++] = (FAT32_Stripe){ position, (uint32_t)(next - position), cluster };
+        for (uint64_t hops = next / fs->clusterSize - position / fs->clusterSize; hops > 0; hops--) {
+            cluster = get_next_cluster(fs, cluster);
+        }
+        position = next;
+    }
+    *out = stripes;
+    return count;
+}
+
+static void writeStripe(void* ctx, int index) {
+    FAT32_StripedTransfer* transfer = (FAT32_StripedTransfer*)ctx;
+    FAT32_Stripe* stripe = &transfer->stripes[index];
+    if (!writeChain(transfer->fs, stripe->cluster, transfer->buffer + stripe->offset, stripe->length)) {
+        __atomic_store_n(&transfer->failed, 1, __ATOMIC_RELAXED);
+    }
+}
+
+// writeChain for a whole file, striped when the transfer is large enough
+static int writeChainStriped(FAT32_FileSystem* fs, uint32_t cluster, const uint8_t* buffer, uint64_t size) {
+    if (!stripesTransfer(fs, size)) return writeChain(fs, cluster, buffer, size);
+
+    FAT32_StripedTransfer transfer = { fs, NULL, (uint8_t*)buffer, 0, NULL, 0 };
+    int count = planStripes(fs, cluster, 0, size, &transfer.stripes);
+    executor_run_indexed(fs->stripeExecutor, count, writeStripe, &transfer);
+    free(transfer.stripes);
+    return !transfer.failed;
+}
+
+// Grow the chain of an on-disk entry until it covers size bytes. A nonzero from
+// is cluster number fromIndex of the chain, the walk to the tail starts there.
+static bool extendChain(FAT32_FileSystem* fs, FAT32_Entry* entry, uint64_t size, uint32_t from, uint32_t fromIndex) {
+    if (!fitsVolume(fs, size)) return false;
+    // The chain always covers the current size
+    if (clustersFor(fs, size) <= clustersFor(fs, entry->fileSize)) return true;
+
+    uint32_t owned = from ? fromIndex : 0;
+    uint32_t last = 0;
+    for (uint32_t cluster = from ? from : entry->startCluster; fat32_valid_cluster(fs, cluster);
+         cluster = get_next_cluster(fs, cluster)) {
+        last = cluster;
+        owned++;
+    }
+
+    uint32_t needed = clustersFor(fs, size);
+    if (needed <= owned) return true;
+    uint32_t extra = allocate_clusters(fs, needed - owned);
+    if (extra == 0) return false;
+    if (last) set_next_cluster(fs, last, extra);
+    else entry->startCluster = extra;
+    return true;
+}
+
+// Inline entries move to clusters, or to staging, once they outgrow the threshold
+static bool spillInline(FAT32_FileSystem* fs, FAT32_Entry* entry, uint64_t size) {
+    entry->attributes &= ~ATTR_INLINE;
+    if (!allocateEntry(fs, entry, size)) {
+        entry->attributes |= ATTR_INLINE;
+        return false;
+    }
+
+    if (entry->fileSize == 0) return true;
+    if (entry->staging) {
+        memcpy(entry->staging->data, entry->inlineData, entry->fileSize);
+        return true;
+    }
+    return writeChain(fs, entry->startCluster, entry->inlineData, entry->fileSize);
+}
+
+// Hash of one cluster and the cluster that follows it, 0 for the end of the chain
+static uint64_t fingerprintCluster(FAT32_FileSystem* fs, const uint8_t* block, uint32_t next) {
+    uint64_t hash = 0xcbf29ce484222325ull ^ next;
+    for (uint32_t i = 0; i < fs->clusterSize; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, block + i, sizeof(word));
+        hash = (hash ^ word) * 0x100000001b3ull;
+        hash ^= hash >> 29;
+    }
+    return hash;
+}
+
+// Cluster index of a write buffer, the partial last cluster is zero padded into scratch
+static const uint8_t* clusterBlock(FAT32_FileSystem* fs, const uint8_t* data, uint64_t size, uint32_t index,
+                                   uint8_t* scratch) {
+    uint64_t offset = (uint64_t)index * fs->clusterSize;
+    if (size - offset >= fs->clusterSize) return data + offset;
+    memcpy(scratch, data + offset, size - offset);
+    memset(scratch + (size - offset), 0, fs->clusterSize - (size - offset));
+    return scratch;
+}
+
+// Indexed cluster holding block and linked to next, 0 if there is none. Equal
+// fingerprints are confirmed byte for byte.
+static uint32_t dedupLookup(FAT32_FileSystem* fs, uint64_t fingerprint, const uint8_t* block, uint32_t next) {
+    FAT32_Dedup* dedup = fs->dedup;
+    for (uint32_t cluster = dedup->buckets[(uint32_t)fingerprint & dedup->bucketMask]; cluster != 0;
+         cluster = dedup->nextInBucket[cluster]) {
+        uint32_t link = get_next_cluster(fs, cluster);
+        if (dedup->fingerprints[cluster] != fingerprint ||
+            (fat32_valid_cluster(fs, link) ? link : 0) != next) {
+            continue;
+        }
+        const uint8_t* data = pinCluster(fs, cluster, false);
+        if (!data) continue;
+        bool same = memcmp(data, block, fs->clusterSize) == 0;
+        unpinCluster(fs, cluster, false);
+        if (same) return cluster;
+    }
+    return 0;
+}
+
+// Dedup write path: share the longest trailing run of clusters already on the
+// volume, then write what precedes it to a new chain linked onto that run.
+// Returns the start cluster, 0 if the volume is full.
+static uint32_t writeDedupChain(FAT32_FileSystem* fs, const uint8_t* data, uint64_t size) {
+    FAT32_Dedup* dedup = fs->dedup;
+    uint32_t count = clustersFor(fs, size);
+    uint8_t scratch[FAT32_MAX_CLUSTER_SIZE];
+    uint32_t shared = 0;
+    uint32_t fresh = count;
+
+    pthread_mutex_lock(&dedup->mutex);
+    while (fresh > 0) {
+        const uint8_t* block = clusterBlock(fs, data, size, fresh - 1, scratch);
+        dedup->lookups++;
+        uint32_t match = dedupLookup(fs, fingerprintCluster(fs, block, shared), block, shared);
+        if (match == 0) break;
+        shared = match;
+        fresh--;
+    }
+    dedup->hits += count - fresh;
+    STATS_ADD(STAT_FAT_DEDUP_HITS, count - fresh);
+    if (shared) dedup->refCounts[shared]++;
+    if (fresh == 0) {
+        pthread_mutex_unlock(&dedup->mutex);
+        return shared;
+    }
+
+    uint32_t start = allocate_clusters(fs, fresh);
+    uint32_t cluster = start;
+    for (uint32_t i = 0; start != 0 && i < fresh; i++) {
+        uint32_t next = (i + 1 < fresh) ? get_next_cluster(fs, cluster) : shared;
+        const uint8_t* block = clusterBlock(fs, data, size, i, scratch);
+        uint8_t* target = pinCluster(fs, cluster, true);
+        if (!target) {
+            // Drop the partial chain, it is not linked to the shared run yet
+            pthread_mutex_unlock(&dedup->mutex);
+            free_clusters(fs, start);
+            pthread_mutex_lock(&dedup->mutex);
+            start = 0;
+            break;
+        }
+        memcpy(target, block, fs->clusterSize);
+        unpinWritten(fs, cluster, target);
+        if (i + 1 == fresh && shared) set_next_cluster(fs, cluster, shared);
+        dedupIndex(dedup, cluster, fingerprintCluster(fs, block, next));
+        cluster = next;
+        STATS_INC(STAT_FAT_WRITE_HOPS);
+    }
+    if (start == 0 && shared) dedup->refCounts[shared]--;
+    pthread_mutex_unlock(&dedup->mutex);
+    return start;
+}
+
+// Writes in place need a chain nobody else can see: take it out of the index,
+// or give the entry a private copy when another file shares part of it
+static bool privatizeChain(FAT32_FileSystem* fs, FAT32_Entry* entry) {
+    FAT32_Dedup* dedup = fs->dedup;
+    if (!dedup) return true;
+
+    uint32_t count = 0;
+    bool indexed = false;
+    bool shared = false;
+    pthread_mutex_lock(&dedup->mutex);
+    for (uint32_t cluster = entry->startCluster; fat32_valid_cluster(fs, cluster);
+         cluster = get_next_cluster(fs, cluster)) {
+        indexed |= dedup->refCounts[cluster] > 0;
+        shared |= dedup->refCounts[cluster] > 1;
+        count++;
+    }
+    if (!shared) {
+        for (uint32_t cluster = entry->startCluster; indexed && fat32_valid_cluster(fs, cluster);
+             cluster = get_next_cluster(fs, cluster)) {
+            dedupUnindex(dedup, cluster);
+        }
+        pthread_mutex_unlock(&dedup->mutex);
+        return true;
+    }
+    pthread_mutex_unlock(&dedup->mutex);
+
+    uint32_t copy = allocate_clusters(fs, count);
+    if (copy == 0) return false;
+    uint32_t from = entry->startCluster;
+    for (uint32_t to = copy; fat32_valid_cluster(fs, to); to = get_next_cluster(fs, to)) {
+        uint8_t* source = pinCluster(fs, from, false);
+        uint8_t* dest = source ? pinCluster(fs, to, true) : NULL;
+        if (!dest) {
+            if (source) unpinCluster(fs, from, false);
+            free_clusters(fs, copy);
+            return false;
+        }
+        memcpy(dest, source, fs->clusterSize);
+        copyChecksum(fs, from, to);
+        unpinCluster(fs, to, true);
+        unpinCluster(fs, from, false);
+        from = get_next_cluster(fs, from);
+    }
+
+    uint32_t old = entry->startCluster;
+    __atomic_store_n(&entry->startCluster, copy, __ATOMIC_RELEASE);
+    retireChain(fs, old, NULL);
+    fat32_reclaim(fs, false);
+    return true;
+}
+
+static uint32_t compressExtent(FAT32_FileSystem* fs) {
+    return FAT32_COMPRESS_CLUSTERS * fs->clusterSize;
+}
+
+static uint32_t extentLength(FAT32_FileSystem* fs, uint64_t fileSize, uint32_t index) {
+    uint64_t offset = (uint64_t)index * compressExtent(fs);
+    return (fileSize - offset < compressExtent(fs)) ? (uint32_t)(fileSize - offset) : compressExtent(fs);
+}
+
+// Compress data extent by extent into a cluster-aligned image. Returns NULL,
+// leaving the data to be stored plain, when no extent saves a cluster.
+static FAT32_ExtentMap* compressExtents(FAT32_FileSystem* fs, const uint8_t* data, uint64_t size, uint8_t** image) {
+    uint32_t count = (uint32_t)((size + compressExtent(fs) - 1) / compressExtent(fs));
+    FAT32_ExtentMap* map = (FAT32_ExtentMap*)malloc(sizeof(FAT32_ExtentMap) + count * sizeof(map->extents[0]));
+    uint8_t* stored = (uint8_t*)malloc((size_t)clustersFor(fs, size) * fs->clusterSize);
+    uint32_t clusters = 0;
+    bool saved = false;
+
+    map->count = count;
+    for (uint32_t i = 0; i < count; i++) {
+        const uint8_t* source = data + (size_t)i * compressExtent(fs);
+        uint32_t rawLength = extentLength(fs, size, i);
+        uint8_t* dest = stored + (size_t)clusters * fs->clusterSize;
+
+        uint32_t length = lz_compress(source, rawLength, dest, (clustersFor(fs, rawLength) - 1) * fs->clusterSize);
+        if (length == 0) {
+            memcpy(dest, source, rawLength);
+            length = rawLength;
+        } else {
+            saved = true;
+        }
+        memset(dest + length, 0, clustersFor(fs, length) * fs->clusterSize - length);
+        map->extents[i].firstCluster = clusters;
+        map->extents[i].storedLength = length;
+        clusters += clustersFor(fs, length);
+    }
+
+    if (!saved) {
+        free(map);
+        free(stored);
+        return NULL;
+    }
+    map->storedClusters = clusters;
+    *image = stored;
+    return map;
+}
+
+// Write data to a new chain: compressed when compress is set and that saves
+// clusters, shared through the dedup index when dedup is on. The start cluster
+// (0 for an empty file) and the extent map (NULL if stored plain) are returned
+// through start and map.
+static bool buildChain(FAT32_FileSystem* fs, const uint8_t* data, uint64_t size, bool compress,
+                       uint32_t* start, FAT32_ExtentMap** map) {
+    if (!fitsVolume(fs, size)) return false;
+    uint8_t* image = NULL;
+    *map = (compress && size > 0) ? compressExtents(fs, data, size, &image) : NULL;
+    const uint8_t* source = *map ? image : data;
+    uint64_t length = *map ? (uint64_t)(*map)->storedClusters * fs->clusterSize : size;
+
+    uint32_t first = 0;
+    if (length > 0 && fs->dedupEnabled) {
+        first = writeDedupChain(fs, source, length);
+    } else if (length > 0 && (first = allocate_clusters(fs, clustersFor(fs, length))) != 0 &&
+               !writeChain(fs, first, source, length)) {
+        free_clusters(fs, first);
+        first = 0;
+    }
+    free(image);
+
+    if (length > 0 && first == 0) {
+        free(*map);
+        *map = NULL;
+        return false;
+    }
+    *start = first;
+    return true;
+}
+
+// Give an on-disk entry a new chain holding data and release the old one
+static bool replaceChain(FAT32_FileSystem* fs, FAT32_Entry* entry, const uint8_t* data, uint64_t size,
+                         bool compress) {
+    uint32_t start;
+    FAT32_ExtentMap* map;
+    if (!buildChain(fs, data, size, compress, &start, &map)) return false;
+
+    // Readers may still be walking the old chain, it goes back through fat32_reclaim
+    uint32_t old = entry->startCluster;
+    FAT32_ExtentMap* oldMap = entry->extentMap;
+    __atomic_store_n(&entry->startCluster, start, __ATOMIC_RELEASE);
+    entry->extentMap = map;
+    retireChain(fs, old, oldMap);
+    fat32_reclaim(fs, false);
+    return true;
+}
+
+// Read from a compressed file. Extents wholly inside the request are
+// decompressed straight into buffer. Returns the bytes copied, or -1.
+static int64_t readCompressed(FAT32_FileSystem* fs, FAT32_Entry* entry, uint64_t offset, uint8_t* buffer,
+                              uint64_t length) {
+    const FAT32_ExtentMap* map = entry->extentMap;
+    uint32_t first = (uint32_t)(offset / compressExtent(fs));
+    uint32_t cluster = entry->startCluster;
+    for (uint32_t i = map->extents[first].firstCluster; i > 0; i--) {
+        cluster = get_next_cluster(fs, cluster);
+        STATS_INC(STAT_FAT_READ_HOPS);
+    }
+
+    uint8_t* stored = (uint8_t*)malloc(compressExtent(fs));
+    uint8_t* raw = NULL;
+    uint64_t copied = 0;
+    int result = 0;
+    for (uint32_t e = first; copied < length && result == 0; e++) {
+        uint32_t rawLength = extentLength(fs, entry->fileSize, e);
+        uint32_t storedLength = map->extents[e].storedLength;
+        for (uint32_t done = 0; done < storedLength; done += fs->clusterSize) {
+            const uint8_t* data = fat32_valid_cluster(fs, cluster) ? pinCluster(fs, cluster, false) : NULL;
+            if (!data || !verifyRead(fs, cluster, data)) {
+                if (data) unpinCluster(fs, cluster, false);
+                result = -1;
+                break;
+            }
+            memcpy(stored + done, data, (storedLength - done < fs->clusterSize) ? storedLength - done : fs->clusterSize);
+            unpinCluster(fs, cluster, false);
+            cluster = get_next_cluster(fs, cluster);
+            STATS_INC(STAT_FAT_READ_HOPS);
+        }
+        if (result != 0) break;
+
+        uint32_t skip = (e == first) ? offset % compressExtent(fs) : 0;
+        uint32_t chunk = rawLength - skip;
+        if (chunk > length - copied) chunk = (uint32_t)(length - copied);
+        if (storedLength == rawLength) {
+            memcpy(buffer + copied, stored + skip, chunk);
+        } else if (skip == 0 && chunk == rawLength) {
+            result = lz_decompress(stored, storedLength, buffer + copied, rawLength) < 0 ? -1 : 0;
+        } else {
+            if (!raw) raw = (uint8_t*)malloc(compressExtent(fs));
+            result = lz_decompress(stored, storedLength, raw, rawLength) < 0 ? -1 : 0;
+            if (result == 0) memcpy(buffer + copied, raw + skip, chunk);
+        }
+        copied += chunk;
+    }
+
+    free(stored);
+    free(raw);
+    return result == 0 ? (int64_t)copied : -1;
+}
+
+// In-place writes need the plain layout, a compressed file is expanded first
+static bool decompressEntry(FAT32_FileSystem* fs, FAT32_Entry* entry) {
+    if (!entry->extentMap) return true;
+
+    uint8_t* plain = (uint8_t*)malloc(entry->fileSize);
+    bool expanded = readCompressed(fs, entry, 0, plain, entry->fileSize) == (int64_t)entry->fileSize &&
+                    replaceChain(fs, entry, plain, entry->fileSize, false);
+    free(plain);
+    return expanded;
+}
+
+// Staged entries keep their data in memory until they are flushed
+static bool writesToStaging(FAT32_FileSystem* fs, FAT32_Entry* entry) {
+    return entry->staging || (fs->delayedAllocation && entry->startCluster == 0);
+}
+
+static int writeEntry(FAT32_FileSystem* fs, FAT32_Entry* entry, const void* data, uint64_t size) {
+    if (!entry || !data || size == 0) return 0;
+    STATS_INC(STAT_FAT_WRITES);
+
+    if ((entry->attributes & ATTR_INLINE) && size > fs->inlineThreshold && !spillInline(fs, entry, size)) {
+        return 0;
+    }
+
+    if (entry->attributes & ATTR_INLINE) {
+        memcpy(entry->inlineData, data, size);
+    } else if (writesToStaging(fs, entry)) {
+        if (!entry->staging && !stageEntry(fs, entry, 0)) return 0;
+        if (!reserveStaged(fs, entry->staging, size) || !growStaged(fs, entry->staging, size)) return 0;
+        memcpy(entry->staging->data, data, size);
+    } else if (fs->dedupEnabled || fs->compression || entry->extentMap) {
+        // The new content gets its own chain (compressed, shared or both), the old one is released
+        if (!replaceChain(fs, entry, (const uint8_t*)data, size, fs->compression)) return 0;
+    } else if (!privatizeChain(fs, entry) || !extendChain(fs, entry, size, 0, 0) ||
+               !writeChainStriped(fs, entry->startCluster, (const uint8_t*)data, size)) {
+        return 0;
     }
     
     entry->fileSize = size;
     entry->modificationTime = time(NULL);
     
-    releaseToken(node);
     return 1;
 }
 
+int fat32_write(FAT32_FileSystem* fs, FAT32_Entry* entry, const void* data, uint64_t size) {
+    if (!entry) return 0;
+    TRACE_BEGIN(TRACE_FAT_WRITE, size);
+    beginChange(fs);
+    lockEntry(entry);
+    time_t oldTime = entry->modificationTime;
+    uint32_t oldStart = entry->startCluster;
+    int result = writeEntry(fs, entry, data, size);
+    notifyChange(fs, entry, oldTime, oldStart);
+    unlockEntry(entry);
+    endChange(fs);
+    TRACE_END(TRACE_FAT_WRITE);
+    return result;
+}
+
+// Shared by fat32_write_range and file handles. With a cursor that still belongs
+// to the entry's chain, the walk to offset starts from the cursor's cluster, and
+// the cursor is left on the cluster holding the last byte written.
+static int writeRangeAt(FAT32_FileSystem* fs, FAT32_Entry* entry, uint64_t offset, const void* data, uint64_t size,
+                        FAT32_Cursor* cursor) {
+    if (!entry || !data || offset > entry->fileSize || size > UINT64_MAX - offset) return 0;
+    if (size == 0) return 1;
+    STATS_INC(STAT_FAT_WRITES);
+
+    uint64_t end = offset + size;
+    if ((entry->attributes & ATTR_INLINE) && end > fs->inlineThreshold && !spillInline(fs, entry, end)) {
+        return 0;
+    }
+
+    if (entry->attributes & ATTR_INLINE) {
+        memcpy(entry->inlineData + offset, data, size);
+    } else if (writesToStaging(fs, entry)) {
+        if (!entry->staging && !stageEntry(fs, entry, entry->fileSize)) return 0;
+        if (end > entry->fileSize &&
+            (!reserveStaged(fs, entry->staging, end) || !growStaged(fs, entry->staging, end))) {
+            return 0;
+        }
+        memcpy(entry->staging->data + offset, data, size);
+    } else {
+        if (!decompressEntry(fs, entry) || !privatizeChain(fs, entry)) return 0;
+
+        uint32_t index = (uint32_t)(offset / fs->clusterSize);
+        bool hinted = cursor && cursor->cluster && cursor->startCluster == entry->startCluster &&
+                      cursor->index <= index;
+        uint32_t from = hinted ? cursor->cluster : 0;
+        uint32_t fromIndex = hinted ? cursor->index : 0;
+        if (!extendChain(fs, entry, end, from, fromIndex)) return 0;
+
+        uint32_t cluster = hinted ? from : entry->startCluster;
+        uint32_t last = cluster;
+        for (uint32_t i = index - fromIndex; i > 0; i--) {
+            cluster = get_next_cluster(fs, cluster);
+            STATS_INC(STAT_FAT_WRITE_HOPS);
+        }
+        const uint8_t* buffer = (const uint8_t*)data;
+        uint32_t skip = offset % fs->clusterSize;
+        uint64_t remaining = size;
+        while (remaining > 0 && fat32_valid_cluster(fs, cluster)) {
+            uint32_t writeSize = fs->clusterSize - skip;
+            if (writeSize > remaining) writeSize = (uint32_t)remaining;
+
+            // Partial clusters are merged with what is already there
+            uint8_t* target = pinCluster(fs, cluster, writeSize == fs->clusterSize);
+            if (!target) return 0;
+            // Merging into a corrupt cluster would give the damage a fresh checksum
+            if (writeSize < fs->clusterSize && !verifyRead(fs, cluster, target)) {
+                unpinCluster(fs, cluster, false);
+                return 0;
+            }
+            memcpy(target + skip, buffer, writeSize);
+            unpinWritten(fs, cluster, target);
+
+            buffer += writeSize;
+            remaining -= writeSize;
+            skip = 0;
+            last = cluster;
+            cluster = get_next_cluster(fs, cluster);
+            STATS_INC(STAT_FAT_WRITE_HOPS);
+        }
+
+        if (cursor) {
+            cursor->startCluster = entry->startCluster;
+            cursor->cluster = last;
+            cursor->index = (uint32_t)((end - 1) / fs->clusterSize);
+        }
+    }
+
+    if (end > entry->fileSize) entry->fileSize = end;
+    entry->modificationTime = time(NULL);
+    return 1;
+}
+
+static int writeRange(FAT32_FileSystem* fs, FAT32_Entry* entry, uint64_t offset, const void* data, uint64_t size,
+                      FAT32_Cursor* cursor) {
+    if (!entry) return 0;
+    TRACE_BEGIN(TRACE_FAT_WRITE, size);
+    beginChange(fs);
+    lockEntry(entry);
+    time_t oldTime = entry->modificationTime;
+    uint32_t oldStart = entry->startCluster;
+    int result = writeRangeAt(fs, entry, offset, data, size, cursor);
+    notifyChange(fs, entry, oldTime, oldStart);
+    unlockEntry(entry);
+    endChange(fs);
+    TRACE_END(TRACE_FAT_WRITE);
+    return result;
+}
+
+// Write size bytes at offset, growing the file when the write ends past it.
+// The offset may be at most the current size. Returns 1 on success.
+int fat32_write_range(FAT32_FileSystem* fs, FAT32_Entry* entry, uint64_t offset, const void* data, uint64_t size) {
+    return writeRange(fs, entry, offset, data, size, NULL);
+}
+
+// Place a staged entry: its final size is known, so it gets one contiguous run
+// whenever the volume has one. Returns 1 on success or if nothing was staged.
+int fat32_flush_entry(FAT32_FileSystem* fs, FAT32_Entry* entry) {
+    if (!entry) return 1;
+
+    beginChange(fs);
+    lockEntry(entry);
+    FAT32_Staging* staging = entry->staging;
+    if (!staging) {
+        // Flushed by another thread meanwhile
+        unlockEntry(entry);
+        endChange(fs);
+        return 1;
+    }
+    __atomic_sub_fetch(&fs->reservedClusters, staging->reserved, __ATOMIC_RELEASE);
+    staging->reserved = 0;
+
+    uint32_t start;
+    FAT32_ExtentMap* map;
+    if (!buildChain(fs, staging->data, entry->fileSize, fs->compression, &start, &map)) {
+        reserveStaged(fs, staging, entry->fileSize);
+        unlockEntry(entry);
+        endChange(fs);
+        return 0;
+    }
+
+    entry->startCluster = start;
+    entry->extentMap = map;
+    unstageEntry(fs, entry);
+    notifyChange(fs, entry, entry->modificationTime, 0);
+    unlockEntry(entry);
+    endChange(fs);
+    return 1;
+}
+
+// Place every staged entry, returns -1 if any could not be written
+int fat32_flush(FAT32_FileSystem* fs) {
+    // Flushing unlinks entries, so work from a snapshot of the list
+    pthread_mutex_lock(&fs->stagedMutex);
+    uint32_t count = 0;
+    for (FAT32_Staging* staging = fs->stagedHead; staging; staging = staging->next) count++;
+    FAT32_Entry** entries = (FAT32_Entry**)malloc((count ? count : 1) * sizeof(FAT32_Entry*));
+    count = 0;
+    for (FAT32_Staging* staging = fs->stagedHead; staging; staging = staging->next) entries[count++] = staging->entry;
+    pthread_mutex_unlock(&fs->stagedMutex);
+
+    int result = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (!fat32_flush_entry(fs, entries[i])) result = -1;
+    }
+    free(entries);
+    return result;
+}
+
+// Files created at up to bytes (capped at FAT32_INLINE_CAPACITY) keep their data
+// in the entry; 0 turns inline storage off. Existing files are not moved, and a
+// file on clusters stays there when a write shrinks it under the threshold.
+void fat32_set_inline_threshold(FAT32_FileSystem* fs, uint32_t bytes) {
+    fs->inlineThreshold = (bytes < FAT32_INLINE_CAPACITY) ? bytes : FAT32_INLINE_CAPACITY;
+}
+
+// Share identical clusters between files written from now on. Turning dedup off
+// keeps the index so chains that are already shared keep their reference counts.
+void fat32_set_dedup(FAT32_FileSystem* fs, bool enabled) {
+    if (enabled && !fs->dedup) {
+        FAT32_Dedup* dedup = (FAT32_Dedup*)calloc(1, sizeof(FAT32_Dedup));
+        uint32_t buckets = 1;
+        while (buckets < fs->clusterCount) buckets <<= 1;
+        dedup->fingerprints = (uint64_t*)calloc(fs->clusterCount, sizeof(uint64_t));
+        dedup->refCounts = (uint32_t*)calloc(fs->clusterCount, sizeof(uint32_t));
+        dedup->nextInBucket = (uint32_t*)calloc(fs->clusterCount, sizeof(uint32_t));
+        dedup->buckets = (uint32_t*)calloc(buckets, sizeof(uint32_t));
+        dedup->bucketMask = buckets - 1;
+        pthread_mutex_init(&dedup->mutex, NULL);
+        fs->dedup = dedup;
+    }
+    fs->dedupEnabled = enabled;
+}
+
+void fat32_dedup_stats(FAT32_FileSystem* fs, FAT32_DedupStats* out) {
+    memset(out, 0, sizeof(*out));
+    if (!fs->dedup) return;
+
+    pthread_mutex_lock(&fs->dedup->mutex);
+    out->lookups = fs->dedup->lookups;
+    out->hits = fs->dedup->hits;
+    out->indexedClusters = fs->dedup->indexedClusters;
+    for (uint32_t cluster = FAT32_FIRST_CLUSTER; cluster < fs->clusterCount; cluster++) {
+        if (fs->dedup->refCounts[cluster] > 1) out->sharedClusters++;
+    }
+    pthread_mutex_unlock(&fs->dedup->mutex);
+}
+
+// Files written with fat32_write or placed by a flush from now on are compressed
+// extent by extent. Existing files keep their layout until rewritten.
+void fat32_set_compression(FAT32_FileSystem* fs, bool enabled) {
+    fs->compression = enabled;
+}
+
+// Run reads and whole-file writes of at least minBytes (FAT32_STRIPE_THRESHOLD
+// if 0) as parallel stripes on executor, NULL to go back to serial transfers.
+// Applies to in-memory volumes; see stripe.h to spread files over volumes.
+void fat32_set_parallel_io(FAT32_FileSystem* fs, struct Executor* executor, uint32_t minBytes) {
+    fs->stripeExecutor = executor;
+    fs->stripeThreshold = minBytes ? minBytes : FAT32_STRIPE_THRESHOLD;
+}
+
+// Keep a CRC32C per cluster, computed as clusters are written; with verifyReads
+// every read checks the clusters it returns and fails with an I/O error on a
+// mismatch. Enabling reads every allocated cluster once to seed the table. The
+// table lives in memory only, so checksums start over on every mount. Must not
+// race other operations on the volume.
+void fat32_set_checksums(FAT32_FileSystem* fs, bool enabled, bool verifyReads) {
+    if (enabled && !fs->checksums) {
+        FAT32_Checksums* sums = (FAT32_Checksums*)calloc(1, sizeof(FAT32_Checksums));
+        sums->crcs = (uint32_t*)calloc(fs->clusterCount, sizeof(uint32_t));
+        sums->valid = (uint8_t*)calloc(fs->clusterCount, 1);
+        uint8_t scratch[FAT32_MAX_CLUSTER_SIZE];
+        for (uint32_t cluster = FAT32_FIRST_CLUSTER; cluster < fs->clusterCount; cluster++) {
+            if (get_next_cluster(fs, cluster) == FAT32_FREE) continue;
+            const uint8_t* data = fs->pool ? scratch : pinCluster(fs, cluster, false);
+            if (fs->pool && bufpool_read(fs->pool, cluster, scratch) != 0) continue;
+            sums->crcs[cluster] = crc32c(0, data, fs->clusterSize);
+            sums->valid[cluster] = 1;
+        }
+        fs->checksums = sums;
+    } else if (!enabled && fs->checksums) {
+        if (fs->pool) bufpool_set_verifier(fs->pool, NULL, NULL);
+        free(fs->checksums->crcs);
+        free(fs->checksums->valid);
+        free(fs->checksums);
+        fs->checksums = NULL;
+    }
+    fs->verifyReads = enabled && verifyReads;
+    if (fs->pool) bufpool_set_verifier(fs->pool, fs->verifyReads ? verifyLoaded : NULL, fs);
+}
+
+// Check one cluster against its checksum without caching it. Returns 1 if it
+// matches or has no checksum, 0 if it is corrupt and -1 if it cannot be read.
+int fat32_verify_cluster(FAT32_FileSystem* fs, uint32_t cluster) {
+    FAT32_Checksums* sums = fs->checksums;
+    uint8_t scratch[FAT32_MAX_CLUSTER_SIZE];
+    if (!sums || !fat32_valid_cluster(fs, cluster)) return 1;
+
+    // A writer can change the data between our read and its checksum update,
+    // so a mismatch only counts if a second look agrees
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (!sums->valid[cluster]) return 1;
+        uint32_t expected = sums->crcs[cluster];
+        const uint8_t* data = fs->pool ? scratch : pinCluster(fs, cluster, false);
+        if (fs->pool && bufpool_read(fs->pool, cluster, scratch) != 0) return -1;
+        if (crc32c(0, data, fs->clusterSize) == expected) return 1;
+    }
+    __atomic_fetch_add(&sums->errors, 1, __ATOMIC_RELAXED);
+    STATS_INC(STAT_FAT_CHECKSUM_ERRORS);
+    return 0;
+}
+
+// Mismatches found so far by verified reads and fat32_verify_cluster
+uint64_t fat32_checksum_errors(FAT32_FileSystem* fs) {
+    return fs->checksums ? __atomic_load_n(&fs->checksums->errors, __ATOMIC_RELAXED) : 0;
+}
+
+// Report entries whose modificationTime or startCluster changed; one hook per
+// volume. guard, if set, brackets each change and its report. Call before the
+// volume is shared between threads.
+void fat32_set_change_hook(FAT32_FileSystem* fs, FAT32_ChangeHook hook, FAT32_ChangeGuard guard, void* ctx) {
+    fs->onChange = hook;
+    fs->changeGuard = guard;
+    fs->onChangeCtx = ctx;
+}
+
+// With delayed allocation new files stay in memory until fat32_flush, fat32_sync
+// or fat32_flush_entry places them. Turning it off flushes what is staged.
+void fat32_set_delayed_allocation(FAT32_FileSystem* fs, bool enabled) {
+    fs->delayedAllocation = enabled;
+    if (!enabled) fat32_flush(fs);
+}
+
+int fat32_write_dme(FAT32_FileSystem* fs, FAT32_Entry* entry, const void* data, uint64_t size, DistributedNode *node) {
+    requestToken(node);
+    int result = fat32_write(fs, entry, data, size);
+    releaseToken(node);
+    return result;
+}
+
+// Chain walking for the read paths. The readahead stage resolves a run of the
+// chain before any of it is copied, so the copy loop never waits on a FAT lookup.
+// Resolve up to count clusters starting at cluster, leaving *next on the one after
+static uint32_t resolveChain(FAT32_FileSystem* fs, uint32_t cluster, uint32_t* out, uint32_t count, uint32_t* next) {
+    uint32_t resolved = 0;
+    while (resolved < count && fat32_valid_cluster(fs, cluster)) {
+        out[resolved++] = cluster;
+        cluster = get_next_cluster(fs, cluster);
+        STATS_INC(STAT_FAT_READ_HOPS);
+    }
+    *next = cluster;
+    return resolved;
+}
+
+static uint32_t seekChain(FAT32_FileSystem* fs, uint32_t cluster, uint32_t index) {
+    while (index-- > 0 && fat32_valid_cluster(fs, cluster)) {
+        cluster = get_next_cluster(fs, cluster);
+        STATS_INC(STAT_FAT_READ_HOPS);
+    }
+    return cluster;
+}
+
+// Memory mode: pull a cluster toward the cache while earlier clusters are copied.
+// Full temporal locality: a non-temporal hint lets the lines be dropped before
+// the copy (and the checksum) reach them.
+static void prefetchCluster(FAT32_FileSystem* fs, uint32_t cluster) {
+    const uint8_t* data = pinCluster(fs, cluster, false);
+    for (uint32_t line = 0; line < fs->clusterSize; line += FAT32_CACHE_LINE) {
+        __builtin_prefetch(data + line, 0, 3);
+    }
+}
+
+// Copy a resolved segment, skipping skip bytes of its first cluster. Returns the
+// bytes copied, or -1 if a cluster fails verification.
+static int copySegment(FAT32_FileSystem* fs, const uint32_t* segment, uint8_t* const* frames, uint32_t count,
+                       uint32_t skip, uint8_t* buffer, uint64_t length) {
+    uint32_t copied = 0;
+    for (uint32_t i = 0; i < count && copied < length; i++) {
+        uint32_t chunk = fs->clusterSize - skip;
+        if (chunk > length - copied) chunk = (uint32_t)(length - copied);
+        if (frames) {
+            memcpy(buffer + copied, frames[i] + skip, chunk);
+        } else {
+            if (i + FAT32_PREFETCH_DISTANCE < count) prefetchCluster(fs, segment[i + FAT32_PREFETCH_DISTANCE]);
+            const uint8_t* data = pinCluster(fs, segment[i], false);
+            if (!copyVerified(fs, segment[i], data, skip, buffer + copied, chunk)) return -1;
+        }
+        copied += chunk;
+        skip = 0;
+    }
+    return (int)copied;
+}
+
+// Read length bytes at offset into buffer. With ra, a read that continues where the
+// previous one ended doubles the readahead window and, on image-backed volumes,
+// starts asynchronous reads of the clusters that follow it. Returns the bytes
+// copied, or -1 on an I/O error.
+static int64_t readRange(FAT32_FileSystem* fs, FAT32_Entry* entry, uint64_t offset, void* buffer, uint64_t length,
+                         FAT32_Readahead* ra) {
+    if (!entry || !buffer) return -1;
+    if (offset >= entry->fileSize) return 0;
+    if (length > entry->fileSize - offset) length = entry->fileSize - offset;
+    STATS_INC(STAT_FAT_READS);
+
+    if (entry->attributes & ATTR_INLINE) {
+        memcpy(buffer, entry->inlineData + offset, length);
+        return (int64_t)length;
+    }
+    if (entry->staging) {
+        memcpy(buffer, entry->staging->data + offset, length);
+        return (int64_t)length;
+    }
+    if (entry->extentMap) return readCompressed(fs, entry, offset, (uint8_t*)buffer, length);
+
+    bool sequential = ra && ra->window > 0 && ra->startCluster == entry->startCluster && ra->nextOffset == offset;
+    uint32_t window = sequential ? ra->window : FAT32_RA_MIN_WINDOW;
+    // A stream that stopped at the end of the chain seeks once the file has grown past it
+    uint32_t cluster = (sequential && fat32_valid_cluster(fs, ra->nextCluster))
+                           ? ra->nextCluster
+                           : seekChain(fs, entry->startCluster, (uint32_t)(offset / fs->clusterSize));
+    uint32_t skip = offset % fs->clusterSize;
+
+    // Streams that start at the beginning or keep going read past the request
+    bool readBeyond = ra && (sequential || offset == 0);
+
+    // Never pin more than half the pool, and leave a quarter for readahead,
+    // so concurrent readers keep making progress
+    uint32_t batchLimit = FAT32_RA_MAX_WINDOW;
+    uint32_t aheadLimit = 0;
+    if (fs->pool) {
+        batchLimit = fs->pool->frameCount / 2;
+        if (batchLimit > BUFPOOL_BATCH_MAX) batchLimit = BUFPOOL_BATCH_MAX;
+        if (batchLimit == 0) batchLimit = 1;
+        aheadLimit = fs->pool->frameCount / 4;
+    }
+
+    uint32_t segment[BUFPOOL_BATCH_MAX > FAT32_RA_MAX_WINDOW ? BUFPOOL_BATCH_MAX : FAT32_RA_MAX_WINDOW];
+    uint32_t ahead[FAT32_RA_MAX_WINDOW];
+    uint8_t* frames[BUFPOOL_BATCH_MAX];
+    uint8_t* out = (uint8_t*)buffer;
+    uint64_t copied = 0;
+    uint32_t lastCluster = cluster;
+
+    while (copied < length && fat32_valid_cluster(fs, cluster)) {
+        // Clusters still to read, capped so the count fits in 32 bits
+        uint64_t remaining = (skip + (length - copied) + fs->clusterSize - 1) / fs->clusterSize;
+        uint32_t needed = remaining < UINT32_MAX ? (uint32_t)remaining : UINT32_MAX;
+        uint32_t wanted = needed;
+        if (wanted > window) wanted = window;
+        if (wanted > batchLimit) wanted = batchLimit;
+
+        uint32_t next;
+        uint32_t count = resolveChain(fs, cluster, segment, wanted, &next);
+
+        if (fs->pool) {
+            // Start the reads of the following window before blocking on this one
+            uint32_t aheadCount = window;
+            if (!readBeyond && aheadCount > needed - count) aheadCount = needed - count;
+            if (aheadCount > aheadLimit) aheadCount = aheadLimit;
+            if (aheadCount > 0) {
+                uint32_t unused;
+                aheadCount = resolveChain(fs, next, ahead, aheadCount, &unused);
+                STATS_ADD(STAT_FAT_READAHEAD, bufpool_prefetch(fs->pool, ahead, aheadCount));
+            }
+
+            int pinned = bufpool_pin_many(fs->pool, segment, count, frames);
+            if (pinned <= 0) return -1;
+            if ((uint32_t)pinned < count) {
+                // Pool pressure, resume from the first cluster left unpinned
+                next = segment[pinned];
+                count = (uint32_t)pinned;
+            }
+            copied += (uint32_t)copySegment(fs, segment, frames, count, skip, out + copied, length - copied);
+            for (uint32_t i = 0; i < count; i++) {
+                bufpool_unpin(fs->pool, segment[i], false);
+            }
+        } else {
+            for (uint32_t i = 0; i < FAT32_PREFETCH_DISTANCE && i < count; i++) {
+                prefetchCluster(fs, segment[i]);
+            }
+            STATS_ADD(STAT_FAT_READAHEAD, count);
+            int segmentCopied = copySegment(fs, segment, NULL, count, skip, out + copied, length - copied);
+            if (segmentCopied < 0) return -1;
+            copied += (uint32_t)segmentCopied;
+        }
+
+        lastCluster = segment[count - 1];
+        cluster = next;
+        skip = 0;
+        if (window < FAT32_RA_MAX_WINDOW) window *= 2;
+    }
+
+    if (ra) {
+        ra->startCluster = entry->startCluster;
+        ra->nextOffset = offset + copied;
+        ra->nextCluster = (ra->nextOffset % fs->clusterSize == 0) ? cluster : lastCluster;
+        ra->window = window;
+    }
+    return (int64_t)copied;
+}
+
+// Each stripe is a readRange of its own that starts at the stripe's cluster
+static void readStripe(void* ctx, int index) {
+    FAT32_StripedTransfer* transfer = (FAT32_StripedTransfer*)ctx;
+    FAT32_Stripe* stripe = &transfer->stripes[index];
+    FAT32_Readahead ra = { transfer->entry->startCluster, stripe->offset, stripe->cluster, FAT32_RA_MIN_WINDOW };
+    int64_t copied = readRange(transfer->fs, transfer->entry, stripe->offset,
+                               transfer->buffer + (stripe->offset - transfer->base), stripe->length, &ra);
+    if (copied != (int64_t)stripe->length) __atomic_store_n(&transfer->failed, 1, __ATOMIC_RELAXED);
+}
+
+// readRange for large reads of plain cluster chains, striped over the executor
+static int64_t readStriped(FAT32_FileSystem* fs, FAT32_Entry* entry, uint64_t offset, void* buffer, uint64_t length,
+                           FAT32_Readahead* ra) {
+    if (!entry || !buffer || offset >= entry->fileSize || (entry->attributes & ATTR_INLINE) || entry->staging ||
+        entry->extentMap) {
+        return readRange(fs, entry, offset, buffer, length, ra);
+    }
+    if (length > entry->fileSize - offset) length = entry->fileSize - offset;
+    if (!stripesTransfer(fs, length)) return readRange(fs, entry, offset, buffer, length, ra);
+
+    FAT32_StripedTransfer transfer = { fs, entry, (uint8_t*)buffer, offset, NULL, 0 };
+    uint32_t first = seekChain(fs, entry->startCluster, (uint32_t)(offset / fs->clusterSize));
+    int count = planStripes(fs, first, offset, length, &transfer.stripes);
+    executor_run_indexed(fs->stripeExecutor, count, readStripe, &transfer);
+
+    uint64_t copied = 0;
+    for (int i = 0; i < count; i++) copied += transfer.stripes[i].length;
+    if (ra && count > 0 && !transfer.failed) {
+        // Leave the stream where a serial read would have
+        FAT32_Stripe* last = &transfer.stripes[count - 1];
+        ra->startCluster = entry->startCluster;
+        ra->nextOffset = offset + copied;
+        ra->nextCluster = seekChain(fs, last->cluster,
+                                    (uint32_t)(ra->nextOffset / fs->clusterSize - last->offset / fs->clusterSize));
+        ra->window = FAT32_RA_MAX_WINDOW;
+    }
+    free(transfer.stripes);
+    return transfer.failed ? -1 : (int64_t)copied;
+}
+
+// Reads run inside an epoch, so a chain a relocation replaces under them stays
+// allocated until they are done with it
+int64_t fat32_read_range(FAT32_FileSystem* fs, FAT32_Entry* entry, uint64_t offset, void* buffer, uint64_t length,
+                         FAT32_Readahead* ra) {
+    TRACE_BEGIN(TRACE_FAT_READ, length);
+    uint32_t* readers = enterEpoch(fs);
+    int64_t result = readStriped(fs, entry, offset, buffer, length, ra);
+    exitEpoch(readers);
+    TRACE_END(TRACE_FAT_READ);
+    return result;
+}
+
 void* fat32_read(FAT32_FileSystem* fs, FAT32_Entry* entry) {
     if (!entry || entry->fileSize == 0) return NULL;
-    
+
     uint8_t* buffer = (uint8_t*)malloc(entry->fileSize);
+    if (fat32_read_range(fs, entry, 0, buffer, entry->fileSize, NULL) < 0) {
+        free(buffer);
+        return NULL;
+    }
+    return buffer;
+}
+
+// Asynchronous reads: one request per file, one counter per outstanding cluster read
+typedef struct FAT32_AsyncRead {
+    void* userData;
+    uint32_t outstanding;     // Cluster reads not yet completed, plus one while submitting
+    int64_t result;           // File size, or the first error seen
+    uint32_t* epochReaders;   // Held until the last cluster read completes
+    struct FAT32_AsyncRead* next;
+} FAT32_AsyncRead;
+
+static void finishAsyncPart(FAT32_FileSystem* fs, FAT32_AsyncRead* req, int result) {
+    pthread_mutex_lock(&fs->asyncMutex);
+    if (result < 0 && req->result >= 0) req->result = result;
+    if (--req->outstanding == 0) {
+        exitEpoch(req->epochReaders);
+        req->next = NULL;
+        if (fs->finishedTail) fs->finishedTail->next = req;
+        else fs->finishedHead = req;
+        fs->finishedTail = req;
+    }
+    pthread_mutex_unlock(&fs->asyncMutex);
+}
+
+// Retire cluster completions into their file requests
+static int drainAsync(FAT32_FileSystem* fs, int minWait) {
+    AioCompletion done[BUFPOOL_BATCH_MAX];
+    int n = aio_reap(fs->aio, done, BUFPOOL_BATCH_MAX, minWait);
+    for (int i = 0; i < n; i++) {
+        finishAsyncPart(fs, (FAT32_AsyncRead*)done[i].userData, done[i].result);
+    }
+    return n;
+}
+
+// Start reading a whole file into buffer (at least fileSize bytes). Every cluster
+// read of the file is queued before a single submission; the request finishes
+// through fat32_reap with userData. Returns 0 when queued, -1 on bad arguments.
+int fat32_read_async(FAT32_FileSystem* fs, FAT32_Entry* entry, void* buffer, void* userData) {
+    if (!entry || !buffer) return -1;
+    STATS_INC(STAT_FAT_READS);
+
+    FAT32_AsyncRead* req = (FAT32_AsyncRead*)malloc(sizeof(FAT32_AsyncRead));
+    req->userData = userData;
+    req->outstanding = 1;
+    req->result = (int64_t)entry->fileSize;
+    req->epochReaders = enterEpoch(fs);
+    req->next = NULL;
+
     uint32_t cluster = entry->startCluster;
-    uint32_t remaining = entry->fileSize;
-    uint8_t* current = buffer;
-    
-    while (remaining > 0 && cluster != 0xFFFFFFFF) {
-        uint32_t sector = cluster_to_sector(fs, cluster);
-        uint32_t readSize = (remaining < CLUSTER_SIZE) ? remaining : CLUSTER_SIZE;
-        
-        memcpy(current, fs->data + sector * SECTOR_SIZE, readSize);
-        
+    uint64_t remaining = entry->fileSize;
+    if (entry->attributes & ATTR_INLINE) {
+        memcpy(buffer, entry->inlineData, remaining);
+        remaining = 0;
+    } else if (entry->staging) {
+        memcpy(buffer, entry->staging->data, remaining);
+        remaining = 0;
+    } else if (entry->extentMap) {
+        if (readCompressed(fs, entry, 0, (uint8_t*)buffer, remaining) < 0) req->result = -EIO;
+        remaining = 0;
+    } else if (fs->pool && fs->verifyReads) {
+        // Raw cluster reads would bypass the pool's verifier, take the verified batched path
+        if (fat32_read_range(fs, entry, 0, buffer, remaining, NULL) < 0) req->result = -EIO;
+        remaining = 0;
+    }
+    uint8_t* current = (uint8_t*)buffer;
+
+    while (remaining > 0 && fat32_valid_cluster(fs, cluster)) {
+        uint32_t readSize = (remaining < fs->clusterSize) ? (uint32_t)remaining : fs->clusterSize;
+
+        if (!fs->pool) {
+            const uint8_t* data = pinCluster(fs, cluster, false);
+            if (!verifyRead(fs, cluster, data)) req->result = -EIO;
+            memcpy(current, data, readSize);
+        } else if (!bufpool_copy_resident(fs->pool, cluster, current, readSize)) {
+            pthread_mutex_lock(&fs->asyncMutex);
+            req->outstanding++;
+            pthread_mutex_unlock(&fs->asyncMutex);
+
+            uint64_t offset = cluster_to_sector(fs, cluster) * SECTOR_SIZE;
+            while (aio_prep_read(fs->aio, current, readSize, offset, req) != 0) {
+                // Queue full, make room by retiring finished cluster reads
+                aio_submit(fs->aio);
+                drainAsync(fs, 1);
+            }
+        }
+
         current += readSize;
         remaining -= readSize;
         cluster = get_next_cluster(fs, cluster);
+        STATS_INC(STAT_FAT_READ_HOPS);
     }
-    
-    return buffer;
+
+    if (fs->aio) aio_submit(fs->aio);
+    finishAsyncPart(fs, req, 0);
+    return 0;
+}
+
+// Collect up to max finished file reads; with wait, block until at least one
+// finishes or nothing is outstanding
+int fat32_reap(FAT32_FileSystem* fs, FAT32_Completion* out, int max, bool wait) {
+    while (1) {
+        if (fs->aio) drainAsync(fs, 0);
+
+        int reaped = 0;
+        pthread_mutex_lock(&fs->asyncMutex);
+        while (reaped < max && fs->finishedHead) {
+            FAT32_AsyncRead* req = fs->finishedHead;
+            fs->finishedHead = req->next;
+            if (!fs->finishedHead) fs->finishedTail = NULL;
+            out[reaped].userData = req->userData;
+            out[reaped].result = req->result;
+            reaped++;
+            free(req);
+        }
+        pthread_mutex_unlock(&fs->asyncMutex);
+
+        if (reaped > 0 || !wait) return reaped;
+        if (!fs->aio || aio_pending(fs->aio) == 0) return 0;
+        drainAsync(fs, 1);
+    }
+}
+
+// File handles: a cursor over one entry. Sequential reads continue from the
+// readahead state and sequential writes from the write cursor, so neither walks
+// the chain from startCluster again, and callers only ever need a buffer the
+// size of one read or write.
+FAT32_File* fat32_open(FAT32_FileSystem* fs, FAT32_Entry* entry) {
+    if (!entry) return NULL;
+    FAT32_File* file = (FAT32_File*)calloc(1, sizeof(FAT32_File));
+    file->fs = fs;
+    file->entry = entry;
+    return file;
+}
+
+// Read up to length bytes at the cursor, returns the bytes read (0 at the end of
+// the file) or -1 on an I/O error
+int64_t fat32_file_read(FAT32_File* file, void* buffer, uint64_t length) {
+    int64_t result = fat32_read_range(file->fs, file->entry, file->position, buffer, length, &file->ra);
+    if (result > 0) file->position += (uint64_t)result;
+    return result;
+}
+
+// Write length bytes at the cursor, growing the file when the write runs past
+// its end. Returns length, or -1 if the write failed.
+int64_t fat32_file_write(FAT32_File* file, const void* data, uint64_t length) {
+    if (length > INT64_MAX) return -1;
+    if (!writeRange(file->fs, file->entry, file->position, data, length, &file->cursor)) return -1;
+    file->position += length;
+    return (int64_t)length;
+}
+
+// Move the cursor to the end of the file, then write there
+int64_t fat32_file_append(FAT32_File* file, const void* data, uint64_t length) {
+    file->position = file->entry->fileSize;
+    return fat32_file_write(file, data, length);
+}
+
+// Move the cursor, at most to the end of the file. Returns 0, or -1 if position is past it.
+int fat32_file_seek(FAT32_File* file, uint64_t position) {
+    if (position > file->entry->fileSize) return -1;
+    file->position = position;
+    return 0;
+}
+
+// Release the handle. A staged file is placed now that its size is final, so it
+// gets one contiguous run. Returns 1, or 0 if that placement failed.
+int fat32_close(FAT32_File* file) {
+    int result = fat32_flush_entry(file->fs, file->entry);
+    free(file);
+    return result;
 }
 
 int fat32_delete(FAT32_FileSystem* fs, FAT32_Entry* entry) {
     if (!entry) return 0;
     
+    if (entry->staging) unstageEntry(fs, entry);
     free_clusters(fs, entry->startCluster);
+    free(entry->extentMap);
     free(entry);
     
     return 1;
 }
 
 void fat32_cleanup(FAT32_FileSystem* fs) {
+    while (fs->retired) {
+        // No reader outlives the volume, retired chains go back before the sync
+        FAT32_RetiredChain* chain = fs->retired;
+        fs->retired = chain->next;
+        free_clusters(fs, chain->startCluster);
+        free(chain->extentMap);
+        free(chain);
+    }
+    if (fs->pool) {
+        fat32_sync(fs);
+        bufpool_destroy(fs->pool);
+    }
+    if (fs->aio) aio_destroy(fs->aio);
+    if (fs->imageFd >= 0) close(fs->imageFd);
+    while (fs->stagedHead) {
+        // In-memory volume going away, staged data goes with it
+        unstageEntry(fs, fs->stagedHead->entry);
+    }
+    if (fs->dedup) {
+        pthread_mutex_destroy(&fs->dedup->mutex);
+        free(fs->dedup->fingerprints);
+        free(fs->dedup->refCounts);
+        free(fs->dedup->nextInBucket);
+        free(fs->dedup->buckets);
+        free(fs->dedup);
+    }
+    if (fs->checksums) {
+        free(fs->checksums->crcs);
+        free(fs->checksums->valid);
+        free(fs->checksums);
+    }
+    pthread_mutex_destroy(&fs->asyncMutex);
+    pthread_mutex_destroy(&fs->retiredMutex);
+    pthread_mutex_destroy(&fs->stagedMutex);
+    free(fs->epochSlots);
+    for (uint32_t i = 0; i < fs->groupCount; i++) pthread_mutex_destroy(&fs->groups[i].mutex);
+    free(fs->groups);
     free(fs->fatTable);
+    free(fs->fatDirty);
     free(fs->data);
-    free(fs->bitmap);
     free(fs);
 }
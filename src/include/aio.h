@@ -0,0 +1,59 @@
+#ifndef AIO_H
+#define AIO_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#define AIO_DEFAULT_DEPTH 256
+
+// Finished request returned by aio_reap()
+typedef struct {
+    void* userData;           // Value passed when the request was prepared
+    int result;               // Bytes transferred, or -errno
+} AioCompletion;
+
+// Asynchronous positional I/O on one file: io_uring when the kernel allows it,
+// otherwise requests run synchronously with pread/pwrite at prepare time
+typedef struct {
+    int fd;                   // File all requests target
+    bool uring;               // io_uring active, false when using the fallback
+    unsigned depth;           // Maximum requests prepared or in flight
+    unsigned queued;          // Prepared but not yet submitted
+    unsigned inflight;        // Submitted but not yet reaped
+
+    // io_uring state
+    int ringFd;
+    void* sqRing;
+    size_t sqRingSize;
+    void* cqRing;
+    size_t cqRingSize;
+    void* sqes;
+    size_t sqesSize;
+    unsigned* sqTail;
+    unsigned* sqMask;
+    unsigned* sqArray;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned* cqMask;
+    void* cqes;
+
+    // Fallback completions, a ring of depth entries
+    AioCompletion* done;
+    unsigned doneHead;
+    unsigned doneCount;
+
+    pthread_mutex_t mutex;    // Serializes preparation, submission and reaping
+} AioContext;
+
+// Core function declarations
+AioContext* aio_create(int fd, unsigned depth);
+int aio_prep_read(AioContext* ctx, void* buffer, uint32_t length, uint64_t offset, void* userData);
+int aio_prep_write(AioContext* ctx, const void* buffer, uint32_t length, uint64_t offset, void* userData);
+int aio_submit(AioContext* ctx);
+int aio_reap(AioContext* ctx, AioCompletion* out, int max, int minWait);
+unsigned aio_pending(AioContext* ctx);
+void aio_destroy(AioContext* ctx);
+
+#endif // AIO_H
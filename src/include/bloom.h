@@ -0,0 +1,58 @@
+#ifndef BLOOM_H
+#define BLOOM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "bptree.h"
+
+#define BLOOM_BITS_PER_KEY 10         // About 1% false positives at capacity
+#define BLOOM_HASHES 7                // Bits set per key, all inside one block
+#define BLOOM_BLOCK_WORDS 8           // 512-bit blocks, one cache line each
+#define BLOOM_REBUILD_DIVISOR 4       // Rebuild once deletes reach a quarter of the keys
+
+// One bit array. Arrays replaced by a resize stay on the retired list until the
+// filter is destroyed, since a lock-free reader may still be probing them.
+typedef struct BloomBits {
+    struct BloomBits* retired;        // Next retired array
+    uint32_t capacity;                // Keys the array is sized for
+    uint32_t blockMask;               // Number of blocks - 1
+    uint64_t words[];
+} BloomBits;
+
+// Blocked Bloom filter over a tree's keys, probed without the tree lock. Two
+// arrays alternate: a rebuild fills the inactive one from a scan and then
+// publishes it by bumping generation, and a reader that sees generation change
+// while it probed ignores its answer and asks the tree.
+typedef struct BloomFilter {
+    BloomBits* bits[2];               // Active array is bits[generation & 1]
+    uint64_t generation;
+    uint32_t keys;                    // Keys added since the last build, under the tree's write lock
+    uint32_t deletes;                 // Keys removed since the last build, leave stale bits behind
+    uint64_t rebuilds;
+    BloomBits* retired;               // Arrays replaced by a resize
+    pthread_mutex_t rebuildMutex;     // One rebuild at a time
+} BloomFilter;
+
+typedef struct {
+    uint32_t capacity;                // Keys the active array is sized for
+    uint32_t keys;
+    uint32_t deletes;
+    uint64_t rebuilds;
+    uint64_t bytes;                   // Size of the active array
+} BloomStats;
+
+// Core function declarations
+void bloom_enable(BPTree* tree, uint32_t expectedKeys);
+bool bloom_may_contain(BPTree* tree, const char* key);
+void bloom_rebuild(BPTree* tree);
+void bloom_get_stats(BPTree* tree, BloomStats* out);
+void bloom_destroy(BPTree* tree);
+
+// Maintenance, bloom_add and bloom_removed under the tree's write lock,
+// bloom_maintain after it is released
+void bloom_add(BPTree* tree, const char* key);
+void bloom_removed(BPTree* tree);
+void bloom_maintain(BPTree* tree);
+
+#endif // BLOOM_H
@@ -5,12 +5,13 @@
 #include <stdint.h>
 #include <pthread.h>
 #include "fat32.h"
+#include "slotmap.h"
 
 // Constants for B+ Tree configuration
 #define MAX_KEYS 4
 #define MIN_KEYS (MAX_KEYS/2)
 #define MAX_FILENAME 256
-#define BITMAP_SIZE 1024
+#define BITMAP_SIZE 1024                 // Initial directory-entry slot bitmap, in bytes
 
 // Node structure for B+ Tree
 typedef struct BPTreeNode {
@@ -20,29 +21,55 @@ typedef struct BPTreeNode {
     FAT32_Entry* values[MAX_KEYS];       // Array of FAT32 entries
     struct BPTreeNode* children[MAX_KEYS + 1];  // Pointers to child nodes
     struct BPTreeNode* next;             // Pointer to next leaf (for leaf nodes)
-    uint32_t bitmapAddress;              // Bitmap location for directory entries
 } BPTreeNode;
 
 // B+ Tree structure
 typedef struct {
     BPTreeNode* root;                    // Pointer to root node
     pthread_rwlock_t lock;               // Read-write lock for thread safety
-    uint8_t* bitmap;                     // Bitmap for directory management
-    uint32_t bitmapSize;                 // Size of bitmap in bytes
+    SlotMap slots;                       // Directory-entry slots, one per indexed entry
     FAT32_FileSystem* fs;                // Pointer to FAT32 file system
+    int height;                          // Number of levels, 1 for a lone leaf root
+    uint32_t nextDirectoryId;            // Id handed to the next directory created
+    struct BPTreeIndexes* indexes;       // Secondary indexes (index.h), NULL when none are kept
+    bool secondary;                      // Index over another tree's entries: takes no slots
+    struct BloomFilter* bloom;           // Filter of the keys (bloom.h), NULL when not kept
 } BPTree;
 
+// Callback for ordered scans, return false to stop early
+typedef bool (*BPTreeVisitor)(const char* key, FAT32_Entry* value, void* ctx);
+
+// Condition of insertIfAbsent and deleteIf, run with the write lock held on the
+// entry to be stored or removed; return false to leave the tree as it is. With
+// indexes kept it must not write to the volume, see fat32_set_change_hook.
+typedef bool (*BPTreeCheck)(BPTree* tree, FAT32_Entry* value, void* ctx);
+
+// Condition of renameEntryIf, run with the write lock held on the entry to move
+// and the one under the new key (NULL if free); return false to move nothing.
+// The same restriction on writes applies.
+typedef bool (*BPTreeRenameCheck)(BPTree* tree, FAT32_Entry* moved, FAT32_Entry* target, void* ctx);
+
 // Core function declarations
 BPTree* initializeBPTree(FAT32_FileSystem* fs);
 void insert(BPTree* tree, const char* key, FAT32_Entry* value);
 FAT32_Entry* search(BPTree* tree, const char* key);
+int scan(BPTree* tree, const char* startKey, int maxCount, BPTreeVisitor visit, void* ctx);
 void delete(BPTree* tree, const char* key);
+bool insertIfAbsent(BPTree* tree, const char* key, FAT32_Entry* value, BPTreeCheck check, void* ctx);
+bool deleteIf(BPTree* tree, const char* key, BPTreeCheck check, void* ctx, FAT32_Entry** removed);
 bool update(BPTree* tree, const char* oldKey, const char* newKey, FAT32_Entry* newValue);
+FAT32_Entry* upsert(BPTree* tree, const char* key, FAT32_Entry* value);
+bool renameEntry(BPTree* tree, const char* oldKey, const char* newKey, FAT32_Entry** replaced);
+bool renameEntryIf(BPTree* tree, const char* oldKey, const char* newKey, BPTreeRenameCheck check, void* ctx,
+                   FAT32_Entry** replaced);
 void destroyBPTree(BPTree* tree);
 
 // Helper function declarations
 BPTreeNode* findLeaf(BPTreeNode* root, const char* key);
+FAT32_Entry* searchLocked(BPTree* tree, const char* key);
+bool containsPrefix(BPTree* tree, const char* prefix);
 void splitLeaf(BPTreeNode* parent, int index, BPTreeNode* child);
+void splitInternal(BPTreeNode* parent, int index, BPTreeNode* child);
 void mergeNodes(BPTreeNode* leftNode, BPTreeNode* rightNode);
 void borrowFromLeft(BPTreeNode* node, BPTreeNode* leftSibling, BPTreeNode* parent, int index);
 void borrowFromRight(BPTreeNode* node, BPTreeNode* rightSibling, BPTreeNode* parent, int index);
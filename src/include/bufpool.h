@@ -0,0 +1,74 @@
+#ifndef BUFPOOL_H
+#define BUFPOOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "aio.h"
+
+#define BUFPOOL_NO_FRAME 0xFFFFFFFF
+#define BUFPOOL_BATCH_MAX 64      // Clusters handled by one batched call
+
+// One cluster-sized cache slot
+typedef struct {
+    uint32_t cluster;         // Cluster held by the frame, BUFPOOL_NO_FRAME when empty
+    uint32_t pinCount;        // Active users, pinned frames are never evicted
+    uint32_t nextInBucket;    // Next frame in the same hash bucket
+    bool dirty;               // Modified since it was loaded or written back
+    bool referenced;          // CLOCK reference bit
+    bool loading;             // Read still in flight, pins wait for it
+    bool ioError;             // Last read of the frame failed
+} BufferFrame;
+
+// Hit/miss counters reported by bufpool_get_stats()
+typedef struct {
+    uint64_t hits;            // Pins served from a resident frame
+    uint64_t misses;          // Pins that had to claim a frame
+    uint64_t reads;           // Clusters read from the image
+    uint64_t writebacks;      // Dirty clusters written to the image
+    uint64_t evictions;       // Frames reclaimed by the CLOCK hand
+    uint64_t prefetches;      // Clusters read ahead by bufpool_prefetch()
+    uint64_t verifyFailures;  // Clusters rejected by the verifier
+    uint32_t frameCount;      // Capacity of the pool in clusters
+    uint32_t residentFrames;  // Frames currently holding a cluster
+    uint32_t dirtyFrames;     // Frames waiting for write-back
+} BufferPoolStats;
+
+// Returns false if a cluster read from the image is corrupt
+typedef bool (*BufferPoolVerifier)(void* ctx, uint32_t cluster, const uint8_t* data);
+
+// Fixed-size cache of clusters in front of an image file
+typedef struct {
+    int fd;                   // Image file descriptor
+    uint64_t dataOffset;      // Byte offset of cluster 2 in the image
+    uint32_t clusterSize;     // Frame size in bytes
+    uint32_t frameCount;      // Number of frames
+    uint8_t* memory;          // frameCount * clusterSize bytes of frame data
+    BufferFrame* frames;      // Frame descriptors
+    uint32_t* buckets;        // Hash table heads, cluster -> first frame
+    uint32_t bucketMask;      // Number of buckets - 1
+    uint32_t clockHand;       // Next frame the CLOCK hand inspects
+    AioContext* aio;          // Batches misses and write-backs into single submissions
+    BufferPoolVerifier verify; // Checks each cluster as it is read, NULL when unset
+    void* verifyCtx;          // Passed to verify
+    BufferPoolStats stats;    // Counters, protected by mutex
+    pthread_mutex_t mutex;    // Protects frames, buckets and stats
+} BufferPool;
+
+// Core function declarations
+BufferPool* bufpool_create(int fd, uint64_t dataOffset, uint32_t clusterSize, uint32_t frameCount);
+uint8_t* bufpool_pin(BufferPool* pool, uint32_t cluster, bool overwrite);
+int bufpool_pin_many(BufferPool* pool, const uint32_t* clusters, uint32_t count, uint8_t** out);
+int bufpool_prefetch(BufferPool* pool, const uint32_t* clusters, uint32_t count);
+int bufpool_write_through(BufferPool* pool, const uint32_t* clusters, const uint8_t* const* buffers, uint32_t count);
+int bufpool_read(BufferPool* pool, uint32_t cluster, void* dest);
+bool bufpool_copy_resident(BufferPool* pool, uint32_t cluster, void* dest, uint32_t length);
+void bufpool_unpin(BufferPool* pool, uint32_t cluster, bool dirty);
+void bufpool_discard(BufferPool* pool, uint32_t cluster);
+int bufpool_flush(BufferPool* pool);
+void bufpool_set_verifier(BufferPool* pool, BufferPoolVerifier verify, void* ctx);
+void bufpool_get_stats(BufferPool* pool, BufferPoolStats* out);
+void bufpool_reset_stats(BufferPool* pool);
+void bufpool_destroy(BufferPool* pool);
+
+#endif // BUFPOOL_H
@@ -0,0 +1,52 @@
+#ifndef CLIENT_H
+#define CLIENT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "protocol.h"
+
+// One response handed out by fsclient_next(). data points into the client's
+// buffer and stays valid until the next call on the same client.
+typedef struct {
+    uint32_t id;
+    int32_t status;
+    const uint8_t* data;
+    uint32_t length;
+} FsResponse;
+
+// Connection to a server started with server_start. Requests are queued in
+// the output buffer, sent together by fsclient_flush and answered in order.
+typedef struct {
+    int fd;
+    uint8_t* out;
+    uint32_t outLength;
+    uint32_t outCapacity;
+    uint8_t* in;
+    uint32_t inLength;
+    uint32_t inUsed;          // Bytes of in already handed out
+    uint32_t inCapacity;
+    uint32_t nextId;
+    uint32_t pending;         // Requests sent or queued and not yet answered
+} FsClient;
+
+// Core function declarations
+FsClient* fsclient_connect(const char* path);
+void fsclient_close(FsClient* client);
+
+// Pipelining: queue any number of requests, flush, then collect one response per request
+uint32_t fsclient_queue(FsClient* client, uint8_t opcode, uint8_t flags, const char* key, uint64_t offset,
+                        uint32_t count, const void* data, uint32_t length);
+int fsclient_flush(FsClient* client);
+int fsclient_next(FsClient* client, FsResponse* out);
+
+// Blocking calls, each one round trip. Negative results are -errno.
+int fsclient_create(FsClient* client, const char* key, const void* data, uint32_t length);
+int fsclient_read(FsClient* client, const char* key, uint64_t offset, void* buffer, uint32_t length);
+int fsclient_write(FsClient* client, const char* key, uint64_t offset, const void* data, uint32_t length);
+int fsclient_append(FsClient* client, const char* key, const void* data, uint32_t length);
+int fsclient_delete(FsClient* client, const char* key);
+int fsclient_stat(FsClient* client, const char* key, FsStat* out);
+int fsclient_list(FsClient* client, const char* prefix, uint32_t max,
+                  bool (*visit)(const char* key, uint64_t size, void* ctx), void* ctx);
+
+#endif // CLIENT_H
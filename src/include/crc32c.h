@@ -0,0 +1,18 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// CRC-32C (Castagnoli), the checksum used by iSCSI, ext4 and btrfs metadata.
+// Uses the SSE4.2 crc32 instruction when the CPU has it, folding long inputs with
+// pclmul carry-less multiplies where available, and a table otherwise.
+#define CRC32C_POLY 0x82F63B78    // Reflected polynomial
+
+// Core function declarations
+uint32_t crc32c(uint32_t crc, const void* data, size_t length);
+uint32_t crc32c_copy(uint32_t crc, void* dest, const void* src, size_t length);
+bool crc32c_hardware(void);
+
+#endif // CRC32C_H
@@ -0,0 +1,49 @@
+#ifndef DEFRAG_H
+#define DEFRAG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "bptree.h"
+
+#define DEFRAG_DEFAULT_IDLE_MS 1000   // Pause after a pass that found nothing to move
+
+// Fragmentation of the files indexed by a tree
+typedef struct {
+    uint32_t files;           // Entries that own clusters
+    uint32_t fragmentedFiles; // Entries whose chain has more than one extent
+    uint64_t clusters;        // Clusters owned by those entries
+    uint64_t extents;         // Contiguous runs over all their chains
+} DefragReport;
+
+// Tuning for defrag_start and defrag_run, zero fields pick the defaults
+typedef struct {
+    uint32_t clustersPerSecond;   // Copy budget, 0 copies as fast as possible
+    uint32_t idleMillis;          // Sleep between passes once everything is contiguous
+} DefragConfig;
+
+// Background defragmenter: walks the tree's leaves, moves fragmented chains into
+// contiguous free runs and hands the old chains to fat32_reclaim
+typedef struct {
+    BPTree* tree;
+    DefragConfig config;
+    pthread_t thread;
+    bool running;             // Background thread started
+    bool stopping;            // Set by defrag_stop
+    bool idle;                // Last pass found nothing to move
+    uint64_t filesMoved;
+    uint64_t clustersMoved;
+    uint32_t passes;
+    pthread_mutex_t mutex;    // Protects the flags and counters
+    pthread_cond_t cond;      // Wakes throttle sleeps on stop, and idle waiters
+} Defragmenter;
+
+// Core function declarations
+void defrag_measure(BPTree* tree, DefragReport* out);
+double defrag_extents_per_file(const DefragReport* report);
+uint64_t defrag_run(BPTree* tree, const DefragConfig* config);
+Defragmenter* defrag_start(BPTree* tree, const DefragConfig* config);
+void defrag_wait_idle(Defragmenter* defrag);
+void defrag_stop(Defragmenter* defrag);
+
+#endif // DEFRAG_H
@@ -0,0 +1,27 @@
+#ifndef DIRECTORY_H
+#define DIRECTORY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "bptree.h"
+
+// Hierarchical namespace on top of the B+ Tree. Every entry is keyed by its
+// parent directory id and its own name, so resolving a path costs one tree
+// lookup per component and a directory's children form one contiguous key range.
+
+#define DIR_SEPARATOR '/'
+#define DIR_KEY_PREFIX 9                            // "%08x/" parent id prefix
+#define DIR_MAX_NAME (MAX_FILENAME - DIR_KEY_PREFIX - 1)
+
+// Core function declarations
+FAT32_Entry* dir_lookup(BPTree* tree, const char* path);
+FAT32_Entry* dir_mkdir(BPTree* tree, const char* path);
+FAT32_Entry* dir_create(BPTree* tree, const char* path, uint64_t size);
+int dir_list(BPTree* tree, const char* path, BPTreeVisitor visit, void* ctx);
+int dir_remove(BPTree* tree, const char* path);
+int dir_rename(BPTree* tree, const char* from, const char* to);
+
+// Helper function declarations
+void dir_make_key(char* key, uint32_t parentId, const char* name);
+
+#endif // DIRECTORY_H
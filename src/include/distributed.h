@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdatomic.h>
 #include <pthread.h>
 #include "bptree.h"
 #include "fat32.h"  
@@ -26,6 +27,17 @@ typedef struct {
     pthread_cond_t cond;        // Condition variable for signaling
 } PriorityQueue;
 
+// Token ring shared by all nodes of one simulated system
+typedef struct {
+    pthread_mutex_t mutex;        // Protects the token state
+    pthread_cond_t cond;          // Signaled whenever the token moves or is freed
+    int holder;                   // ID of the node currently holding the token
+    bool busy;                    // Whether the holder is inside its critical section
+    int totalNodes;               // Number of nodes in the ring
+    bool requesting[MAX_NODES];   // Nodes waiting for the token
+    bool verbose;                 // Print every acquire, release and pass
+} TokenRing;
+
 // Distributed node structure
 typedef struct {
     int nodeId;               // ID of this node
@@ -35,15 +47,23 @@ typedef struct {
     PriorityQueue* queue;     // Priority queue for managing tasks
     BPTree* sharedTree;       // Pointer to shared B+Tree
     FAT32_FileSystem* sharedFS; // Pointer to shared FAT32 file system
+    TokenRing* ring;          // Token ring this node belongs to (NULL when standalone)
+    int tokenDepth;           // Nesting depth of requestToken calls
+    atomic_bool scheduled;    // Whether the node is queued on or running in an executor
 } DistributedNode;
 
 // Function declarations
 DistributedNode* initializeNode(int nodeId, int totalNodes, bool initialToken, BPTree* tree, FAT32_FileSystem* fs);
+TokenRing* initializeTokenRing(DistributedNode** nodes, int totalNodes);
+void destroyTokenRing(TokenRing* ring);
 void requestToken(DistributedNode* node);
-void releaseToken(DistributedNode* node);
+int postTokenRequest(DistributedNode* node);
+int releaseToken(DistributedNode* node);
 
 // Priority queue operations
 void enqueue(PriorityQueue* queue, Task task); // Add a task to the priority queue
 Task dequeue(PriorityQueue* queue);            // Remove the highest-priority task
+bool tryDequeue(PriorityQueue* queue, Task* task); // Non-blocking dequeue, false if empty
+int queueSize(PriorityQueue* queue);           // Current number of queued tasks
 
 #endif // DISTRIBUTED_H
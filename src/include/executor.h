@@ -0,0 +1,55 @@
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "distributed.h"
+
+// Tasks a node runs per scheduling turn before yielding its worker
+#define EXECUTOR_NODE_BATCH 8
+#define EXECUTOR_DEQUE_INITIAL 64
+
+typedef void (*JobFunc)(void* arg);
+typedef void (*IndexFunc)(void* ctx, int index);
+typedef void (*TaskHandler)(DistributedNode* node, Task task);
+
+// Unit of work scheduled on the pool
+typedef struct {
+    JobFunc fn;
+    void* arg;
+} Job;
+
+// Per-worker double-ended queue: the owner works at the tail, thieves take from the head
+typedef struct {
+    Job* jobs;                // Ring buffer of jobs
+    int capacity;             // Ring buffer capacity (power of two)
+    int head;                 // Index of the oldest job
+    int count;                // Number of jobs in the deque
+    pthread_mutex_t mutex;    // Protects the deque
+} WorkDeque;
+
+// Work-stealing thread pool
+typedef struct Executor {
+    int numWorkers;           // Number of worker threads
+    pthread_t* threads;       // Worker thread handles
+    WorkDeque* deques;        // One deque per worker
+    TaskHandler taskHandler;  // Callback used for node tasks
+    atomic_int queued;        // Jobs sitting in deques
+    atomic_int pending;       // Jobs submitted but not yet finished
+    atomic_uint nextDeque;    // Round-robin cursor for submits from outside the pool
+    atomic_bool stopping;     // Set when the pool is shutting down
+    pthread_mutex_t idleMutex;
+    pthread_cond_t workCond;  // Signaled when new work is queued
+    pthread_cond_t doneCond;  // Signaled when pending drops to zero
+} Executor;
+
+// Core function declarations
+Executor* executor_create(int numWorkers, TaskHandler handler);
+void executor_submit(Executor* ex, JobFunc fn, void* arg);
+void executor_submit_task(Executor* ex, DistributedNode* node, Task task);
+void executor_run_indexed(Executor* ex, int count, IndexFunc fn, void* ctx);
+void executor_wait_idle(Executor* ex);
+void executor_destroy(Executor* ex);
+
+#endif // EXECUTOR_H
@@ -1,14 +1,62 @@
 #ifndef FAT32_H
 #define FAT32_H
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <time.h>
+#include <pthread.h>
+#include "aio.h"
+#include "bufpool.h"
 
 // FAT32 constants
 #define SECTOR_SIZE 512
-#define CLUSTER_SIZE 4096
+#define CLUSTER_SIZE 4096             // Smallest cluster, volumes up to about 1TB use it
+#define FAT32_MAX_CLUSTER_SIZE 65536  // 128 sectors per cluster, FAT32's largest cluster
 #define MAX_FILENAME 256
 #define FAT_ENTRY_SIZE 32
+#define FAT32_IMAGE_MAGIC "BPTFAT32"
+#define FAT32_IMAGE_VERSION 4
+
+// FAT entry values, only the low 28 bits of an entry are significant. Larger
+// volumes get larger clusters to stay within FAT32_MAX_CLUSTERS.
+#define FAT32_ENTRY_MASK 0x0FFFFFFF
+#define FAT32_FREE       0x00000000
+#define FAT32_BAD        0x0FFFFFF7
+#define FAT32_EOC_MIN    0x0FFFFFF8   // Any value from here up ends a chain
+#define FAT32_EOC        0x0FFFFFFF   // End-of-chain value written by this driver
+#define FAT32_MEDIA      0x0FFFFFF8   // Entry 0, media descriptor 0xF8
+#define FAT32_FIRST_CLUSTER 2         // Entries 0 and 1 are reserved
+#define FAT32_MAX_CLUSTERS FAT32_BAD  // FAT entries a volume can have, cluster numbers stay below FAT32_BAD
+
+// FSInfo sector signatures
+#define FSINFO_LEAD_SIGNATURE   0x41615252
+#define FSINFO_STRUCT_SIGNATURE 0x61417272
+#define FSINFO_TRAIL_SIGNATURE  0xAA550000
+#define FSINFO_UNKNOWN          0xFFFFFFFF
+#define DIR_ROOT_ID 1               // Directory id of the namespace root
+
+// Readahead tuning
+#define FAT32_RA_MIN_WINDOW 4       // Clusters resolved ahead when a stream starts
+#define FAT32_RA_MAX_WINDOW 64      // Upper bound of the adaptive window
+#define FAT32_PREFETCH_DISTANCE 2   // Clusters between the copy and its software prefetch
+#define FAT32_CACHE_LINE 64
+
+// Small files are kept in their entry instead of a cluster
+#define FAT32_INLINE_CAPACITY 64    // Bytes of data an entry can hold
+
+// Transparent compression works on extents of this many clusters of raw bytes
+#define FAT32_COMPRESS_CLUSTERS 16
+
+// Large transfers are split into stripes of this many clusters and run in parallel
+#define FAT32_STRIPE_CLUSTERS 256
+#define FAT32_STRIPE_THRESHOLD (2 * FAT32_STRIPE_CLUSTERS * CLUSTER_SIZE)  // Default smallest striped transfer
+
+// Readers announce themselves in one of this many slots, threads are spread over them
+#define FAT32_EPOCH_SLOTS 64
+
+// Allocation groups, threads allocate from their own group and steal when it runs out
+#define FAT32_MAX_GROUPS 64         // Groups a volume is split into at most
+#define FAT32_GROUP_MIN_CLUSTERS 1024  // Smaller volumes get fewer groups
 
 // File attributes
 #define ATTR_READ_ONLY 0x01
@@ -17,46 +65,213 @@
 #define ATTR_VOLUME_ID 0x08
 #define ATTR_DIRECTORY 0x10
 #define ATTR_ARCHIVE   0x20
+#define ATTR_INLINE    0x40         // Data lives in inlineData, the entry owns no clusters
 
 // FAT32 entry structure
 typedef struct {
     char filename[MAX_FILENAME];
-    uint32_t fileSize;
+    uint64_t fileSize;
     uint32_t startCluster;
     uint8_t attributes;
     time_t creationTime;
     time_t modificationTime;
     uint32_t bitmapAddress;
+    uint32_t parentId;        // Directory holding the entry, 0 outside the directory namespace
+    uint32_t directoryId;     // Id of the directory itself, 0 for files
+    struct FAT32_Staging* staging;  // Data held back by delayed allocation, NULL once on disk
+    uint8_t inlineData[FAT32_INLINE_CAPACITY];  // File data while ATTR_INLINE is set
+    struct FAT32_ExtentMap* extentMap;      // Compressed layout of the chain, NULL when stored plain
+    uint32_t writeSequence;   // Odd while a write or a relocation holds the entry, bumped by each
 } FAT32_Entry;
 
+// Called after a write, flush or relocation changed an entry's modificationTime
+// or startCluster, with the values the entry had before
+typedef void (*FAT32_ChangeHook)(void* ctx, FAT32_Entry* entry, time_t oldTime, uint32_t oldStart);
+
+// Brackets every write, flush and relocation: called with enter set before the
+// entry is touched and with enter clear after the change hook ran, so the
+// hook's owner can keep its lock over both the change and the hook
+typedef void (*FAT32_ChangeGuard)(void* ctx, bool enter);
+
+// Slice of the cluster space with its own lock and free-space summary. A group's
+// lock covers its free FAT entries; allocated entries belong to their chain's owner.
+// Groups sit on their own cache lines so threads in neighbouring groups do not share one.
+typedef struct __attribute__((aligned(FAT32_CACHE_LINE))) FAT32_AllocGroup {
+    pthread_mutex_t mutex;
+    uint32_t first;           // First cluster of the group
+    uint32_t end;             // One past the last cluster
+    uint32_t freeCount;       // Free clusters in [first, end)
+    uint32_t nextFree;        // Where allocation in the group starts looking
+} FAT32_AllocGroup;
+
+// Readers inside the read paths, counted by the parity of the epoch they entered in.
+// Slots sit on their own cache lines so readers on different slots do not share one.
+typedef struct __attribute__((aligned(FAT32_CACHE_LINE))) FAT32_EpochSlot {
+    uint32_t readers[2];
+} FAT32_EpochSlot;
+
 // FAT32 file system structure
 typedef struct {
-    uint32_t totalSectors;
+    uint64_t totalSectors;
     uint32_t sectorsPerCluster;
+    uint32_t clusterSize;     // Bytes per cluster, sectorsPerCluster * SECTOR_SIZE
     uint32_t reservedSectors;
     uint32_t numberOfFATs;
     uint32_t sectorsPerFAT;
     uint32_t rootCluster;
-    uint8_t* fatTable;
+    uint32_t clusterCount;    // FAT entries in use, data clusters plus the two reserved
+    uint32_t* fatTable;       // In-memory FAT, mirrored to every on-disk copy by fat32_sync
+    uint8_t* fatDirty;        // One flag per FAT sector changed since the last sync
+    uint32_t freeClusters;    // FSInfo free count, kept exact, changed atomically
+    struct FAT32_AllocGroup* groups;        // Cluster space split for parallel allocation
+    uint32_t groupCount;
+    uint32_t groupClusters;   // Clusters per group, the last one may be shorter
+    bool delayedAllocation;   // New files are staged in memory and placed at flush time
+    uint32_t reservedClusters;              // Free clusters promised to staged files, changed atomically
+    struct FAT32_Staging* stagedHead;       // Entries with staged data, flushed by fat32_flush
+    pthread_mutex_t stagedMutex;            // Protects stagedHead and the links of the staged list
+    uint32_t inlineThreshold; // Files up to this size are stored in their entry
+    bool dedupEnabled;        // fat32_write shares identical clusters through the dedup index
+    struct FAT32_Dedup* dedup;              // Fingerprint index and reference counts, NULL until first enabled
+    bool compression;         // fat32_write and flushes compress each extent that saves a cluster
+    struct FAT32_Checksums* checksums;      // Per-cluster CRC32C, NULL while checksums are off
+    bool verifyReads;         // Reads check every cluster they return against its checksum
+    FAT32_ChangeHook onChange;              // Keeps secondary indexes current, NULL when unset
+    FAT32_ChangeGuard changeGuard;          // Brackets changes reported to onChange, NULL when unset
+    void* onChangeCtx;
     uint8_t* data;
-    uint32_t dataSize;
-    uint8_t* bitmap;
-    uint32_t bitmapSize;
+    uint64_t dataSize;
+    int imageFd;              // Backing image file, -1 for an in-memory volume
+    BufferPool* pool;         // Cluster cache in front of the image, NULL in memory
+    struct Executor* stripeExecutor;        // Runs the stripes of large transfers, NULL for serial I/O
+    uint32_t stripeThreshold; // Reads and whole-file writes of at least this many bytes are striped
+    AioContext* aio;          // Queue for fat32_read_async, NULL in memory
+    struct FAT32_AsyncRead* finishedHead;   // Completed async reads awaiting fat32_reap
+    struct FAT32_AsyncRead* finishedTail;
+    pthread_mutex_t asyncMutex;             // Protects the finished list and request counters
+    uint64_t epoch;           // Advances once no reader is left from the epoch before it
+    FAT32_EpochSlot* epochSlots;            // FAT32_EPOCH_SLOTS reader counters
+    struct FAT32_RetiredChain* retired;     // Chains replaced by relocations and writes, freed two epochs later
+    pthread_mutex_t retiredMutex;
 } FAT32_FileSystem;
 
+// Completed asynchronous file read returned by fat32_reap()
+typedef struct {
+    void* userData;           // Value passed to fat32_read_async
+    int64_t result;           // Bytes read, or -errno
+} FAT32_Completion;
+
+// Readahead state of one sequential reader, zero it before the first read
+typedef struct {
+    uint32_t startCluster;    // File the state belongs to
+    uint64_t nextOffset;      // Offset that continues the previous read
+    uint32_t nextCluster;     // Cluster holding nextOffset, saves walking the chain again
+    uint32_t window;          // Readahead window in clusters, 0 before the first read
+} FAT32_Readahead;
+
+// Write position in a chain, lets sequential writes skip the walk from startCluster
+typedef struct {
+    uint32_t startCluster;    // Chain the cursor belongs to, a rewritten or moved file invalidates it
+    uint32_t cluster;         // Cluster number index of that chain, 0 when unset
+    uint32_t index;
+} FAT32_Cursor;
+
+// Open file returned by fat32_open()
+typedef struct {
+    FAT32_FileSystem* fs;
+    FAT32_Entry* entry;
+    uint64_t position;        // Offset of the next read or write
+    FAT32_Readahead ra;       // Where the last read stopped
+    FAT32_Cursor cursor;      // Where the last write stopped
+} FAT32_File;
+
+// Space report returned by fat32_statfs()
+typedef struct {
+    uint32_t clusterSize;     // Bytes per cluster
+    uint32_t totalClusters;   // Data clusters on the volume
+    uint32_t freeClusters;    // Data clusters not in any chain
+    uint32_t reservedClusters;  // Free clusters already promised to staged files
+} FAT32_StatFs;
+
+// Deduplication counters returned by fat32_dedup_stats()
+typedef struct {
+    uint64_t lookups;         // Clusters fingerprinted by the dedup write path
+    uint64_t hits;            // Clusters shared instead of written
+    uint32_t indexedClusters; // Clusters in the fingerprint index
+    uint32_t sharedClusters;  // Indexed clusters referenced more than once
+} FAT32_DedupStats;
+
+// Geometry header stored in the first reserved sector of an image
+typedef struct {
+    char magic[8];
+    uint64_t totalSectors;
+    uint32_t sectorsPerCluster;
+    uint32_t reservedSectors;
+    uint32_t numberOfFATs;
+    uint32_t sectorsPerFAT;
+    uint32_t rootCluster;
+    uint32_t version;
+} FAT32_ImageHeader;
+
+// FSInfo sector stored in the second reserved sector, laid out as on real FAT32
+typedef struct {
+    uint32_t leadSignature;
+    uint8_t reserved1[480];
+    uint32_t structSignature;
+    uint32_t freeCount;       // Free clusters, FSINFO_UNKNOWN if not maintained
+    uint32_t nextFree;        // Allocation hint, FSINFO_UNKNOWN if not maintained
+    uint8_t reserved2[12];
+    uint32_t trailSignature;
+} FAT32_FSInfo;
+
 // Core function declarations
-FAT32_FileSystem* fat32_init(uint32_t size);
-FAT32_Entry* create_file_entry(FAT32_FileSystem* fs, const char* filename, uint32_t size);
-int fat32_write(FAT32_FileSystem* fs, FAT32_Entry* entry, const void* data, uint32_t size);
+FAT32_FileSystem* fat32_init(uint64_t size);
+FAT32_FileSystem* fat32_init_image(const char* path, uint64_t size, uint32_t cacheClusters);
+int fat32_sync(FAT32_FileSystem* fs);
+void fat32_statfs(FAT32_FileSystem* fs, FAT32_StatFs* out);
+FAT32_Entry* create_file_entry(FAT32_FileSystem* fs, const char* filename, uint64_t size);
+int fat32_write(FAT32_FileSystem* fs, FAT32_Entry* entry, const void* data, uint64_t size);
+int fat32_write_range(FAT32_FileSystem* fs, FAT32_Entry* entry, uint64_t offset, const void* data, uint64_t size);
+void fat32_set_delayed_allocation(FAT32_FileSystem* fs, bool enabled);
+void fat32_set_inline_threshold(FAT32_FileSystem* fs, uint32_t bytes);
+void fat32_set_dedup(FAT32_FileSystem* fs, bool enabled);
+void fat32_dedup_stats(FAT32_FileSystem* fs, FAT32_DedupStats* out);
+void fat32_set_compression(FAT32_FileSystem* fs, bool enabled);
+void fat32_set_checksums(FAT32_FileSystem* fs, bool enabled, bool verifyReads);
+void fat32_set_parallel_io(FAT32_FileSystem* fs, struct Executor* executor, uint32_t minBytes);
+int fat32_verify_cluster(FAT32_FileSystem* fs, uint32_t cluster);
+uint64_t fat32_checksum_errors(FAT32_FileSystem* fs);
+// With an indexed tree's hook installed, every write, flush and relocation takes
+// the tree's lock for reading: never call them while holding it for writing (from
+// a BPTreeCheck or BPTreeRenameCheck, say), and calling them from a scan visitor
+// relies on the lock preferring readers, which initializeBPTree asks for
+void fat32_set_change_hook(FAT32_FileSystem* fs, FAT32_ChangeHook hook, FAT32_ChangeGuard guard, void* ctx);
+int fat32_flush_entry(FAT32_FileSystem* fs, FAT32_Entry* entry);
+int fat32_flush(FAT32_FileSystem* fs);
 void* fat32_read(FAT32_FileSystem* fs, FAT32_Entry* entry);
+int64_t fat32_read_range(FAT32_FileSystem* fs, FAT32_Entry* entry, uint64_t offset, void* buffer, uint64_t length,
+                         FAT32_Readahead* ra);
+int fat32_read_async(FAT32_FileSystem* fs, FAT32_Entry* entry, void* buffer, void* userData);
+int fat32_reap(FAT32_FileSystem* fs, FAT32_Completion* out, int max, bool wait);
+FAT32_File* fat32_open(FAT32_FileSystem* fs, FAT32_Entry* entry);
+int64_t fat32_file_read(FAT32_File* file, void* buffer, uint64_t length);
+int64_t fat32_file_write(FAT32_File* file, const void* data, uint64_t length);
+int64_t fat32_file_append(FAT32_File* file, const void* data, uint64_t length);
+int fat32_file_seek(FAT32_File* file, uint64_t position);
+int fat32_close(FAT32_File* file);
 int fat32_delete(FAT32_FileSystem* fs, FAT32_Entry* entry);
 void fat32_cleanup(FAT32_FileSystem* fs);
 
 // Helper function declarations
 uint32_t allocate_clusters(FAT32_FileSystem* fs, uint32_t count);
+uint32_t allocate_contiguous(FAT32_FileSystem* fs, uint32_t count);
 void free_clusters(FAT32_FileSystem* fs, uint32_t startCluster);
 uint32_t get_next_cluster(FAT32_FileSystem* fs, uint32_t cluster);
 void set_next_cluster(FAT32_FileSystem* fs, uint32_t cluster, uint32_t next);
-uint32_t cluster_to_sector(FAT32_FileSystem* fs, uint32_t cluster);
+bool fat32_valid_cluster(FAT32_FileSystem* fs, uint32_t cluster);
+uint32_t fat32_count_extents(FAT32_FileSystem* fs, uint32_t startCluster);
+int fat32_relocate(FAT32_FileSystem* fs, FAT32_Entry* entry);
+uint32_t fat32_reclaim(FAT32_FileSystem* fs, bool wait);
+uint64_t cluster_to_sector(FAT32_FileSystem* fs, uint32_t cluster);
 
 #endif
@@ -0,0 +1,35 @@
+#ifndef INDEX_H
+#define INDEX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include "bptree.h"
+
+// Secondary indexes a tree can keep next to its name index
+#define INDEX_MODIFICATION_TIME 0x01  // Entries by modificationTime, for "changed since"
+#define INDEX_START_CLUSTER 0x02      // Entries by startCluster, for "who owns this cluster"
+
+#define INDEX_KEY_LENGTH 32           // Field as 16 hex digits, then the entry address
+
+// Secondary B+Trees over the entries of one tree. Keys order entries by the
+// indexed field, with the entry address appended so every key is unique.
+typedef struct BPTreeIndexes {
+    BPTree* byTime;           // NULL unless INDEX_MODIFICATION_TIME
+    BPTree* byCluster;        // NULL unless INDEX_START_CLUSTER, entries without clusters are never visited
+    pthread_rwlock_t lock;    // Maintenance holds it for writing, queries for reading
+} BPTreeIndexes;
+
+// Core function declarations
+void index_enable(BPTree* tree, unsigned which);
+int index_changed_since(BPTree* tree, time_t since, BPTreeVisitor visit, void* ctx);
+int index_by_cluster(BPTree* tree, uint32_t first, uint32_t last, BPTreeVisitor visit, void* ctx);
+FAT32_Entry* index_cluster_owner(BPTree* tree, uint32_t cluster);
+void index_destroy(BPTree* tree);
+
+// Maintenance, called by the tree under its write lock
+void index_add(BPTree* tree, FAT32_Entry* entry);
+void index_remove(BPTree* tree, FAT32_Entry* entry);
+
+#endif // INDEX_H
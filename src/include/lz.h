@@ -0,0 +1,19 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <stdint.h>
+
+// Byte-oriented LZ77 block codec used for transparent cluster compression.
+// A block is a series of sequences: a token byte (literal count in the high
+// nibble, match length - LZ_MIN_MATCH in the low nibble, 15 meaning more
+// length bytes follow), the literals, then a 2-byte little-endian offset.
+// The last sequence carries literals only.
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 13
+
+// Core function declarations
+uint32_t lz_compress(const uint8_t* src, uint32_t srcLength, uint8_t* dst, uint32_t dstCapacity);
+int lz_decompress(const uint8_t* src, uint32_t srcLength, uint8_t* dst, uint32_t dstLength);
+
+#endif // LZ_H
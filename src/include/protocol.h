@@ -0,0 +1,58 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stdint.h>
+
+// Wire format shared by the socket server and its client library. Both ends run
+// on the same host, so fields travel in host byte order. Every request is a
+// header followed by length bytes: the key, then the data. Responses come back
+// on the same connection in request order, each echoing its request's id.
+
+#define FS_PROTO_MAX_KEY 255              // Keys must also fit a B+Tree key
+#define FS_PROTO_MAX_DATA (1024 * 1024)   // Largest read or write carried by one request
+
+enum {
+    FS_OP_CREATE = 1,         // Create key with data as its content
+    FS_OP_READ,               // Read count bytes at offset
+    FS_OP_WRITE,              // Write data at offset, or at the end with FS_FLAG_APPEND
+    FS_OP_DELETE,             // Remove key and free its clusters
+    FS_OP_STAT,               // Size, attributes and times of key
+    FS_OP_LIST,               // Up to count keys starting with key, in order
+};
+
+#define FS_FLAG_APPEND 0x01       // FS_OP_WRITE: ignore offset, write at the end of the file
+
+typedef struct {
+    uint32_t length;          // Bytes after the header: keyLength bytes of key, then data
+    uint32_t id;              // Chosen by the client, echoed in the response
+    uint8_t opcode;           // FS_OP_*
+    uint8_t flags;            // FS_FLAG_*
+    uint16_t keyLength;
+    uint32_t count;           // READ length, LIST limit
+    uint64_t offset;          // READ and WRITE position
+} FsRequestHeader;
+
+typedef struct {
+    uint32_t length;          // Bytes of payload after the header
+    uint32_t id;              // Id of the request answered
+    int32_t status;           // Bytes read or written, entries listed, 0, or -errno
+} FsResponseHeader;
+
+// FS_OP_STAT payload
+typedef struct {
+    uint64_t size;
+    uint32_t attributes;
+    uint32_t reserved;
+    int64_t creationTime;
+    int64_t modificationTime;
+} FsStat;
+
+// FS_OP_LIST payload: status entries, each this header followed by the key
+typedef struct {
+    uint64_t size;
+    uint16_t keyLength;
+    uint16_t reserved;
+    uint32_t reserved2;
+} FsListEntry;
+
+#endif // PROTOCOL_H
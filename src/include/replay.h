@@ -0,0 +1,83 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include "distributed.h"
+#include "executor.h"
+
+#define REPLAY_FORMAT_VERSION 1
+#define REPLAY_INSERT_NANOS 20000     // Default simulated cost of an insert task
+#define REPLAY_SEARCH_NANOS 5000      // Default simulated cost of a search task
+#define REPLAY_DELETE_NANOS 15000     // Default simulated cost of a delete and of unknown operations
+
+// One task as a node received it
+typedef struct {
+    int nodeId;
+    uint64_t arrival;         // Nanoseconds after the recording started
+    Task task;
+} ReplayRecord;
+
+// Task streams of the nodes of one ring, in the order they were recorded
+typedef struct {
+    int totalNodes;
+    ReplayRecord* records;
+    int count;
+    int capacity;
+    struct timespec start;    // Arrival times are measured from here
+    pthread_mutex_t mutex;    // Nodes may record from several threads
+} ReplayRecording;
+
+// Delay of one directed link, each pass of the token takes latency plus a
+// uniform draw from [0, jitter]
+typedef struct {
+    uint64_t latencyNanos;
+    uint64_t jitterNanos;
+} ReplayLink;
+
+// Simulated network and costs, zero cost fields pick the defaults
+typedef struct {
+    int totalNodes;
+    ReplayLink* links;            // totalNodes * totalNodes, from * totalNodes + to
+    uint64_t seed;                // Jitter draws, equal seeds give equal replays
+    uint64_t insertNanos;
+    uint64_t searchNanos;
+    uint64_t deleteNanos;
+    TaskHandler handler;          // Runs each task on the replay's nodes, NULL to only simulate
+    BPTree* tree;                 // Shared by the replay's nodes
+    FAT32_FileSystem* fs;
+} ReplayConfig;
+
+// Outcome of one replay, times are simulated nanoseconds
+typedef struct {
+    uint64_t tasks;
+    uint64_t completionNanos;     // Last task finished
+    uint64_t tokenPasses;         // Token moved to another node
+    uint64_t travelNanos;         // Time the token spent on links
+    uint64_t waitMean;            // Token wait, request to acquire, over every task
+    uint64_t waitP50;
+    uint64_t waitP99;
+    uint64_t waitMax;
+    uint64_t nodeTasks[MAX_NODES];
+    uint64_t nodeWaitMean[MAX_NODES];
+    double fairness;              // Jain's index over per-node mean waits, 1 is perfectly fair
+    uint64_t digest;              // Hash of the order tasks ran in
+} ReplayReport;
+
+// Recording
+ReplayRecording* replay_recording_create(int totalNodes);
+void replay_record(ReplayRecording* recording, DistributedNode* node, Task task);
+bool replay_save(ReplayRecording* recording, const char* path);
+ReplayRecording* replay_load(const char* path);
+void replay_recording_destroy(ReplayRecording* recording);
+
+// Replay
+bool replay_config_init(ReplayConfig* config, int totalNodes);
+void replay_set_link(ReplayConfig* config, int from, int to, uint64_t latencyNanos, uint64_t jitterNanos);
+void replay_set_all_links(ReplayConfig* config, uint64_t latencyNanos, uint64_t jitterNanos);
+void replay_config_destroy(ReplayConfig* config);
+bool replay_run(const ReplayRecording* recording, const ReplayConfig* config, ReplayReport* report);
+
+#endif // REPLAY_H
@@ -0,0 +1,46 @@
+#ifndef SCRUB_H
+#define SCRUB_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "fat32.h"
+
+#define SCRUB_DEFAULT_INTERVAL_MS 60000   // Pause between passes of the background scrubber
+#define SCRUB_BATCH 64                    // Clusters checked between throttle sleeps
+
+// Outcome of one or more scrub passes
+typedef struct {
+    uint64_t clustersChecked; // Allocated clusters read and checked
+    uint64_t corruptClusters; // Clusters that did not match their checksum
+    uint64_t readErrors;      // Clusters that could not be read
+    uint32_t lastCorrupt;     // Most recent corrupt cluster, 0 if none
+} ScrubReport;
+
+// Tuning for scrub_start and scrub_run, zero fields pick the defaults
+typedef struct {
+    uint32_t clustersPerSecond;   // Read budget, 0 reads as fast as possible
+    uint32_t intervalMillis;      // Sleep between passes of the background thread
+} ScrubConfig;
+
+// Background scrubber: rereads every allocated cluster of a volume with checksums
+// enabled and counts the ones that no longer match
+typedef struct {
+    FAT32_FileSystem* fs;
+    ScrubConfig config;
+    pthread_t thread;
+    bool running;             // Background thread started
+    bool stopping;            // Set by scrub_stop
+    uint32_t passes;          // Completed passes
+    ScrubReport report;       // Totals over every completed pass
+    pthread_mutex_t mutex;    // Protects the flags, counters and report
+    pthread_cond_t cond;      // Wakes interval sleeps on stop, and pass waiters
+} Scrubber;
+
+// Core function declarations
+void scrub_run(FAT32_FileSystem* fs, const ScrubConfig* config, ScrubReport* out);
+Scrubber* scrub_start(FAT32_FileSystem* fs, const ScrubConfig* config);
+void scrub_wait_pass(Scrubber* scrubber, ScrubReport* out);
+void scrub_stop(Scrubber* scrubber);
+
+#endif // SCRUB_H
@@ -0,0 +1,42 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "bptree.h"
+#include "protocol.h"
+
+#define SERVER_DEFAULT_WORKERS 4
+#define SERVER_KEY_STRIPES 256        // Locks that serialize operations on the same key
+#define SERVER_READ_CHUNK 65536       // Bytes read from a socket per attempt
+#define SERVER_MAX_OUTPUT (4 * 1024 * 1024)   // Pending response bytes before a connection stops being read
+
+// Counters returned by server_get_stats()
+typedef struct {
+    uint64_t connections;     // Connections accepted
+    uint64_t requests;        // Requests answered
+    uint64_t errors;          // Requests answered with a negative status
+    uint64_t batches;         // Socket reads that yielded at least one request
+} ServerStats;
+
+// Local file system server: every worker thread runs its own epoll loop, accepts
+// connections from the shared listening socket and answers the pipelined
+// requests of the connections it owns in order, one write per batch
+typedef struct {
+    BPTree* tree;
+    char path[108];           // Socket path, removed by server_stop
+    int listenFd;
+    int stopFd;               // eventfd, readable once server_stop was called
+    int workerCount;
+    pthread_t* threads;
+    pthread_mutex_t stripes[SERVER_KEY_STRIPES];
+    ServerStats stats;        // Updated atomically by the workers
+} Server;
+
+// Core function declarations
+Server* server_start(BPTree* tree, const char* path, int workers);
+void server_get_stats(Server* server, ServerStats* out);
+void server_stop(Server* server);
+
+#endif // SERVER_H
@@ -0,0 +1,42 @@
+#ifndef SLOTMAP_H
+#define SLOTMAP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define SLOTMAP_NONE 0xFFFFFFFF
+#define SLOTMAP_CACHES 16         // Reservation caches, threads are spread over them
+#define SLOTMAP_CACHE_SLOTS 32    // Slots one cache holds at most
+#define SLOTMAP_REFILL 16         // Slots moved between a cache and the map at a time
+
+// Slots reserved for the threads that share one cache
+typedef struct {
+    pthread_mutex_t mutex;
+    uint32_t count;
+    uint32_t slots[SLOTMAP_CACHE_SLOTS];
+} SlotCache;
+
+// Allocator of directory-entry slots. A bit per slot, plus two summary levels
+// with a bit per word of the level below that is set when that word is full,
+// so finding the lowest free slot reads one word per level.
+typedef struct {
+    uint64_t* words;          // Bit per slot, set when the slot is in use
+    uint64_t* summary;        // Bit per word of words, set when the word is full
+    uint64_t* top;            // Bit per word of summary, set when the word is full
+    uint32_t capacity;        // Slots, a power of two of at least 4096
+    uint32_t used;            // Slots marked in words, including reserved ones
+    pthread_mutex_t mutex;    // Protects the bitmaps
+    SlotCache* caches;        // Per-thread reservations, NULL unless enabled
+} SlotMap;
+
+// Core function declarations
+void slotmap_init(SlotMap* map, uint32_t capacity);
+uint32_t slotmap_alloc(SlotMap* map);
+void slotmap_free(SlotMap* map, uint32_t slot);
+bool slotmap_in_use(SlotMap* map, uint32_t slot);
+uint32_t slotmap_count(SlotMap* map);
+void slotmap_set_caching(SlotMap* map, bool enabled);
+void slotmap_destroy(SlotMap* map);
+
+#endif // SLOTMAP_H
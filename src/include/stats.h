@@ -0,0 +1,104 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+// Instrumentation counters for the tree, FAT and token layers.
+// Hot paths use the STATS_* macros, which compile to nothing unless the
+// build defines FS_STATS (make STATS=1). Each thread updates its own block
+// without atomics; snapshots sum all blocks.
+
+// Event counters
+typedef enum {
+    STAT_TREE_LOOKUPS,          // search() calls
+    STAT_TREE_INSERTS,          // insert() calls
+    STAT_TREE_DELETES,          // delete() calls
+    STAT_TREE_NODES_VISITED,    // Nodes touched while descending the tree
+    STAT_TREE_SPLITS,           // Leaf and internal node splits
+    STAT_TREE_MERGES,           // Node merges
+    STAT_TREE_BLOOM_REJECTS,    // Lookups the Bloom filter answered without the tree
+    STAT_TREE_BLOOM_FALSE_POSITIVES, // Lookups the filter let through that missed
+    STAT_FAT_ALLOC_CALLS,       // allocate_clusters() calls
+    STAT_FAT_ALLOC_FAILURES,    // Allocations that found no room
+    STAT_FAT_ALLOC_SCANNED,     // FAT entries inspected by allocate_clusters()
+    STAT_FAT_ALLOC_STEALS,      // Allocations served by a group other than the thread's own
+    STAT_FAT_CLUSTERS_FREED,    // Clusters released by free_clusters()
+    STAT_FAT_READS,             // fat32_read() and fat32_read_range() calls
+    STAT_FAT_READ_HOPS,         // Chain hops followed by the read paths
+    STAT_FAT_READAHEAD,         // Clusters resolved or fetched ahead of the copy
+    STAT_FAT_WRITES,            // fat32_write() calls
+    STAT_FAT_WRITE_HOPS,        // Chain hops followed by fat32_write()
+    STAT_FAT_DEDUP_HITS,        // Clusters shared by the dedup write path instead of written
+    STAT_FAT_CHECKSUM_ERRORS,   // Clusters whose contents did not match their CRC32C
+    STAT_TOKEN_ACQUIRES,        // Outermost requestToken() acquisitions
+    STAT_TOKEN_PASSES,          // Token hand-offs to another node
+    STAT_COUNTER_COUNT
+} StatCounter;
+
+// Latency histograms, log2 nanosecond buckets
+typedef enum {
+    STAT_HIST_TREE_RDLOCK_WAIT, // Wait for tree->lock in shared mode
+    STAT_HIST_TREE_WRLOCK_WAIT, // Wait for tree->lock in exclusive mode
+    STAT_HIST_FAT_ALLOC,        // Duration of allocate_clusters()
+    STAT_HIST_TOKEN_WAIT,       // Wait inside requestToken()
+    STAT_HIST_COUNT
+} StatHistogram;
+
+// Last-value gauges
+typedef enum {
+    STAT_GAUGE_TREE_HEIGHT,     // Height of the most recently grown tree
+    STAT_GAUGE_COUNT
+} StatGauge;
+
+#define STATS_HIST_BUCKETS 48
+
+typedef struct {
+    uint64_t count;
+    uint64_t sumNanos;
+    uint64_t maxNanos;
+    uint64_t buckets[STATS_HIST_BUCKETS];   // Bucket i counts samples in [2^(i-1), 2^i) ns
+} StatsHistogramData;
+
+// Aggregated view returned by stats_snapshot()
+typedef struct {
+    bool enabled;                           // Whether the build has instrumentation compiled in
+    uint64_t counters[STAT_COUNTER_COUNT];
+    StatsHistogramData histograms[STAT_HIST_COUNT];
+    uint64_t gauges[STAT_GAUGE_COUNT];
+} FSStats;
+
+// Snapshot and reporting API, available in every build
+void stats_snapshot(FSStats* out);
+void stats_reset(void);
+void stats_dump_text(FILE* out);
+void stats_dump_json(FILE* out);
+
+// Recording functions behind the macros
+void stats_add(StatCounter counter, uint64_t amount);
+void stats_record(StatHistogram histogram, uint64_t nanos);
+void stats_gauge(StatGauge gauge, uint64_t value);
+
+static inline uint64_t stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+#ifdef FS_STATS
+#define STATS_INC(counter)              stats_add((counter), 1)
+#define STATS_ADD(counter, amount)      stats_add((counter), (amount))
+#define STATS_GAUGE(gauge, value)       stats_gauge((gauge), (value))
+#define STATS_TIMER_START(var)          uint64_t var = stats_now()
+#define STATS_TIMER_RECORD(hist, var)   stats_record((hist), stats_now() - (var))
+#else
+#define STATS_INC(counter)              ((void)0)
+#define STATS_ADD(counter, amount)      ((void)(amount))
+#define STATS_GAUGE(gauge, value)       ((void)(value))
+#define STATS_TIMER_START(var)          ((void)0)
+#define STATS_TIMER_RECORD(hist, var)   ((void)0)
+#endif
+
+#endif // STATS_H
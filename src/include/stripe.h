@@ -0,0 +1,37 @@
+#ifndef STRIPE_H
+#define STRIPE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "fat32.h"
+#include "executor.h"
+
+#define STRIPE_MAX_VOLUMES 16
+#define STRIPE_UNIT_DEFAULT (64 * CLUSTER_SIZE)  // Bytes per volume before moving to the next
+
+// Volumes a file's data is spread over, RAID-0 style: unit k of a file is
+// stored on volume k % count, so one large transfer keeps every volume busy.
+// The set does not own its volumes or executor.
+typedef struct {
+    FAT32_FileSystem* volumes[STRIPE_MAX_VOLUMES];
+    int count;
+    uint32_t unit;                    // Stripe unit in bytes, a multiple of every volume's cluster size
+    Executor* executor;               // Runs one job per volume, NULL for serial transfers
+} StripeSet;
+
+// A file of a stripe set, one member entry per volume
+typedef struct {
+    StripeSet* set;
+    FAT32_Entry* members[STRIPE_MAX_VOLUMES];
+    uint64_t size;
+} StripedFile;
+
+// Core function declarations
+StripeSet* stripe_create(FAT32_FileSystem** volumes, int count, uint32_t unit, Executor* executor);
+void stripe_destroy(StripeSet* set);
+StripedFile* stripe_create_file(StripeSet* set, const char* filename);
+int stripe_write(StripedFile* file, const void* data, uint64_t size);
+int64_t stripe_read(StripedFile* file, uint64_t offset, void* buffer, uint64_t length);
+int stripe_delete(StripedFile* file);
+
+#endif // STRIPE_H
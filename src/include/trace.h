@@ -0,0 +1,63 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Per-thread event tracing for the tree, FAT and token layers. Each thread
+// appends begin/end records to its own ring buffer without locks or atomic
+// read-modify-writes; the oldest records are overwritten when a ring is full.
+// Tracing is compiled into every build and off until trace_start(); with a
+// sampling rate of N about one in N outermost operations of a thread is
+// recorded, together with everything nested inside it.
+
+#define TRACE_RING_EVENTS 16384       // Records per thread, a power of two
+
+// Traced spans
+typedef enum {
+    TRACE_TREE_SEARCH,          // search()
+    TRACE_TREE_SCAN,            // scan()
+    TRACE_TREE_INSERT,          // insert() and insert_dme()
+    TRACE_TREE_DELETE,          // delete() and delete_dme()
+    TRACE_TREE_UPSERT,          // upsert()
+    TRACE_TREE_RENAME,          // renameEntry()
+    TRACE_TREE_UPDATE,          // update() and update_dme()
+    TRACE_TREE_SPLIT,           // One node split, arg 1 for a leaf
+    TRACE_TREE_RDLOCK,          // Wait for tree->lock in shared mode
+    TRACE_TREE_WRLOCK,          // Wait for tree->lock in exclusive mode
+    TRACE_FAT_ALLOC,            // allocate_clusters(), arg the cluster count
+    TRACE_FAT_FREE,             // free_clusters()
+    TRACE_FAT_READ,             // fat32_read_range(), arg the byte count
+    TRACE_FAT_WRITE,            // fat32_write() and fat32_write_range(), arg the byte count
+    TRACE_TOKEN_ACQUIRE,        // Outermost requestToken(), arg the node id
+    TRACE_TOKEN_RELEASE,        // Outermost releaseToken(), arg the node id
+    TRACE_EVENT_COUNT
+} TraceEvent;
+
+// Control and export
+void trace_start(uint32_t sampleEvery);
+void trace_stop(void);
+void trace_reset(void);
+int trace_dump_chrome(FILE* out);
+
+// Recording functions behind the macros
+void trace_begin(TraceEvent event, uint32_t arg);
+void trace_end(TraceEvent event);
+
+extern int traceEnabled;
+extern __thread uint32_t traceDepth;   // Spans open on this thread since tracing was on
+
+// Off, one load of traceEnabled and one of traceDepth per span. A span that
+// began before trace_stop() still ends, so ends only test the depth.
+#define TRACE_BEGIN(event, arg) \
+    do { \
+        if (__builtin_expect(__atomic_load_n(&traceEnabled, __ATOMIC_RELAXED) || traceDepth, 0)) \
+            trace_begin((event), (arg)); \
+    } while (0)
+#define TRACE_END(event) \
+    do { \
+        if (__builtin_expect(traceDepth != 0, 0)) trace_end((event)); \
+    } while (0)
+
+#endif // TRACE_H
@@ -0,0 +1,289 @@
+#include "include/index.h"
+#include "include/fat32.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Range query over one secondary tree
+typedef struct {
+    char lastKey[INDEX_KEY_LENGTH + 1];   // Keys above this end the range
+    BPTreeVisitor visit;
+    void* ctx;
+    int count;
+} IndexRange;
+
+// Full search for the owner of a cluster
+typedef struct {
+    FAT32_FileSystem* fs;
+    uint32_t cluster;
+    FAT32_Entry* owner;
+} OwnerSearch;
+
+// Helper function implementations
+
+// Times are signed, flipping the top bit makes their hex digits sort in time order
+static uint64_t timeField(time_t t) {
+    return (uint64_t)(int64_t)t ^ 0x8000000000000000ull;
+}
+
+static void makeKey(char* key, uint64_t field, uintptr_t address) {
+    snprintf(key, INDEX_KEY_LENGTH + 1, "%016llx%016llx", (unsigned long long)field, (unsigned long long)address);
+}
+
+static void parseKey(const char* key, uint64_t* field, uintptr_t* address) {
+    char half[17];
+    memcpy(half, key, 16);
+    half[16] = '\0';
+    *field = strtoull(half, NULL, 16);
+    *address = (uintptr_t)strtoull(key + 16, NULL, 16);
+}
+
+// Add or drop the keys of entry for the given field values, with the index lock held
+static void addKeys(BPTreeIndexes* indexes, FAT32_Entry* entry, time_t modified, uint32_t start) {
+    char key[INDEX_KEY_LENGTH + 1];
+    if (indexes->byTime) {
+        makeKey(key, timeField(modified), (uintptr_t)entry);
+        insert(indexes->byTime, key, entry);
+    }
+    if (indexes->byCluster) {
+        makeKey(key, start, (uintptr_t)entry);
+        insert(indexes->byCluster, key, entry);
+    }
+}
+
+// Returns false if entry was not indexed under those values
+static bool removeKeys(BPTreeIndexes* indexes, FAT32_Entry* entry, time_t modified, uint32_t start) {
+    char key[INDEX_KEY_LENGTH + 1];
+    bool found = false;
+    if (indexes->byTime) {
+        makeKey(key, timeField(modified), (uintptr_t)entry);
+        if (search(indexes->byTime, key) == entry) {
+            delete(indexes->byTime, key);
+            found = true;
+        }
+    }
+    if (indexes->byCluster) {
+        makeKey(key, start, (uintptr_t)entry);
+        if (search(indexes->byCluster, key) == entry) {
+            delete(indexes->byCluster, key);
+            found = true;
+        }
+    }
+    return found;
+}
+
+// FAT32 change guard: a write, flush or relocation holds the tree's read lock
+// from before it touches the entry until entryChanged has moved its keys, so
+// insert, update and delete, which keep the indexes under the write lock, never
+// find an entry whose fields and keys disagree. initializeBPTree makes the lock
+// prefer readers, so a relocation from a scan visitor may take it again; a caller
+// holding it for writing must not write to the volume.
+static void changeGuard(void* ctx, bool enter) {
+    BPTree* tree = (BPTree*)ctx;
+    if (enter) pthread_rwlock_rdlock(&tree->lock);
+    else pthread_rwlock_unlock(&tree->lock);
+}
+
+// FAT32 change hook, run inside changeGuard: move the entry's keys if the entry is indexed
+static void entryChanged(void* ctx, FAT32_Entry* entry, time_t oldTime, uint32_t oldStart) {
+    BPTreeIndexes* indexes = ((BPTree*)ctx)->indexes;
+    pthread_rwlock_wrlock(&indexes->lock);
+    if (removeKeys(indexes, entry, oldTime, oldStart)) {
+        addKeys(indexes, entry, entry->modificationTime, entry->startCluster);
+    }
+    pthread_rwlock_unlock(&indexes->lock);
+}
+
+static bool populateVisitor(const char* key, FAT32_Entry* value, void* ctx) {
+    BPTreeIndexes* indexes = (BPTreeIndexes*)ctx;
+    char indexKey[INDEX_KEY_LENGTH + 1];
+    (void)key;
+    if (!value) return true;
+    // Indexes kept before this call already hold the entry
+    makeKey(indexKey, timeField(value->modificationTime), (uintptr_t)value);
+    if (indexes->byTime && search(indexes->byTime, indexKey) != value) insert(indexes->byTime, indexKey, value);
+    makeKey(indexKey, value->startCluster, (uintptr_t)value);
+    if (indexes->byCluster && search(indexes->byCluster, indexKey) != value) {
+        insert(indexes->byCluster, indexKey, value);
+    }
+    return true;
+}
+
+static bool rangeVisitor(const char* key, FAT32_Entry* value, void* ctx) {
+    IndexRange* range = (IndexRange*)ctx;
+    if (strcmp(key, range->lastKey) > 0) return false;
+    range->count++;
+    return range->visit ? range->visit(value->filename, value, range->ctx) : true;
+}
+
+static int queryRange(BPTree* index, const char* firstKey, IndexRange* range) {
+    range->count = 0;
+    scan(index, firstKey, 0, rangeVisitor, range);
+    return range->count;
+}
+
+// Entry with the greatest key <= key below node, copying that key into found.
+// Leaves emptied by deletes are skipped by falling back to the next subtree left.
+static FAT32_Entry* floorEntry(BPTreeNode* node, const char* key, char* found) {
+    if (node->isLeaf) {
+        for (int i = node->numKeys - 1; i >= 0; i--) {
+            if (strcmp(node->keys[i], key) <= 0) {
+                strcpy(found, node->keys[i]);
+                return node->values[i];
+            }
+        }
+        return NULL;
+    }
+
+    int position = 0;
+    while (position < node->numKeys && strcmp(key, node->keys[position]) >= 0) position++;
+    for (int child = position; child >= 0; child--) {
+        FAT32_Entry* entry = floorEntry(node->children[child], key, found);
+        if (entry) return entry;
+    }
+    return NULL;
+}
+
+static bool chainHolds(FAT32_FileSystem* fs, uint32_t start, uint32_t cluster) {
+    for (uint32_t current = start; fat32_valid_cluster(fs, current); current = get_next_cluster(fs, current)) {
+        if (current == cluster) return true;
+    }
+    return false;
+}
+
+static bool ownerVisitor(const char* key, FAT32_Entry* value, void* ctx) {
+    OwnerSearch* search = (OwnerSearch*)ctx;
+    uint64_t start;
+    uintptr_t address;
+    parseKey(key, &start, &address);
+    if (chainHolds(search->fs, (uint32_t)start, search->cluster)) {
+        search->owner = value;
+        return false;
+    }
+    return true;
+}
+
+// Core function implementations
+
+// Start keeping the secondary indexes in which (INDEX_* flags), built from the
+// entries already in the tree. Call before the tree is shared between threads.
+void index_enable(BPTree* tree, unsigned which) {
+    if (!tree->indexes) {
+        tree->indexes = (BPTreeIndexes*)calloc(1, sizeof(BPTreeIndexes));
+        pthread_rwlock_init(&tree->indexes->lock, NULL);
+        fat32_set_change_hook(tree->fs, entryChanged, changeGuard, tree);
+    }
+
+    BPTreeIndexes* indexes = tree->indexes;
+    pthread_rwlock_wrlock(&indexes->lock);
+    if ((which & INDEX_MODIFICATION_TIME) && !indexes->byTime) {
+        indexes->byTime = initializeBPTree(tree->fs);
+        indexes->byTime->secondary = true;
+    }
+    if ((which & INDEX_START_CLUSTER) && !indexes->byCluster) {
+        indexes->byCluster = initializeBPTree(tree->fs);
+        indexes->byCluster->secondary = true;
+    }
+    pthread_rwlock_unlock(&indexes->lock);
+    scan(tree, "", 0, populateVisitor, indexes);
+}
+
+// Visit entries modified at or after since, oldest first. Visitors receive the
+// entry's filename, run under the index lock and must not modify the volume.
+// Returns the number of entries visited, -1 without INDEX_MODIFICATION_TIME.
+int index_changed_since(BPTree* tree, time_t since, BPTreeVisitor visit, void* ctx) {
+    BPTreeIndexes* indexes = tree->indexes;
+    if (!indexes || !indexes->byTime) return -1;
+
+    char firstKey[INDEX_KEY_LENGTH + 1];
+    IndexRange range;
+    makeKey(firstKey, timeField(since), 0);
+    makeKey(range.lastKey, UINT64_MAX, UINTPTR_MAX);
+    range.visit = visit;
+    range.ctx = ctx;
+
+    pthread_rwlock_rdlock(&indexes->lock);
+    int count = queryRange(indexes->byTime, firstKey, &range);
+    pthread_rwlock_unlock(&indexes->lock);
+    return count;
+}
+
+// Visit entries whose chain starts in [first, last], in cluster order. Inline,
+// empty and staged entries are keyed under cluster 0 only so a change hook can
+// still find them when they gain clusters; they own no cluster and are skipped.
+// Returns the number visited, -1 without INDEX_START_CLUSTER.
+int index_by_cluster(BPTree* tree, uint32_t first, uint32_t last, BPTreeVisitor visit, void* ctx) {
+    BPTreeIndexes* indexes = tree->indexes;
+    if (!indexes || !indexes->byCluster) return -1;
+    if (first < FAT32_FIRST_CLUSTER) first = FAT32_FIRST_CLUSTER;
+    if (last < first) return 0;
+
+    char firstKey[INDEX_KEY_LENGTH + 1];
+    IndexRange range;
+    makeKey(firstKey, first, 0);
+    makeKey(range.lastKey, last, UINTPTR_MAX);
+    range.visit = visit;
+    range.ctx = ctx;
+
+    pthread_rwlock_rdlock(&indexes->lock);
+    int count = queryRange(indexes->byCluster, firstKey, &range);
+    pthread_rwlock_unlock(&indexes->lock);
+    return count;
+}
+
+// Entry whose chain holds cluster, NULL if none. The entry with the nearest
+// start at or below cluster is tried first, which finds any file stored in one
+// run with a single lookup; clusters of fragmented files fall back to walking
+// every indexed chain.
+FAT32_Entry* index_cluster_owner(BPTree* tree, uint32_t cluster) {
+    BPTreeIndexes* indexes = tree->indexes;
+    if (!indexes || !indexes->byCluster || !fat32_valid_cluster(tree->fs, cluster)) return NULL;
+
+    char key[INDEX_KEY_LENGTH + 1];
+    char found[MAX_FILENAME];
+    OwnerSearch search = { tree->fs, cluster, NULL };
+    makeKey(key, cluster, UINTPTR_MAX);
+
+    pthread_rwlock_rdlock(&indexes->lock);
+    pthread_rwlock_rdlock(&indexes->byCluster->lock);
+    FAT32_Entry* candidate = floorEntry(indexes->byCluster->root, key, found);
+    if (candidate) {
+        uint64_t start;
+        uintptr_t address;
+        parseKey(found, &start, &address);
+        if (chainHolds(tree->fs, (uint32_t)start, cluster)) search.owner = candidate;
+    }
+    pthread_rwlock_unlock(&indexes->byCluster->lock);
+
+    if (!search.owner) {
+        makeKey(key, FAT32_FIRST_CLUSTER, 0);
+        scan(indexes->byCluster, key, 0, ownerVisitor, &search);
+    }
+    pthread_rwlock_unlock(&indexes->lock);
+    return search.owner;
+}
+
+void index_destroy(BPTree* tree) {
+    BPTreeIndexes* indexes = tree->indexes;
+    if (!indexes) return;
+    if (tree->fs->onChangeCtx == tree) fat32_set_change_hook(tree->fs, NULL, NULL, NULL);
+    if (indexes->byTime) destroyBPTree(indexes->byTime);
+    if (indexes->byCluster) destroyBPTree(indexes->byCluster);
+    pthread_rwlock_destroy(&indexes->lock);
+    free(indexes);
+    tree->indexes = NULL;
+}
+
+void index_add(BPTree* tree, FAT32_Entry* entry) {
+    if (!entry) return;
+    pthread_rwlock_wrlock(&tree->indexes->lock);
+    addKeys(tree->indexes, entry, entry->modificationTime, entry->startCluster);
+    pthread_rwlock_unlock(&tree->indexes->lock);
+}
+
+void index_remove(BPTree* tree, FAT32_Entry* entry) {
+    if (!entry) return;
+    pthread_rwlock_wrlock(&tree->indexes->lock);
+    removeKeys(tree->indexes, entry, entry->modificationTime, entry->startCluster);
+    pthread_rwlock_unlock(&tree->indexes->lock);
+}
@@ -0,0 +1,143 @@
+#include "include/lz.h"
+#include <string.h>
+
+#define LZ_NO_POSITION 0xFFFFFFFF
+#define LZ_WILD_COPY 16       // Fixed copy size for short literal runs and matches
+
+// Helper function implementations
+static uint32_t read32(const uint8_t* p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static uint32_t hashSequence(uint32_t value) {
+    return (value * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// Lengths of 15 and up continue in bytes of 255 ending with one below 255
+static uint8_t* writeLength(uint8_t* op, const uint8_t* end, uint32_t length) {
+    while (length >= 255) {
+        if (op >= end) return NULL;
+        *op++ = 255;
+        length -= 255;
+    }
+    if (op >= end) return NULL;
+    *op++ = (uint8_t)length;
+    return op;
+}
+
+static uint8_t* writeSequence(uint8_t* op, const uint8_t* end, const uint8_t* literals, uint32_t literalCount,
+                              uint32_t offset, uint32_t matchLength) {
+    if (op >= end) return NULL;
+    uint8_t* token = op++;
+    uint32_t matchCode = matchLength ? matchLength - LZ_MIN_MATCH : 0;
+    *token = (uint8_t)(((literalCount < 15 ? literalCount : 15) << 4) | (matchCode < 15 ? matchCode : 15));
+
+    if (literalCount >= 15 && !(op = writeLength(op, end, literalCount - 15))) return NULL;
+    if ((uint32_t)(end - op) < literalCount) return NULL;
+    memcpy(op, literals, literalCount);
+    op += literalCount;
+
+    if (matchLength == 0) return op;
+    if (end - op < 2) return NULL;
+    *op++ = (uint8_t)(offset & 0xFF);
+    *op++ = (uint8_t)(offset >> 8);
+    if (matchCode >= 15 && !(op = writeLength(op, end, matchCode - 15))) return NULL;
+    return op;
+}
+
+static int readLength(const uint8_t** ip, const uint8_t* end, uint32_t* length) {
+    uint8_t byte;
+    do {
+        if (*ip >= end) return -1;
+        byte = *(*ip)++;
+        *length += byte;
+    } while (byte == 255);
+    return 0;
+}
+
+// Core function implementations
+
+// Compress src into dst, returns the compressed length or 0 if it does not fit in dstCapacity
+uint32_t lz_compress(const uint8_t* src, uint32_t srcLength, uint8_t* dst, uint32_t dstCapacity) {
+    uint32_t table[1 << LZ_HASH_BITS];
+    const uint8_t* end = dst + dstCapacity;
+    uint8_t* op = dst;
+    uint32_t anchor = 0;
+    uint32_t ip = 0;
+
+    memset(table, 0xFF, sizeof(table));
+    while (ip + LZ_MIN_MATCH <= srcLength) {
+        uint32_t sequence = read32(src + ip);
+        uint32_t h = hashSequence(sequence);
+        uint32_t candidate = table[h];
+        table[h] = ip;
+
+        if (candidate == LZ_NO_POSITION || ip - candidate > LZ_MAX_OFFSET || read32(src + candidate) != sequence) {
+            ip++;
+            continue;
+        }
+
+        uint32_t matchLength = LZ_MIN_MATCH;
+        while (ip + matchLength < srcLength && src[candidate + matchLength] == src[ip + matchLength]) {
+            matchLength++;
+        }
+        op = writeSequence(op, end, src + anchor, ip - anchor, ip - candidate, matchLength);
+        if (!op) return 0;
+        ip += matchLength;
+        anchor = ip;
+    }
+
+    op = writeSequence(op, end, src + anchor, srcLength - anchor, 0, 0);
+    return op ? (uint32_t)(op - dst) : 0;
+}
+
+// Decompress a block produced by lz_compress into exactly dstLength bytes.
+// Returns dstLength, or -1 for a corrupt or truncated block.
+int lz_decompress(const uint8_t* src, uint32_t srcLength, uint8_t* dst, uint32_t dstLength) {
+    const uint8_t* ip = src;
+    const uint8_t* inEnd = src + srcLength;
+    uint8_t* op = dst;
+    uint8_t* outEnd = dst + dstLength;
+
+    while (ip < inEnd) {
+        uint8_t token = *ip++;
+        uint32_t literalCount = token >> 4;
+        if (literalCount == 15 && readLength(&ip, inEnd, &literalCount) != 0) return -1;
+        if ((uint32_t)(inEnd - ip) < literalCount || (uint32_t)(outEnd - op) < literalCount) return -1;
+        if (literalCount <= LZ_WILD_COPY && inEnd - ip >= LZ_WILD_COPY && outEnd - op >= LZ_WILD_COPY) {
+            // Short runs are copied as one fixed-size block, the excess is overwritten later
+            memcpy(op, ip, LZ_WILD_COPY);
+        } else {
+            memcpy(op, ip, literalCount);
+        }
+        ip += literalCount;
+        op += literalCount;
+        if (ip == inEnd) break;
+
+        if (inEnd - ip < 2) return -1;
+        uint32_t offset = ip[0] | ((uint32_t)ip[1] << 8);
+        ip += 2;
+        uint32_t matchLength = token & 0x0F;
+        if (matchLength == 15 && readLength(&ip, inEnd, &matchLength) != 0) return -1;
+        matchLength += LZ_MIN_MATCH;
+        if (offset == 0 || offset > (uint32_t)(op - dst) || (uint32_t)(outEnd - op) < matchLength) return -1;
+
+        // Overlapping copies repeat the last offset bytes
+        const uint8_t* match = op - offset;
+        if (offset >= LZ_WILD_COPY && matchLength <= LZ_WILD_COPY && outEnd - op >= LZ_WILD_COPY) {
+            memcpy(op, match, LZ_WILD_COPY);
+        } else if (offset == 1) {
+            memset(op, *match, matchLength);
+        } else if (offset >= 8) {
+            uint32_t copied = 0;
+            for (; copied + 8 <= matchLength; copied += 8) memcpy(op + copied, match + copied, 8);
+            for (; copied < matchLength; copied++) op[copied] = match[copied];
+        } else {
+            for (uint32_t i = 0; i < matchLength; i++) op[i] = match[i];
+        }
+        op += matchLength;
+    }
+    return op == outEnd ? (int)dstLength : -1;
+}
@@ -1,10 +1,25 @@
 #include "include/bptree.h"
 #include "include/fat32.h"
+#include "include/directory.h"
+#include "include/defrag.h"
+#include "include/scrub.h"
+#include "include/crc32c.h"
 #include "include/distributed.h"
+#include "include/executor.h"
+#include "include/replay.h"
+#include "include/index.h"
+#include "include/bloom.h"
+#include "include/server.h"
+#include "include/stripe.h"
+#include "include/client.h"
+#include "include/stats.h"
+#include "include/trace.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <signal.h>
+#include <unistd.h>
 
 void performSequentialRAOperations()
 {
@@ -27,6 +42,14 @@ void performSequentialRAOperations()
         return;
     }
 
+    // Populate the tree so both passes measure hits rather than misses
+    for (int i = 0; i < 1000; i++)
+    {
+        char filename[32];
+        sprintf(filename, "seq_file_%d.txt", i);
+        insert(tree, filename, create_file_entry(fs, filename, 0));
+    }
+
     // Sequential vs Random Access
     printf("Test Case 1: Sequential vs Random Access\n");
     clock_t start = clock();
@@ -152,8 +175,8 @@ void performCRUDTestOperations()
     entry = search(tree, filenames[2]);
     if (entry)
     {
-        fat32_delete(fs, entry);
         delete (tree, filenames[2]);
+        fat32_delete(fs, entry);
         printf("Deleted: %s\n\n", filenames[2]);
     }
 
@@ -253,81 +276,1224 @@ void performBulkTestOperations(FAT32_FileSystem *fs, BPTree *tree, int size)
     if (fs && tree && tree->root)
     {
         clock_t start = clock();
-        char *large_content = (char *)malloc(512 * 1024); // 512KB instead of 1MB for stability
-        if (large_content)
+        // Streamed through a file handle one cluster at a time, never held whole in memory
+        char chunk[CLUSTER_SIZE];
+        char expected[CLUSTER_SIZE];
+        memset(expected, 'X', sizeof(expected));
+        FAT32_Entry *large_entry = create_file_entry(fs, "large_file.txt", 0);
+        if (large_entry)
         {
-            memset(large_content, 'X', 512 * 1024);
-            FAT32_Entry *large_entry = create_file_entry(fs, "large_file.txt", 512 * 1024);
-            if (large_entry)
+            FAT32_File *file = fat32_open(fs, large_entry);
+            bool written = true;
+            for (int i = 0; i < 512 * 1024 / CLUSTER_SIZE && written; i++)
+                written = fat32_file_append(file, expected, sizeof(expected)) == (int)sizeof(expected);
+            fat32_close(file);
+
+            uint32_t verified = 0;
+            int n;
+            file = fat32_open(fs, large_entry);
+            while ((n = fat32_file_read(file, chunk, sizeof(chunk))) > 0 && memcmp(chunk, expected, n) == 0)
+                verified += (uint32_t)n;
+            fat32_close(file);
+
+            if (written && verified == 512 * 1024)
             {
-                if (fat32_write(fs, large_entry, large_content, 512 * 1024))
-                {
-                    insert(tree, "large_file.txt", large_entry);
-                }
+                insert(tree, "large_file.txt", large_entry);
+            }
+            else
+            {
+                if (written)
+                    printf("Large file check failed after %u bytes\n", verified);
+                else
+                    printf("Volume full, large file not kept\n");
+                fat32_delete(fs, large_entry);
             }
-            free(large_content);
         }
         printf("Time to handle 512KB file: %.2f ms\n\n",
                (double)(clock() - start) / CLOCKS_PER_SEC * 1000);
     }
 }
 
-void *performCriticalOperations(void *arg)
+static void runSmallFiles(uint32_t inlineThreshold)
 {
-    DistributedNode *node = (DistributedNode *)arg;
-    BPTree *tree = node->sharedTree;       // Access shared B+Tree
-    FAT32_FileSystem *fs = node->sharedFS; // Access shared FAT32 file system
-    PriorityQueue *queue = node->queue;
+    const int files = 4000;
+    FAT32_FileSystem *fs = fat32_init(32 * 1024 * 1024);
+    BPTree *tree = initializeBPTree(fs);
+    FAT32_StatFs before, after;
+    char filename[32];
+    char content[64];
 
-    while (1)
+    fat32_set_inline_threshold(fs, inlineThreshold);
+    fat32_statfs(fs, &before);
+    for (int i = 0; i < files; i++)
+    {
+        snprintf(filename, sizeof(filename), "config_%d.conf", i);
+        snprintf(content, sizeof(content), "Content for file %d", i);
+        FAT32_Entry *entry = create_file_entry(fs, filename, strlen(content));
+        if (entry && fat32_write(fs, entry, content, strlen(content)))
+        {
+            insert(tree, filename, entry);
+        }
+    }
+    fat32_statfs(fs, &after);
+
+    uint64_t start = stats_now();
+    int ok = 0;
+    for (int i = 0; i < files; i++)
+    {
+        snprintf(filename, sizeof(filename), "config_%d.conf", rand() % files);
+        FAT32_Entry *entry = search(tree, filename);
+        if (entry && fat32_read_range(fs, entry, 0, content, sizeof(content), NULL) == (int)entry->fileSize)
+        {
+            ok++;
+        }
+    }
+    double elapsed = (double)(stats_now() - start) / 1e6;
+
+    printf("Inline threshold %2u: %d files use %u clusters (%u KB), %d random reads in %.2f ms\n",
+           inlineThreshold, files, before.freeClusters - after.freeClusters,
+           (before.freeClusters - after.freeClusters) * before.clusterSize / 1024, ok, elapsed);
+    destroyBPTree(tree);
+    fat32_cleanup(fs);
+}
+
+void performInlineOperations()
+{
+    printf("=== Small file storage ===\n");
+    runSmallFiles(0);
+    runSmallFiles(FAT32_INLINE_CAPACITY);
+    printf("\n");
+}
+
+static void runTemplatedWrites(bool dedup)
+{
+    const int files = 1000;
+    const int templates = 8;
+    const uint32_t size = 4 * CLUSTER_SIZE;
+    FAT32_FileSystem *fs = fat32_init(64 * 1024 * 1024);
+    FAT32_Entry **entries = (FAT32_Entry **)malloc(files * sizeof(FAT32_Entry *));
+    char *content = (char *)malloc(size);
+    FAT32_StatFs before, after;
+
+    fat32_set_dedup(fs, dedup);
+    fat32_statfs(fs, &before);
+    uint64_t start = stats_now();
+    for (int i = 0; i < files; i++)
+    {
+        // A per-file header cluster followed by one of a few shared bodies
+        memset(content, 0, size);
+        snprintf(content, CLUSTER_SIZE, "# generated config %d", i);
+        for (uint32_t j = CLUSTER_SIZE; j < size; j++)
+        {
+            content[j] = (char)((j * 31 + (i % templates) * 17) & 0x7F);
+        }
+        entries[i] = create_file_entry(fs, "templated.conf", 0);
+        fat32_write(fs, entries[i], content, size);
+    }
+    double elapsed = (double)(stats_now() - start) / 1e6;
+    fat32_statfs(fs, &after);
+
+    FAT32_DedupStats stats;
+    fat32_dedup_stats(fs, &stats);
+    uint32_t used = before.freeClusters - after.freeClusters;
+    printf("Dedup %-3s: %d files x %u KB written in %.2f ms (%.2f us/file), %u clusters used (%u KB), %llu shared\n",
+           dedup ? "on" : "off", files, size / 1024, elapsed, elapsed * 1000 / files, used,
+           used * before.clusterSize / 1024, (unsigned long long)stats.hits);
+
+    for (int i = 0; i < files; i++)
+    {
+        fat32_delete(fs, entries[i]);
+    }
+    free(entries);
+    free(content);
+    fat32_cleanup(fs);
+}
+
+void performDedupOperations()
+{
+    printf("=== Templated file deduplication ===\n");
+    runTemplatedWrites(false);
+    runTemplatedWrites(true);
+    printf("\n");
+}
+
+static void runCompressedFile(const char *label, const char *content, uint32_t size)
+{
+    const int reads = 50;
+    char *buffer = (char *)malloc(size);
+
+    for (int compress = 0; compress <= 1; compress++)
     {
-        // Dequeue the highest-priority task
-        Task task = dequeue(queue);
+        FAT32_FileSystem *fs = fat32_init(8 * 1024 * 1024);
+        FAT32_StatFs before, after;
+        fat32_set_compression(fs, compress);
+        fat32_statfs(fs, &before);
 
-        // Acquire token for distributed mutual exclusion
-        requestToken(node);
+        uint64_t start = stats_now();
+        FAT32_Entry *entry = create_file_entry(fs, label, 0);
+        fat32_write(fs, entry, content, size);
+        double writeMs = (double)(stats_now() - start) / 1e6;
+        fat32_statfs(fs, &after);
 
-        if (strcmp(task.operation, "insert") == 0)
+        start = stats_now();
+        bool intact = true;
+        for (int i = 0; i < reads; i++)
         {
-            // Perform insert operation
-            char filename[32];
-            snprintf(filename, sizeof(filename), "node_%d_file_%d.txt", node->nodeId, task.processID);
-            FAT32_Entry *entry = create_file_entry(fs, filename, 64);
-            if (entry)
+            intact &= fat32_read_range(fs, entry, 0, buffer, size, NULL) == (int)size;
+        }
+        double readSeconds = (double)(stats_now() - start) / 1e9;
+        intact &= memcmp(buffer, content, size) == 0;
+
+        uint32_t stored = before.freeClusters - after.freeClusters;
+        printf("%-7s %-4s: %4u KB -> %4u clusters (ratio %5.1fx), write %.2f ms, read %7.1f MB/s%s\n",
+               label, compress ? "lz" : "raw", size / 1024, stored,
+               stored ? (double)size / ((double)stored * before.clusterSize) : 0.0, writeMs,
+               (double)size * reads / (1024.0 * 1024.0) / readSeconds, intact ? "" : " MISMATCH");
+        fat32_delete(fs, entry);
+        fat32_cleanup(fs);
+    }
+    free(buffer);
+}
+
+void performCompressionOperations()
+{
+    const uint32_t size = 512 * 1024;
+    char *content = (char *)malloc(size);
+    static const char *words[] = {"cluster ", "entry ", "chain ", "token ", "leaf ", "node ", "sync ", "write "};
+
+    printf("=== Transparent compression ===\n");
+    memset(content, 'X', size);
+    runCompressedFile("repeat", content, size);
+
+    // Log-like text from a small vocabulary
+    uint32_t used = 0;
+    while (used < size)
+    {
+        const char *word = words[rand() % 8];
+        for (const char *c = word; *c && used < size; c++)
+            content[used++] = *c;
+        if (used < size && rand() % 12 == 0)
+            content[used++] = '\n';
+    }
+    runCompressedFile("text", content, size);
+
+    for (uint32_t i = 0; i < size; i++)
+        content[i] = (char)rand();
+    runCompressedFile("random", content, size);
+    free(content);
+    printf("\n");
+}
+
+static double timeChecksumReads(FAT32_FileSystem *fs, FAT32_Entry **entries, int files, char *buffer, uint32_t size)
+{
+    const int passes = 8;
+    uint64_t start = stats_now();
+    for (int pass = 0; pass < passes; pass++)
+    {
+        for (int i = 0; i < files; i++)
+            fat32_read_range(fs, entries[i], 0, buffer, size, NULL);
+    }
+    return (double)size * files * passes / (1024.0 * 1024.0) / ((double)(stats_now() - start) / 1e9);
+}
+
+static void runChecksumVolume(const char *label, FAT32_FileSystem *fs)
+{
+    const int files = 64;
+    const uint32_t size = 256 * 1024;
+    FAT32_Entry *entries[64];
+    char *buffer = (char *)malloc(size);
+
+    for (uint32_t i = 0; i < size; i++)
+        buffer[i] = (char)rand();
+    for (int i = 0; i < files; i++)
+    {
+        char name[32];
+        sprintf(name, "crc_%d", i);
+        buffer[0] = (char)i;
+        entries[i] = create_file_entry(fs, name, 0);
+        fat32_write(fs, entries[i], buffer, size);
+    }
+
+    // Warm up once so both timings see the same cache state
+    fat32_set_checksums(fs, true, false);
+    timeChecksumReads(fs, entries, files, buffer, size);
+    double plain = timeChecksumReads(fs, entries, files, buffer, size);
+    fat32_set_checksums(fs, true, true);
+    double verified = timeChecksumReads(fs, entries, files, buffer, size);
+    printf("%-6s: read %7.1f MB/s unverified, %7.1f MB/s verified (%+.1f%%)\n", label, plain, verified,
+           (verified - plain) * 100.0 / plain);
+
+    ScrubReport report;
+    uint64_t start = stats_now();
+    scrub_run(fs, NULL, &report);
+    printf("%-6s: scrub checked %llu clusters in %.2f ms, %llu corrupt\n", label,
+           (unsigned long long)report.clustersChecked, (double)(stats_now() - start) / 1e6,
+           (unsigned long long)report.corruptClusters);
+
+    for (int i = 0; i < files; i++)
+        fat32_delete(fs, entries[i]);
+    free(buffer);
+}
+
+void performChecksumOperations()
+{
+    printf("=== Cluster checksums (CRC32C, %s) ===\n", crc32c_hardware() ? "SSE4.2" : "table-driven");
+
+    FAT32_FileSystem *fs = fat32_init(32 * 1024 * 1024);
+    runChecksumVolume("memory", fs);
+
+    // Flip one bit behind the file system's back: reads of that file fail, the scrub names the cluster
+    FAT32_Entry *entry = create_file_entry(fs, "victim", 0);
+    char content[3 * CLUSTER_SIZE];
+    memset(content, 'v', sizeof(content));
+    fat32_write(fs, entry, content, sizeof(content));
+    uint32_t damaged = get_next_cluster(fs, entry->startCluster);
+    fs->data[(uint64_t)(damaged - FAT32_FIRST_CLUSTER) * fs->clusterSize + 100] ^= 0x10;
+
+    ScrubReport report;
+    int result = fat32_read_range(fs, entry, 0, content, sizeof(content), NULL);
+    scrub_run(fs, NULL, &report);
+    printf("Corrupted cluster %u: read returned %d, scrub found %llu corrupt (cluster %u)\n", damaged, result,
+           (unsigned long long)report.corruptClusters, report.lastCorrupt);
+    fat32_cleanup(fs);
+
+    // Image volume with every cluster cached: verification runs once per load
+    const char *image = "checksum_demo.img";
+    remove(image);
+    fs = fat32_init_image(image, 32 * 1024 * 1024, 8192);
+    if (fs)
+    {
+        runChecksumVolume("image", fs);
+        fat32_cleanup(fs);
+    }
+    remove(image);
+    printf("\n");
+}
+
+typedef struct
+{
+    time_t since;
+    int changed;
+} ChangedScan;
+
+static bool countVisitor(const char *name, FAT32_Entry *entry, void *ctx)
+{
+    (void)name;
+    (void)entry;
+    (*(int *)ctx)++;
+    return true;
+}
+
+static bool changedScanVisitor(const char *name, FAT32_Entry *entry, void *ctx)
+{
+    ChangedScan *scanState = (ChangedScan *)ctx;
+    (void)name;
+    if (entry && entry->modificationTime >= scanState->since)
+        scanState->changed++;
+    return true;
+}
+
+void performIndexOperations()
+{
+    printf("=== Secondary indexes ===\n");
+    const int files = 20000;
+    FAT32_FileSystem *fs = fat32_init(256 * 1024 * 1024);
+    BPTree *tree = initializeBPTree(fs);
+    FAT32_Entry **entries = (FAT32_Entry **)malloc(files * sizeof(FAT32_Entry *));
+    char content[2 * CLUSTER_SIZE];
+    memset(content, 'i', sizeof(content));
+    fat32_set_inline_threshold(fs, 0);
+
+    for (int i = 0; i < files; i++)
+    {
+        char name[32];
+        sprintf(name, "backup_%05d", i);
+        entries[i] = create_file_entry(fs, name, 0);
+        fat32_write(fs, entries[i], content, sizeof(content));
+        insert(tree, name, entries[i]);
+    }
+    index_enable(tree, INDEX_MODIFICATION_TIME | INDEX_START_CLUSTER);
+
+    // Times have one-second resolution: change 1% of the files in a fresh second
+    time_t previous = time(NULL);
+    while (time(NULL) == previous)
+        usleep(10000);
+    time_t since = time(NULL);
+    for (int i = 0; i < files; i += 100)
+        fat32_write_range(fs, entries[i], 0, "changed", 7);
+
+    int changed = 0;
+    uint64_t start = stats_now();
+    index_changed_since(tree, since, countVisitor, &changed);
+    double indexed = (double)(stats_now() - start) / 1e6;
+    ChangedScan scanState = {since, 0};
+    start = stats_now();
+    scan(tree, "", 0, changedScanVisitor, &scanState);
+    printf("Changed since last backup: %d of %d files, %.3f ms with the index, %.3f ms scanning all (%d)\n",
+           changed, files, indexed, (double)(stats_now() - start) / 1e6, scanState.changed);
+
+    int found = 0;
+    start = stats_now();
+    for (int i = 0; i < files; i++)
+    {
+        uint32_t second = get_next_cluster(fs, entries[i]->startCluster);
+        if (index_cluster_owner(tree, second) == entries[i])
+            found++;
+    }
+    printf("Cluster owner lookups: %d of %d correct, %.2f us each\n\n", found, files,
+           (double)(stats_now() - start) / 1e3 / files);
+
+    destroyBPTree(tree);
+    for (int i = 0; i < files; i++)
+        fat32_delete(fs, entries[i]);
+    free(entries);
+    fat32_cleanup(fs);
+}
+
+// Average time of one search() over names that are not in the tree
+static double timeMisses(BPTree *tree, char (*names)[32], int lookups)
+{
+    int found = 0;
+    uint64_t start = stats_now();
+    for (int i = 0; i < lookups; i++)
+    {
+        if (search(tree, names[i]))
+            found++;
+    }
+    double average = (double)(stats_now() - start) / lookups;
+    if (found)
+        printf("  %d missing names were found\n", found);
+    return average;
+}
+
+// Deleted names the filter still lets through to the tree
+static int countStale(BPTree *tree, int files)
+{
+    char name[32];
+    int stale = 0;
+    for (int i = 0; i < files; i += 2)
+    {
+        sprintf(name, "present_%07d", i);
+        if (bloom_may_contain(tree, name))
+            stale++;
+    }
+    return stale;
+}
+
+void performBloomOperations()
+{
+    printf("=== Negative lookup filter ===\n");
+    const int files = 50000;
+    const int lookups = 200000;
+    FAT32_FileSystem *fs = fat32_init(64 * 1024 * 1024);
+    BPTree *tree = initializeBPTree(fs);
+    FAT32_Entry **entries = (FAT32_Entry **)malloc(files * sizeof(FAT32_Entry *));
+    char name[32];
+
+    for (int i = 0; i < files; i++)
+    {
+        sprintf(name, "present_%07d", i);
+        entries[i] = create_file_entry(fs, name, 0);
+        insert(tree, name, entries[i]);
+    }
+
+    char (*missing)[32] = malloc(lookups * sizeof(*missing));
+    for (int i = 0; i < lookups; i++)
+        sprintf(missing[i], "present_%07d~", (int)((i * 7919ull) % files));
+    printf("Without filter: %.1f ns per miss\n", timeMisses(tree, missing, lookups));
+
+    bloom_enable(tree, files);
+    int passed = 0;
+    for (int i = 0; i < lookups; i++)
+    {
+        if (bloom_may_contain(tree, missing[i]))
+            passed++;
+    }
+    double filtered = timeMisses(tree, missing, lookups);
+    BloomStats bloomStats;
+    bloom_get_stats(tree, &bloomStats);
+    printf("With filter:    %.1f ns per miss, %.3f%% false positives, %llu KB for %u keys\n", filtered,
+           100.0 * passed / lookups, (unsigned long long)bloomStats.bytes / 1024, bloomStats.keys);
+
+    // Deleted names keep their bits until a rebuild clears them
+    for (int i = 0; i < files; i += 2)
+    {
+        sprintf(name, "present_%07d", i);
+        delete(tree, name);
+        fat32_delete(fs, entries[i]);
+    }
+    bloom_get_stats(tree, &bloomStats);
+    printf("After deleting half: %llu rebuilds, %d of %d deleted names still pass\n",
+           (unsigned long long)bloomStats.rebuilds, countStale(tree, files), files / 2);
+    bloom_rebuild(tree);
+    printf("After a rebuild: %d still pass\n\n", countStale(tree, files));
+
+    free(missing);
+    destroyBPTree(tree);
+    for (int i = 1; i < files; i += 2)
+        fat32_delete(fs, entries[i]);
+    free(entries);
+    fat32_cleanup(fs);
+}
+
+#define STRIPED_RUNS 5
+
+// In-memory volume whose data area has already been touched, so no timed run
+// pays the first-touch page faults of a fresh allocation
+static FAT32_FileSystem *createWarmVolume(uint64_t size)
+{
+    FAT32_FileSystem *fs = fat32_init(size);
+    memset(fs->data, 0, fs->dataSize);
+    return fs;
+}
+
+static int compareSeconds(const void *a, const void *b)
+{
+    double left = *(const double *)a;
+    double right = *(const double *)b;
+    return (left > right) - (left < right);
+}
+
+static double medianSeconds(double *samples, int count)
+{
+    qsort(samples, count, sizeof(double), compareSeconds);
+    return samples[count / 2];
+}
+
+// One write and one read of size bytes, returns 0 if the data did not come back intact
+static int timeLargeFile(FAT32_FileSystem *fs, StripeSet *set, const uint8_t *data, uint8_t *buffer, uint32_t size,
+                         double *writeSeconds, double *readSeconds)
+{
+    FAT32_Entry *entry = NULL;
+    StripedFile *file = NULL;
+    int written, read;
+    uint64_t start = stats_now();
+    if (set)
+    {
+        file = stripe_create_file(set, "large.bin");
+        written = file && stripe_write(file, data, size);
+    }
+    else
+    {
+        entry = create_file_entry(fs, "large.bin", 0);
+        written = entry && fat32_write(fs, entry, data, size);
+    }
+    *writeSeconds = (double)(stats_now() - start) / 1e9;
+
+    memset(buffer, 0, size);
+    start = stats_now();
+    read = set ? stripe_read(file, 0, buffer, size) : fat32_read_range(fs, entry, 0, buffer, size, NULL);
+    *readSeconds = (double)(stats_now() - start) / 1e9;
+
+    if (file)
+        stripe_delete(file);
+    if (entry)
+        fat32_delete(fs, entry);
+    return written && read == (int)size && memcmp(data, buffer, size) == 0;
+}
+
+// Median over STRIPED_RUNS runs, each on freshly created, pre-faulted volumes.
+// One volume is striped over the executor when striped is set; several volumes
+// always go through a stripe set.
+static void timeStripedCase(const char *label, Executor *executor, int volumeCount, int striped, const uint8_t *data,
+                            uint8_t *buffer, uint32_t size)
+{
+    double writes[STRIPED_RUNS], reads[STRIPED_RUNS];
+    int intact = 1;
+    for (int run = 0; run < STRIPED_RUNS; run++)
+    {
+        FAT32_FileSystem *volumes[4];
+        for (int i = 0; i < volumeCount; i++)
+            volumes[i] = createWarmVolume(size / volumeCount + 16 * 1024 * 1024);
+        StripeSet *set = NULL;
+        if (volumeCount > 1)
+            set = stripe_create(volumes, volumeCount, 0, executor);
+        else if (striped)
+            fat32_set_parallel_io(volumes[0], executor, 0);
+
+        if (!timeLargeFile(volumes[0], set, data, buffer, size, &writes[run], &reads[run]))
+            intact = 0;
+
+        if (set)
+            stripe_destroy(set);
+        for (int i = 0; i < volumeCount; i++)
+            fat32_cleanup(volumes[i]);
+    }
+    printf("%-28s write %7.0f MB/s, read %7.0f MB/s%s\n", label, size / 1e6 / medianSeconds(writes, STRIPED_RUNS),
+           size / 1e6 / medianSeconds(reads, STRIPED_RUNS), intact ? "" : " (MISMATCH)");
+}
+
+void performStripedOperations()
+{
+    printf("=== Striped I/O ===\n");
+    const uint32_t size = 64 * 1024 * 1024;
+    uint8_t *data = (uint8_t *)malloc(size);
+    uint8_t *buffer = (uint8_t *)malloc(size);
+    for (uint32_t i = 0; i < size; i++)
+        data[i] = (uint8_t)(i * 2654435761u >> 24);
+    memset(buffer, 0, size);
+    Executor *executor = executor_create(0, NULL);
+    printf("%d workers, %u MB file, median of %d runs on fresh pre-faulted volumes\n", executor->numWorkers,
+           size >> 20, STRIPED_RUNS);
+
+    timeStripedCase("One volume, serial", executor, 1, 0, data, buffer, size);
+    timeStripedCase("One volume, striped", executor, 1, 1, data, buffer, size);
+    timeStripedCase("Four volumes, striped", executor, 4, 1, data, buffer, size);
+    printf("\n");
+
+    executor_destroy(executor);
+    free(data);
+    free(buffer);
+}
+
+// Reads every file once, keeping up to depth reads in flight; each slot reuses
+// its own buffer as soon as its read is reaped. Returns MB/s.
+static double timeAsyncReads(FAT32_FileSystem *fs, FAT32_Entry **entries, int files, uint8_t *buffers,
+                             uint32_t size, int depth, int *failed)
+{
+    FAT32_Completion completions[64];
+    int slotFile[64];
+    int next = 0, done = 0;
+    uint64_t start = stats_now();
+    for (int slot = 0; slot < depth && next < files; slot++)
+    {
+        slotFile[slot] = next;
+        fat32_read_async(fs, entries[next++], buffers + (uint64_t)slot * size, (void *)(intptr_t)slot);
+    }
+    while (done < files)
+    {
+        int reaped = fat32_reap(fs, completions, 64, true);
+        if (reaped == 0)
+            break;
+        for (int i = 0; i < reaped; i++)
+        {
+            int slot = (int)(intptr_t)completions[i].userData;
+            uint8_t *buffer = buffers + (uint64_t)slot * size;
+            if (completions[i].result != (int64_t)size || buffer[0] != (uint8_t)slotFile[slot])
+                (*failed)++;
+            done++;
+            if (next < files)
             {
-                insert_dme(tree, filename, entry, node);
-                printf("Node %d: Inserted %s into B+Tree\n", node->nodeId, filename);
+                slotFile[slot] = next;
+                fat32_read_async(fs, entries[next++], buffer, (void *)(intptr_t)slot);
             }
         }
-        else if (strcmp(task.operation, "search") == 0)
+    }
+    return (double)size * files / (1024.0 * 1024.0) / ((double)(stats_now() - start) / 1e9);
+}
+
+// Pool counters since the last call, then resets them
+static void printPoolStats(BufferPool *pool)
+{
+    BufferPoolStats stats;
+    bufpool_get_stats(pool, &stats);
+    bufpool_reset_stats(pool);
+    printf("    pool: %llu hits, %llu misses, %llu image reads, %llu prefetched, %llu evictions, "
+           "%u/%u frames resident\n",
+           (unsigned long long)stats.hits, (unsigned long long)stats.misses, (unsigned long long)stats.reads,
+           (unsigned long long)stats.prefetches, (unsigned long long)stats.evictions, stats.residentFrames,
+           stats.frameCount);
+}
+
+void performAsyncOperations()
+{
+    const int files = 256;
+    const int depths[] = {1, 4, 16, 64};
+    const uint32_t size = 256 * 1024;
+    printf("=== Asynchronous image reads ===\n");
+
+    // The pool holds 4MB of the 64MB written, so nearly every cluster is read from the image
+    const char *image = "async_demo.img";
+    remove(image);
+    FAT32_FileSystem *fs = fat32_init_image(image, 128 * 1024 * 1024, 1024);
+    if (!fs)
+    {
+        printf("Failed to create %s\n\n", image);
+        return;
+    }
+
+    FAT32_Entry *entries[256];
+    uint8_t *buffers = (uint8_t *)malloc((uint64_t)64 * size);
+    for (uint32_t i = 0; i < size; i++)
+        buffers[i] = (uint8_t)rand();
+    for (int i = 0; i < files; i++)
+    {
+        char name[32];
+        sprintf(name, "async_%d", i);
+        buffers[0] = (uint8_t)i;
+        entries[i] = create_file_entry(fs, name, 0);
+        fat32_write(fs, entries[i], buffers, size);
+    }
+    fat32_sync(fs);
+    bufpool_reset_stats(fs->pool);
+    printf("%d files of %u KB, %u MB in total\n", files, size >> 10, (files * size) >> 20);
+
+    int failed = 0;
+    uint64_t start = stats_now();
+    for (int i = 0; i < files; i++)
+    {
+        if (fat32_read_range(fs, entries[i], 0, buffers, size, NULL) != (int64_t)size || buffers[0] != (uint8_t)i)
+            failed++;
+    }
+    printf("fat32_read_range         : %8.1f MB/s\n",
+           (double)size * files / (1024.0 * 1024.0) / ((double)(stats_now() - start) / 1e9));
+    printPoolStats(fs->pool);
+    for (int i = 0; i < (int)(sizeof(depths) / sizeof(depths[0])); i++)
+    {
+        double rate = timeAsyncReads(fs, entries, files, buffers, size, depths[i], &failed);
+        printf("fat32_read_async, %2d deep: %8.1f MB/s\n", depths[i], rate);
+        printPoolStats(fs->pool);
+    }
+    printf("Failed or mismatched reads: %d\n\n", failed);
+
+    free(buffers);
+    fat32_cleanup(fs);
+    remove(image);
+}
+
+typedef struct
+{
+    FAT32_FileSystem *fs;
+    int index;
+    int files;
+    int failed;
+    FAT32_Entry **kept;
+} CreatorArgs;
+
+// One creator: files of one to four clusters, every other one deleted again
+static void *runCreator(void *arg)
+{
+    CreatorArgs *args = (CreatorArgs *)arg;
+    char name[32];
+    for (int i = 0; i < args->files; i++)
+    {
+        sprintf(name, "creator%d_%d", args->index, i);
+        FAT32_Entry *entry = create_file_entry(args->fs, name, (uint32_t)(1 + i % 4) * CLUSTER_SIZE);
+        if (!entry)
+            args->failed++;
+        else if (i % 2)
+            fat32_delete(args->fs, entry);
+        else
+            args->kept[i / 2] = entry;
+    }
+    return NULL;
+}
+
+void performAllocationOperations()
+{
+    printf("=== Parallel allocation ===\n");
+    const int files = 20000;
+    for (int threads = 1; threads <= 8; threads *= 2)
+    {
+        FAT32_FileSystem *fs = fat32_init(512 * 1024 * 1024);
+        fat32_set_inline_threshold(fs, 0);
+        pthread_t workers[8];
+        CreatorArgs args[8];
+        uint64_t start = stats_now();
+        for (int i = 0; i < threads; i++)
+        {
+            args[i] = (CreatorArgs){fs, i, files / threads, 0, calloc(files / threads, sizeof(FAT32_Entry *))};
+            pthread_create(&workers[i], NULL, runCreator, &args[i]);
+        }
+        int failed = 0;
+        for (int i = 0; i < threads; i++)
+        {
+            pthread_join(workers[i], NULL);
+            failed += args[i].failed;
+        }
+        double seconds = (double)(stats_now() - start) / 1e9;
+
+        // The exact free count has to agree with the FAT itself
+        uint32_t fatFree = 0;
+        for (uint32_t cluster = FAT32_FIRST_CLUSTER; cluster < fs->clusterCount; cluster++)
+        {
+            if (get_next_cluster(fs, cluster) == FAT32_FREE)
+                fatFree++;
+        }
+        FAT32_StatFs statfs;
+        fat32_statfs(fs, &statfs);
+        printf("%d thread%s over %u groups: %.0f creates/s, %d failed, free clusters %u (FAT says %u)\n", threads,
+               threads > 1 ? "s" : " ", fs->groupCount, files / seconds, failed, statfs.freeClusters, fatFree);
+        for (int i = 0; i < threads; i++)
         {
-            // Perform search operation
-            char filename[32];
-            snprintf(filename, sizeof(filename), "node_%d_file_%d.txt", node->nodeId, task.processID);
-            FAT32_Entry *result = search(tree, filename);
-            if (result)
+            for (int j = 0; j < files / threads; j++)
+                fat32_delete(fs, args[i].kept[j]);
+            free(args[i].kept);
+        }
+        fat32_cleanup(fs);
+    }
+    printf("\n");
+}
+
+typedef struct
+{
+    const char *path;
+    int index;
+    int rounds;
+} ServerClientArgs;
+
+// One client: each round pipelines a batch of creates, stats and deletes in a single flush
+static void *runServerClient(void *arg)
+{
+    ServerClientArgs *args = (ServerClientArgs *)arg;
+    const int batch = 64;
+    FsClient *client = fsclient_connect(args->path);
+    if (!client)
+        return (void *)1;
+
+    long failures = 0;
+    char key[64];
+    for (int round = 0; round < args->rounds; round++)
+    {
+        const uint8_t ops[] = {FS_OP_CREATE, FS_OP_STAT, FS_OP_DELETE};
+        for (int op = 0; op < 3; op++)
+        {
+            for (int i = 0; i < batch; i++)
             {
-                printf("Node %d: Found %s in B+Tree\n", node->nodeId, filename);
+                sprintf(key, "client%d/file%d", args->index, round * batch + i);
+                fsclient_queue(client, ops[op], 0, key, 0, 0, NULL, 0);
             }
-            else
+        }
+        fsclient_flush(client);
+
+        FsResponse response;
+        for (int i = 0; i < 3 * batch; i++)
+        {
+            if (fsclient_next(client, &response) != 0 || response.status != 0)
+                failures++;
+        }
+    }
+    fsclient_close(client);
+    return (void *)failures;
+}
+
+void performServerOperations()
+{
+    printf("=== Unix socket server ===\n");
+    const int clients = 8;
+    const int rounds = 200;
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/bptree_fs_%d.sock", (int)getpid());
+
+    FAT32_FileSystem *fs = fat32_init(16 * 1024 * 1024);
+    BPTree *tree = initializeBPTree(fs);
+    Server *server = server_start(tree, path, 0);
+    if (!server)
+    {
+        destroyBPTree(tree);
+        fat32_cleanup(fs);
+        return;
+    }
+
+    // A few blocking calls first, one round trip each
+    FsClient *client = fsclient_connect(path);
+    char buffer[64];
+    FsStat stat;
+    fsclient_create(client, "notes.txt", "hello", 5);
+    fsclient_append(client, "notes.txt", ", server", 8);
+    int length = fsclient_read(client, "notes.txt", 0, buffer, sizeof(buffer) - 1);
+    buffer[length > 0 ? length : 0] = '\0';
+    fsclient_stat(client, "notes.txt", &stat);
+    printf("notes.txt: \"%s\" (%llu bytes), create again: %d, missing file: %d\n", buffer,
+           (unsigned long long)stat.size,
+           fsclient_create(client, "notes.txt", NULL, 0), fsclient_stat(client, "missing", &stat));
+    fsclient_close(client);
+
+    pthread_t threads[8];
+    ServerClientArgs args[8];
+    long failures = 0;
+    uint64_t start = stats_now();
+    for (int i = 0; i < clients; i++)
+    {
+        args[i] = (ServerClientArgs){path, i, rounds};
+        pthread_create(&threads[i], NULL, runServerClient, &args[i]);
+    }
+    for (int i = 0; i < clients; i++)
+    {
+        void *result;
+        pthread_join(threads[i], &result);
+        failures += (long)result;
+    }
+    double seconds = (double)(stats_now() - start) / 1e9;
+
+    ServerStats stats;
+    server_get_stats(server, &stats);
+    long ops = (long)clients * rounds * 64 * 3;
+    printf("%d clients, %ld pipelined metadata ops in %.3f s: %.0f ops/s, %ld failed\n", clients, ops, seconds,
+           ops / seconds, failures);
+    printf("Server: %llu connections, %llu requests, %.1f requests per read\n\n",
+           (unsigned long long)stats.connections, (unsigned long long)stats.requests,
+           stats.batches ? (double)stats.requests / stats.batches : 0.0);
+
+    server_stop(server);
+    destroyBPTree(tree);
+    fat32_cleanup(fs);
+}
+
+// Daemon mode: serve a volume on a Unix socket until SIGINT or SIGTERM
+static int runServer(int argc, char **argv)
+{
+    const char *path = argv[2];
+    const char *image = NULL;
+    uint32_t sizeMB = 64;
+    uint32_t cacheClusters = 4096;
+    int workers = 0;
+    const char *traceFile = NULL;
+    uint32_t traceSample = 100;
+    for (int i = 3; i + 1 < argc; i += 2)
+    {
+        if (strcmp(argv[i], "--image") == 0)
+            image = argv[i + 1];
+        else if (strcmp(argv[i], "--size") == 0)
+            sizeMB = (uint32_t)atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--cache") == 0)
+            cacheClusters = (uint32_t)atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--workers") == 0)
+            workers = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--trace") == 0)
+            traceFile = argv[i + 1];
+        else if (strcmp(argv[i], "--trace-sample") == 0)
+            traceSample = (uint32_t)atoi(argv[i + 1]);
+    }
+
+    // Block the signals before any thread starts so only sigwait sees them
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    FAT32_FileSystem *fs = image ? fat32_init_image(image, sizeMB * 1024 * 1024, cacheClusters) : fat32_init(sizeMB * 1024 * 1024);
+    if (!fs)
+    {
+        printf("Failed to initialize FAT32 file system\n");
+        return 1;
+    }
+    BPTree *tree = initializeBPTree(fs);
+    if (traceFile)
+        trace_start(traceSample);
+    Server *server = server_start(tree, path, workers);
+    if (!server)
+    {
+        destroyBPTree(tree);
+        fat32_cleanup(fs);
+        return 1;
+    }
+    printf("Serving %u MB %s volume on %s with %d workers\n", sizeMB, image ? image : "in-memory", path,
+           server->workerCount);
+    fflush(stdout);
+
+    int signal;
+    sigwait(&signals, &signal);
+
+    ServerStats stats;
+    server_get_stats(server, &stats);
+    server_stop(server);
+    printf("Stopped: %llu connections, %llu requests, %llu errors\n", (unsigned long long)stats.connections,
+           (unsigned long long)stats.requests, (unsigned long long)stats.errors);
+    if (traceFile)
+    {
+        // The rings hold each thread's most recent sampled operations
+        trace_stop();
+        FILE *out = fopen(traceFile, "w");
+        if (out)
+        {
+            printf("Wrote %d trace events to %s\n", trace_dump_chrome(out), traceFile);
+            fclose(out);
+        }
+    }
+    if (image)
+        fat32_sync(fs);
+    destroyBPTree(tree);
+    fat32_cleanup(fs);
+    return 0;
+}
+
+static bool printDirectoryEntry(const char *name, FAT32_Entry *entry, void *ctx)
+{
+    (void)ctx;
+    printf("  %s%s\n", name, (entry->attributes & ATTR_DIRECTORY) ? "/" : "");
+    return true;
+}
+
+void performDirectoryOperations()
+{
+    FAT32_FileSystem *fs = fat32_init(1024 * 1024);
+    BPTree *tree = initializeBPTree(fs);
+    if (!fs || !tree)
+    {
+        printf("Failed to initialize file system\n");
+        return;
+    }
+
+    // Build /projects/<p>/src with a few files each, plus a deep chain of directories
+    printf("=== Creating directory tree ===\n");
+    dir_mkdir(tree, "/projects");
+    for (int p = 0; p < 20; p++)
+    {
+        char path[64];
+        snprintf(path, sizeof(path), "/projects/p%02d", p);
+        dir_mkdir(tree, path);
+        snprintf(path, sizeof(path), "/projects/p%02d/src", p);
+        dir_mkdir(tree, path);
+        for (int f = 0; f < 10; f++)
+        {
+            snprintf(path, sizeof(path), "/projects/p%02d/src/file%d.c", p, f);
+            dir_create(tree, path, 0);
+        }
+    }
+    char deep[256] = "";
+    for (int d = 0; d < 16; d++)
+    {
+        char component[8];
+        snprintf(component, sizeof(component), "/d%d", d);
+        strcat(deep, component);
+        dir_mkdir(tree, deep);
+    }
+
+    printf("Listing /projects/p07/src:\n");
+    int children = dir_list(tree, "/projects/p07/src", printDirectoryEntry, NULL);
+    printf("%d entries\n\n", children);
+
+    // Resolution costs one tree lookup per component
+    printf("=== Path resolution ===\n");
+    clock_t start = clock();
+    int found = 0;
+    for (int i = 0; i < 10000; i++)
+    {
+        char path[64];
+        snprintf(path, sizeof(path), "/projects/p%02d/src/file%d.c", rand() % 20, rand() % 10);
+        found += dir_lookup(tree, path) != NULL;
+    }
+    printf("10000 lookups at depth 4: %.2f ms (%d found)\n", (double)(clock() - start) / CLOCKS_PER_SEC * 1000, found);
+    start = clock();
+    for (int i = 0; i < 10000; i++)
+    {
+        found += dir_lookup(tree, deep) != NULL;
+    }
+    printf("10000 lookups at depth 16: %.2f ms\n", (double)(clock() - start) / CLOCKS_PER_SEC * 1000);
+
+    printf("Remove non-empty /projects/p07: %s\n", dir_remove(tree, "/projects/p07") ? "removed" : "refused");
+    printf("Remove /projects/p07/src/file3.c: %s\n\n", dir_remove(tree, "/projects/p07/src/file3.c") ? "removed" : "failed");
+
+    printf("=== Cleaning Up ===\n");
+    destroyBPTree(tree);
+    fat32_cleanup(fs);
+    printf("Cleanup completed successfully\n");
+}
+
+// Interleaved appends from several writers, with clusters placed either on every
+// append or once at flush time
+static void runInterleavedWriters(bool delayed)
+{
+    const int writers = 8;
+    const int appends = 64;
+    FAT32_FileSystem *fs = fat32_init(8 * 1024 * 1024);
+    BPTree *tree = initializeBPTree(fs);
+    FAT32_Entry *files[writers];
+    char chunk[CLUSTER_SIZE];
+
+    fat32_set_delayed_allocation(fs, delayed);
+    for (int w = 0; w < writers; w++)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "writer_%d.log", w);
+        files[w] = create_file_entry(fs, name, 0);
+        insert(tree, name, files[w]);
+    }
+
+    clock_t start = clock();
+    for (int a = 0; a < appends; a++)
+    {
+        for (int w = 0; w < writers; w++)
+        {
+            memset(chunk, 'a' + w, sizeof(chunk));
+            fat32_write_range(fs, files[w], files[w]->fileSize, chunk, sizeof(chunk));
+        }
+    }
+    fat32_flush(fs);
+    double elapsed = (double)(clock() - start) / CLOCKS_PER_SEC * 1000;
+
+    DefragReport report;
+    defrag_measure(tree, &report);
+    printf("%-8s allocation: %d writers x %d appends in %.2f ms, %.1f extents per file\n",
+           delayed ? "Delayed" : "Eager", writers, appends, elapsed, defrag_extents_per_file(&report));
+
+    if (report.fragmentedFiles > 0)
+    {
+        // Relocate in the background, throttled, while readers keep using the tree
+        DefragConfig config = {0};
+        config.clustersPerSecond = 16384;
+        uint64_t defragStart = stats_now();
+        Defragmenter *defrag = defrag_start(tree, &config);
+        uint32_t reads = 0;
+        for (int w = 0; w < writers; w++)
+        {
+            if (fat32_read_range(fs, search(tree, files[w]->filename), 0, chunk, sizeof(chunk), NULL) == (int)sizeof(chunk) &&
+                chunk[0] == 'a' + w)
             {
-                printf("Node %d: %s not found in B+Tree\n", node->nodeId, filename);
+                reads++;
             }
         }
-        else if (strcmp(task.operation, "delete") == 0)
+        defrag_wait_idle(defrag);
+        uint64_t moved = defrag->clustersMoved;
+        defrag_stop(defrag);
+        elapsed = (double)(stats_now() - defragStart) / 1e6;
+
+        defrag_measure(tree, &report);
+        printf("Defragmented: %llu clusters moved in %.2f ms, %.1f extents per file, %u fragmented files, %u/%d concurrent reads ok\n",
+               (unsigned long long)moved, elapsed, defrag_extents_per_file(&report), report.fragmentedFiles, reads, writers);
+    }
+
+    for (int w = 0; w < writers; w++)
+    {
+        delete(tree, files[w]->filename);
+        fat32_delete(fs, files[w]);
+    }
+    destroyBPTree(tree);
+    fat32_cleanup(fs);
+}
+
+void performFragmentationOperations()
+{
+    printf("=== Interleaved writer fragmentation ===\n");
+    runInterleavedWriters(false);
+    runInterleavedWriters(true);
+    printf("\n");
+}
+
+// Runs one task's tree operation, the caller holds the node's token
+void runTask(DistributedNode *node, Task task, bool verbose)
+{
+    BPTree *tree = node->sharedTree;       // Access shared B+Tree
+    FAT32_FileSystem *fs = node->sharedFS; // Access shared FAT32 file system
+
+    if (strcmp(task.operation, "insert") == 0)
+    {
+        // Perform insert operation
+        char filename[32];
+        snprintf(filename, sizeof(filename), "node_%d_file_%d.txt", node->nodeId, task.processID);
+        FAT32_Entry *entry = create_file_entry(fs, filename, 64);
+        if (entry)
         {
-            // Perform delete operation
-            char filename[32];
-            snprintf(filename, sizeof(filename), "node_%d_file_%d.txt", node->nodeId, task.processID);
-            delete_dme(tree, filename, node);
-            printf("Node %d: Deleted %s from B+Tree\n", node->nodeId, filename);
+            insert_dme(tree, filename, entry, node);
+            if (verbose)
+                printf("Node %d: Inserted %s into B+Tree\n", node->nodeId, filename);
+        }
+    }
+    else if (strcmp(task.operation, "search") == 0)
+    {
+        // Perform search operation
+        char filename[32];
+        snprintf(filename, sizeof(filename), "node_%d_file_%d.txt", node->nodeId, task.processID);
+        FAT32_Entry *result = search(tree, filename);
+        if (verbose && result)
+        {
+            printf("Node %d: Found %s in B+Tree\n", node->nodeId, filename);
         }
+        else if (verbose)
+        {
+            printf("Node %d: %s not found in B+Tree\n", node->nodeId, filename);
+        }
+    }
+    else if (strcmp(task.operation, "delete") == 0)
+    {
+        // Perform delete operation
+        char filename[32];
+        snprintf(filename, sizeof(filename), "node_%d_file_%d.txt", node->nodeId, task.processID);
+        delete_dme(tree, filename, node);
+        if (verbose)
+            printf("Node %d: Deleted %s from B+Tree\n", node->nodeId, filename);
+    }
+}
+
+// Executes one task on behalf of a distributed node, called from executor workers
+void processTask(DistributedNode *node, Task task)
+{
+    // Acquire token for distributed mutual exclusion
+    requestToken(node);
+    runTask(node, task, true);
+
+    // Release the token after finishing the task
+    releaseToken(node);
+}
+
+// Replays run tasks quietly, the replay already holds the token
+void replayTask(DistributedNode *node, Task task)
+{
+    runTask(node, task, false);
+}
+
+// Replays a recording on a fresh volume and prints one line of its report
+bool replayScenario(const char *label, ReplayRecording *recording, ReplayConfig *config, ReplayReport *report)
+{
+    config->fs = fat32_init(1024 * 1024);
+    config->tree = config->fs ? initializeBPTree(config->fs) : NULL;
+    config->handler = replayTask;
+    bool replayed = config->tree && replay_run(recording, config, report);
+    if (replayed)
+        printf("%-26s %9.1f %7llu %8.1f %8.1f %8.1f %9.3f  %016llx\n", label, report->completionNanos / 1e3,
+               (unsigned long long)report->tokenPasses, report->waitP50 / 1e3, report->waitP99 / 1e3,
+               report->waitMax / 1e3, report->fairness, (unsigned long long)report->digest);
+    else
+        printf("%-26s replay failed\n", label);
+
+    if (config->tree)
+        destroyBPTree(config->tree);
+    if (config->fs)
+        fat32_cleanup(config->fs);
+    return replayed;
+}
 
-        // Release the token after finishing the task
-        releaseToken(node);
+void performReplayOperations()
+{
+    printf("=== Distributed replay ===\n");
+    ReplayRecording *recording = replay_load("distributed.rec");
+    if (!recording)
+    {
+        printf("No recording in distributed.rec, run 'd' first\n\n");
+        return;
     }
+    int totalNodes = recording->totalNodes;
+    printf("%d tasks over %d nodes from distributed.rec, times in microseconds\n", recording->count, totalNodes);
+    printf("%-26s %9s %7s %8s %8s %8s %9s  %s\n", "Links", "Done", "Passes", "Wait p50", "p99", "max", "Fairness",
+           "Order digest");
 
-    return NULL;
+    ReplayConfig config;
+    ReplayReport report;
+    ReplayReport repeat;
+    if (!replay_config_init(&config, totalNodes))
+    {
+        replay_recording_destroy(recording);
+        return;
+    }
+    replayScenario("No latency", recording, &config, &report);
+
+    replay_set_all_links(&config, 50000, 20000);
+    replayScenario("50-70us", recording, &config, &report);
+    replayScenario("50-70us again", recording, &config, &repeat);
+    printf("Same seed, same replay: %s\n",
+           report.digest == repeat.digest && report.completionNanos == repeat.completionNanos &&
+                   report.waitMax == repeat.waitMax
+               ? "yes"
+               : "NO");
+    config.seed = 42;
+    replayScenario("50-70us, seed 42", recording, &config, &report);
+
+    // The last node sits far from the others
+    config.seed = 0;
+    for (int i = 0; i < totalNodes - 1; i++)
+    {
+        replay_set_link(&config, i, totalNodes - 1, 500000, 20000);
+        replay_set_link(&config, totalNodes - 1, i, 500000, 20000);
+    }
+    char label[32];
+    snprintf(label, sizeof(label), "50-70us, node %d 500us", totalNodes - 1);
+    replayScenario(label, recording, &config, &report);
+    printf("\n");
+
+    replay_config_destroy(&config);
+    replay_recording_destroy(recording);
 }
 
 // Helper function to print file information
@@ -336,7 +1502,7 @@ void print_file_info(const char *operation, const char *filename, FAT32_Entry *e
     printf("%s: %s\n", operation, filename);
     if (entry)
     {
-        printf("  Size: %u bytes\n", entry->fileSize);
+        printf("  Size: %llu bytes\n", (unsigned long long)entry->fileSize);
         printf("  Created: %s", ctime(&entry->creationTime));
         printf("  Modified: %s", ctime(&entry->modificationTime));
         printf("  Start Cluster: %u\n", entry->startCluster);
@@ -344,9 +1510,13 @@ void print_file_info(const char *operation, const char *filename, FAT32_Entry *e
     printf("\n");
 }
 
-int main()
+int main(int argc, char **argv)
 {
+    if (argc >= 3 && strcmp(argv[1], "--serve") == 0)
+        return runServer(argc, argv);
+
     char input[100];
+    bool tracing = false;
     while (1)
     {
         printf("Enter commands (type 'exit' to quit)\n");
@@ -429,6 +1599,12 @@ int main()
             for (int i = 0; i < totalNodes; i++) {
                 nodes[i] = initializeNode(i, totalNodes, i == 0, tree, fs); // Node 0 starts with the token
             }
+            TokenRing *ring = initializeTokenRing(nodes, totalNodes);
+
+            // Work-stealing pool sized to the machine, shared by all nodes
+            Executor *executor = executor_create(0, processTask);
+            // Task streams are recorded so 'r' can replay them deterministically
+            ReplayRecording *recording = replay_recording_create(totalNodes);
             // Create tasks and assign them to specific nodes
             for (int i = 0; i < 30; i++)
             {
@@ -450,27 +1626,24 @@ int main()
 
                 // Assign the task to a specific node
                 int nodeIndex = i % totalNodes;
-                enqueue(nodes[nodeIndex]->queue, task);
-            }
-
-            // Start threads for each distributed node
-            pthread_t threads[totalNodes];
-            for (int i = 0; i < totalNodes; i++)
-            {
-                pthread_create(&threads[i], NULL, performCriticalOperations, (void *)nodes[i]);
+                replay_record(recording, nodes[nodeIndex], task);
+                executor_submit_task(executor, nodes[nodeIndex], task);
             }
 
-            // Let threads run for a while
-            sleep(2);
+            // Wait for every queued task to finish
+            executor_wait_idle(executor);
+            executor_destroy(executor);
+            if (replay_save(recording, "distributed.rec"))
+                printf("Recorded %d tasks to distributed.rec, replay them with 'r'\n", recording->count);
+            replay_recording_destroy(recording);
 
             // Cleanup
             for (int i = 0; i < totalNodes; i++)
             {
-                pthread_cancel(threads[i]); // Terminate threads
-                pthread_join(threads[i], NULL);
                 free(nodes[i]->queue);
                 free(nodes[i]);
             }
+            destroyTokenRing(ring);
 
             // Clean up B+Tree and FAT32
             destroyBPTree(tree);
@@ -484,6 +1657,101 @@ int main()
             performSequentialRAOperations();
             break;
         }
+        case 'p':
+        {
+            performDirectoryOperations();
+            break;
+        }
+        case 'f':
+        {
+            performFragmentationOperations();
+            break;
+        }
+        case 'i':
+        {
+            performInlineOperations();
+            break;
+        }
+        case 'u':
+        {
+            performDedupOperations();
+            break;
+        }
+        case 'z':
+        {
+            performCompressionOperations();
+            break;
+        }
+        case 'k':
+        {
+            performChecksumOperations();
+            break;
+        }
+        case 'x':
+        {
+            performIndexOperations();
+            break;
+        }
+        case 'n':
+        {
+            performServerOperations();
+            break;
+        }
+        case 'g':
+        {
+            performAllocationOperations();
+            break;
+        }
+        case 'l':
+        {
+            performBloomOperations();
+            break;
+        }
+        case 'v':
+        {
+            performStripedOperations();
+            break;
+        }
+        case 'a':
+        {
+            performAsyncOperations();
+            break;
+        }
+        case 'r':
+        {
+            performReplayOperations();
+            break;
+        }
+        case 't':
+        {
+            // Trace every operation of the commands run until the next 't'
+            if (!tracing)
+            {
+                trace_reset();
+                trace_start(1);
+                printf("Tracing started, enter 't' again to write trace.json\n");
+            }
+            else
+            {
+                trace_stop();
+                FILE *out = fopen("trace.json", "w");
+                if (out)
+                {
+                    printf("Wrote %d trace events to trace.json (open in chrome://tracing or ui.perfetto.dev)\n",
+                           trace_dump_chrome(out));
+                    fclose(out);
+                }
+            }
+            tracing = !tracing;
+            break;
+        }
+        case 'm':
+        {
+            // Instrumentation counters accumulated since the last 'm'
+            stats_dump_text(stdout);
+            stats_reset();
+            break;
+        }
         default:
             break;
         }
@@ -0,0 +1,425 @@
+#include "include/replay.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define REPLAY_SEED_DEFAULT 0x9E3779B97F4A7C15ull
+
+typedef enum {
+    EVENT_ARRIVAL,            // Next recorded task reaches the node's queue
+    EVENT_TOKEN,              // Token reaches the node
+    EVENT_DONE                // Node finished the task it holds the token for
+} EventType;
+
+typedef struct {
+    uint64_t time;
+    uint64_t sequence;        // Breaks ties in the order events were scheduled
+    EventType type;
+    int node;
+} Event;
+
+// Per-node progress through its stream
+typedef struct {
+    int next;                 // Next record to arrive
+    int end;                  // One past the node's last record
+    bool blocked;             // Next record waits for room in the queue
+    bool waiting;             // Requested the token and has not got it yet
+    bool holding;             // Has the token and runs a task
+    uint64_t requestedAt;
+    uint64_t waitTotal;
+} NodeState;
+
+typedef struct {
+    const ReplayConfig* config;
+    DistributedNode* nodes[MAX_NODES];
+    TokenRing* ring;
+    NodeState state[MAX_NODES];
+    ReplayRecord* records;    // Sorted by node, then arrival
+    Event* events;            // Min-heap on time, then sequence
+    int eventCount;
+    int eventCapacity;
+    uint64_t sequence;
+    uint64_t random;
+    uint64_t* waits;
+    ReplayReport* report;
+} Replay;
+
+// Helper function implementations
+static uint64_t nanosSince(const struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)(now.tv_sec - start->tv_sec) * 1000000000ull + (uint64_t)now.tv_nsec - (uint64_t)start->tv_nsec;
+}
+
+static int compareU64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+// By node, then arrival; ties fall back to processID so the order never depends on qsort
+static int compareRecords(const void* a, const void* b) {
+    const ReplayRecord* x = (const ReplayRecord*)a;
+    const ReplayRecord* y = (const ReplayRecord*)b;
+    if (x->nodeId != y->nodeId) return x->nodeId < y->nodeId ? -1 : 1;
+    if (x->arrival != y->arrival) return x->arrival < y->arrival ? -1 : 1;
+    return x->task.processID < y->task.processID ? -1 : x->task.processID > y->task.processID;
+}
+
+static bool eventBefore(const Event* a, const Event* b) {
+    return a->time != b->time ? a->time < b->time : a->sequence < b->sequence;
+}
+
+static bool schedule(Replay* replay, EventType type, int node, uint64_t time) {
+    if (replay->eventCount == replay->eventCapacity) {
+        int capacity = replay->eventCapacity ? replay->eventCapacity * 2 : 64;
+        Event* grown = (Event*)realloc(replay->events, capacity * sizeof(Event));
+        if (!grown) return false;
+        replay->events = grown;
+        replay->eventCapacity = capacity;
+    }
+
+    Event event = { time, replay->sequence++, type, node };
+    int i = replay->eventCount++;
+    while (i > 0 && eventBefore(&event, &replay->events[(i - 1) / 2])) {
+        replay->events[i] = replay->events[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    replay->events[i] = event;
+    return true;
+}
+
+static Event nextEvent(Replay* replay) {
+    Event top = replay->events[0];
+    Event last = replay->events[--replay->eventCount];
+    int i = 0;
+    while (2 * i + 1 < replay->eventCount) {
+        int child = 2 * i + 1;
+        if (child + 1 < replay->eventCount && eventBefore(&replay->events[child + 1], &replay->events[child])) child++;
+        if (!eventBefore(&replay->events[child], &last)) break;
+        replay->events[i] = replay->events[child];
+        i = child;
+    }
+    if (replay->eventCount > 0) replay->events[i] = last;
+    return top;
+}
+
+// xorshift64*, seeded from the config so jitter repeats exactly
+static uint64_t nextRandom(Replay* replay) {
+    replay->random ^= replay->random >> 12;
+    replay->random ^= replay->random << 25;
+    replay->random ^= replay->random >> 27;
+    return replay->random * 2685821657736338717ull;
+}
+
+static uint64_t serviceNanos(const ReplayConfig* config, const Task* task) {
+    if (strcmp(task->operation, "insert") == 0) return config->insertNanos ? config->insertNanos : REPLAY_INSERT_NANOS;
+    if (strcmp(task->operation, "search") == 0) return config->searchNanos ? config->searchNanos : REPLAY_SEARCH_NANOS;
+    return config->deleteNanos ? config->deleteNanos : REPLAY_DELETE_NANOS;
+}
+
+// FNV-1a over the node and task, in the order tasks get the token
+static void addToDigest(uint64_t* digest, int node, const Task* task) {
+    unsigned char bytes[sizeof(int) * 2 + sizeof(task->operation)];
+    memcpy(bytes, &node, sizeof(int));
+    memcpy(bytes + sizeof(int), &task->processID, sizeof(int));
+    memcpy(bytes + sizeof(int) * 2, task->operation, sizeof(task->operation));
+    for (size_t i = 0; i < sizeof(bytes); i++) {
+        *digest ^= bytes[i];
+        *digest *= 1099511628211ull;
+    }
+}
+
+// Put the token on the link from one node to another, arriving after the link's delay
+static bool sendToken(Replay* replay, int from, int to, uint64_t now) {
+    uint64_t delay = 0;
+    if (from != to) {
+        const ReplayLink* link = &replay->config->links[from * replay->config->totalNodes + to];
+        delay = link->latencyNanos;
+        if (link->jitterNanos) delay += nextRandom(replay) % (link->jitterNanos + 1);
+        replay->report->tokenPasses++;
+        replay->report->travelNanos += delay;
+    }
+    return schedule(replay, EVENT_TOKEN, to, now + delay);
+}
+
+// Ask the ring for the token without blocking the simulated clock. An idle
+// token is sent for at once, a busy one is handed over by releaseToken when
+// this node's turn comes.
+static bool requestFor(Replay* replay, int node, uint64_t now) {
+    NodeState* state = &replay->state[node];
+    state->waiting = true;
+    state->requestedAt = now;
+
+    int from = postTokenRequest(replay->nodes[node]);
+    return from >= 0 ? sendToken(replay, from, node, now) : true;
+}
+
+static bool onArrival(Replay* replay, int node, uint64_t now) {
+    NodeState* state = &replay->state[node];
+    PriorityQueue* queue = replay->nodes[node]->queue;
+    if (queueSize(queue) >= MAX_QUEUE_SIZE) {
+        // Held back until the node takes a task, rather than dropped like enqueue would
+        state->blocked = true;
+        return true;
+    }
+
+    enqueue(queue, replay->records[state->next++].task);
+    if (state->next < state->end && !schedule(replay, EVENT_ARRIVAL, node, replay->records[state->next].arrival)) {
+        return false;
+    }
+    if (!state->waiting && !state->holding) return requestFor(replay, node, now);
+    return true;
+}
+
+static bool onToken(Replay* replay, int node, uint64_t now) {
+    DistributedNode* distributedNode = replay->nodes[node];
+    NodeState* state = &replay->state[node];
+    ReplayReport* report = replay->report;
+    Task task;
+
+    // The ring already names this node as holder, so this never blocks
+    requestToken(distributedNode);
+    state->waiting = false;
+    state->holding = true;
+    tryDequeue(distributedNode->queue, &task);
+    if (state->blocked) {
+        state->blocked = false;
+        if (!schedule(replay, EVENT_ARRIVAL, node, now)) return false;
+    }
+
+    uint64_t wait = now - state->requestedAt;
+    replay->waits[report->tasks++] = wait;
+    state->waitTotal += wait;
+    report->nodeTasks[node]++;
+    addToDigest(&report->digest, node, &task);
+
+    if (replay->config->handler) replay->config->handler(distributedNode, task);
+    return schedule(replay, EVENT_DONE, node, now + serviceNanos(replay->config, &task));
+}
+
+static bool onDone(Replay* replay, int node, uint64_t now) {
+    replay->report->completionNanos = now;
+    replay->state[node].holding = false;
+    int next = releaseToken(replay->nodes[node]);
+    if (next >= 0 && !sendToken(replay, node, next, now)) return false;
+
+    if (queueSize(replay->nodes[node]->queue) > 0 || replay->state[node].blocked) return requestFor(replay, node, now);
+    return true;
+}
+
+static void summarize(Replay* replay, int totalNodes) {
+    ReplayReport* report = replay->report;
+    if (report->tasks == 0) {
+        report->fairness = 1.0;
+        return;
+    }
+
+    uint64_t total = 0;
+    for (uint64_t i = 0; i < report->tasks; i++) total += replay->waits[i];
+    qsort(replay->waits, report->tasks, sizeof(uint64_t), compareU64);
+    report->waitMean = total / report->tasks;
+    report->waitP50 = replay->waits[(uint64_t)(0.50 * (report->tasks - 1))];
+    report->waitP99 = replay->waits[(uint64_t)(0.99 * (report->tasks - 1))];
+    report->waitMax = replay->waits[report->tasks - 1];
+
+    double sum = 0;
+    double squares = 0;
+    int active = 0;
+    for (int i = 0; i < totalNodes; i++) {
+        if (report->nodeTasks[i] == 0) continue;
+        report->nodeWaitMean[i] = replay->state[i].waitTotal / report->nodeTasks[i];
+        sum += (double)report->nodeWaitMean[i];
+        squares += (double)report->nodeWaitMean[i] * (double)report->nodeWaitMean[i];
+        active++;
+    }
+    report->fairness = squares > 0 ? sum * sum / (active * squares) : 1.0;
+}
+
+// Core function implementations
+
+// Empty recording for a ring of totalNodes, arrival times count from now
+ReplayRecording* replay_recording_create(int totalNodes) {
+    if (totalNodes <= 0 || totalNodes > MAX_NODES) return NULL;
+    ReplayRecording* recording = (ReplayRecording*)calloc(1, sizeof(ReplayRecording));
+    if (!recording) return NULL;
+    recording->totalNodes = totalNodes;
+    clock_gettime(CLOCK_MONOTONIC, &recording->start);
+    pthread_mutex_init(&recording->mutex, NULL);
+    return recording;
+}
+
+// Append a task handed to node, stamped with the time since the recording started
+void replay_record(ReplayRecording* recording, DistributedNode* node, Task task) {
+    pthread_mutex_lock(&recording->mutex);
+    if (recording->count == recording->capacity) {
+        int capacity = recording->capacity ? recording->capacity * 2 : 64;
+        ReplayRecord* grown = (ReplayRecord*)realloc(recording->records, capacity * sizeof(ReplayRecord));
+        if (!grown) {
+            pthread_mutex_unlock(&recording->mutex);
+            return;
+        }
+        recording->records = grown;
+        recording->capacity = capacity;
+    }
+    ReplayRecord* record = &recording->records[recording->count++];
+    record->nodeId = node->nodeId;
+    record->arrival = nanosSince(&recording->start);
+    record->task = task;
+    pthread_mutex_unlock(&recording->mutex);
+}
+
+// Text format: a "replay VERSION NODES COUNT" line, then one
+// "NODE ARRIVAL PROCESS TIMESTAMP OPERATION" line per record
+bool replay_save(ReplayRecording* recording, const char* path) {
+    FILE* file = fopen(path, "w");
+    if (!file) return false;
+
+    pthread_mutex_lock(&recording->mutex);
+    fprintf(file, "replay %d %d %d\n", REPLAY_FORMAT_VERSION, recording->totalNodes, recording->count);
+    for (int i = 0; i < recording->count; i++) {
+        const ReplayRecord* record = &recording->records[i];
+        fprintf(file, "%d %llu %d %ld %s\n", record->nodeId, (unsigned long long)record->arrival,
+                record->task.processID, record->task.timestamp, record->task.operation);
+    }
+    pthread_mutex_unlock(&recording->mutex);
+
+    bool ok = !ferror(file);
+    return fclose(file) == 0 && ok;
+}
+
+// NULL if the file is missing or malformed
+ReplayRecording* replay_load(const char* path) {
+    FILE* file = fopen(path, "r");
+    if (!file) return NULL;
+
+    int version, totalNodes, count;
+    ReplayRecording* recording = NULL;
+    if (fscanf(file, "replay %d %d %d", &version, &totalNodes, &count) != 3 || version != REPLAY_FORMAT_VERSION ||
+        count < 0 || !(recording = replay_recording_create(totalNodes))) {
+        fclose(file);
+        return NULL;
+    }
+
+    recording->records = (ReplayRecord*)calloc(count ? count : 1, sizeof(ReplayRecord));
+    recording->capacity = count;
+    for (int i = 0; recording->records && i < count; i++) {
+        ReplayRecord* record = &recording->records[i];
+        unsigned long long arrival;
+        if (fscanf(file, "%d %llu %d %ld %9s", &record->nodeId, &arrival, &record->task.processID,
+                   &record->task.timestamp, record->task.operation) != 5 ||
+            record->nodeId < 0 || record->nodeId >= totalNodes) {
+            break;
+        }
+        record->arrival = arrival;
+        recording->count++;
+    }
+    fclose(file);
+
+    if (recording->count != count) {
+        replay_recording_destroy(recording);
+        return NULL;
+    }
+    return recording;
+}
+
+void replay_recording_destroy(ReplayRecording* recording) {
+    if (!recording) return;
+    pthread_mutex_destroy(&recording->mutex);
+    free(recording->records);
+    free(recording);
+}
+
+// Zero-latency links and default costs for a ring of totalNodes
+bool replay_config_init(ReplayConfig* config, int totalNodes) {
+    memset(config, 0, sizeof(*config));
+    if (totalNodes <= 0 || totalNodes > MAX_NODES) return false;
+    config->links = (ReplayLink*)calloc((size_t)totalNodes * totalNodes, sizeof(ReplayLink));
+    if (!config->links) return false;
+    config->totalNodes = totalNodes;
+    return true;
+}
+
+void replay_set_link(ReplayConfig* config, int from, int to, uint64_t latencyNanos, uint64_t jitterNanos) {
+    if (from < 0 || to < 0 || from >= config->totalNodes || to >= config->totalNodes || from == to) return;
+    ReplayLink* link = &config->links[from * config->totalNodes + to];
+    link->latencyNanos = latencyNanos;
+    link->jitterNanos = jitterNanos;
+}
+
+void replay_set_all_links(ReplayConfig* config, uint64_t latencyNanos, uint64_t jitterNanos) {
+    for (int from = 0; from < config->totalNodes; from++) {
+        for (int to = 0; to < config->totalNodes; to++) replay_set_link(config, from, to, latencyNanos, jitterNanos);
+    }
+}
+
+void replay_config_destroy(ReplayConfig* config) {
+    free(config->links);
+    config->links = NULL;
+}
+
+// Replay a recording on a simulated clock. Fresh nodes join a real TokenRing and
+// every request, acquire and release goes through postTokenRequest, requestToken
+// and releaseToken, so the ring's passing policy is what is measured, but time
+// only advances by the configured link delays and task costs. One thread runs
+// everything in event order, so equal recordings and configs give equal reports,
+// digest included. Returns false if the node counts differ or memory runs out.
+bool replay_run(const ReplayRecording* recording, const ReplayConfig* config, ReplayReport* report) {
+    int totalNodes = config->totalNodes;
+    if (recording->totalNodes != totalNodes) return false;
+
+    memset(report, 0, sizeof(*report));
+    report->digest = 14695981039346656037ull;
+
+    Replay replay;
+    memset(&replay, 0, sizeof(replay));
+    replay.config = config;
+    replay.report = report;
+    replay.random = config->seed ? config->seed : REPLAY_SEED_DEFAULT;
+    replay.records = (ReplayRecord*)malloc((recording->count ? recording->count : 1) * sizeof(ReplayRecord));
+    replay.waits = (uint64_t*)malloc((recording->count ? recording->count : 1) * sizeof(uint64_t));
+    if (!replay.records || !replay.waits) {
+        free(replay.records);
+        free(replay.waits);
+        return false;
+    }
+    memcpy(replay.records, recording->records, recording->count * sizeof(ReplayRecord));
+    qsort(replay.records, recording->count, sizeof(ReplayRecord), compareRecords);
+
+    for (int i = 0; i < totalNodes; i++) {
+        replay.nodes[i] = initializeNode(i, totalNodes, i == 0, config->tree, config->fs);
+    }
+    replay.ring = initializeTokenRing(replay.nodes, totalNodes);
+    replay.ring->verbose = false;
+
+    // Each node's first arrival, later ones are scheduled as their predecessor arrives
+    bool ok = true;
+    for (int i = 0, node = 0; node < totalNodes; node++) {
+        replay.state[node].next = i;
+        while (i < recording->count && replay.records[i].nodeId == node) i++;
+        replay.state[node].end = i;
+        if (replay.state[node].next < i) {
+            ok = ok && schedule(&replay, EVENT_ARRIVAL, node, replay.records[replay.state[node].next].arrival);
+        }
+    }
+
+    while (ok && replay.eventCount > 0) {
+        Event event = nextEvent(&replay);
+        switch (event.type) {
+        case EVENT_ARRIVAL: ok = onArrival(&replay, event.node, event.time); break;
+        case EVENT_TOKEN: ok = onToken(&replay, event.node, event.time); break;
+        case EVENT_DONE: ok = onDone(&replay, event.node, event.time); break;
+        }
+    }
+    if (ok) summarize(&replay, totalNodes);
+
+    for (int i = 0; i < totalNodes; i++) {
+        free(replay.nodes[i]->queue);
+        free(replay.nodes[i]);
+    }
+    destroyTokenRing(replay.ring);
+    free(replay.events);
+    free(replay.records);
+    free(replay.waits);
+    return ok;
+}
@@ -0,0 +1,154 @@
+#include "include/scrub.h"
+#include "include/stats.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Helper function implementations
+static void applyDefaults(ScrubConfig* config, const ScrubConfig* requested) {
+    memset(config, 0, sizeof(*config));
+    if (requested) *config = *requested;
+    if (config->intervalMillis == 0) config->intervalMillis = SCRUB_DEFAULT_INTERVAL_MS;
+}
+
+static void addReport(ScrubReport* total, const ScrubReport* pass) {
+    total->clustersChecked += pass->clustersChecked;
+    total->corruptClusters += pass->corruptClusters;
+    total->readErrors += pass->readErrors;
+    if (pass->lastCorrupt) total->lastCorrupt = pass->lastCorrupt;
+}
+
+static bool stopRequested(Scrubber* scrubber) {
+    if (!scrubber) return false;
+    pthread_mutex_lock(&scrubber->mutex);
+    bool stopping = scrubber->stopping;
+    pthread_mutex_unlock(&scrubber->mutex);
+    return stopping;
+}
+
+// Sleep for up to nanos, returns true if a stop request cut it short. Without a
+// scrubber (scrub_run) it is a plain sleep.
+static bool pauseFor(Scrubber* scrubber, uint64_t nanos) {
+    uint64_t deadline = stats_now() + nanos;
+    if (!scrubber) {
+        struct timespec delay;
+        delay.tv_sec = (time_t)(nanos / 1000000000ull);
+        delay.tv_nsec = (long)(nanos % 1000000000ull);
+        nanosleep(&delay, NULL);
+        return false;
+    }
+
+    struct timespec until;
+    until.tv_sec = (time_t)(deadline / 1000000000ull);
+    until.tv_nsec = (long)(deadline % 1000000000ull);
+    pthread_mutex_lock(&scrubber->mutex);
+    while (!scrubber->stopping && stats_now() < deadline) {
+        pthread_cond_timedwait(&scrubber->cond, &scrubber->mutex, &until);
+    }
+    bool stopping = scrubber->stopping;
+    pthread_mutex_unlock(&scrubber->mutex);
+    return stopping;
+}
+
+// One pass over the allocated clusters, stops early if scrubber is being stopped
+static void runPass(FAT32_FileSystem* fs, const ScrubConfig* config, Scrubber* scrubber, ScrubReport* out) {
+    uint32_t batch = 0;
+    memset(out, 0, sizeof(*out));
+
+    for (uint32_t cluster = FAT32_FIRST_CLUSTER; cluster < fs->clusterCount; cluster++) {
+        if (get_next_cluster(fs, cluster) == FAT32_FREE) continue;
+
+        int status = fat32_verify_cluster(fs, cluster);
+        out->clustersChecked++;
+        if (status == 0) {
+            out->corruptClusters++;
+            out->lastCorrupt = cluster;
+        } else if (status < 0) {
+            out->readErrors++;
+        }
+
+        if (++batch < SCRUB_BATCH) continue;
+        batch = 0;
+        // Throttle: spread the read budget evenly over time
+        if (config->clustersPerSecond > 0 &&
+            pauseFor(scrubber, (uint64_t)SCRUB_BATCH * 1000000000ull / config->clustersPerSecond)) {
+            return;
+        }
+        if (stopRequested(scrubber)) return;
+    }
+}
+
+static void* scrubMain(void* arg) {
+    Scrubber* scrubber = (Scrubber*)arg;
+
+    while (!stopRequested(scrubber)) {
+        ScrubReport pass;
+        runPass(scrubber->fs, &scrubber->config, scrubber, &pass);
+
+        pthread_mutex_lock(&scrubber->mutex);
+        if (!scrubber->stopping) {
+            addReport(&scrubber->report, &pass);
+            scrubber->passes++;
+            pthread_cond_broadcast(&scrubber->cond);
+        }
+        pthread_mutex_unlock(&scrubber->mutex);
+
+        pauseFor(scrubber, (uint64_t)scrubber->config.intervalMillis * 1000000ull);
+    }
+    return NULL;
+}
+
+// Core function implementations
+
+// Check every allocated cluster once in the calling thread
+void scrub_run(FAT32_FileSystem* fs, const ScrubConfig* config, ScrubReport* out) {
+    ScrubConfig applied;
+    applyDefaults(&applied, config);
+    runPass(fs, &applied, NULL, out);
+}
+
+// Scrub on a background thread while the volume stays in use
+Scrubber* scrub_start(FAT32_FileSystem* fs, const ScrubConfig* config) {
+    Scrubber* scrubber = (Scrubber*)calloc(1, sizeof(Scrubber));
+    scrubber->fs = fs;
+    applyDefaults(&scrubber->config, config);
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&scrubber->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&scrubber->mutex, NULL);
+
+    if (pthread_create(&scrubber->thread, NULL, scrubMain, scrubber) != 0) {
+        pthread_cond_destroy(&scrubber->cond);
+        pthread_mutex_destroy(&scrubber->mutex);
+        free(scrubber);
+        return NULL;
+    }
+    scrubber->running = true;
+    return scrubber;
+}
+
+// Block until the pass in progress completes, then copy the running totals
+void scrub_wait_pass(Scrubber* scrubber, ScrubReport* out) {
+    pthread_mutex_lock(&scrubber->mutex);
+    uint32_t passes = scrubber->passes;
+    while (scrubber->passes == passes && !scrubber->stopping) {
+        pthread_cond_wait(&scrubber->cond, &scrubber->mutex);
+    }
+    *out = scrubber->report;
+    pthread_mutex_unlock(&scrubber->mutex);
+}
+
+void scrub_stop(Scrubber* scrubber) {
+    pthread_mutex_lock(&scrubber->mutex);
+    scrubber->stopping = true;
+    pthread_cond_broadcast(&scrubber->cond);
+    pthread_mutex_unlock(&scrubber->mutex);
+
+    if (scrubber->running) pthread_join(scrubber->thread, NULL);
+    pthread_cond_destroy(&scrubber->cond);
+    pthread_mutex_destroy(&scrubber->mutex);
+    free(scrubber);
+}
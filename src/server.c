@@ -0,0 +1,437 @@
+#define _GNU_SOURCE
+#include "include/server.h"
+#include "include/fat32.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define SERVER_EVENTS 64
+
+// One client connection, owned by the worker that accepted it
+typedef struct Connection {
+    int fd;
+    uint8_t* in;              // Bytes received but not yet handled
+    uint32_t inLength;
+    uint32_t inCapacity;
+    uint8_t* out;             // Responses not yet sent
+    uint32_t outLength;
+    uint32_t outCapacity;
+    uint32_t events;          // Events the connection is registered for
+    struct Connection* prev;  // Worker's list of open connections
+    struct Connection* next;
+} Connection;
+
+typedef struct {
+    Server* server;
+    int epollFd;
+    Connection* connections;
+} Worker;
+
+// Response being built for one LIST request
+typedef struct {
+    Connection* conn;
+    const char* prefix;
+    uint16_t prefixLength;
+    int32_t count;
+} ListCursor;
+
+// Helper function implementations
+static bool reserve(uint8_t** buffer, uint32_t* capacity, uint32_t needed) {
+    if (needed <= *capacity) return true;
+    uint32_t grown = *capacity ? *capacity : 4096;
+    while (grown < needed) grown *= 2;
+    uint8_t* resized = (uint8_t*)realloc(*buffer, grown);
+    if (!resized) return false;
+    *buffer = resized;
+    *capacity = grown;
+    return true;
+}
+
+static pthread_mutex_t* stripeFor(Server* server, const char* key) {
+    uint32_t hash = 2166136261u;
+    for (const char* c = key; *c; c++) hash = (hash ^ (uint8_t)*c) * 16777619u;
+    return &server->stripes[hash % SERVER_KEY_STRIPES];
+}
+
+// Append a response header and reserve room for payload bytes, returns where the payload goes
+static uint8_t* beginResponse(Connection* conn, uint32_t id, uint32_t payload) {
+    if (!reserve(&conn->out, &conn->outCapacity, conn->outLength + sizeof(FsResponseHeader) + payload)) return NULL;
+    FsResponseHeader header = { payload, id, 0 };
+    memcpy(conn->out + conn->outLength, &header, sizeof(header));
+    return conn->out + conn->outLength + sizeof(header);
+}
+
+// Set the status and length of the response begun last, and commit it
+static void finishResponse(Server* server, Connection* conn, int32_t status, uint32_t payload) {
+    FsResponseHeader* header = (FsResponseHeader*)(conn->out + conn->outLength);
+    header->status = status;
+    header->length = payload;
+    conn->outLength += sizeof(FsResponseHeader) + payload;
+    __atomic_fetch_add(&server->stats.requests, 1, __ATOMIC_RELAXED);
+    if (status < 0) __atomic_fetch_add(&server->stats.errors, 1, __ATOMIC_RELAXED);
+}
+
+static void reply(Server* server, Connection* conn, uint32_t id, int32_t status) {
+    if (beginResponse(conn, id, 0)) finishResponse(server, conn, status, 0);
+}
+
+static bool listVisitor(const char* key, FAT32_Entry* value, void* ctx) {
+    ListCursor* cursor = (ListCursor*)ctx;
+    if (strncmp(key, cursor->prefix, cursor->prefixLength) != 0) return false;
+
+    size_t keyLength = strlen(key);
+    FsListEntry item = { value ? value->fileSize : 0, (uint16_t)keyLength, 0, 0 };
+    Connection* conn = cursor->conn;
+    // The response header sits at outLength, entries are appended after it
+    uint32_t used = sizeof(FsResponseHeader) + ((FsResponseHeader*)(conn->out + conn->outLength))->length;
+    if (!reserve(&conn->out, &conn->outCapacity, conn->outLength + used + sizeof(item) + keyLength)) return false;
+    uint8_t* at = conn->out + conn->outLength + used;
+    memcpy(at, &item, sizeof(item));
+    memcpy(at + sizeof(item), key, keyLength);
+    ((FsResponseHeader*)(conn->out + conn->outLength))->length += sizeof(item) + keyLength;
+    cursor->count++;
+    return true;
+}
+
+static int32_t createFile(Server* server, const char* key, const uint8_t* data, uint32_t length) {
+    BPTree* tree = server->tree;
+    if (search(tree, key)) return -EEXIST;
+    FAT32_Entry* entry = create_file_entry(tree->fs, key, 0);
+    if (!entry) return -ENOSPC;
+    if (length > 0 && !fat32_write(tree->fs, entry, data, length)) {
+        fat32_delete(tree->fs, entry);
+        return -ENOSPC;
+    }
+    insert(tree, key, entry);
+    return 0;
+}
+
+static int32_t writeFile(Server* server, const FsRequestHeader* request, const char* key, const uint8_t* data,
+                         uint32_t length) {
+    FAT32_Entry* entry = search(server->tree, key);
+    if (!entry) return -ENOENT;
+    uint64_t offset = (request->flags & FS_FLAG_APPEND) ? entry->fileSize : request->offset;
+    if (offset > entry->fileSize) return -EINVAL;
+    if (length > 0 && !fat32_write_range(server->tree->fs, entry, offset, data, length)) return -ENOSPC;
+    return (int32_t)length;
+}
+
+static int32_t deleteFile(Server* server, const char* key) {
+    FAT32_Entry* entry = search(server->tree, key);
+    if (!entry) return -ENOENT;
+    delete(server->tree, key);
+    fat32_delete(server->tree->fs, entry);
+    return 0;
+}
+
+// Run one request and append its response
+static void handleRequest(Server* server, Connection* conn, const FsRequestHeader* request, const uint8_t* body) {
+    char key[FS_PROTO_MAX_KEY + 1];
+    const uint8_t* data = body + request->keyLength;
+    uint32_t dataLength = request->length - request->keyLength;
+    memcpy(key, body, request->keyLength);
+    key[request->keyLength] = '\0';
+
+    if (request->opcode == FS_OP_LIST) {
+        ListCursor cursor = { conn, key, request->keyLength, 0 };
+        if (!beginResponse(conn, request->id, 0)) return;
+        scan(server->tree, key, request->count ? (int)request->count : 0, listVisitor, &cursor);
+        finishResponse(server, conn, cursor.count, ((FsResponseHeader*)(conn->out + conn->outLength))->length);
+        return;
+    }
+    if (request->keyLength == 0 || strlen(key) != request->keyLength) {
+        reply(server, conn, request->id, -EINVAL);
+        return;
+    }
+
+    pthread_mutex_t* stripe = stripeFor(server, key);
+    pthread_mutex_lock(stripe);
+    switch (request->opcode) {
+    case FS_OP_CREATE:
+        reply(server, conn, request->id, createFile(server, key, data, dataLength));
+        break;
+    case FS_OP_WRITE:
+        reply(server, conn, request->id, writeFile(server, request, key, data, dataLength));
+        break;
+    case FS_OP_DELETE:
+        reply(server, conn, request->id, deleteFile(server, key));
+        break;
+    case FS_OP_READ: {
+        FAT32_Entry* entry = search(server->tree, key);
+        uint32_t count = request->count;
+        if (!entry) {
+            reply(server, conn, request->id, -ENOENT);
+            break;
+        }
+        if (count > FS_PROTO_MAX_DATA) count = FS_PROTO_MAX_DATA;
+        uint8_t* payload = beginResponse(conn, request->id, count);
+        if (!payload) break;
+        int64_t result = fat32_read_range(server->tree->fs, entry, request->offset, payload, count, NULL);
+        finishResponse(server, conn, result < 0 ? -EIO : (int32_t)result, result < 0 ? 0 : (uint32_t)result);
+        break;
+    }
+    case FS_OP_STAT: {
+        FAT32_Entry* entry = search(server->tree, key);
+        if (!entry) {
+            reply(server, conn, request->id, -ENOENT);
+            break;
+        }
+        FsStat stat = { entry->fileSize, entry->attributes, 0, (int64_t)entry->creationTime,
+                        (int64_t)entry->modificationTime };
+        uint8_t* payload = beginResponse(conn, request->id, sizeof(stat));
+        if (!payload) break;
+        memcpy(payload, &stat, sizeof(stat));
+        finishResponse(server, conn, 0, sizeof(stat));
+        break;
+    }
+    default:
+        reply(server, conn, request->id, -EINVAL);
+        break;
+    }
+    pthread_mutex_unlock(stripe);
+}
+
+// Answer every complete request in the input buffer, returns false if the
+// connection sent something that cannot be parsed
+static bool handleInput(Server* server, Connection* conn) {
+    uint32_t used = 0;
+    bool handled = false;
+    while (conn->inLength - used >= sizeof(FsRequestHeader) && conn->outLength < SERVER_MAX_OUTPUT) {
+        FsRequestHeader request;
+        memcpy(&request, conn->in + used, sizeof(request));
+        if (request.keyLength > FS_PROTO_MAX_KEY || request.keyLength > request.length ||
+            request.length - request.keyLength > FS_PROTO_MAX_DATA) {
+            return false;
+        }
+        if (conn->inLength - used - sizeof(request) < request.length) {
+            // Partial request, make sure the whole of it will fit
+            if (!reserve(&conn->in, &conn->inCapacity, sizeof(request) + request.length)) return false;
+            break;
+        }
+        handleRequest(server, conn, &request, conn->in + used + sizeof(request));
+        used += sizeof(request) + request.length;
+        handled = true;
+    }
+
+    if (handled) __atomic_fetch_add(&server->stats.batches, 1, __ATOMIC_RELAXED);
+    memmove(conn->in, conn->in + used, conn->inLength - used);
+    conn->inLength -= used;
+    return true;
+}
+
+static void closeConnection(Worker* worker, Connection* conn) {
+    if (conn->prev) conn->prev->next = conn->next;
+    else worker->connections = conn->next;
+    if (conn->next) conn->next->prev = conn->prev;
+    epoll_ctl(worker->epollFd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    free(conn->in);
+    free(conn->out);
+    free(conn);
+}
+
+// Send pending responses. Leftovers move to the front of the buffer; past
+// SERVER_MAX_OUTPUT the connection stops being read until the client catches up.
+static bool flushOutput(Worker* worker, Connection* conn) {
+    uint32_t sent = 0;
+    while (sent < conn->outLength) {
+        ssize_t n = send(conn->fd, conn->out + sent, conn->outLength - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (n <= 0) return false;
+        sent += (uint32_t)n;
+    }
+    memmove(conn->out, conn->out + sent, conn->outLength - sent);
+    conn->outLength -= sent;
+
+    uint32_t events = conn->outLength == 0 ? EPOLLIN
+                    : conn->outLength < SERVER_MAX_OUTPUT ? EPOLLIN | EPOLLOUT : EPOLLOUT;
+    if (events != conn->events) {
+        struct epoll_event event = { .events = events, .data.ptr = conn };
+        epoll_ctl(worker->epollFd, EPOLL_CTL_MOD, conn->fd, &event);
+        conn->events = events;
+    }
+    return true;
+}
+
+static bool requestBuffered(Connection* conn) {
+    FsRequestHeader request;
+    if (conn->inLength < sizeof(request)) return false;
+    memcpy(&request, conn->in, sizeof(request));
+    return conn->inLength - sizeof(request) >= request.length;
+}
+
+// Answer buffered requests until they run out or the output limit is reached
+static bool serveBuffered(Worker* worker, Connection* conn) {
+    do {
+        if (!handleInput(worker->server, conn) || !flushOutput(worker, conn)) return false;
+    } while (conn->outLength < SERVER_MAX_OUTPUT && requestBuffered(conn));
+    return true;
+}
+
+static bool readInput(Worker* worker, Connection* conn) {
+    if (conn->outLength >= SERVER_MAX_OUTPUT) return true;
+    if (!reserve(&conn->in, &conn->inCapacity, conn->inLength + SERVER_READ_CHUNK)) return false;
+    ssize_t n = recv(conn->fd, conn->in + conn->inLength, conn->inCapacity - conn->inLength, 0);
+    if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) return true;
+    if (n <= 0) return false;
+    conn->inLength += (uint32_t)n;
+    return serveBuffered(worker, conn);
+}
+
+static void acceptConnections(Worker* worker) {
+    while (1) {
+        int fd = accept4(worker->server->listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) return;
+
+        Connection* conn = (Connection*)calloc(1, sizeof(Connection));
+        conn->fd = fd;
+        conn->events = EPOLLIN;
+        struct epoll_event event = { .events = EPOLLIN, .data.ptr = conn };
+        if (epoll_ctl(worker->epollFd, EPOLL_CTL_ADD, fd, &event) != 0) {
+            close(fd);
+            free(conn);
+            continue;
+        }
+        conn->next = worker->connections;
+        if (conn->next) conn->next->prev = conn;
+        worker->connections = conn;
+        __atomic_fetch_add(&worker->server->stats.connections, 1, __ATOMIC_RELAXED);
+    }
+}
+
+static void* workerMain(void* arg) {
+    Worker* worker = (Worker*)arg;
+    Server* server = worker->server;
+    struct epoll_event events[SERVER_EVENTS];
+    bool stopping = false;
+
+    while (!stopping) {
+        int n = epoll_wait(worker->epollFd, events, SERVER_EVENTS, -1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) break;
+
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.ptr == &server->listenFd) {
+                acceptConnections(worker);
+                continue;
+            }
+            if (events[i].data.ptr == &server->stopFd) {
+                stopping = true;
+                continue;
+            }
+
+            Connection* conn = (Connection*)events[i].data.ptr;
+            uint32_t ready = events[i].events;
+            bool alive = true;
+            if (ready & EPOLLOUT) {
+                // Requests left in the buffer at the output limit can run now
+                alive = flushOutput(worker, conn) && serveBuffered(worker, conn);
+            }
+            if (alive && (ready & (EPOLLIN | EPOLLHUP | EPOLLERR))) alive = readInput(worker, conn);
+            if (!alive) closeConnection(worker, conn);
+        }
+    }
+
+    while (worker->connections) closeConnection(worker, worker->connections);
+    close(worker->epollFd);
+    free(worker);
+    return NULL;
+}
+
+static int listenOn(const char* path) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) return -1;
+    strcpy(address.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    unlink(path);
+    if (bind(fd, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(fd, SOMAXCONN) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static Worker* startWorker(Server* server, pthread_t* thread) {
+    Worker* worker = (Worker*)calloc(1, sizeof(Worker));
+    worker->server = server;
+    worker->epollFd = epoll_create1(EPOLL_CLOEXEC);
+
+    // Every worker waits on the listening socket, EPOLLEXCLUSIVE wakes only one per connection
+    struct epoll_event listen = { .events = EPOLLIN | EPOLLEXCLUSIVE, .data.ptr = &server->listenFd };
+    struct epoll_event stop = { .events = EPOLLIN, .data.ptr = &server->stopFd };
+    if (worker->epollFd < 0 || epoll_ctl(worker->epollFd, EPOLL_CTL_ADD, server->listenFd, &listen) != 0 ||
+        epoll_ctl(worker->epollFd, EPOLL_CTL_ADD, server->stopFd, &stop) != 0 ||
+        pthread_create(thread, NULL, workerMain, worker) != 0) {
+        if (worker->epollFd >= 0) close(worker->epollFd);
+        free(worker);
+        return NULL;
+    }
+    return worker;
+}
+
+// Core function implementations
+
+// Serve tree on a Unix domain socket at path with the given number of worker
+// threads, 0 for the default. An existing socket file at path is replaced.
+Server* server_start(BPTree* tree, const char* path, int workers) {
+    Server* server = (Server*)calloc(1, sizeof(Server));
+    server->tree = tree;
+    server->workerCount = workers > 0 ? workers : SERVER_DEFAULT_WORKERS;
+    snprintf(server->path, sizeof(server->path), "%s", path);
+    for (int i = 0; i < SERVER_KEY_STRIPES; i++) pthread_mutex_init(&server->stripes[i], NULL);
+    // Workers insert concurrently, let each take entry slots from its own reservation
+    slotmap_set_caching(&tree->slots, true);
+
+    server->listenFd = listenOn(path);
+    server->stopFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (server->listenFd < 0 || server->stopFd < 0) {
+        fprintf(stderr, "Cannot listen on %s: %s\n", path, strerror(errno));
+        if (server->listenFd >= 0) close(server->listenFd);
+        if (server->stopFd >= 0) close(server->stopFd);
+        free(server);
+        return NULL;
+    }
+
+    server->threads = (pthread_t*)calloc(server->workerCount, sizeof(pthread_t));
+    for (int i = 0; i < server->workerCount; i++) {
+        if (!startWorker(server, &server->threads[i])) {
+            server->workerCount = i;
+            server_stop(server);
+            return NULL;
+        }
+    }
+    return server;
+}
+
+void server_get_stats(Server* server, ServerStats* out) {
+    out->connections = __atomic_load_n(&server->stats.connections, __ATOMIC_RELAXED);
+    out->requests = __atomic_load_n(&server->stats.requests, __ATOMIC_RELAXED);
+    out->errors = __atomic_load_n(&server->stats.errors, __ATOMIC_RELAXED);
+    out->batches = __atomic_load_n(&server->stats.batches, __ATOMIC_RELAXED);
+}
+
+// Close every connection, join the workers and remove the socket file
+void server_stop(Server* server) {
+    uint64_t one = 1;
+    if (write(server->stopFd, &one, sizeof(one)) != sizeof(one)) perror("server_stop");
+    for (int i = 0; i < server->workerCount; i++) pthread_join(server->threads[i], NULL);
+
+    close(server->listenFd);
+    close(server->stopFd);
+    unlink(server->path);
+    for (int i = 0; i < SERVER_KEY_STRIPES; i++) pthread_mutex_destroy(&server->stripes[i]);
+    free(server->threads);
+    free(server);
+}
@@ -0,0 +1,216 @@
+#include "include/slotmap.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define SLOTMAP_MIN_CAPACITY 4096 // One summary word covers 64 * 64 slots
+
+static uint32_t nextCacheIndex;
+static __thread int threadCacheIndex = -1;
+
+// Helper function implementations
+static uint32_t wordsFor(uint32_t bits) {
+    return (bits + 63) / 64;
+}
+
+// Mark the bits of the last top word that do not cover a summary word as full
+static void padTop(SlotMap* map) {
+    uint32_t summaryWords = map->capacity / 4096;
+    if (summaryWords % 64) map->top[summaryWords / 64] |= ~0ull << (summaryWords % 64);
+}
+
+static void markUsed(SlotMap* map, uint32_t slot) {
+    uint32_t word = slot / 64;
+    map->words[word] |= 1ull << (slot % 64);
+    if (map->words[word] == ~0ull) {
+        map->summary[word / 64] |= 1ull << (word % 64);
+        if (map->summary[word / 64] == ~0ull) map->top[word / 4096] |= 1ull << (word / 64 % 64);
+    }
+    map->used++;
+}
+
+static void markFree(SlotMap* map, uint32_t slot) {
+    uint32_t word = slot / 64;
+    if (slot >= map->capacity || !(map->words[word] >> (slot % 64) & 1)) return;
+    map->words[word] &= ~(1ull << (slot % 64));
+    map->summary[word / 64] &= ~(1ull << (word % 64));
+    map->top[word / 4096] &= ~(1ull << (word / 64 % 64));
+    map->used--;
+}
+
+// Index of the first word of words that has a free slot, one ctz per level
+static bool findFreeWord(SlotMap* map, uint32_t* word) {
+    uint32_t topWords = wordsFor(map->capacity / 4096);
+    for (uint32_t t = 0; t < topWords; t++) {
+        if (map->top[t] == ~0ull) continue;
+        uint32_t s = t * 64 + (uint32_t)__builtin_ctzll(~map->top[t]);
+        *word = s * 64 + (uint32_t)__builtin_ctzll(~map->summary[s]);
+        return true;
+    }
+    return false;
+}
+
+// Double the capacity, the new slots are all free
+static bool grow(SlotMap* map) {
+    uint32_t capacity = map->capacity * 2;
+    if (capacity == 0 || capacity > (SLOTMAP_NONE / 2) + 1) return false;
+    uint64_t* words = (uint64_t*)calloc(wordsFor(capacity), sizeof(uint64_t));
+    uint64_t* summary = (uint64_t*)calloc(wordsFor(capacity / 64), sizeof(uint64_t));
+    uint64_t* top = (uint64_t*)calloc(wordsFor(capacity / 4096), sizeof(uint64_t));
+    if (!words || !summary || !top) {
+        free(words);
+        free(summary);
+        free(top);
+        return false;
+    }
+
+    memcpy(words, map->words, wordsFor(map->capacity) * sizeof(uint64_t));
+    memcpy(summary, map->summary, wordsFor(map->capacity / 64) * sizeof(uint64_t));
+    uint32_t summaryWords = map->capacity / 4096;
+    for (uint32_t s = 0; s < summaryWords; s++) {
+        if (summary[s] == ~0ull) top[s / 64] |= 1ull << (s % 64);
+    }
+    free(map->words);
+    free(map->summary);
+    free(map->top);
+    map->words = words;
+    map->summary = summary;
+    map->top = top;
+    map->capacity = capacity;
+    padTop(map);
+    return true;
+}
+
+// Take up to count free slots, lowest first, with the map mutex held
+static uint32_t takeSlots(SlotMap* map, uint32_t* slots, uint32_t count) {
+    uint32_t taken = 0;
+    uint32_t word;
+    while (taken < count) {
+        if (!findFreeWord(map, &word) && (!grow(map) || !findFreeWord(map, &word))) break;
+
+        // Every free bit of the word in one go
+        uint64_t available = ~map->words[word];
+        uint32_t take = (uint32_t)__builtin_popcountll(available);
+        if (take > count - taken) take = count - taken;
+        while (take-- > 0) {
+            uint32_t slot = word * 64 + (uint32_t)__builtin_ctzll(available);
+            available &= available - 1;
+            markUsed(map, slot);
+            slots[taken++] = slot;
+        }
+    }
+    return taken;
+}
+
+static SlotCache* threadCache(SlotMap* map) {
+    if (threadCacheIndex < 0) {
+        threadCacheIndex = (int)(__atomic_fetch_add(&nextCacheIndex, 1, __ATOMIC_RELAXED) % SLOTMAP_CACHES);
+    }
+    return &map->caches[threadCacheIndex];
+}
+
+static void releaseSlots(SlotMap* map, const uint32_t* slots, uint32_t count) {
+    pthread_mutex_lock(&map->mutex);
+    for (uint32_t i = 0; i < count; i++) markFree(map, slots[i]);
+    pthread_mutex_unlock(&map->mutex);
+}
+
+// Core function implementations
+void slotmap_init(SlotMap* map, uint32_t capacity) {
+    uint32_t rounded = SLOTMAP_MIN_CAPACITY;
+    while (rounded < capacity) rounded *= 2;
+
+    memset(map, 0, sizeof(*map));
+    map->capacity = rounded;
+    map->words = (uint64_t*)calloc(wordsFor(rounded), sizeof(uint64_t));
+    map->summary = (uint64_t*)calloc(wordsFor(rounded / 64), sizeof(uint64_t));
+    map->top = (uint64_t*)calloc(wordsFor(rounded / 4096), sizeof(uint64_t));
+    padTop(map);
+    pthread_mutex_init(&map->mutex, NULL);
+}
+
+// Lowest free slot, the map doubles when it is full. SLOTMAP_NONE if out of memory.
+uint32_t slotmap_alloc(SlotMap* map) {
+    uint32_t slot = SLOTMAP_NONE;
+    if (map->caches) {
+        SlotCache* cache = threadCache(map);
+        pthread_mutex_lock(&cache->mutex);
+        if (cache->count == 0) {
+            pthread_mutex_lock(&map->mutex);
+            cache->count = takeSlots(map, cache->slots, SLOTMAP_REFILL);
+            pthread_mutex_unlock(&map->mutex);
+        }
+        if (cache->count > 0) slot = cache->slots[--cache->count];
+        pthread_mutex_unlock(&cache->mutex);
+        return slot;
+    }
+
+    pthread_mutex_lock(&map->mutex);
+    takeSlots(map, &slot, 1);
+    pthread_mutex_unlock(&map->mutex);
+    return slot;
+}
+
+void slotmap_free(SlotMap* map, uint32_t slot) {
+    if (slot == SLOTMAP_NONE) return;
+    if (map->caches) {
+        SlotCache* cache = threadCache(map);
+        pthread_mutex_lock(&cache->mutex);
+        if (cache->count == SLOTMAP_CACHE_SLOTS) {
+            // Full cache: give the oldest reservations back to the map
+            releaseSlots(map, cache->slots, SLOTMAP_REFILL);
+            cache->count -= SLOTMAP_REFILL;
+            memmove(cache->slots, cache->slots + SLOTMAP_REFILL, cache->count * sizeof(uint32_t));
+        }
+        cache->slots[cache->count++] = slot;
+        pthread_mutex_unlock(&cache->mutex);
+        return;
+    }
+    releaseSlots(map, &slot, 1);
+}
+
+// True if slot is allocated or held in a reservation cache
+bool slotmap_in_use(SlotMap* map, uint32_t slot) {
+    pthread_mutex_lock(&map->mutex);
+    bool used = slot < map->capacity && (map->words[slot / 64] >> (slot % 64) & 1);
+    pthread_mutex_unlock(&map->mutex);
+    return used;
+}
+
+// Slots handed out and not freed, reservations excluded
+uint32_t slotmap_count(SlotMap* map) {
+    uint32_t reserved = 0;
+    for (int i = 0; map->caches && i < SLOTMAP_CACHES; i++) {
+        pthread_mutex_lock(&map->caches[i].mutex);
+        reserved += map->caches[i].count;
+        pthread_mutex_unlock(&map->caches[i].mutex);
+    }
+    pthread_mutex_lock(&map->mutex);
+    uint32_t used = map->used;
+    pthread_mutex_unlock(&map->mutex);
+    return used - reserved;
+}
+
+// Per-thread reservation caches: each thread takes and returns slots in batches
+// of SLOTMAP_REFILL, so concurrent allocations rarely meet on the map mutex.
+// Switch while no other thread uses the map; disabling returns the reservations.
+void slotmap_set_caching(SlotMap* map, bool enabled) {
+    if (enabled && !map->caches) {
+        map->caches = (SlotCache*)calloc(SLOTMAP_CACHES, sizeof(SlotCache));
+        for (int i = 0; i < SLOTMAP_CACHES; i++) pthread_mutex_init(&map->caches[i].mutex, NULL);
+    } else if (!enabled && map->caches) {
+        for (int i = 0; i < SLOTMAP_CACHES; i++) {
+            releaseSlots(map, map->caches[i].slots, map->caches[i].count);
+            pthread_mutex_destroy(&map->caches[i].mutex);
+        }
+        free(map->caches);
+        map->caches = NULL;
+    }
+}
+
+void slotmap_destroy(SlotMap* map) {
+    slotmap_set_caching(map, false);
+    free(map->words);
+    free(map->summary);
+    free(map->top);
+    pthread_mutex_destroy(&map->mutex);
+}
@@ -0,0 +1,218 @@
+#include "include/stats.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+// Per-thread block, written only by its owner and read by snapshots
+typedef struct StatsBlock {
+    uint64_t counters[STAT_COUNTER_COUNT];
+    StatsHistogramData histograms[STAT_HIST_COUNT];
+    struct StatsBlock* next;
+} StatsBlock;
+
+static pthread_mutex_t registryMutex = PTHREAD_MUTEX_INITIALIZER;
+static StatsBlock* registry = NULL;
+static FSStats resetBase;                   // Totals at the last stats_reset()
+static uint64_t gauges[STAT_GAUGE_COUNT];
+static __thread StatsBlock* localBlock = NULL;
+
+static StatsBlock* getLocalBlock(void) {
+    if (!localBlock) {
+        // Blocks outlive their threads so finished work stays counted
+        StatsBlock* block = (StatsBlock*)calloc(1, sizeof(StatsBlock));
+        pthread_mutex_lock(&registryMutex);
+        block->next = registry;
+        registry = block;
+        pthread_mutex_unlock(&registryMutex);
+        localBlock = block;
+    }
+    return localBlock;
+}
+
+// Single-writer update, relaxed so concurrent snapshots never see torn values
+static inline void bump(uint64_t* slot, uint64_t amount) {
+    __atomic_store_n(slot, __atomic_load_n(slot, __ATOMIC_RELAXED) + amount, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t readSlot(const uint64_t* slot) {
+    return __atomic_load_n(slot, __ATOMIC_RELAXED);
+}
+
+static int bucketFor(uint64_t nanos) {
+    int bucket = nanos ? 64 - __builtin_clzll(nanos) : 0;
+    return bucket < STATS_HIST_BUCKETS ? bucket : STATS_HIST_BUCKETS - 1;
+}
+
+// Recording functions
+void stats_add(StatCounter counter, uint64_t amount) {
+    bump(&getLocalBlock()->counters[counter], amount);
+}
+
+void stats_record(StatHistogram histogram, uint64_t nanos) {
+    StatsHistogramData* h = &getLocalBlock()->histograms[histogram];
+    bump(&h->count, 1);
+    bump(&h->sumNanos, nanos);
+    bump(&h->buckets[bucketFor(nanos)], 1);
+    if (nanos > readSlot(&h->maxNanos)) __atomic_store_n(&h->maxNanos, nanos, __ATOMIC_RELAXED);
+}
+
+void stats_gauge(StatGauge gauge, uint64_t value) {
+    __atomic_store_n(&gauges[gauge], value, __ATOMIC_RELAXED);
+}
+
+// Sum every thread's block without applying the reset baseline
+static void collectTotals(FSStats* out) {
+    memset(out, 0, sizeof(FSStats));
+    pthread_mutex_lock(&registryMutex);
+    for (StatsBlock* block = registry; block; block = block->next) {
+        for (int c = 0; c < STAT_COUNTER_COUNT; c++) {
+            out->counters[c] += readSlot(&block->counters[c]);
+        }
+        for (int h = 0; h < STAT_HIST_COUNT; h++) {
+            StatsHistogramData* src = &block->histograms[h];
+            StatsHistogramData* dst = &out->histograms[h];
+            dst->count += readSlot(&src->count);
+            dst->sumNanos += readSlot(&src->sumNanos);
+            uint64_t max = readSlot(&src->maxNanos);
+            if (max > dst->maxNanos) dst->maxNanos = max;
+            for (int b = 0; b < STATS_HIST_BUCKETS; b++) {
+                dst->buckets[b] += readSlot(&src->buckets[b]);
+            }
+        }
+    }
+    pthread_mutex_unlock(&registryMutex);
+}
+
+void stats_snapshot(FSStats* out) {
+    collectTotals(out);
+
+    pthread_mutex_lock(&registryMutex);
+    for (int c = 0; c < STAT_COUNTER_COUNT; c++) {
+        out->counters[c] -= resetBase.counters[c];
+    }
+    for (int h = 0; h < STAT_HIST_COUNT; h++) {
+        StatsHistogramData* dst = &out->histograms[h];
+        StatsHistogramData* base = &resetBase.histograms[h];
+        dst->count -= base->count;
+        dst->sumNanos -= base->sumNanos;
+        for (int b = 0; b < STATS_HIST_BUCKETS; b++) {
+            dst->buckets[b] -= base->buckets[b];
+        }
+        // Max is not decomposable, report it only while samples remain
+        if (dst->count == 0) dst->maxNanos = 0;
+    }
+    pthread_mutex_unlock(&registryMutex);
+
+    for (int g = 0; g < STAT_GAUGE_COUNT; g++) {
+        out->gauges[g] = __atomic_load_n(&gauges[g], __ATOMIC_RELAXED);
+    }
+#ifdef FS_STATS
+    out->enabled = true;
+#else
+    out->enabled = false;
+#endif
+}
+
+// Reset by moving the baseline, so owners never race with a clearing thread
+void stats_reset(void) {
+    FSStats totals;
+    collectTotals(&totals);
+    pthread_mutex_lock(&registryMutex);
+    resetBase = totals;
+    pthread_mutex_unlock(&registryMutex);
+}
+
+// Reporting
+static const char* counterNames[STAT_COUNTER_COUNT] = {
+    "tree_lookups", "tree_inserts", "tree_deletes", "tree_nodes_visited",
+    "tree_splits", "tree_merges", "tree_bloom_rejects", "tree_bloom_false_positives",
+    "fat_alloc_calls", "fat_alloc_failures", "fat_alloc_clusters_scanned", "fat_alloc_steals",
+    "fat_clusters_freed",
+    "fat_reads", "fat_read_chain_hops", "fat_readahead_clusters", "fat_writes", "fat_write_chain_hops",
+    "fat_dedup_hits",
+    "fat_checksum_errors",
+    "token_acquires", "token_passes",
+};
+
+static const char* histogramNames[STAT_HIST_COUNT] = {
+    "tree_rdlock_wait", "tree_wrlock_wait", "fat_alloc_time", "token_wait",
+};
+
+static const char* gaugeNames[STAT_GAUGE_COUNT] = {
+    "tree_height",
+};
+
+// Upper bound of the bucket containing the given quantile
+static uint64_t histogramQuantile(const StatsHistogramData* h, double q) {
+    if (h->count == 0) return 0;
+    uint64_t target = (uint64_t)(q * (double)h->count);
+    uint64_t seen = 0;
+    for (int b = 0; b < STATS_HIST_BUCKETS; b++) {
+        seen += h->buckets[b];
+        if (seen > target) return b ? (1ull << b) : 1;
+    }
+    return h->maxNanos;
+}
+
+void stats_dump_text(FILE* out) {
+    FSStats stats;
+    stats_snapshot(&stats);
+
+    fprintf(out, "=== Instrumentation (%s) ===\n", stats.enabled ? "enabled" : "disabled, build with STATS=1");
+    for (int c = 0; c < STAT_COUNTER_COUNT; c++) {
+        fprintf(out, "  %-28s %llu\n", counterNames[c], (unsigned long long)stats.counters[c]);
+    }
+    if (stats.counters[STAT_TREE_LOOKUPS] + stats.counters[STAT_TREE_INSERTS] + stats.counters[STAT_TREE_DELETES]) {
+        fprintf(out, "  %-28s %.2f\n", "tree_nodes_per_op",
+                (double)stats.counters[STAT_TREE_NODES_VISITED] /
+                (double)(stats.counters[STAT_TREE_LOOKUPS] + stats.counters[STAT_TREE_INSERTS] +
+                         stats.counters[STAT_TREE_DELETES]));
+    }
+    if (stats.counters[STAT_FAT_ALLOC_CALLS]) {
+        fprintf(out, "  %-28s %.2f\n", "fat_scanned_per_alloc",
+                (double)stats.counters[STAT_FAT_ALLOC_SCANNED] / (double)stats.counters[STAT_FAT_ALLOC_CALLS]);
+    }
+    for (int g = 0; g < STAT_GAUGE_COUNT; g++) {
+        fprintf(out, "  %-28s %llu\n", gaugeNames[g], (unsigned long long)stats.gauges[g]);
+    }
+    for (int h = 0; h < STAT_HIST_COUNT; h++) {
+        const StatsHistogramData* hist = &stats.histograms[h];
+        fprintf(out, "  %-28s count=%llu mean=%.0fns p50<=%lluns p99<=%lluns max=%lluns\n", histogramNames[h],
+                (unsigned long long)hist->count, hist->count ? (double)hist->sumNanos / (double)hist->count : 0.0,
+                (unsigned long long)histogramQuantile(hist, 0.50),
+                (unsigned long long)histogramQuantile(hist, 0.99),
+                (unsigned long long)hist->maxNanos);
+    }
+}
+
+void stats_dump_json(FILE* out) {
+    FSStats stats;
+    stats_snapshot(&stats);
+
+    fprintf(out, "{\"enabled\": %s, \"counters\": {", stats.enabled ? "true" : "false");
+    for (int c = 0; c < STAT_COUNTER_COUNT; c++) {
+        fprintf(out, "%s\"%s\": %llu", c ? ", " : "", counterNames[c], (unsigned long long)stats.counters[c]);
+    }
+    fprintf(out, "}, \"gauges\": {");
+    for (int g = 0; g < STAT_GAUGE_COUNT; g++) {
+        fprintf(out, "%s\"%s\": %llu", g ? ", " : "", gaugeNames[g], (unsigned long long)stats.gauges[g]);
+    }
+    fprintf(out, "}, \"histograms_ns\": {");
+    for (int h = 0; h < STAT_HIST_COUNT; h++) {
+        const StatsHistogramData* hist = &stats.histograms[h];
+        fprintf(out, "%s\"%s\": {\"count\": %llu, \"sum\": %llu, \"max\": %llu, \"p50\": %llu, \"p99\": %llu, \"buckets\": {",
+                h ? ", " : "", histogramNames[h], (unsigned long long)hist->count,
+                (unsigned long long)hist->sumNanos, (unsigned long long)hist->maxNanos,
+                (unsigned long long)histogramQuantile(hist, 0.50),
+                (unsigned long long)histogramQuantile(hist, 0.99));
+        bool first = true;
+        for (int b = 0; b < STATS_HIST_BUCKETS; b++) {
+            if (!hist->buckets[b]) continue;
+            fprintf(out, "%s\"%llu\": %llu", first ? "" : ", ", b ? (unsigned long long)(1ull << b) : 1ull,
+                    (unsigned long long)hist->buckets[b]);
+            first = false;
+        }
+        fprintf(out, "}}");
+    }
+    fprintf(out, "}}");
+}
@@ -0,0 +1,137 @@
+#include "include/stripe.h"
+#include <stdlib.h>
+#include <string.h>
+
+// One stripe_write or stripe_read, shared by the per-volume jobs
+typedef struct {
+    StripedFile* file;
+    uint8_t* buffer;                  // Holds byte offset of the file
+    uint64_t offset;
+    uint64_t length;
+    int failed;
+} StripeTransfer;
+
+// Helper function implementations
+static void markFailed(StripeTransfer* transfer) {
+    __atomic_store_n(&transfer->failed, 1, __ATOMIC_RELAXED);
+}
+
+// Write the units of one volume. They are adjacent in the member file, so after
+// the first one a handle appends each without walking the chain again.
+static void writeMember(void* ctx, int volume) {
+    StripeTransfer* transfer = (StripeTransfer*)ctx;
+    StripeSet* set = transfer->file->set;
+    FAT32_FileSystem* fs = set->volumes[volume];
+    FAT32_Entry* member = transfer->file->members[volume];
+    FAT32_File* handle = NULL;
+    bool written = true;
+
+    for (uint64_t start = (uint64_t)volume * set->unit; start < transfer->length && written;
+         start += (uint64_t)set->count * set->unit) {
+        uint32_t length = transfer->length - start < set->unit ? (uint32_t)(transfer->length - start) : set->unit;
+        if (!handle) {
+            // A whole-file write replaces what the member held
+            written = fat32_write(fs, member, transfer->buffer + start, length);
+            handle = fat32_open(fs, member);
+            fat32_file_seek(handle, member->fileSize);
+        } else {
+            written = fat32_file_write(handle, transfer->buffer + start, length) == (int64_t)length;
+        }
+    }
+    if (handle) fat32_close(handle);
+    if (!written) markFailed(transfer);
+}
+
+// Read the units of one volume that overlap the transfer, in member order so
+// the handle's readahead sees one sequential stream
+static void readMember(void* ctx, int volume) {
+    StripeTransfer* transfer = (StripeTransfer*)ctx;
+    StripeSet* set = transfer->file->set;
+    uint64_t end = transfer->offset + transfer->length;
+    uint64_t unit = transfer->offset / set->unit;
+    unit += ((uint64_t)volume + set->count - unit % set->count) % set->count;
+    FAT32_File* handle = NULL;
+
+    for (; unit * set->unit < end; unit += set->count) {
+        uint64_t start = unit * set->unit;
+        uint64_t from = start > transfer->offset ? start : transfer->offset;
+        uint64_t to = start + set->unit < end ? start + set->unit : end;
+        uint64_t memberOffset = unit / set->count * set->unit + (from - start);
+
+        if (!handle) handle = fat32_open(set->volumes[volume], transfer->file->members[volume]);
+        if (fat32_file_seek(handle, memberOffset) != 0 ||
+            fat32_file_read(handle, transfer->buffer + (from - transfer->offset), to - from) != (int64_t)(to - from)) {
+            markFailed(transfer);
+            break;
+        }
+    }
+    if (handle) fat32_close(handle);
+}
+
+// Core function implementations
+StripeSet* stripe_create(FAT32_FileSystem** volumes, int count, uint32_t unit, Executor* executor) {
+    if (count <= 0 || count > STRIPE_MAX_VOLUMES) return NULL;
+    StripeSet* set = (StripeSet*)calloc(1, sizeof(StripeSet));
+    memcpy(set->volumes, volumes, count * sizeof(FAT32_FileSystem*));
+    set->count = count;
+    // Whole clusters on every volume: cluster sizes are powers of two, so the largest will do
+    uint32_t clusterSize = CLUSTER_SIZE;
+    for (int i = 0; i < count; i++) {
+        if (volumes[i]->clusterSize > clusterSize) clusterSize = volumes[i]->clusterSize;
+    }
+    if (!unit) unit = STRIPE_UNIT_DEFAULT;
+    set->unit = (unit + clusterSize - 1) / clusterSize * clusterSize;
+    set->executor = executor;
+    return set;
+}
+
+void stripe_destroy(StripeSet* set) {
+    free(set);
+}
+
+// Empty file with a member of the same name on every volume, NULL if one could not be created
+StripedFile* stripe_create_file(StripeSet* set, const char* filename) {
+    StripedFile* file = (StripedFile*)calloc(1, sizeof(StripedFile));
+    file->set = set;
+    for (int i = 0; i < set->count; i++) {
+        file->members[i] = create_file_entry(set->volumes[i], filename, 0);
+        if (!file->members[i]) {
+            stripe_delete(file);
+            return NULL;
+        }
+    }
+    return file;
+}
+
+// Replace the file's contents, every volume written in parallel. Returns 1 on success.
+int stripe_write(StripedFile* file, const void* data, uint64_t size) {
+    if (!data || size == 0) return 0;
+    StripeTransfer transfer = { file, (uint8_t*)data, 0, size, 0 };
+    int volumes = size / file->set->unit + 1 < (uint64_t)file->set->count ? (int)(size / file->set->unit + 1)
+                                                                           : file->set->count;
+    executor_run_indexed(file->set->executor, volumes, writeMember, &transfer);
+    if (transfer.failed) return 0;
+    file->size = size;
+    return 1;
+}
+
+// Read length bytes at offset, the volumes in parallel. Returns the bytes read,
+// or -1 if a volume failed.
+int64_t stripe_read(StripedFile* file, uint64_t offset, void* buffer, uint64_t length) {
+    if (!buffer) return -1;
+    if (offset >= file->size) return 0;
+    if (length > file->size - offset) length = file->size - offset;
+    StripeTransfer transfer = { file, (uint8_t*)buffer, offset, length, 0 };
+    executor_run_indexed(file->set->executor, file->set->count, readMember, &transfer);
+    return transfer.failed ? -1 : (int64_t)length;
+}
+
+// Delete every member and the handle
+int stripe_delete(StripedFile* file) {
+    int result = 1;
+    for (int i = 0; i < file->set->count; i++) {
+        if (file->members[i] && !fat32_delete(file->set->volumes[i], file->members[i])) result = 0;
+    }
+    free(file);
+    return result;
+}
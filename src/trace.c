@@ -0,0 +1,195 @@
+#include "include/trace.h"
+#include "include/stats.h"
+#include <stdlib.h>
+#include <pthread.h>
+
+#define TRACE_PHASE_BEGIN 0
+#define TRACE_PHASE_END 1
+
+// One record, stored as two words so exports can read them while the owner writes
+typedef struct {
+    uint64_t timestamp;
+    uint64_t info;                    // Event, phase and argument, see packInfo
+} TraceRecord;
+
+// Per-thread ring, written only by its owner. head counts every record ever
+// written, so exports can tell which slots were overwritten while they copied.
+typedef struct TraceRing {
+    uint64_t head;
+    uint32_t tid;
+    struct TraceRing* next;
+    TraceRecord records[TRACE_RING_EVENTS];
+} TraceRing;
+
+typedef struct {
+    const char* name;
+    const char* category;
+    const char* argName;              // NULL when the event has no argument
+} TraceEventInfo;
+
+static const TraceEventInfo eventInfo[TRACE_EVENT_COUNT] = {
+    { "search", "tree", NULL },
+    { "scan", "tree", NULL },
+    { "insert", "tree", NULL },
+    { "delete", "tree", NULL },
+    { "upsert", "tree", NULL },
+    { "renameEntry", "tree", NULL },
+    { "update", "tree", NULL },
+    { "split", "tree", "leaf" },
+    { "rdlock_wait", "tree", NULL },
+    { "wrlock_wait", "tree", NULL },
+    { "allocate_clusters", "fat", "clusters" },
+    { "free_clusters", "fat", NULL },
+    { "fat32_read", "fat", "bytes" },
+    { "fat32_write", "fat", "bytes" },
+    { "requestToken", "token", "node" },
+    { "releaseToken", "token", "node" },
+};
+
+int traceEnabled = 0;
+__thread uint32_t traceDepth = 0;
+
+static uint32_t sampleEvery = 1;
+static uint64_t traceEpoch;           // Records older than the last trace_reset() are not exported
+static pthread_mutex_t registryMutex = PTHREAD_MUTEX_INITIALIZER;
+static TraceRing* registry = NULL;
+static uint32_t nextTid = 1;
+static __thread TraceRing* localRing = NULL;
+static __thread uint64_t sampleState = 0;
+static __thread bool sampled = false;
+
+// Helper function implementations
+static uint64_t packInfo(TraceEvent event, int phase, uint32_t arg) {
+    return (uint64_t)event | (uint64_t)phase << 8 | (uint64_t)arg << 32;
+}
+
+// Sampled at random rather than every Nth operation, so a loop that repeats a
+// fixed sequence of operations does not always land on the same one
+static bool sampleNext(void) {
+    uint32_t every = __atomic_load_n(&sampleEvery, __ATOMIC_RELAXED);
+    if (every <= 1) return true;
+    if (sampleState == 0) sampleState = ((uint64_t)(uintptr_t)&sampleState ^ stats_now()) | 1;
+    sampleState ^= sampleState << 13;
+    sampleState ^= sampleState >> 7;
+    sampleState ^= sampleState << 17;
+    return sampleState % every == 0;
+}
+
+static TraceRing* getLocalRing(void) {
+    if (!localRing) {
+        // Rings outlive their threads so a trace still shows finished work
+        TraceRing* ring = (TraceRing*)calloc(1, sizeof(TraceRing));
+        pthread_mutex_lock(&registryMutex);
+        ring->tid = nextTid++;
+        ring->next = registry;
+        registry = ring;
+        pthread_mutex_unlock(&registryMutex);
+        localRing = ring;
+    }
+    return localRing;
+}
+
+static void record(TraceEvent event, int phase, uint32_t arg) {
+    TraceRing* ring = getLocalRing();
+    uint64_t head = ring->head;
+    TraceRecord* slot = &ring->records[head & (TRACE_RING_EVENTS - 1)];
+    __atomic_store_n(&slot->timestamp, stats_now(), __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->info, packInfo(event, phase, arg), __ATOMIC_RELAXED);
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+// Copy the records of ring that are still intact, oldest first. Returns the count.
+static uint32_t copyRing(TraceRing* ring, TraceRecord* out) {
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint64_t first = head > TRACE_RING_EVENTS ? head - TRACE_RING_EVENTS : 0;
+    for (uint64_t i = first; i < head; i++) {
+        TraceRecord* slot = &ring->records[i & (TRACE_RING_EVENTS - 1)];
+        out[i - first].timestamp = __atomic_load_n(&slot->timestamp, __ATOMIC_RELAXED);
+        out[i - first].info = __atomic_load_n(&slot->info, __ATOMIC_RELAXED);
+    }
+
+    // The owner may have lapped the copy meanwhile, and may be writing one slot past its head
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    uint64_t now = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    uint64_t valid = now + 1 > TRACE_RING_EVENTS ? now + 1 - TRACE_RING_EVENTS : 0;
+    if (valid <= first) return (uint32_t)(head - first);
+    if (valid >= head) return 0;
+    uint32_t skip = (uint32_t)(valid - first);
+    for (uint32_t i = 0; i < head - valid; i++) out[i] = out[i + skip];
+    return (uint32_t)(head - valid);
+}
+
+// Core function implementations
+
+// Record about one in every outermost operations per thread, 1 for all of them
+void trace_start(uint32_t every) {
+    __atomic_store_n(&sampleEvery, every ? every : 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&traceEnabled, 1, __ATOMIC_RELEASE);
+}
+
+// Operations already being recorded finish their spans
+void trace_stop(void) {
+    __atomic_store_n(&traceEnabled, 0, __ATOMIC_RELEASE);
+}
+
+// Leave everything recorded so far out of later exports
+void trace_reset(void) {
+    __atomic_store_n(&traceEpoch, stats_now(), __ATOMIC_RELAXED);
+}
+
+// Write every thread's records since the last reset as Chrome trace JSON
+// (chrome://tracing, Perfetto). Ends whose begin was overwritten are dropped.
+// Safe while other threads trace. Returns the number of events written.
+int trace_dump_chrome(FILE* out) {
+    TraceRecord* records = (TraceRecord*)malloc(TRACE_RING_EVENTS * sizeof(TraceRecord));
+    uint64_t epoch = __atomic_load_n(&traceEpoch, __ATOMIC_RELAXED);
+    int written = 0;
+
+    fprintf(out, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [");
+    pthread_mutex_lock(&registryMutex);
+    for (TraceRing* ring = registry; ring; ring = ring->next) {
+        uint32_t count = copyRing(ring, records);
+        fprintf(out, "%s\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, "
+                     "\"args\": {\"name\": \"thread %u\"}}",
+                written ? "," : "", ring->tid, ring->tid);
+        written++;
+
+        int depth = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            TraceEvent event = (TraceEvent)(records[i].info & 0xFF);
+            int phase = (int)(records[i].info >> 8 & 0xFF);
+            uint32_t arg = (uint32_t)(records[i].info >> 32);
+            if (records[i].timestamp < epoch || event >= TRACE_EVENT_COUNT) continue;
+            if (phase == TRACE_PHASE_END && depth == 0) continue;
+            depth += phase == TRACE_PHASE_BEGIN ? 1 : -1;
+
+            const TraceEventInfo* info = &eventInfo[event];
+            fprintf(out, ",\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"%s\", \"ts\": %.3f, \"pid\": 1, \"tid\": %u",
+                    info->name, info->category, phase == TRACE_PHASE_BEGIN ? "B" : "E",
+                    (double)(records[i].timestamp - epoch) / 1e3, ring->tid);
+            if (phase == TRACE_PHASE_BEGIN && info->argName) {
+                fprintf(out, ", \"args\": {\"%s\": %u}", info->argName, arg);
+            }
+            fprintf(out, "}");
+            written++;
+        }
+    }
+    pthread_mutex_unlock(&registryMutex);
+    fprintf(out, "\n]}\n");
+    free(records);
+    return written;
+}
+
+void trace_begin(TraceEvent event, uint32_t arg) {
+    if (traceDepth == 0) {
+        if (!__atomic_load_n(&traceEnabled, __ATOMIC_ACQUIRE)) return;
+        sampled = sampleNext();
+    }
+    traceDepth++;
+    if (sampled) record(event, TRACE_PHASE_BEGIN, arg);
+}
+
+void trace_end(TraceEvent event) {
+    traceDepth--;
+    if (sampled) record(event, TRACE_PHASE_END, 0);
+}